@@ -23,8 +23,11 @@
 #include <string.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include <poll.h>
 
-#include "request.h"
+#include "pipeline.h"
+
+#define ADD_TREE_BATCH 1024 /**< Archivos de un directorio cuyos hashes se calculan juntos antes de enviarlos */
 
 /**
  * @brief Manejador de señales
@@ -36,6 +39,50 @@
  */
 void sig_handler(int signo);
 
+/**
+ * @brief Agrega una version de varios archivos con el mismo comentario
+ *
+ * Los hashes de todos los archivos se calculan antes de enviar las solicitudes.
+ * Con v2 las solicitudes van en manifiestos: solo se envia el contenido que el
+ * servidor no tiene, sin esperar una respuesta por archivo.
+ *
+ * @param username Nombre de usuario
+ * @param filenames Nombres de los archivos
+ * @param count Cantidad de archivos
+ * @param comment Comentario de las versiones
+ */
+void add_files(const char *username, char **filenames, size_t count, char *comment);
+
+/**
+ * @brief Agrega una version de todos los archivos de un directorio y de sus subdirectorios
+ *
+ * Los archivos se agregan con add_files en lotes de ADD_TREE_BATCH.
+ *
+ * @param username Nombre de usuario
+ * @param dir Directorio
+ * @param comment Comentario de las versiones
+ */
+void add_tree(const char *username, const char *dir, char *comment);
+
+/**
+ * @brief Indica si la entrada estandar tiene otra linea disponible sin esperar
+ *
+ * Con v2 los comandos se envian sin esperar sus respuestas mientras haya mas
+ * entrada; cuando hay que esperar al usuario se reciben todas las respuestas.
+ *
+ * @return 1 si se puede leer la entrada sin bloquear, 0 si no
+ */
+int input_ready(void);
+
+/**
+ * @brief Crea un socket y lo conecta al servidor, termina el programa si ocurre un error
+ *
+ * @param server_ip Direccion IP del servidor
+ * @param port Puerto del servidor
+ * @return Socket conectado
+ */
+int connect_server(const char *server_ip, int port);
+
 /**
  * @brief Muestra el mensaje de uso del cliente
  */
@@ -43,11 +90,22 @@ void usage(const char *server_ip, int port, const char *username);
 
 
 int client_socket; // Socket del cliente
+shindex hash_index; // Hashes de los archivos que no cambiaron desde la ultima adicion
+spipeline pipeline; // Solicitudes en curso (v2)
+int pipelined; // 1 si la conexion usa v2 y las solicitudes no esperan su respuesta
 
 int main(int argc, char *argv[])
 {
-    if (argc < 4) { // Verificar que se hayan pasado los argumentos necesarios
-        fprintf(stderr,"Usage: %s <server id> <port> <username>\n", argv[0]);
+    int compress = 1; // 1 si se ofrece comprimir los frames
+    int opt;
+
+    while ((opt = getopt(argc, argv, "z:")) != -1) {
+        if (opt != 'z') break;
+        compress = atoi(optarg) != 0;
+    }
+
+    if (opt != -1 || argc - optind < 3) { // Verificar que se hayan pasado los argumentos necesarios
+        fprintf(stderr,"Usage: %s [-z 0|1] <server id> <port> <username>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -56,9 +114,9 @@ int main(int argc, char *argv[])
     signal(SIGTERM, sig_handler);
 
     // Obtenemos la id y el puerto del servidor
-    char *server_ip = argv[1];
-    int port = atoi(argv[2]);
-    char *username = argv[3];
+    char *server_ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
+    char *username = argv[optind + 2];
 
     // Validamos el nombre de ususario
     if (strlen(username) == 0) {
@@ -66,63 +124,73 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    // Creamos el socket
-    if ((client_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("Error creating socket");
-        exit(EXIT_FAILURE);
-    }
-
-    // Creamos la estructura de dirección del servidor
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(struct sockaddr_in));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-
-    // Convertimos la dirección IP a binario
-    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
-        perror("Error converting IP address");
+    // Primero se intenta el protocolo v2; un servidor v1 cierra la conexion y se vuelve a conectar con v1
+    client_socket = connect_server(server_ip, port);
+    int protocol = 1; // Version del protocolo que eligio el servidor
+    int codec = 0; // Codec de los frames que eligio el servidor
+    pipelined = hello_request(client_socket, username, compress ? FRAME_CODEC_LZ : 0, &protocol, &codec) == SUCCESS;
+    if (!pipelined) {
         close(client_socket);
-        exit(EXIT_FAILURE);
-    }
+        client_socket = connect_server(server_ip, port);
 
-    // Conectamos al servidor
-    if (connect(client_socket, (struct sockaddr *)&server_addr, sizeof(struct sockaddr_in)) < 0) {
-        perror("Error connecting to server");
-        close(client_socket);
-        exit(EXIT_FAILURE);
+        // Lo primero que se envia es el nombre de usuario
+        if (login_request(client_socket, username) == ERROR) {
+            perror("Error sending username");
+            close(client_socket);
+            exit(EXIT_FAILURE);
+        }
     }
 
     printf("Connected to server %s:%d\n", server_ip, port);
 
+    if (hindex_open(&hash_index, HINDEX_FILE) < 0) {
+        perror("Error loading hash index");
+    }
+    pipeline_init(&pipeline, client_socket, protocol, codec, &hash_index);
+
     int LINESIZE = 512;
     char line[LINESIZE], filename[HASH_SIZE], comment[COMMENT_SIZE];
     size_t version;
     return_code result;
 
     while (1) {
-        fgets(line, LINESIZE, stdin);
-        line[strlen(line) - 1] = '\0';
+        if (pipelined && pipeline.count && !input_ready()) { // Se espera al usuario: primero las respuestas pendientes
+            pipeline_drain(&pipeline);
+            hindex_save(&hash_index);
+        }
+
+        if (!fgets(line, LINESIZE, stdin)) break; // Fin de la entrada estandar
+        line[strcspn(line, "\n")] = '\0';
+
+        if (sscanf(line, "add -r %255s \"%[^\"]\"", filename, comment) == 2)
+        {
+            // Un directorio y sus subdirectorios: add -r directorio "comentario"
+            add_tree(username, filename, comment);
+            continue;
+        }
 
         if(sscanf(line, "add %s \"%[^\"]\"",filename, comment) == 2)
         {
             sadd sadd_request;
             memset(&sadd_request, 0, sizeof(sadd));
             strcpy(sadd_request.username, username);//Incluye el username para que el servidor gestione
-            if(create_sadd(filename, comment, &sadd_request) == VERSION_ERROR)
+            if (pipelined) pipeline_wait_file(&pipeline, filename); // Una obtencion en curso puede estar escribiendolo
+            if(create_sadd(filename, comment, &sadd_request, &hash_index) == VERSION_ERROR)
             {
                 printf("The file does not exist or is not a regular file\n");
                 continue;
             }
 
-            if(add_request(client_socket, &sadd_request) == ERROR)
-            {
-                printf("Error sending sadd request\n");
+            if (pipelined) {
+                pipeline_add(&pipeline, &sadd_request, 0);
                 continue;
             }
 
-            if(recv(client_socket, &result, sizeof(return_code), 0) != sizeof(return_code))
+            result = add_request(client_socket, &sadd_request, &hash_index);
+            hindex_save(&hash_index);
+            if(result == ERROR)
             {
-                printf("Error receiving result\n");
+                printf("Error sending sadd request\n");
                 continue;
             }
 
@@ -142,6 +210,24 @@ int main(int argc, char *argv[])
             continue;
         }
 
+        if (strncmp(line, "add ", 4) == 0 && strchr(line, '"') && strchr(strchr(line, '"') + 1, '"'))
+        {
+            // Varios archivos con el mismo comentario: add archivo1 archivo2 ... "comentario"
+            char *files[LINESIZE / 2];
+            size_t count = 0;
+            char *quote = strchr(line, '"');
+
+            *strchr(quote + 1, '"') = '\0';
+            snprintf(comment, COMMENT_SIZE, "%s", quote + 1);
+            *quote = '\0';
+
+            for (char *token = strtok(line + 4, " \t"); token; token = strtok(NULL, " \t"))
+                files[count++] = token;
+
+            add_files(username, files, count, comment);
+            continue;
+        }
+
         if (sscanf(line, "list %s", filename) == 1)
         {
             slist slist_request;
@@ -149,25 +235,24 @@ int main(int argc, char *argv[])
             strcpy(slist_request.filename, filename);
             strcpy(slist_request.username, username);//Incluye el username para que el servidor gestione
 
-            if(list_request(client_socket, &slist_request) == ERROR)
-            {
-                printf("Error sending slist request\n");
+            if (pipelined) {
+                pipeline_list(&pipeline, &slist_request);
                 continue;
             }
 
-            if(recv(client_socket, &result, sizeof(return_code), 0) != sizeof(return_code))
+            result = list_versions(client_socket, &slist_request);
+            if(result == ERROR)
             {
-                printf("Error receiving result\n");
+                printf("Error sending slist request\n");
                 continue;
             }
 
-            if(result == VERSION_NOT_FOUND)
+            if(result != VERSION_CREATED)
             {
                 printf("Version not found\n");
                 continue;
             }
 
-            print_list(client_socket);
             continue;
         }
 
@@ -179,15 +264,16 @@ int main(int argc, char *argv[])
             strcpy(sget_request.username, username);//Incluye el username para que el servidor gestione
             sget_request.version = atoi(comment);
 
-            if(get_request(client_socket, &sget_request) == ERROR)
-            {
-                printf("Error sending sget request\n");
+            if (pipelined) {
+                pipeline_wait_file(&pipeline, filename); // Dos obtenciones del mismo archivo no se escriben a la vez
+                pipeline_get(&pipeline, &sget_request);
                 continue;
             }
 
-            if(recv(client_socket, &result, sizeof(return_code), 0) != sizeof(return_code))
+            result = get_version(client_socket, &sget_request);
+            if(result == ERROR)
             {
-                printf("Error receiving result\n");
+                printf("Error sending sget request\n");
                 continue;
             }
 
@@ -197,9 +283,6 @@ int main(int argc, char *argv[])
                 continue;
             }
 
-
-            local_copy(client_socket, filename);
-
             continue;
         }
 
@@ -208,32 +291,38 @@ int main(int argc, char *argv[])
             slist slist_request;
             memset(&slist_request, 0, sizeof(slist));
             slist_request.filename[0] = '\0';
+            strcpy(slist_request.username, username);//Incluye el username para que el servidor gestione
 
-            if(list_request(client_socket, &slist_request) == ERROR)
-            {
-                printf("Error sending slist request\n");
+            if (pipelined) {
+                pipeline_list(&pipeline, &slist_request);
                 continue;
             }
 
-            if(recv(client_socket, &result, sizeof(return_code), 0) != sizeof(return_code))
+            result = list_versions(client_socket, &slist_request);
+            if(result == ERROR)
             {
-                printf("Error receiving result\n");
+                printf("Error sending slist request\n");
                 continue;
             }
 
-            if(result == VERSION_NOT_FOUND)
+            if(result != VERSION_CREATED)
             {
                 printf("version not found\n");
                 continue;
             }
 
-            print_list(client_socket);
             continue;
         }
 
         usage(server_ip, port, username);
 
     }
+
+    pipeline_drain(&pipeline);
+    hindex_save(&hash_index);
+    hindex_close(&hash_index);
+    close(client_socket);
+    exit(EXIT_SUCCESS);
 }
 
 void sig_handler(int signo) {
@@ -242,11 +331,124 @@ void sig_handler(int signo) {
     exit(EXIT_SUCCESS);
 }
 
+void add_files(const char *username, char **filenames, size_t count, char *comment) {
+    sadd *requests = malloc(count * sizeof(sadd));
+    return_code *codes = malloc(count * sizeof(return_code));
+    return_code result;
+
+    if (!requests || !codes) {
+        printf("Error allocating memory\n");
+        free(requests);
+        free(codes);
+        return;
+    }
+
+    if (pipelined) {
+        for (size_t i = 0; i < count; i++)
+            pipeline_wait_file(&pipeline, filenames[i]); // Una obtencion en curso puede estar escribiendolo
+    }
+
+    create_sadd_batch(filenames, count, comment, requests, codes, &hash_index);
+
+    size_t valid = 0; // Solicitudes de los archivos que se pudieron leer, al inicio de requests
+    for (size_t i = 0; i < count; i++) {
+        if (codes[i] == VERSION_ERROR) {
+            printf("%s: The file does not exist or is not a regular file\n", filenames[i]);
+            continue;
+        }
+
+        strcpy(requests[i].username, username);//Incluye el username para que el servidor gestione
+        if (pipelined) {
+            if (valid != i) requests[valid] = requests[i];
+            valid++;
+            continue;
+        }
+
+        if ((result = add_request(client_socket, &requests[i], &hash_index)) == ERROR) {
+            printf("%s: Error sending sadd request\n", filenames[i]);
+            continue;
+        }
+
+        if (result == VERSION_ALREADY_EXISTS)
+            printf("%s: Version already exists\n", filenames[i]);
+        else if (result == VERSION_ERROR)
+            printf("%s: Error adding version\n", filenames[i]);
+        else
+            printf("%s: Version added\n", filenames[i]);
+    }
+
+    if (pipelined)
+        pipeline_manifest(&pipeline, requests, valid);
+    else
+        hindex_save(&hash_index); // Con v2 se guarda al recibir las respuestas
+    free(requests);
+    free(codes);
+}
+
+void add_tree(const char *username, const char *dir, char *comment) {
+    char **files;
+    size_t count;
+
+    if (list_files(dir, &files, &count) < 0) {
+        printf("The directory does not exist or cannot be read\n");
+        return;
+    }
+
+    if (count == 0)
+        printf("The directory has no regular files\n");
+
+    for (size_t i = 0; i < count; i += ADD_TREE_BATCH)
+        add_files(username, files + i, count - i < ADD_TREE_BATCH ? count - i : ADD_TREE_BATCH, comment);
+
+    for (size_t i = 0; i < count; i++)
+        free(files[i]);
+    free(files);
+}
+
+int input_ready(void) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+
+    return poll(&pfd, 1, 0) > 0;
+}
+
+int connect_server(const char *server_ip, int port) {
+    int fd;
+
+    // Creamos el socket
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("Error creating socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // Creamos la estructura de dirección del servidor
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+
+    // Convertimos la dirección IP a binario
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
+        perror("Error converting IP address");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // Conectamos al servidor
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(struct sockaddr_in)) < 0) {
+        perror("Error connecting to server");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
+}
+
 void usage(const char *server_ip, int port, const char *username) {
     printf("------------------Usage-----------------\n");
     printf("You are connected to server %s:%d as user '%s'\n", server_ip, port, username);
     printf("Commands:\n");
-    printf("  add <filename> \"<comment>\"\n");
+    printf("  add <filename> [<filename> ...] \"<comment>\"\n");
+    printf("  add -r <directory> \"<comment>\"\n");
     printf("  get <version> <filename>\n");
     printf("  list <filename>(optional)\n");
 }
@@ -0,0 +1,302 @@
+/**
+ * @file
+ * @brief Implementacion del indice de hashes de los archivos locales
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hashindex.h"
+
+#define HINDEX_MIN_SLOTS 1024 /**< Capacidad inicial de la tabla hash */
+
+/**
+ * @brief Hash FNV-1a de una cadena
+ *
+ * @param s Cadena
+ * @return Hash
+ */
+static uint64_t hindex_hash(const char *s);
+
+/**
+ * @brief Busca la posicion de una ruta en la tabla hash
+ *
+ * @param index Indice
+ * @param path Ruta absoluta
+ * @return Posicion de la tabla: la del archivo o la posicion libre donde se agregaria
+ */
+static uint32_t hindex_slot(shindex *index, const char *path);
+
+/**
+ * @brief Busca un archivo y lo agrega si no existe
+ *
+ * @param index Indice
+ * @param path Ruta absoluta
+ * @return Archivo, NULL si no hay memoria
+ */
+static shindex_entry *hindex_insert(shindex *index, const char *path);
+
+/**
+ * @brief Duplica la capacidad de la tabla hash
+ *
+ * @param index Indice
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+static int hindex_grow(shindex *index);
+
+/**
+ * @brief Obtiene la ruta absoluta de un archivo
+ *
+ * @param path Ruta del archivo
+ * @param resolved Buffer de PATH_MAX bytes
+ * @return 0 en caso de exito, -1 si no se puede resolver
+ */
+static int hindex_resolve(const char *path, char *resolved);
+
+/**
+ * @brief Tiempo de una marca de stat en nanosegundos
+ *
+ * @param ts Marca de tiempo
+ * @return Nanosegundos desde la epoca
+ */
+static int64_t hindex_ns(const struct timespec *ts);
+
+/**
+ * @brief Lee los registros del archivo del indice
+ *
+ * Los registros se leen hasta el primero incompleto o invalido.
+ *
+ * @param index Indice
+ * @param data Contenido del archivo
+ * @param size Tamaño del contenido
+ */
+static void hindex_parse(shindex *index, const unsigned char *data, size_t size);
+
+int hindex_open(shindex *index, const char *file) {
+	struct stat st;
+	unsigned char *data = NULL;
+	size_t size = 0;
+
+	memset(index, 0, sizeof *index);
+	index->file = strdup(file);
+	index->slot_count = HINDEX_MIN_SLOTS;
+	index->slots = calloc(index->slot_count, sizeof(uint32_t));
+	if (!index->file || !index->slots) {
+		hindex_close(index);
+		return -1;
+	}
+
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return 0; // Todavia no hay indice
+
+	if (fstat(fd, &st) == 0 && st.st_size > HINDEX_HEADER_SIZE && (data = malloc(st.st_size))) {
+		while (size < (size_t)st.st_size) {
+			ssize_t nread = read(fd, data + size, st.st_size - size);
+			if (nread <= 0) break;
+			size += nread;
+		}
+	}
+	close(fd);
+
+	// Un indice de otro formato se ignora: se vuelve a escribir al guardar
+	if (data && size > HINDEX_HEADER_SIZE && memcmp(data, HINDEX_MAGIC, HINDEX_HEADER_SIZE) == 0)
+		hindex_parse(index, data + HINDEX_HEADER_SIZE, size - HINDEX_HEADER_SIZE);
+
+	free(data);
+	return 0;
+}
+
+int hindex_lookup(shindex *index, const char *path, const struct stat *st, char *hash) {
+	char resolved[PATH_MAX];
+
+	if (!index || !index->slots || hindex_resolve(path, resolved) < 0) return 0;
+
+	uint32_t slot = index->slots[hindex_slot(index, resolved)];
+	if (!slot) return 0;
+
+	shindex_entry *entry = &index->entries[slot - 1];
+	if (entry->dev != (uint64_t)st->st_dev || entry->ino != (uint64_t)st->st_ino ||
+		entry->size != (uint64_t)st->st_size || entry->mtime_ns != hindex_ns(&st->st_mtim) ||
+		entry->ctime_ns != hindex_ns(&st->st_ctim))
+		return 0;
+
+	memcpy(hash, entry->hash, sizeof(entry->hash));
+	return 1;
+}
+
+void hindex_update(shindex *index, const char *path, const struct stat *st, const char *hash) {
+	char resolved[PATH_MAX];
+	struct timespec now;
+
+	if (!index || !index->slots || strlen(hash) != 2 * HINDEX_HASH_BYTES || hindex_resolve(path, resolved) < 0) return;
+
+	// Un archivo modificado recientemente se vuelve a leer la proxima vez
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t limit = hindex_ns(&now) - HINDEX_RACY_NS;
+	if (hindex_ns(&st->st_mtim) >= limit || hindex_ns(&st->st_ctim) >= limit) return;
+
+	shindex_entry *entry = hindex_insert(index, resolved);
+	if (!entry) return;
+
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime_ns = hindex_ns(&st->st_mtim);
+	entry->ctime_ns = hindex_ns(&st->st_ctim);
+	memcpy(entry->hash, hash, sizeof(entry->hash));
+	index->dirty = 1;
+}
+
+int hindex_save(shindex *index) {
+	char tmp_path[PATH_MAX];
+	unsigned char header[HINDEX_RECORD_HEADER];
+
+	if (!index || !index->dirty) return 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index->file);
+	FILE *out = fopen(tmp_path, "wb");
+	if (!out) return -1;
+
+	fwrite(HINDEX_MAGIC, 1, HINDEX_HEADER_SIZE, out);
+	for (uint32_t i = 0; i < index->count; i++) {
+		shindex_entry *entry = &index->entries[i];
+		uint64_t fields[5] = { entry->dev, entry->ino, entry->size, (uint64_t)entry->mtime_ns, (uint64_t)entry->ctime_ns };
+		uint16_t len = strlen(entry->path);
+
+		memcpy(header, fields, sizeof(fields));
+		for (int j = 0; j < HINDEX_HASH_BYTES; j++) {
+			unsigned int byte;
+			sscanf(entry->hash + 2 * j, "%2x", &byte);
+			header[sizeof(fields) + j] = byte;
+		}
+		memcpy(header + sizeof(fields) + HINDEX_HASH_BYTES, &len, sizeof(len));
+
+		fwrite(header, 1, sizeof(header), out);
+		fwrite(entry->path, 1, len, out);
+	}
+
+	int failed = ferror(out);
+	if (fclose(out) != 0) failed = 1;
+	if (failed || rename(tmp_path, index->file) < 0) {
+		unlink(tmp_path);
+		return -1;
+	}
+
+	index->dirty = 0;
+	return 0;
+}
+
+void hindex_close(shindex *index) {
+	for (uint32_t i = 0; i < index->count; i++)
+		free(index->entries[i].path);
+
+	free(index->entries);
+	free(index->slots);
+	free(index->file);
+	memset(index, 0, sizeof *index);
+}
+
+static void hindex_parse(shindex *index, const unsigned char *data, size_t size) {
+	char path[PATH_MAX];
+	size_t off = 0;
+
+	while (off + HINDEX_RECORD_HEADER <= size) {
+		uint64_t fields[5];
+		uint16_t len;
+
+		memcpy(fields, data + off, sizeof(fields));
+		memcpy(&len, data + off + sizeof(fields) + HINDEX_HASH_BYTES, sizeof(len));
+		if (len == 0 || len >= PATH_MAX || off + HINDEX_RECORD_HEADER + len > size) break;
+
+		memcpy(path, data + off + HINDEX_RECORD_HEADER, len);
+		path[len] = '\0';
+
+		shindex_entry *entry = hindex_insert(index, path);
+		if (!entry) break;
+
+		entry->dev = fields[0];
+		entry->ino = fields[1];
+		entry->size = fields[2];
+		entry->mtime_ns = (int64_t)fields[3];
+		entry->ctime_ns = (int64_t)fields[4];
+		for (int j = 0; j < HINDEX_HASH_BYTES; j++)
+			sprintf(entry->hash + 2 * j, "%02x", data[off + sizeof(fields) + j]);
+
+		off += HINDEX_RECORD_HEADER + len;
+	}
+}
+
+static shindex_entry *hindex_insert(shindex *index, const char *path) {
+	uint32_t slot = hindex_slot(index, path);
+	if (index->slots[slot]) return &index->entries[index->slots[slot] - 1];
+
+	// La tabla hash se mantiene a lo sumo a la mitad de su capacidad
+	if (2 * (index->count + 1) > index->slot_count) {
+		if (hindex_grow(index) < 0) return NULL;
+		slot = hindex_slot(index, path);
+	}
+
+	if (index->count == index->cap) {
+		uint32_t cap = index->cap ? 2 * index->cap : 256;
+		shindex_entry *entries = realloc(index->entries, cap * sizeof(shindex_entry));
+		if (!entries) return NULL;
+		index->entries = entries;
+		index->cap = cap;
+	}
+
+	shindex_entry *entry = &index->entries[index->count];
+	memset(entry, 0, sizeof *entry);
+	if (!(entry->path = strdup(path))) return NULL;
+
+	index->slots[slot] = ++index->count;
+	return entry;
+}
+
+static uint32_t hindex_slot(shindex *index, const char *path) {
+	uint32_t mask = index->slot_count - 1;
+	uint32_t slot = hindex_hash(path) & mask;
+
+	while (index->slots[slot] && strcmp(index->entries[index->slots[slot] - 1].path, path) != 0)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+static int hindex_grow(shindex *index) {
+	uint32_t count = 2 * index->slot_count;
+	uint32_t *slots = calloc(count, sizeof(uint32_t));
+	if (!slots) return -1;
+
+	free(index->slots);
+	index->slots = slots;
+	index->slot_count = count;
+
+	for (uint32_t i = 0; i < index->count; i++)
+		index->slots[hindex_slot(index, index->entries[i].path)] = i + 1;
+
+	return 0;
+}
+
+static int hindex_resolve(const char *path, char *resolved) {
+	return realpath(path, resolved) ? 0 : -1;
+}
+
+static int64_t hindex_ns(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static uint64_t hindex_hash(const char *s) {
+	uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+
+	return h;
+}
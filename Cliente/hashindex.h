@@ -0,0 +1,109 @@
+/**
+ * @file
+ * @brief Indice de hashes de los archivos locales
+ *
+ * Guarda, para cada archivo del que ya se calculo el hash, los datos de stat
+ * que cambian cuando se modifica su contenido (dispositivo, inodo, tamaño,
+ * mtime y ctime en nanosegundos). Si al volver a agregar el archivo esos datos
+ * no cambiaron se usa el hash guardado y el archivo no se vuelve a leer.
+ *
+ * El indice se guarda en HINDEX_FILE, en el directorio donde se ejecuta el
+ * cliente. Cada registro ocupa:
+ *  - dispositivo, inodo, tamaño, mtime y ctime (8 bytes cada uno)
+ *  - hash SHA-256 en binario (32 bytes)
+ *  - longitud de la ruta (2 bytes) y la ruta absoluta, sin NULL
+ *
+ * Un archivo modificado hace menos de HINDEX_RACY_NS no se guarda: en algunos
+ * sistemas de archivos otra modificacion en ese intervalo podria dejar el
+ * mismo mtime y el indice no la detectaria.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define HINDEX_FILE ".versions_index" /**< Archivo del indice */
+#define HINDEX_MAGIC "RHIX0001" /**< Encabezado del indice (8 bytes, sin NULL) */
+#define HINDEX_HEADER_SIZE 8 /**< Tamaño del encabezado del indice */
+#define HINDEX_HASH_BYTES 32 /**< Bytes del hash SHA-256 en binario */
+#define HINDEX_RECORD_HEADER (5 * 8 + HINDEX_HASH_BYTES + 2) /**< Datos de stat, hash y longitud de la ruta */
+#define HINDEX_RACY_NS (2000000000LL) /**< Antiguedad minima de mtime/ctime para guardar un archivo */
+
+/**
+ * @brief Archivo del indice
+ */
+typedef struct {
+	char *path; /**< Ruta absoluta (clave) */
+	uint64_t dev; /**< Dispositivo */
+	uint64_t ino; /**< Inodo */
+	uint64_t size; /**< Tamaño en bytes */
+	int64_t mtime_ns; /**< Ultima modificacion del contenido */
+	int64_t ctime_ns; /**< Ultimo cambio del inodo */
+	char hash[2 * HINDEX_HASH_BYTES + 1]; /**< Hash del contenido en hexadecimal */
+} shindex_entry;
+
+/**
+ * @brief Indice de hashes en memoria
+ */
+typedef struct {
+	char *file; /**< Ruta del archivo del indice */
+	shindex_entry *entries; /**< Archivos */
+	uint32_t count; /**< Cantidad de archivos */
+	uint32_t cap; /**< Capacidad de la tabla de archivos */
+	uint32_t *slots; /**< Tabla hash de rutas: posicion + 1, 0 si esta libre */
+	uint32_t slot_count; /**< Capacidad de la tabla hash (potencia de 2) */
+	int dirty; /**< 1 si hay cambios sin guardar */
+} shindex;
+
+/**
+ * @brief Lee el indice de un archivo
+ *
+ * Si el archivo no existe o no tiene el formato esperado el indice queda vacio.
+ *
+ * @param index Indice
+ * @param file Ruta del archivo del indice
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+int hindex_open(shindex *index, const char *file);
+
+/**
+ * @brief Busca el hash de un archivo
+ *
+ * @param index Indice
+ * @param path Ruta del archivo
+ * @param st Estado actual del archivo
+ * @param hash Buffer para el hash en hexadecimal (al menos 65 bytes)
+ * @return 1 si el archivo no cambio desde que se guardo su hash, 0 si se debe calcular
+ */
+int hindex_lookup(shindex *index, const char *path, const struct stat *st, char *hash);
+
+/**
+ * @brief Guarda el hash de un archivo
+ *
+ * @param index Indice
+ * @param path Ruta del archivo
+ * @param st Estado del archivo antes de leer su contenido
+ * @param hash Hash del contenido en hexadecimal
+ */
+void hindex_update(shindex *index, const char *path, const struct stat *st, const char *hash);
+
+/**
+ * @brief Escribe el indice en su archivo si tiene cambios
+ *
+ * El archivo se reemplaza de forma atomica.
+ *
+ * @param index Indice
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int hindex_save(shindex *index);
+
+/**
+ * @brief Libera el indice (sin guardarlo)
+ *
+ * @param index Indice
+ */
+void hindex_close(shindex *index);
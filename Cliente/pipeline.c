@@ -0,0 +1,822 @@
+/**
+ * @file
+ * @brief Implementacion de las solicitudes v2 en curso sobre una misma conexion
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+
+/**
+ * @brief Reserva la posicion de una solicitud nueva
+ *
+ * Si ya hay FRAME_PIPELINE_MAX solicitudes en curso espera a que termine alguna.
+ *
+ * @param pipeline Solicitudes en curso
+ * @param type Codigo del frame de la solicitud
+ * @return Solicitud, NULL si la conexion fallo
+ */
+static spending *pipeline_reserve(spipeline *pipeline, frame_opcode type);
+
+/**
+ * @brief Envia el frame de una solicitud reservada y el contenido que pida el servidor
+ *
+ * @param pipeline Solicitudes en curso
+ * @param pending Solicitud
+ * @param payload Contenido del frame
+ * @param length Bytes del contenido
+ */
+static void pipeline_submit(spipeline *pipeline, spending *pending, const unsigned char *payload, size_t length);
+
+/**
+ * @brief Envia bytes por el socket y, mientras el socket no admite escritura, procesa los frames que llegan
+ *
+ * @param pipeline Solicitudes en curso
+ * @param data Bytes
+ * @param size Cantidad de bytes
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int pipeline_send(spipeline *pipeline, const void *data, size_t size);
+
+/**
+ * @brief Indica si llegaron datos del servidor, sin esperar
+ *
+ * @param pipeline Solicitudes en curso
+ * @return 1 si hay datos para leer (o la conexion se cerro), 0 si no
+ */
+static int pipeline_ready(spipeline *pipeline);
+
+/**
+ * @brief Envia el contenido que pidio el servidor o, si no hay, procesa el siguiente frame
+ *
+ * @param pipeline Solicitudes en curso
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int pipeline_step(spipeline *pipeline);
+
+/**
+ * @brief Recibe un frame completo y lo entrega a su solicitud
+ *
+ * @param pipeline Solicitudes en curso
+ * @return 0 en caso de exito, -1 si ocurre un error o el frame no corresponde a ninguna solicitud
+ */
+static int pipeline_receive(spipeline *pipeline);
+
+/**
+ * @brief Procesa la respuesta FRAME_STATUS de una solicitud
+ *
+ * @param pipeline Solicitudes en curso
+ * @param pending Solicitud
+ * @param payload Contenido del frame
+ * @param length Bytes del contenido
+ * @return 0 en caso de exito, -1 si la respuesta no es valida
+ */
+static int pipeline_status(spipeline *pipeline, spending *pending, unsigned char *payload, uint32_t length);
+
+/**
+ * @brief Divide en fragmentos el archivo de una adicion en flujo y envia la solicitud FRAME_CHUNKS
+ *
+ * @param pipeline Solicitudes en curso
+ * @param pending Adicion
+ * @return 0 si se envio, 1 si la lista de fragmentos no cabe en un frame (el hash
+ *         de la adicion queda calculado), -1 si el archivo no se puede leer
+ */
+static int pipeline_chunks(spipeline *pipeline, spending *pending);
+
+/**
+ * @brief Envia el contenido que pidio el servidor: el de una adicion o los de un manifiesto o fragmentos, en orden
+ *
+ * @param pipeline Solicitudes en curso
+ * @param pending Adicion o manifiesto
+ * @return 0 en caso de exito, -1 si ocurre un error de comunicacion
+ */
+static int pipeline_upload(spipeline *pipeline, spending *pending);
+
+/**
+ * @brief Envia el contenido de un archivo en frames FRAME_DATA seguidos de FRAME_END
+ *
+ * Se envian exactamente los bytes anunciados en la solicitud: si el archivo se
+ * acorta o no se puede leer, el resto se completa con ceros y el hash enviado no
+ * coincide, asi el servidor responde VERSION_ERROR y la conexion sigue sincronizada.
+ *
+ * Si el servidor ofrecio continuar una recepcion interrumpida, primero se envia
+ * FRAME_RESUME con el final del ultimo bloque ofrecido que coincide con el archivo.
+ *
+ * @param pipeline Solicitudes en curso
+ * @param id Id de la solicitud
+ * @param filename Archivo
+ * @param start Posicion del archivo desde la que se envia (la de un fragmento)
+ * @param size Bytes anunciados en la solicitud
+ * @param hash Hash anunciado; si esta vacio (adicion en flujo) se calcula, se guarda aqui y va en FRAME_END
+ * @param offer Bytes que el servidor ofrece no volver a recibir, 0 si no ofrecio continuar
+ * @param checkpoints Puntos de control de los bloques ofrecidos
+ * @return 0 en caso de exito, -1 si ocurre un error de comunicacion
+ */
+static int pipeline_send_file(spipeline *pipeline, uint32_t id, const char *filename, off_t start, off_t size, char *hash,
+	off_t offer, const uint64_t *checkpoints);
+
+/**
+ * @brief Escribe en una solicitud de obtencion los bloques completos del archivo parcial y sus puntos de control
+ *
+ * @param partial Archivo parcial de una obtencion interrumpida
+ * @param wire Cursor sobre el contenido de la solicitud
+ * @return Bytes ofrecidos, 0 si no hay archivo parcial
+ */
+static off_t pipeline_put_partial(const char *partial, swire *wire);
+
+/**
+ * @brief Imprime el resultado de la adicion de un archivo
+ *
+ * @param label Nombre del archivo, NULL si el mensaje no lo lleva
+ * @param result Resultado (ERROR si fallo la comunicacion)
+ */
+static void pipeline_print_add(const char *label, return_code result);
+
+/**
+ * @brief Imprime el resultado de una solicitud y libera su posicion
+ *
+ * @param pipeline Solicitudes en curso
+ * @param pending Solicitud
+ * @param result Resultado (ERROR si fallo la comunicacion)
+ */
+static void pipeline_finish(spipeline *pipeline, spending *pending, return_code result);
+
+/**
+ * @brief Termina todas las solicitudes en curso con ERROR despues de un error de comunicacion
+ *
+ * @param pipeline Solicitudes en curso
+ */
+static void pipeline_fail(spipeline *pipeline);
+
+void pipeline_init(spipeline *pipeline, int socket, int version, int codec, shindex *index) {
+	memset(pipeline, 0, sizeof *pipeline);
+	pipeline->socket = socket;
+	pipeline->manifests = version >= PROTOCOL_MANIFEST;
+	pipeline->resume = version >= PROTOCOL_RESUME;
+	pipeline->chunks = version >= PROTOCOL_CHUNKS;
+	pipeline->codec = codec;
+	pipeline->index = index;
+	pipeline->next_id = 1;
+}
+
+void pipeline_add(spipeline *pipeline, sadd *request, int labeled) {
+	unsigned char payload[8 + 3 * 2 + HASH_SIZE + COMMENT_SIZE + PATH_MAX];
+	spending *pending = pipeline_reserve(pipeline, FRAME_ADD);
+	swire wire;
+
+	if (!pending) {
+		if (labeled) printf("%s: ", request->filename);
+		printf("Error sending sadd request\n");
+		return;
+	}
+
+	pending->labeled = labeled;
+	pending->streamed = request->hash[0] == '\0';
+	pending->add = *request;
+	if (stat(request->filename, &pending->st) < 0) { // El tamaño va en la solicitud
+		pipeline_finish(pipeline, pending, ERROR);
+		return;
+	}
+
+	if (pipeline->chunks && pending->streamed) {
+		int sent = pipeline_chunks(pipeline, pending);
+		if (sent < 0) pipeline_finish(pipeline, pending, ERROR);
+		if (sent <= 0) return;
+		request = &pending->add; // No cabe: se envia todo el contenido, con el hash ya calculado
+	}
+
+	wire_init(&wire, payload, sizeof(payload));
+	wire_put_uint(&wire, pending->st.st_size, 8);
+	wire_put_string(&wire, request->hash);
+	wire_put_string(&wire, request->comment);
+	wire_put_string(&wire, request->filename);
+	if (wire.error) {
+		pipeline_finish(pipeline, pending, ERROR);
+		return;
+	}
+
+	pipeline_submit(pipeline, pending, payload, wire.off);
+}
+
+void pipeline_manifest(spipeline *pipeline, sadd *requests, size_t count) {
+	unsigned char payload[FRAME_CONTROL_MAX];
+	size_t next = 0;
+
+	if (!pipeline->manifests) { // Servidor de la version FRAME_VERSION
+		for (; next < count; next++) pipeline_add(pipeline, &requests[next], 1);
+		return;
+	}
+
+	while (next < count) {
+		spending *pending = pipeline_reserve(pipeline, FRAME_MANIFEST);
+		swire wire;
+
+		if (!pending || !(pending->files = malloc((count - next) * sizeof(smanifest_file)))) {
+			if (pending) pipeline_finish(pipeline, pending, ERROR);
+			for (; next < count; next++) pipeline_print_add(requests[next].filename, ERROR);
+			return;
+		}
+
+		wire_init(&wire, payload, sizeof(payload));
+		wire_put_string(&wire, requests[next].comment);
+		for (; next < count; next++) {
+			smanifest_file *file = &pending->files[pending->file_count];
+			size_t off = wire.off;
+
+			if (pipeline->chunks && requests[next].hash[0] == '\0') continue; // Se envia aparte, por fragmentos
+
+			// El tamaño va en el manifiesto
+			if (stat(requests[next].filename, &file->st) < 0 || !(file->filename = strdup(requests[next].filename))) {
+				pipeline_print_add(requests[next].filename, ERROR);
+				continue;
+			}
+
+			wire_put_uint(&wire, file->st.st_size, 8);
+			wire_put_string(&wire, requests[next].hash);
+			wire_put_string(&wire, requests[next].filename);
+			if (wire.error) { // No cabe: va en el siguiente manifiesto
+				free(file->filename);
+				wire.off = off;
+				wire.error = 0;
+				break;
+			}
+
+			memcpy(file->hash, requests[next].hash, TRAILER_HASH_SIZE); // Vacio en una adicion en flujo
+			file->hash[TRAILER_HASH_SIZE] = '\0';
+			file->streamed = file->hash[0] == '\0';
+			file->result = ERROR;
+			pending->file_count++;
+		}
+
+		if (pending->file_count == 0) {
+			pipeline_finish(pipeline, pending, ERROR);
+			continue;
+		}
+		pipeline_submit(pipeline, pending, payload, wire.off);
+	}
+
+	// Despues de los manifiestos: la solicitud en construccion no puede quedar esperando respuestas
+	for (next = 0; pipeline->chunks && next < count; next++)
+		if (requests[next].hash[0] == '\0') pipeline_add(pipeline, &requests[next], 1);
+}
+
+void pipeline_get(spipeline *pipeline, sget *request) {
+	unsigned char payload[8 + 2 + HASH_SIZE + 8 + 8 * RESUME_CHECKPOINTS_MAX];
+	spending *pending = pipeline_reserve(pipeline, FRAME_GET);
+	char partial[PATH_MAX + sizeof(PARTIAL_SUFFIX)]; // Archivo donde se recibe el contenido
+	swire wire;
+
+	if (!pending) {
+		printf("Error sending sget request\n");
+		return;
+	}
+
+	snprintf(pending->filename, sizeof(pending->filename), "%s", request->filename);
+	snprintf(partial, sizeof(partial), "%s" PARTIAL_SUFFIX, request->filename);
+	wire_init(&wire, payload, sizeof(payload));
+	wire_put_uint(&wire, request->version, 8);
+	wire_put_string(&wire, request->filename);
+	if (pipeline->resume) pending->offset = pipeline_put_partial(partial, &wire);
+	pipeline_submit(pipeline, pending, payload, wire.off);
+}
+
+void pipeline_list(spipeline *pipeline, slist *request) {
+	unsigned char payload[2 + HASH_SIZE];
+	spending *pending = pipeline_reserve(pipeline, FRAME_LIST);
+	swire wire;
+
+	if (!pending) {
+		printf("Error sending slist request\n");
+		return;
+	}
+
+	snprintf(pending->filename, sizeof(pending->filename), "%s", request->filename);
+	wire_init(&wire, payload, sizeof(payload));
+	wire_put_string(&wire, request->filename);
+	pipeline_submit(pipeline, pending, payload, wire.off);
+}
+
+void pipeline_wait_file(spipeline *pipeline, const char *filename) {
+	for (int i = 0; i < FRAME_PIPELINE_MAX && !pipeline->broken; i++) {
+		spending *pending = &pipeline->pending[i];
+
+		// La posicion puede quedar libre y volver a usarse mientras se espera: se revisa cada vez
+		while (pending->id && pending->type == FRAME_GET && strcmp(pending->filename, filename) == 0 && !pipeline->broken) {
+			if (pipeline_step(pipeline) < 0) pipeline_fail(pipeline);
+		}
+	}
+}
+
+void pipeline_drain(spipeline *pipeline) {
+	while (pipeline->count && !pipeline->broken) {
+		if (pipeline_step(pipeline) < 0) pipeline_fail(pipeline);
+	}
+}
+
+static spending *pipeline_reserve(spipeline *pipeline, frame_opcode type) {
+	while (pipeline->count == FRAME_PIPELINE_MAX && !pipeline->broken) {
+		if (pipeline_step(pipeline) < 0) pipeline_fail(pipeline);
+	}
+	if (pipeline->broken) return NULL;
+
+	for (int i = 0; i < FRAME_PIPELINE_MAX; i++) {
+		spending *pending = &pipeline->pending[i];
+		if (pending->id) continue;
+
+		memset(pending, 0, sizeof *pending);
+		pending->id = pipeline->next_id++;
+		if (pipeline->next_id == 0) pipeline->next_id = 1; // El id 0 es el del saludo
+		pending->type = type;
+		pipeline->count++;
+		return pending;
+	}
+
+	return NULL;
+}
+
+static void pipeline_submit(spipeline *pipeline, spending *pending, const unsigned char *payload, size_t length) {
+	unsigned char control[FRAME_HEADER_SIZE + FRAME_CONTROL_MAX];
+	unsigned char *frame = control;
+	int failed;
+
+	if (length > FRAME_CONTROL_MAX && !(frame = malloc(FRAME_HEADER_SIZE + length))) { // Lista de fragmentos
+		pipeline_finish(pipeline, pending, ERROR);
+		return;
+	}
+
+	frame_pack(frame, pending->type, pending->id, length);
+	memcpy(frame + FRAME_HEADER_SIZE, payload, length);
+	failed = pipeline_send(pipeline, frame, FRAME_HEADER_SIZE + length) < 0;
+	if (frame != control) free(frame);
+	if (failed) {
+		pipeline_fail(pipeline);
+		return;
+	}
+
+	// Las respuestas que ya llegaron se procesan sin esperar: el contenido se envia en cuanto el servidor lo pide
+	while (!pipeline->broken && (pipeline->upload || pipeline_ready(pipeline))) {
+		if (pipeline_step(pipeline) < 0) pipeline_fail(pipeline);
+	}
+}
+
+static int pipeline_send(spipeline *pipeline, const void *data, size_t size) {
+	const char *next = data;
+
+	while (size > 0) {
+		struct pollfd pfd = { .fd = pipeline->socket, .events = POLLIN | POLLOUT };
+
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		if (!(pfd.revents & POLLOUT)) { // El servidor esta esperando que se lean sus respuestas
+			if (pipeline_receive(pipeline) < 0) return -1;
+			continue;
+		}
+
+		ssize_t nsent = send(pipeline->socket, next, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (nsent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+			return -1;
+		}
+		next += nsent;
+		size -= nsent;
+	}
+
+	return 0;
+}
+
+static int pipeline_ready(spipeline *pipeline) {
+	struct pollfd pfd = { .fd = pipeline->socket, .events = POLLIN };
+
+	return pipeline->count && poll(&pfd, 1, 0) > 0;
+}
+
+static int pipeline_step(spipeline *pipeline) {
+	if (pipeline->upload) return pipeline_upload(pipeline, pipeline->upload);
+	return pipeline_receive(pipeline);
+}
+
+static int pipeline_receive(spipeline *pipeline) {
+	spending *pending = NULL;
+	unsigned char *payload, *packed;
+	sframe frame;
+	int failed;
+
+	if (frame_recv(pipeline->socket, &frame) < 0) return -1;
+
+	for (int i = 0; i < FRAME_PIPELINE_MAX && !pending; i++)
+		if (pipeline->pending[i].id && pipeline->pending[i].id == frame.id) pending = &pipeline->pending[i];
+	if (!pending) return -1;
+
+	switch (frame.opcode) {
+		case FRAME_PACKED: // FRAME_STATUS o FRAME_DATA comprimido
+			if (!pipeline->codec || frame.length > FRAME_DATA_MAX) return -1;
+			if (!(packed = malloc(frame.length ? frame.length : 1)) || !(payload = malloc(FRAME_DATA_MAX))) {
+				free(packed);
+				return -1;
+			}
+			failed = frame_recv_payload(pipeline->socket, packed, frame.length) < 0 ||
+				frame_decompress(packed, &frame, payload, FRAME_DATA_MAX) < 0;
+			free(packed);
+
+			if (!failed && frame.opcode == FRAME_STATUS)
+				failed = frame.length == 0 || pipeline_status(pipeline, pending, payload, frame.length) < 0;
+			else if (!failed && frame.opcode == FRAME_DATA)
+				failed = pending->type != FRAME_GET || !pending->receiving ||
+					frame.length > pending->size - pending->receiver.received ||
+					receiver_write(&pending->receiver, payload, frame.length) < 0;
+			else
+				failed = 1;
+			free(payload);
+			return failed ? -1 : 0;
+
+		case FRAME_STATUS:
+			if (frame.length == 0 || !(payload = malloc(frame.length))) return -1;
+			failed = frame_recv_payload(pipeline->socket, payload, frame.length) < 0 ||
+				pipeline_status(pipeline, pending, payload, frame.length) < 0;
+			free(payload);
+			return failed ? -1 : 0;
+
+		case FRAME_DATA: // Bloque del contenido de una obtencion
+			if (pending->type != FRAME_GET || !pending->receiving || frame.length > pending->size - pending->receiver.received)
+				return -1;
+			return receiver_copy(pipeline->socket, &pending->receiver, frame.length);
+
+		case FRAME_END:
+			if (pending->type != FRAME_GET || !pending->receiving || frame.length != 0 || pending->receiver.received != pending->size)
+				return -1;
+			receiver_close(&pending->receiver, 1);
+			pending->receiving = 0;
+
+			// El archivo destino solo se reemplaza con el contenido completo
+			char partial[PATH_MAX + sizeof(PARTIAL_SUFFIX)];
+			snprintf(partial, sizeof(partial), "%s" PARTIAL_SUFFIX, pending->filename);
+			if (rename(partial, pending->filename) < 0) {
+				perror("Error renaming file");
+				pipeline_finish(pipeline, pending, VERSION_ERROR);
+				return 0;
+			}
+			printf("File %s copied\n", pending->filename);
+			pipeline_finish(pipeline, pending, VERSION_CREATED);
+			return 0;
+
+		default:
+			return -1;
+	}
+}
+
+static int pipeline_status(spipeline *pipeline, spending *pending, unsigned char *payload, uint32_t length) {
+	char line[BUFFSIZE];
+	char partial[PATH_MAX + sizeof(PARTIAL_SUFFIX)];
+	return_code result;
+	uint64_t size, offset;
+	swire wire;
+
+	wire_init(&wire, payload, length);
+	result = wire_get_uint(&wire, 1);
+
+	switch (pending->type) {
+		case FRAME_ADD:
+			if (result == CONTENT_REQUIRED) {
+				if (pipeline->upload) return -1; // El servidor recibe un contenido a la vez
+
+				if (pipeline->resume) { // Bytes de una recepcion interrumpida que el servidor ya tiene
+					offset = wire_get_uint(&wire, 8);
+					if (wire.error || offset % RESUME_CHUNK || (off_t)offset > pending->st.st_size ||
+						offset / RESUME_CHUNK > RESUME_CHECKPOINTS_MAX || length != 1 + 8 + offset / RESUME_CHUNK * 8)
+						return -1;
+					if (offset && !(pending->checkpoints = malloc(offset / RESUME_CHUNK * sizeof(uint64_t)))) return -1;
+					for (uint32_t i = 0; i < offset / RESUME_CHUNK; i++)
+						pending->checkpoints[i] = wire_get_uint(&wire, 8);
+					pending->offset = offset;
+				}
+				pipeline->upload = pending;
+				return 0;
+			}
+			break;
+
+		case FRAME_MANIFEST:
+		case FRAME_CHUNKS:
+			if (result == CONTENT_REQUIRED) { // Indices de los archivos o fragmentos cuyo contenido se debe enviar
+				uint32_t count = (length - 1) / 4;
+				uint32_t limit = pending->type == FRAME_MANIFEST ? pending->file_count : pending->chunk_count;
+
+				if (pipeline->upload || pending->missing || count == 0 || count > limit || (length - 1) % 4)
+					return -1;
+				if (!(pending->missing = malloc(count * sizeof(uint32_t)))) return -1;
+
+				for (uint32_t i = 0; i < count; i++) {
+					uint32_t index = wire_get_uint(&wire, 4);
+					if (index >= limit || (i > 0 && index <= pending->missing[i - 1])) return -1;
+					pending->missing[pending->missing_count++] = index;
+				}
+				pipeline->upload = pending;
+				return 0;
+			}
+
+			if (result == SUCCESS && pending->type == FRAME_MANIFEST) { // Resultado de cada archivo
+				if (length != 1 + pending->file_count) return -1;
+				for (uint32_t i = 0; i < pending->file_count; i++)
+					pending->files[i].result = wire_get_uint(&wire, 1);
+			}
+			break;
+
+		case FRAME_GET:
+			if (pending->receiving) return -1;
+			if (result != VERSION_CREATED) break;
+
+			// Tamaño del archivo y, desde PROTOCOL_RESUME, bytes del archivo parcial que se conservan
+			size = wire_get_uint(&wire, 8);
+			offset = pipeline->resume ? wire_get_uint(&wire, 8) : 0;
+			if (wire.error || size > INT64_MAX || offset > size || (off_t)offset > pending->offset) return -1;
+
+			// El contenido llega en frames FRAME_DATA
+			snprintf(partial, sizeof(partial), "%s" PARTIAL_SUFFIX, pending->filename);
+			if (receiver_open(&pending->receiver, partial, size, offset) < 0) return -1;
+			if (offset)
+				printf("File %s resumed at %ld bytes\n", pending->filename, (long)offset);
+			else
+				printf("File %s created\n", pending->filename);
+			printf("File size: %ld\n", (long)size);
+			pending->receiving = 1;
+			pending->size = size;
+			return 0;
+
+		case FRAME_LIST:
+			if (result != VERSION_CREATED) break;
+
+			printf("List of versions:\n");
+			while (wire.off < wire.size) {
+				wire_get_string(&wire, line, sizeof(line));
+				if (wire.error) return -1;
+				printf("%s", line);
+			}
+			break;
+
+		default:
+			return -1;
+	}
+
+	pipeline_finish(pipeline, pending, result);
+	return 0;
+}
+
+static int pipeline_chunks(spipeline *pipeline, spending *pending) {
+	unsigned char *payload;
+	uint64_t size = 0; // Suma de los fragmentos: el archivo pudo cambiar despues de stat
+	swire wire;
+
+	if (chunk_file(pending->add.filename, &pending->chunks, &pending->chunk_count, pending->add.hash) < 0) return -1;
+	if (!(payload = malloc(FRAME_CHUNKS_MAX))) return -1;
+
+	for (uint32_t i = 0; i < pending->chunk_count; i++) size += pending->chunks[i].size;
+
+	wire_init(&wire, payload, FRAME_CHUNKS_MAX);
+	wire_put_uint(&wire, size, 8);
+	wire_put_string(&wire, pending->add.hash);
+	wire_put_string(&wire, pending->add.comment);
+	wire_put_string(&wire, pending->add.filename);
+	for (uint32_t i = 0; i < pending->chunk_count; i++) {
+		wire_put_uint(&wire, pending->chunks[i].size, 4);
+		wire_put_bytes(&wire, pending->chunks[i].hash, sizeof(pending->chunks[i].hash));
+	}
+
+	if (wire.error) { // Archivo demasiado grande para una lista de fragmentos
+		free(payload);
+		free(pending->chunks);
+		pending->chunks = NULL;
+		pending->chunk_count = 0;
+		return 1;
+	}
+
+	pending->type = FRAME_CHUNKS;
+	pipeline_submit(pipeline, pending, payload, wire.off);
+	free(payload);
+	return 0;
+}
+
+static int pipeline_upload(spipeline *pipeline, spending *pending) {
+	pipeline->upload = NULL;
+	if (pending->type == FRAME_ADD)
+		return pipeline_send_file(pipeline, pending->id, pending->add.filename, 0, pending->st.st_size, pending->add.hash,
+			pending->offset, pending->checkpoints);
+
+	if (pending->type == FRAME_CHUNKS) { // Los fragmentos van uno tras otro, igual que los archivos de un manifiesto
+		for (uint32_t i = 0; i < pending->missing_count; i++) {
+			schunk *chunk = &pending->chunks[pending->missing[i]];
+			char hash[TRAILER_HASH_SIZE + 1];
+
+			for (int j = 0; j < (int)sizeof(chunk->hash); j++) sprintf(hash + 2 * j, "%02x", chunk->hash[j]);
+			if (pipeline_send_file(pipeline, pending->id, pending->add.filename, chunk->offset, chunk->size, hash, 0, NULL) < 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	// Los contenidos de un manifiesto van uno tras otro, el servidor no responde entre ellos
+	for (uint32_t i = 0; i < pending->missing_count; i++) {
+		smanifest_file *file = &pending->files[pending->missing[i]];
+		if (pipeline_send_file(pipeline, pending->id, file->filename, 0, file->st.st_size, file->hash, 0, NULL) < 0) return -1;
+	}
+	return 0;
+}
+
+static int pipeline_send_file(spipeline *pipeline, uint32_t id, const char *filename, off_t start, off_t size, char *hash,
+	off_t offer, const uint64_t *checkpoints) {
+	unsigned char end[FRAME_HEADER_SIZE + TRAILER_HASH_SIZE]; // Frame FRAME_END
+	int streamed = hash[0] == '\0';
+	struct sha256_buff digest; // Hash del contenido enviado en una adicion en flujo
+	off_t remaining = size; // Bytes pendientes por enviar
+	int failed = 0; // 1 si el archivo no se pudo leer completo
+	char *buffer; // Frame FRAME_DATA: encabezado y bloque del archivo
+	unsigned char *scratch = NULL; // Bloque comprimido, si hay codec
+	spacker packer; // Compresion de los frames FRAME_DATA
+	int fd;
+
+	if (!(buffer = malloc(FRAME_HEADER_SIZE + TRANSFER_BUFFSIZE))) return -1;
+	if (pipeline->codec && !(scratch = malloc(TRANSFER_BUFFSIZE))) {
+		free(buffer);
+		return -1;
+	}
+	packer_init(&packer, pipeline->codec);
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || (start && lseek(fd, start, SEEK_SET) < 0)) failed = 1;
+	sha256_init(&digest);
+
+	if (offer > 0) { // El servidor tiene los primeros bloques de una adicion interrumpida
+		unsigned char resume[FRAME_HEADER_SIZE + 8]; // Frame FRAME_RESUME
+		off_t offset = 0; // Bytes que no se vuelven a enviar
+		swire wire;
+
+		// Se envia desde el final del ultimo bloque que coincide; el hash de una adicion en flujo sigue desde alli
+		if (!failed) offset = (off_t)resume_scan(fd, &digest, offer / RESUME_CHUNK, checkpoints, NULL) * RESUME_CHUNK;
+		if (offset && lseek(fd, offset, SEEK_SET) < 0) {
+			sha256_init(&digest);
+			offset = 0;
+		}
+
+		wire_init(&wire, resume + FRAME_HEADER_SIZE, 8);
+		wire_put_uint(&wire, offset, 8);
+		frame_pack(resume, FRAME_RESUME, id, 8);
+		if (pipeline_send(pipeline, resume, sizeof(resume)) < 0) {
+			free(buffer);
+			free(scratch);
+			if (fd >= 0) close(fd);
+			return -1;
+		}
+		if (offset) printf("%s: resumed at %ld bytes\n", filename, (long)offset);
+		remaining -= offset;
+	}
+
+	while (remaining > 0) {
+		char *data = buffer + FRAME_HEADER_SIZE;
+		size_t chunk = remaining < TRANSFER_BUFFSIZE ? remaining : TRANSFER_BUFFSIZE;
+		ssize_t nread = failed ? 0 : read(fd, data, chunk);
+
+		if (nread < 0 && errno == EINTR) continue;
+		if (nread <= 0) { // Error de lectura o el archivo se acorto
+			failed = 1;
+			memset(data, 0, chunk);
+			nread = chunk;
+		}
+
+		if (streamed) sha256_update(&digest, data, nread); // El hash se calcula en la misma lectura del envio
+		frame_pack((unsigned char *)buffer, FRAME_DATA, id, nread);
+		size_t length = packer_ready(&packer) ? frame_compress(&packer, (unsigned char *)buffer, scratch) : FRAME_HEADER_SIZE + (size_t)nread;
+		if (pipeline_send(pipeline, buffer, length) < 0) {
+			free(buffer);
+			free(scratch);
+			if (fd >= 0) close(fd);
+			return -1;
+		}
+		remaining -= nread;
+	}
+
+	free(buffer);
+	free(scratch);
+	if (fd >= 0) close(fd);
+
+	if (streamed) { // El hash calculado va en el frame FRAME_END
+		sha256_finalize(&digest);
+		sha256_read_hex(&digest, hash);
+		if (failed) memset(hash, '-', TRAILER_HASH_SIZE); // Nunca coincide con el contenido recibido
+		memcpy(end + FRAME_HEADER_SIZE, hash, TRAILER_HASH_SIZE);
+	}
+	frame_pack(end, FRAME_END, id, streamed ? TRAILER_HASH_SIZE : 0);
+	return pipeline_send(pipeline, end, FRAME_HEADER_SIZE + (streamed ? TRAILER_HASH_SIZE : 0));
+}
+
+static void pipeline_finish(spipeline *pipeline, spending *pending, return_code result) {
+	const char *label = pending->labeled ? pending->add.filename : NULL;
+
+	switch (pending->type) {
+		case FRAME_ADD:
+		case FRAME_CHUNKS:
+			pipeline_print_add(label, result);
+			free(pending->checkpoints);
+			free(pending->chunks);
+			free(pending->missing);
+			pending->checkpoints = NULL;
+			pending->chunks = NULL;
+			pending->missing = NULL;
+
+			// El servidor verifico el hash: si el archivo cambio mientras se enviaba responde VERSION_ERROR
+			if (pending->streamed && (result == VERSION_ADDED || result == VERSION_ALREADY_EXISTS))
+				hindex_update(pipeline->index, pending->add.filename, &pending->st, pending->add.hash);
+			break;
+
+		case FRAME_MANIFEST:
+			for (uint32_t i = 0; i < pending->file_count; i++) {
+				smanifest_file *file = &pending->files[i];
+				return_code code = result == SUCCESS ? file->result : result; // Si fallo el manifiesto fallan todos
+
+				pipeline_print_add(file->filename, code);
+				if (file->streamed && (code == VERSION_ADDED || code == VERSION_ALREADY_EXISTS))
+					hindex_update(pipeline->index, file->filename, &file->st, file->hash);
+				free(file->filename);
+			}
+			free(pending->files);
+			free(pending->missing);
+			pending->files = NULL;
+			pending->missing = NULL;
+			pending->file_count = pending->missing_count = 0;
+			break;
+
+		case FRAME_GET:
+			if (pending->receiving) { // La conexion fallo mientras se recibia: el archivo parcial se conserva
+				receiver_close(&pending->receiver, 0);
+				printf("Incomplete file read\n");
+			}
+			if (result == ERROR)
+				printf("Error sending sget request\n");
+			else if (result == VERSION_NOT_FOUND)
+				printf("Version not found\n");
+			break;
+
+		case FRAME_LIST:
+			if (result == ERROR)
+				printf("Error sending slist request\n");
+			else if (result != VERSION_CREATED)
+				printf("Version not found\n");
+			break;
+
+		default:
+			break;
+	}
+
+	if (pending->id) {
+		pending->id = 0;
+		pipeline->count--;
+	}
+}
+
+static off_t pipeline_put_partial(const char *partial, swire *wire) {
+	struct sha256_buff digest, *states = NULL; // Hash al final de cada bloque
+	uint32_t count = 0; // Bloques completos que se ofrecen
+	struct stat st;
+	int fd;
+
+	if ((fd = open(partial, O_RDONLY | O_CLOEXEC)) >= 0 && fstat(fd, &st) == 0 && st.st_size >= RESUME_CHUNK) {
+		off_t blocks = st.st_size / RESUME_CHUNK;
+		if (blocks > RESUME_CHECKPOINTS_MAX) blocks = RESUME_CHECKPOINTS_MAX;
+
+		sha256_init(&digest);
+		if ((states = malloc(blocks * sizeof(struct sha256_buff)))) count = resume_scan(fd, &digest, blocks, NULL, states);
+	}
+	if (fd >= 0) close(fd);
+
+	wire_put_uint(wire, (uint64_t)count * RESUME_CHUNK, 8);
+	for (uint32_t i = 0; i < count; i++)
+		wire_put_uint(wire, resume_checkpoint(&states[i]), 8);
+	free(states);
+	return (off_t)count * RESUME_CHUNK;
+}
+
+static void pipeline_print_add(const char *label, return_code result) {
+	if (label) printf("%s: ", label);
+	if (result == ERROR)
+		printf("Error sending sadd request\n");
+	else if (result == VERSION_ALREADY_EXISTS)
+		printf("Version already exists\n");
+	else if (result == VERSION_ERROR)
+		printf("Error adding version\n");
+	else
+		printf("Version added\n");
+}
+
+static void pipeline_fail(spipeline *pipeline) {
+	pipeline->broken = 1;
+	pipeline->upload = NULL;
+
+	for (int i = 0; i < FRAME_PIPELINE_MAX; i++)
+		if (pipeline->pending[i].id) pipeline_finish(pipeline, &pipeline->pending[i], ERROR);
+}
@@ -0,0 +1,157 @@
+/**
+ * @file
+ * @brief Solicitudes v2 en curso sobre una misma conexion
+ *
+ * Las solicitudes se envian sin esperar la respuesta de las anteriores, hasta
+ * FRAME_PIPELINE_MAX a la vez. Cada frame que llega se asocia a su solicitud
+ * por el id: las respuestas y el contenido de varias obtenciones pueden llegar
+ * intercalados. El resultado de cada solicitud se imprime al completarse, con
+ * los mismos mensajes que las solicitudes v1.
+ *
+ * Mientras se envia (una solicitud o el contenido de una adicion) tambien se
+ * reciben los frames que llegan, asi el cliente y el servidor nunca quedan los
+ * dos esperando a que el otro lea.
+ *
+ * Una obtencion se recibe en el archivo destino con PARTIAL_SUFFIX y se renombra al
+ * terminar; si se interrumpe, desde PROTOCOL_RESUME la siguiente obtencion del mismo
+ * archivo continua despues de los bloques que ya tiene, igual que una adicion que el
+ * servidor ofrece continuar.
+ *
+ * Desde PROTOCOL_CHUNKS una adicion en flujo se envia dividida en fragmentos
+ * (FRAME_CHUNKS): el servidor solo pide los que no tiene de otras versiones.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include "request.h"
+
+#define PARTIAL_SUFFIX ".part" /**< Sufijo del archivo donde se recibe una obtencion hasta completarla */
+
+/**
+ * @brief Archivo de un manifiesto (adicion de varios archivos)
+ */
+typedef struct {
+	char *filename; /**< Nombre del archivo */
+	char hash[TRAILER_HASH_SIZE + 1]; /**< Hash del contenido, en una adicion en flujo se llena al enviarlo */
+	int streamed; /**< 1 si el hash se calcula mientras se envia el contenido */
+	struct stat st; /**< Estado del archivo antes de enviarlo */
+	return_code result; /**< Resultado de la adicion del archivo */
+} smanifest_file;
+
+/**
+ * @brief Solicitud en curso
+ */
+typedef struct {
+	uint32_t id; /**< Id de la solicitud, 0 si la posicion esta libre */
+	frame_opcode type; /**< FRAME_ADD, FRAME_CHUNKS, FRAME_GET, FRAME_LIST o FRAME_MANIFEST */
+	int labeled; /**< 1 si los mensajes del resultado llevan el nombre del archivo */
+	int streamed; /**< Adicion: 1 si el hash se calcula mientras se envia el contenido */
+	sadd add; /**< Adicion: solicitud, el hash de una adicion en flujo se llena al enviar el contenido */
+	struct stat st; /**< Adicion: estado del archivo antes de enviarlo */
+	off_t offset; /**< Adicion: bytes que el servidor ofrece no volver a recibir; obtencion: bytes del archivo parcial ofrecidos */
+	uint64_t *checkpoints; /**< Adicion: puntos de control del servidor, uno por bloque de RESUME_CHUNK de offset */
+	char filename[PATH_MAX]; /**< Obtencion: archivo destino; listado: archivo (vacio para todos) */
+	sreceiver receiver; /**< Obtencion: archivo que se esta recibiendo */
+	int receiving; /**< Obtencion: 1 desde que se creo el archivo destino */
+	ssize_t size; /**< Obtencion: tamaño anunciado por el servidor */
+	smanifest_file *files; /**< Manifiesto: archivos */
+	uint32_t file_count; /**< Manifiesto: cantidad de archivos */
+	schunk *chunks; /**< Fragmentos: fragmentos del archivo */
+	uint32_t chunk_count; /**< Fragmentos: cantidad de fragmentos */
+	uint32_t *missing; /**< Manifiesto o fragmentos: indices de los archivos o fragmentos cuyo contenido pidio el servidor */
+	uint32_t missing_count; /**< Manifiesto o fragmentos: cantidad de indices en missing */
+} spending;
+
+/**
+ * @brief Solicitudes en curso de una conexion v2
+ */
+typedef struct {
+	int socket; /**< Socket de comunicacion */
+	int manifests; /**< 1 si el servidor admite FRAME_MANIFEST (version PROTOCOL_MANIFEST o mayor) */
+	int resume; /**< 1 si se continuan transferencias interrumpidas (version PROTOCOL_RESUME o mayor) */
+	int chunks; /**< 1 si las adiciones en flujo se envian por fragmentos (version PROTOCOL_CHUNKS o mayor) */
+	int codec; /**< Codec de los frames FRAME_PACKED que eligio el servidor, 0 si no se comprime */
+	shindex *index; /**< Indice de hashes, NULL si no se usa */
+	uint32_t next_id; /**< Id de la siguiente solicitud */
+	int count; /**< Solicitudes en curso */
+	int broken; /**< 1 si la conexion fallo: las solicitudes siguientes fallan sin enviarse */
+	spending *upload; /**< Adicion o manifiesto cuyo contenido pidio el servidor, NULL si no hay */
+	spending pending[FRAME_PIPELINE_MAX]; /**< Solicitudes */
+} spipeline;
+
+/**
+ * @brief Inicializa las solicitudes en curso de una conexion
+ *
+ * @param pipeline Solicitudes en curso
+ * @param socket Socket de comunicacion, despues de hello_request
+ * @param version Version del protocolo que eligio el servidor
+ * @param codec Codec de los frames que eligio el servidor, 0 si no se comprime
+ * @param index Indice de hashes, NULL si no se usa
+ */
+void pipeline_init(spipeline *pipeline, int socket, int version, int codec, shindex *index);
+
+/**
+ * @brief Envia una solicitud de adicion
+ *
+ * Si el servidor pide el contenido se envia en cuanto llega la respuesta. Una
+ * adicion en flujo se divide en fragmentos si el servidor lo admite.
+ *
+ * @param pipeline Solicitudes en curso
+ * @param request Solicitud creada con create_sadd
+ * @param labeled 1 si los mensajes del resultado llevan el nombre del archivo
+ */
+void pipeline_add(spipeline *pipeline, sadd *request, int labeled);
+
+/**
+ * @brief Envia las solicitudes de adicion de varios archivos en manifiestos (FRAME_MANIFEST)
+ *
+ * Cada manifiesto lleva los archivos que quepan en un frame. El servidor pide de
+ * una vez los contenidos que no tiene y se envian uno tras otro, sin esperar una
+ * respuesta por archivo. Los mensajes del resultado llevan el nombre del archivo.
+ * Si el servidor no admite manifiestos se envia una solicitud de adicion por archivo;
+ * si admite fragmentos, las adiciones en flujo tambien van aparte, divididas en fragmentos.
+ *
+ * @param pipeline Solicitudes en curso
+ * @param requests Solicitudes creadas con create_sadd_batch, todas con el mismo comentario
+ * @param count Cantidad de solicitudes
+ */
+void pipeline_manifest(spipeline *pipeline, sadd *requests, size_t count);
+
+/**
+ * @brief Envia una solicitud de obtencion; el archivo se escribe en request->filename
+ *
+ * Desde PROTOCOL_RESUME, si existe el archivo parcial de una obtencion interrumpida,
+ * se ofrecen sus bloques completos para que el servidor no los vuelva a enviar.
+ *
+ * @param pipeline Solicitudes en curso
+ * @param request Solicitud
+ */
+void pipeline_get(spipeline *pipeline, sget *request);
+
+/**
+ * @brief Envia una solicitud de listado
+ *
+ * @param pipeline Solicitudes en curso
+ * @param request Solicitud
+ */
+void pipeline_list(spipeline *pipeline, slist *request);
+
+/**
+ * @brief Espera a que terminen las obtenciones que escriben un archivo
+ *
+ * Se usa antes de leer o volver a escribir el archivo.
+ *
+ * @param pipeline Solicitudes en curso
+ * @param filename Archivo
+ */
+void pipeline_wait_file(spipeline *pipeline, const char *filename);
+
+/**
+ * @brief Espera a que terminen todas las solicitudes en curso
+ *
+ * @param pipeline Solicitudes en curso
+ */
+void pipeline_drain(spipeline *pipeline);
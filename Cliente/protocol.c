@@ -6,107 +6,457 @@
  * @copyright MIT Liscense
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "protocol.h"
+#include "sha256.h"
+#include "../Servidor/lz.h"
+
+/**
+ * @brief Envia exactamente size bytes por el socket
+ *
+ * @param socket Socket de comunicacion
+ * @param buffer Datos a enviar
+ * @param size Cantidad de bytes a enviar
+ * @param flags Opciones de send (ademas de MSG_NOSIGNAL)
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error o el servidor se desconecta
+ */
+static int send_all(int socket, const void * buffer, size_t size, int flags);
+
+/**
+ * @brief Recibe exactamente size bytes del socket
+ *
+ * @param socket Socket de comunicacion
+ * @param buffer Buffer destino
+ * @param size Cantidad de bytes a recibir
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error o el servidor se desconecta
+ */
+static int recv_all(int socket, void * buffer, size_t size);
 
 return_code local_copy(int socket, char * destination) {
-	// Copia el contenido de source a destination (se debe usar open-read-write-close, o fopen-fread-fwrite-fclose)
-	FILE *fd; // Archivos fuente y destino
-	char buffer[BUFFSIZE]; // Buffer de lectura/escritura, mas 1 para el caracter nulo
-	ssize_t filesz, nread; // Cantidad de bytes leidos
-	if(recv(socket, &filesz, sizeof(filesz), 0) != sizeof(filesz)) return VERSION_ERROR; // Recibe el tamaño del archivo
-	// Abre los archivos fuente y destino y retorna VERSION_ERROR si no se pueden abrir
+	// Copia el contenido del socket hacia destination moviendo los datos con splice a traves de una tuberia
+	sreceiver receiver; // Archivo destino
+	ssize_t filesz; // Tamaño del archivo
+
+	if(recv_all(socket, &filesz, sizeof(filesz)) < 0 || filesz < 0) return VERSION_ERROR; // Recibe el tamaño del archivo
 
-	if(!(fd = fopen(destination, "w"))) return VERSION_ERROR;
+	// Abre el archivo destino y retorna VERSION_ERROR si no se puede abrir
+	if(receiver_open(&receiver, destination, filesz, 0) < 0) return VERSION_ERROR;
 
 	printf("File %s created\n", destination);
 	printf("File size: %ld\n", filesz);
-	while (filesz != 0) // Lee el archivo fuente
+
+	if (receiver_copy(socket, &receiver, filesz) < 0)
 	{
-		memset(buffer, 0, BUFFSIZE);
-		// Determinar tamaño de lectura (si filesz es negativo, usar su valor absoluto) 
-		ssize_t to_read = (filesz > 0) ? 
-					(filesz<BUFFSIZE) ? filesz :BUFFSIZE : -filesz; //(si el filesz es menor que BUFFSIZE, usar filesz)
-		
-		
-		// Recibe el contenido del archivo
-		ssize_t total_read = 0;
-		ssize_t nread = recv(socket, &buffer, to_read, 0);
-		total_read += nread;
+		receiver_close(&receiver, 0);
+		return VERSION_ERROR;
+	}
+
+	receiver_close(&receiver, 1);
+	printf("File %s copied\n", destination);
+	return VERSION_CREATED;
+}
+
+int receiver_open(sreceiver * receiver, const char * destination, ssize_t filesz, off_t offset) {
+	memset(receiver, 0, sizeof *receiver);
+	if((receiver->fd = open(destination, O_WRONLY | O_CREAT | (offset ? 0 : O_TRUNC) | O_CLOEXEC, 0644)) < 0) return -1;
 
-		while (total_read < to_read)
+	// Se conservan los primeros offset bytes de una recepcion interrumpida, el resto se vuelve a recibir
+	if (offset && (ftruncate(receiver->fd, offset) < 0 || lseek(receiver->fd, offset, SEEK_SET) < 0))
+	{
+		close(receiver->fd);
+		return -1;
+	}
+	receiver->received = offset;
+
+	// Reserva el espacio del archivo de una vez (si el sistema de archivos no lo admite se ignora)
+	if (filesz > offset) fallocate(receiver->fd, 0, offset, filesz - offset);
+
+	receiver->zero_copy = pipe2(receiver->pipefd, O_CLOEXEC) == 0;
+	if (receiver->zero_copy) fcntl(receiver->pipefd[1], F_SETPIPE_SZ, TRANSFER_BUFFSIZE);
+	return 0;
+}
+
+int receiver_copy(int socket, sreceiver * receiver, ssize_t size) {
+	while (size > 0)
+	{
+		size_t to_read = (size < TRANSFER_BUFFSIZE) ? size : TRANSFER_BUFFSIZE;
+		ssize_t nread;
+
+		if (receiver->zero_copy)
 		{
-			nread = recv(socket, buffer + total_read, to_read - total_read, 0);
-			
-			if (nread < 0)
+			nread = splice(socket, NULL, receiver->pipefd[1], NULL, to_read, SPLICE_F_MOVE);
+			if (nread < 0 && (errno == EINVAL || errno == ENOSYS)) // El socket no admite splice
 			{
-				fclose(fd);
-				printf("Error reading file\n");
-				return VERSION_ERROR;
+				close(receiver->pipefd[0]);
+				close(receiver->pipefd[1]);
+				receiver->zero_copy = 0;
+				continue;
 			}
-			
-			if (nread == 0) // Se alcanzó el final de la transmisión
+
+			// Vacia la tuberia en el archivo destino
+			for (ssize_t pending = nread; pending > 0; )
 			{
-				break;
+				ssize_t nwritten = splice(receiver->pipefd[0], NULL, receiver->fd, NULL, pending, SPLICE_F_MOVE);
+				if (nwritten < 0 && errno == EINTR) continue;
+				if (nwritten <= 0)
+				{
+					printf("Error writing file\n");
+					return -1;
+				}
+				pending -= nwritten;
 			}
+		}
+		else
+		{
+			if (!receiver->buffer && !(receiver->buffer = malloc(TRANSFER_BUFFSIZE))) return -1;
 
-			total_read += nread;
+			nread = recv(socket, receiver->buffer, to_read, 0);
+			for (ssize_t written = 0; nread > 0 && written < nread; )
+			{
+				ssize_t nwritten = write(receiver->fd, receiver->buffer + written, nread - written);
+				if (nwritten < 0 && errno == EINTR) continue;
+				if (nwritten <= 0)
+				{
+					printf("Error writing file\n");
+					return -1;
+				}
+				written += nwritten;
+			}
 		}
 
-		if (total_read != to_read)
+		if (nread < 0 && errno == EINTR) continue;
+		if (nread <= 0) // Error o el servidor cerro la conexion antes de terminar
 		{
-			fclose(fd);
 			printf("Incomplete file read\n");
-			return VERSION_ERROR;
+			return -1;
 		}
 
-		// Escribe el archivo destino
-		if(fwrite(buffer, sizeof(char), to_read, fd) != to_read)
+		receiver->received += nread;
+		size -= nread;
+	}
+
+	return 0;
+}
+
+int receiver_write(sreceiver * receiver, const void * data, size_t size) {
+	const char *next = data;
+
+	while (size > 0)
+	{
+		ssize_t nwritten = write(receiver->fd, next, size);
+		if (nwritten < 0 && errno == EINTR) continue;
+		if (nwritten <= 0)
 		{
-			fclose(fd);
 			printf("Error writing file\n");
-
-			return VERSION_ERROR;
+			return -1;
 		}
-
-		// Reducir filesz según el número de bytes leídos
-		filesz -= to_read;
+		next += nwritten;
+		size -= nwritten;
+		receiver->received += nwritten;
 	}
 
-	fclose(fd);
-	printf("File %s copied\n", destination);
-	return VERSION_CREATED;
+	return 0;
 }
 
-return_code remote_copy(char * source, int socket) {
-	FILE *fr; // Archivo fuente
-	char buffer[BUFFSIZE + 1]; // Buffer de lectura/escritura, mas 1 para el caracter nulo
+void receiver_close(sreceiver * receiver, int ok) {
+	if (receiver->zero_copy)
+	{
+		close(receiver->pipefd[0]);
+		close(receiver->pipefd[1]);
+	}
+	free(receiver->buffer);
+	if (!ok && ftruncate(receiver->fd, receiver->received) < 0) { } // No se deja el espacio reservado como si fuera contenido
+	close(receiver->fd);
+}
+
+return_code remote_copy(char * source, int socket, char * hex) {
+	int fd; // Archivo fuente
+	char *buffer; // Buffer de lectura/escritura
 	ssize_t nread; // Cantidad de bytes leidos
-    struct stat st; // Estructura de estadisticas de archivos
+	struct stat st; // Estructura de estadisticas de archivos
+	struct sha256_buff digest; // Hash del contenido enviado, solo si hex no es NULL
+
+	if((fd = open(source, O_RDONLY | O_CLOEXEC)) < 0) return VERSION_ERROR; // Abre el archivo fuente y retorna VERSION_ERROR si no se puede abrir
 
-	if(!(fr = fopen(source, "r"))) return VERSION_ERROR; // Abre el archivo fuente y retorna VERSION_ERROR si no se puede abrir
-	
-	if(stat(source, &st) != 0) return VERSION_ERROR; // Obtiene las estadisticas del archivo fuente y retorna VERSION_ERROR si no se puede obtener
+	if(fstat(fd, &st) != 0 || !(buffer = malloc(TRANSFER_BUFFSIZE))) // Obtiene las estadisticas del archivo fuente
+	{
+		close(fd);
+		return VERSION_ERROR;
+	}
 
-	if(send(socket, &st.st_size, sizeof(st.st_size), 0) != sizeof(st.st_size) ) return VERSION_ERROR; // Envía el tamaño del archivo al socket
+	if(send_all(socket, &st.st_size, sizeof(st.st_size), 0) < 0) goto error; // Envía el tamaño del archivo al socket
 
-	while(nread = fread(buffer , sizeof(char), BUFFSIZE, fr), nread > 0) // Lee el archivo fuente
+	if (hex) sha256_init(&digest);
+
+	// Envía exactamente el tamaño anunciado: si el archivo cambia mientras se lee, el servidor detecta el hash distinto
+	off_t remaining = st.st_size; // Bytes pendientes por enviar
+	while (remaining > 0)
 	{
-		if(send(socket, buffer, nread, 0) != nread) // Envía el contenido del archivo al socket
-		{
-			fclose(fr);
-			return VERSION_ERROR;
-		}
+		nread = read(fd, buffer, remaining < TRANSFER_BUFFSIZE ? remaining : TRANSFER_BUFFSIZE);
+		if (nread < 0 && errno == EINTR) continue;
+		if (nread <= 0) goto error; // Error de lectura o el archivo se acorto
+
+		if (hex) sha256_update(&digest, buffer, nread); // El hash se calcula en la misma lectura del envio
+		if (send_all(socket, buffer, nread, 0) < 0) goto error;
+		remaining -= nread;
 	}
 
-	if (nread == 0) // Si se leyó todo el archivo, retorna VERSION_CREATED
+	if (hex) // El hash calculado se envia despues del contenido
 	{
-		fclose(fr);
-		return VERSION_CREATED;
+		sha256_finalize(&digest);
+		sha256_read_hex(&digest, hex);
+		if (send_all(socket, hex, TRAILER_HASH_SIZE, 0) < 0) goto error;
 	}
 
+	free(buffer);
+	close(fd);
+	return VERSION_CREATED;
+
+error:
+	free(buffer);
+	close(fd);
 	return VERSION_ERROR;
 }
 
+int frame_send(int socket, frame_opcode opcode, uint32_t id, const void * payload, uint32_t length) {
+	unsigned char header[FRAME_HEADER_SIZE];
+
+	frame_pack(header, opcode, id, length);
+	if (send_all(socket, header, sizeof(header), length ? MSG_MORE : 0) < 0) return -1;
+	return length ? send_all(socket, payload, length, 0) : 0;
+}
+
+int frame_recv(int socket, sframe * frame) {
+	unsigned char header[FRAME_HEADER_SIZE];
+
+	if (recv_all(socket, header, sizeof(header)) < 0 || frame_unpack(header, frame) < 0 || frame->version != FRAME_VERSION) return -1;
+	return 0;
+}
+
+int frame_recv_payload(int socket, void * payload, uint32_t length) {
+	return recv_all(socket, payload, length);
+}
+
+static int send_all(int socket, const void * buffer, size_t size, int flags) {
+	size_t total = 0;
+	ssize_t nsent;
+
+	while (total < size)
+	{
+		nsent = send(socket, (const char *)buffer + total, size - total, MSG_NOSIGNAL | flags);
+		if (nsent < 0 && errno == EINTR) continue;
+		if (nsent <= 0) return -1;
+		total += nsent;
+	}
+
+	return 0;
+}
+
+static int recv_all(int socket, void * buffer, size_t size) {
+	size_t total = 0;
+	ssize_t nread;
+
+	while (total < size)
+	{
+		nread = recv(socket, (char *)buffer + total, size - total, 0);
+		if (nread < 0 && errno == EINTR) continue;
+		if (nread <= 0) return -1;
+		total += nread;
+	}
+
+	return 0;
+}
+
+void frame_pack(unsigned char *out, frame_opcode opcode, uint32_t id, uint32_t length) {
+	swire wire;
+
+	wire_init(&wire, out, FRAME_HEADER_SIZE);
+	wire_put_uint(&wire, FRAME_MAGIC, 2);
+	wire_put_uint(&wire, FRAME_VERSION, 1);
+	wire_put_uint(&wire, opcode, 1);
+	wire_put_uint(&wire, id, 4);
+	wire_put_uint(&wire, length, 4);
+}
+
+int frame_unpack(const unsigned char *in, sframe *frame) {
+	swire wire;
+
+	wire_init(&wire, (void *)in, FRAME_HEADER_SIZE);
+	if (wire_get_uint(&wire, 2) != FRAME_MAGIC) return -1;
+	frame->version = wire_get_uint(&wire, 1);
+	frame->opcode = wire_get_uint(&wire, 1);
+	frame->id = wire_get_uint(&wire, 4);
+	frame->length = wire_get_uint(&wire, 4);
+	return 0;
+}
+
+void packer_init(spacker *packer, int codec) {
+	packer->codec = codec;
+	packer->skip = 0;
+	packer->backoff = 1;
+}
+
+int packer_ready(spacker *packer) {
+	if (!packer->codec) return 0;
+	if (packer->skip == 0) return 1;
+	packer->skip--;
+	return 0;
+}
+
+size_t frame_compress(spacker *packer, unsigned char *frame, unsigned char *scratch) {
+	sframe header;
+	size_t size, limit;
+	swire wire;
+
+	frame_unpack(frame, &header);
+	if (!packer->codec || header.length < FRAME_PACKED_MIN || header.length > FRAME_DATA_MAX)
+		return FRAME_HEADER_SIZE + header.length;
+
+	// Solo se envia comprimido si ahorra al menos 1/FRAME_PACKED_RATIO, contando el encabezado de FRAME_PACKED
+	limit = header.length - header.length / FRAME_PACKED_RATIO - FRAME_PACKED_HEADER;
+	if (!(size = lz_compress(frame + FRAME_HEADER_SIZE, header.length, scratch, limit))) {
+		packer->skip = packer->backoff;
+		if (packer->backoff < FRAME_PACKED_BACKOFF_MAX) packer->backoff *= 2;
+		return FRAME_HEADER_SIZE + header.length;
+	}
+	packer->backoff = 1;
+
+	frame_pack(frame, FRAME_PACKED, header.id, FRAME_PACKED_HEADER + size);
+	wire_init(&wire, frame + FRAME_HEADER_SIZE, FRAME_PACKED_HEADER + size);
+	wire_put_uint(&wire, header.opcode, 1);
+	wire_put_uint(&wire, header.length, 4);
+	wire_put_bytes(&wire, scratch, size);
+	return FRAME_HEADER_SIZE + wire.off;
+}
+
+int frame_decompress(const unsigned char *payload, sframe *frame, unsigned char *out, size_t cap) {
+	uint32_t length;
+	uint8_t opcode;
+	swire wire;
+
+	wire_init(&wire, (void *)payload, frame->length);
+	opcode = wire_get_uint(&wire, 1);
+	length = wire_get_uint(&wire, 4);
+	if (wire.error || opcode == FRAME_PACKED || length > cap || length > FRAME_DATA_MAX ||
+		lz_decompress(payload + wire.off, frame->length - wire.off, out, length) != (ssize_t)length)
+		return -1;
+
+	frame->opcode = opcode;
+	frame->length = length;
+	return 0;
+}
+
+void wire_init(swire *wire, void *data, size_t size) {
+	wire->data = data;
+	wire->size = size;
+	wire->off = 0;
+	wire->error = 0;
+}
+
+void wire_put_uint(swire *wire, uint64_t value, size_t bytes) {
+	if (wire->error || wire->size - wire->off < bytes) {
+		wire->error = 1;
+		return;
+	}
+
+	for (size_t i = bytes; i > 0; i--, value >>= 8)
+		wire->data[wire->off + i - 1] = value & 0xff;
+	wire->off += bytes;
+}
+
+void wire_put_bytes(swire *wire, const void *data, size_t size) {
+	if (wire->error || wire->size - wire->off < size) {
+		wire->error = 1;
+		return;
+	}
+
+	memcpy(wire->data + wire->off, data, size);
+	wire->off += size;
+}
+
+void wire_put_string(swire *wire, const char *s) {
+	size_t len = strlen(s);
+
+	if (len > UINT16_MAX) {
+		wire->error = 1;
+		return;
+	}
+
+	wire_put_uint(wire, len, 2);
+	wire_put_bytes(wire, s, len);
+}
+
+uint64_t wire_get_uint(swire *wire, size_t bytes) {
+	uint64_t value = 0;
+
+	if (wire->error || wire->size - wire->off < bytes) {
+		wire->error = 1;
+		return 0;
+	}
+
+	for (size_t i = 0; i < bytes; i++)
+		value = (value << 8) | wire->data[wire->off + i];
+	wire->off += bytes;
+	return value;
+}
+
+void wire_get_string(swire *wire, char *s, size_t cap) {
+	size_t len = wire_get_uint(wire, 2);
+
+	if (wire->error || len >= cap || wire->size - wire->off < len) {
+		wire->error = 1;
+		s[0] = '\0';
+		return;
+	}
+
+	memcpy(s, wire->data + wire->off, len);
+	s[len] = '\0';
+	wire->off += len;
+}
+
+uint64_t resume_checkpoint(const struct sha256_buff *digest) {
+	return ((uint64_t)digest->h[0] << 32) | digest->h[1];
+}
+
+uint32_t resume_scan(int fd, struct sha256_buff *digest, uint32_t count, const uint64_t *expected, struct sha256_buff *states) {
+	struct sha256_buff block = *digest; // Hash hasta el final de lo leido del bloque en curso
+	char *buffer = malloc(TRANSFER_BUFFSIZE);
+	uint32_t accepted = 0;
+	off_t off = 0;
+
+	if (!buffer) return 0;
+
+	while (accepted < count)
+	{
+		// Las lecturas no cruzan el final del bloque
+		size_t to_read = RESUME_CHUNK - off % RESUME_CHUNK;
+		if (to_read > TRANSFER_BUFFSIZE) to_read = TRANSFER_BUFFSIZE;
+
+		ssize_t nread = pread(fd, buffer, to_read, off);
+		if (nread < 0 && errno == EINTR) continue;
+		if (nread <= 0) break; // Bloque incompleto o error de lectura: no se acepta
+
+		sha256_update(&block, buffer, nread);
+		off += nread;
+		if (off % RESUME_CHUNK) continue;
+
+		if (expected && resume_checkpoint(&block) != expected[accepted]) break;
+		*digest = block;
+		if (states) states[accepted] = block;
+		accepted++;
+	}
+
+	free(buffer);
+	return accepted;
+}
+
 void fake_local_copy(int socket) {
 // Copia el contenido de source a destination (se debe usar open-read-write-close, o fopen-fread-fwrite-fclose)
 	char buffer[BUFFSIZE]; // Buffer de lectura/escritura, mas 1 para el caracter nulo
@@ -6,8 +6,30 @@
  * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
  * @copyright MIT Liscense
  */
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "request.h"
 
+/**
+ * @brief Rutas encontradas al recorrer un directorio
+ */
+typedef struct {
+    char **paths; /**< Rutas */
+    size_t count; /**< Cantidad de rutas */
+    size_t cap; /**< Capacidad de paths */
+} sfile_list;
+
+#define CDC_BUFFSIZE (4 * CDC_MAX_SIZE) /**< Bytes del archivo que se leen a la vez al dividirlo en fragmentos */
+#define CDC_MASK_SMALL (~0ULL << (64 - 22)) /**< Corte antes de CDC_AVG_SIZE: mas bits, menos probable */
+#define CDC_MASK_LARGE (~0ULL << (64 - 18)) /**< Corte despues de CDC_AVG_SIZE: menos bits, mas probable */
+
+/**
+ * @brief Valores aleatorios (fijos) que el hash rodante suma por cada byte
+ */
+static uint64_t gear[256];
+
 /**
  * @brief Obtiene el hash de un archivo
  * 
@@ -18,8 +40,104 @@
  */
 char *get_file_hash(char * filename, char * hash);
 
+/**
+ * @brief Llena la tabla gear, la primera vez que se usa
+ *
+ * La tabla debe ser la misma en todos los clientes: si cambia, cambian los
+ * limites de los fragmentos y ninguno se repite con las versiones anteriores.
+ */
+static void gear_init(void);
+
+/**
+ * @brief Busca el final del primer fragmento de un bloque (FastCDC con corte normalizado)
+ *
+ * Antes de CDC_AVG_SIZE se usa una mascara mas dificil de cumplir y despues una
+ * mas facil, asi los tamaños quedan concentrados cerca del promedio.
+ *
+ * @param data Bloque, empieza al inicio del fragmento
+ * @param size Bytes del bloque
+ * @return Tamaño del fragmento, a lo sumo CDC_MAX_SIZE y size
+ */
+static uint32_t cdc_cut(const uint8_t * data, size_t size);
+
+/**
+ * @brief Recibe exactamente size bytes del socket
+ * 
+ * @param socket Socket de comunicacion
+ * @param buffer Buffer destino
+ * @param size Cantidad de bytes a recibir
+ * 
+ * @return 0 en caso de exito, -1 si ocurre un error o el servidor se desconecta
+ */
+static int recv_all(int socket, void * buffer, size_t size);
+
+/**
+ * @brief Agrega a la lista los archivos regulares de un directorio, recorriendo sus subdirectorios
+ *
+ * @param dir Directorio
+ * @param list Lista de rutas
+ * @return 0 en caso de exito, -1 si un directorio no se puede leer o no hay memoria
+ */
+static int collect_files(const char * dir, sfile_list * list);
+
+/**
+ * @brief Compara dos rutas para ordenarlas con qsort
+ *
+ * @param a Ruta
+ * @param b Ruta
+ * @return Igual que strcmp
+ */
+static int compare_paths(const void * a, const void * b);
+
+return_code hello_request(int socket, const char * username, int codecs, int * version, int * codec) {
+    unsigned char payload[4 + USERNAME_SIZE]; // Version, nombre de usuario, codecs y relleno
+    unsigned char reply[3]; // Version elegida, resultado y, desde PROTOCOL_COMPRESS, codec elegido
+    sframe frame;
+    swire wire;
+
+    if (strlen(username) >= USERNAME_SIZE) {
+        return ERROR;
+    }
+
+    memset(payload, 0, sizeof(payload));
+    wire_init(&wire, payload, sizeof(payload));
+    wire_put_uint(&wire, PROTOCOL_VERSION, 1);
+    wire_put_string(&wire, username);
+    wire_put_uint(&wire, codecs, 1); // Un servidor anterior a PROTOCOL_COMPRESS lo lee como relleno
+
+    // Un servidor que solo habla v1 lee FRAME_HELLO_MIN bytes como nombre de usuario y cierra la conexion
+    if (wire.off < FRAME_HELLO_MIN - FRAME_HEADER_SIZE) {
+        wire.off = FRAME_HELLO_MIN - FRAME_HEADER_SIZE;
+    }
+
+    if (wire.error || frame_send(socket, FRAME_HELLO, 0, payload, wire.off) < 0 ||
+        frame_recv(socket, &frame) < 0 || frame.opcode != FRAME_HELLO || frame.length < 2 || frame.length > sizeof(reply) ||
+        frame_recv_payload(socket, reply, frame.length) < 0 || reply[0] < FRAME_VERSION || reply[0] > PROTOCOL_VERSION ||
+        reply[1] != SUCCESS || frame.length != (reply[0] < PROTOCOL_COMPRESS ? 2u : 3u) ||
+        (frame.length == 3 && (reply[2] & ~codecs))) {
+        return ERROR;
+    }
+
+    *version = reply[0];
+    *codec = frame.length == 3 ? reply[2] : 0;
+    return SUCCESS;
+}
+
+return_code login_request(int socket, const char * username) {
+    char buffer[USERNAME_SIZE];
+
+    memset(buffer, 0, sizeof(buffer));
+    strncpy(buffer, username, sizeof(buffer) - 1);
+
+    if (send(socket, buffer, sizeof(buffer), 0) != sizeof(buffer)) {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
 
-return_code create_sadd(char * filename, char * comment, sadd * result) {
+
+return_code create_sadd(char * filename, char * comment, sadd * result, shindex * index) {
 
     struct stat s;
     char hash[HASH_SIZE];
@@ -29,8 +147,14 @@ return_code create_sadd(char * filename, char * comment, sadd * result) {
         return VERSION_ERROR;
     }
 
-	// Obtiene el HASH del archivo y construye la ruta nueva
-	get_file_hash(filename, hash);
+	// Obtiene el HASH del archivo: del indice si no cambio, si es grande se calcula mientras se envia
+	hash[0] = '\0';
+	if (!hindex_lookup(index, filename, &s, hash) && s.st_size < STREAM_ADD_MIN) {
+		if (get_file_hash(filename, hash) == NULL) {
+			return VERSION_ERROR;
+		}
+		hindex_update(index, filename, &s, hash);
+	}
 
 	// Limpia la estructura de version
 	memset(result,0,sizeof *result);
@@ -43,9 +167,178 @@ return_code create_sadd(char * filename, char * comment, sadd * result) {
     return VERSION_CREATED;
 }
 
-return_code add_request(int socket, sadd * request) {
+void create_sadd_batch(char ** filenames, size_t count, char * comment, sadd * results, return_code * codes, shindex * index) {
+    char **paths = malloc(count * sizeof(char *)); // Archivos que se deben leer
+    char **hashes = malloc(count * sizeof(char *)); // Hash de cada archivo que se debe leer
+    struct stat *stats = malloc(count * sizeof(struct stat)); // Estado de cada archivo antes de leerlo
+    size_t valid = 0;
+    struct stat s;
+
+    for (size_t i = 0; i < count; i++) {
+        memset(&results[i], 0, sizeof(sadd));
+        codes[i] = VERSION_ERROR;
+
+        // Verifica que el archivo exista y sea un archivo regular
+        if (!paths || !hashes || !stats || stat(filenames[i], &s) < 0 || !S_ISREG(s.st_mode)) {
+            continue;
+        }
+
+        strcpy(results[i].filename, filenames[i]);
+        strcpy(results[i].comment, comment);
+        codes[i] = VERSION_CREATED;
+        if (hindex_lookup(index, filenames[i], &s, results[i].hash)) {
+            continue; // No cambio desde que se guardo su hash
+        }
+        if (s.st_size >= STREAM_ADD_MIN) {
+            continue; // Su hash se calcula al enviarlo o al dividirlo en fragmentos
+        }
+
+        paths[valid] = filenames[i];
+        stats[valid] = s;
+        hashes[valid++] = results[i].hash;
+    }
+
+    sha256_hash_files_hex(paths, hashes, valid);
+
+    for (size_t i = 0; i < valid; i++) {
+        if (hashes[i][0] != '\0') {
+            hindex_update(index, paths[i], &stats[i], hashes[i]);
+        }
+    }
+
+    // Si un archivo no se pudo leer su hash queda vacio
+    for (size_t i = 0; i < valid; i++) {
+        if (hashes[i][0] == '\0') {
+            hashes[i][0] = '-'; // Se marca para distinguirlo de una adicion en flujo
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (codes[i] == VERSION_CREATED && results[i].hash[0] == '-') {
+            codes[i] = VERSION_ERROR;
+        }
+    }
+
+    free(paths);
+    free(hashes);
+    free(stats);
+}
+
+int chunk_file(const char * filename, schunk ** chunks, uint32_t * count, char * hash) {
+    struct sha256_buff file_digest, chunk_digest; // Hash de todo el contenido y del fragmento actual
+    struct sha256_buff *digests[2] = { &file_digest, &chunk_digest };
+    uint8_t *buffer = NULL;
+    size_t start = 0, end = 0; // Bytes leidos y aun sin asignar a un fragmento: buffer[start, end)
+    uint32_t cap = 0;
+    off_t offset = 0;
+    int eof = 0, fd;
+
+    *chunks = NULL;
+    *count = 0;
+    gear_init();
+
+    if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0 || !(buffer = malloc(CDC_BUFFSIZE))) {
+        perror(filename);
+        free(buffer);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    sha256_init(&file_digest);
+
+    while (!eof || start < end) {
+        // Un fragmento puede medir hasta CDC_MAX_SIZE: se lee mas antes de buscar su final
+        if (!eof && end - start < CDC_MAX_SIZE) {
+            memmove(buffer, buffer + start, end - start);
+            end -= start;
+            start = 0;
+            while (!eof && end < CDC_BUFFSIZE) {
+                ssize_t nread = read(fd, buffer + end, CDC_BUFFSIZE - end);
+                if (nread < 0 && errno == EINTR) continue;
+                if (nread < 0) {
+                    perror(filename);
+                    goto error;
+                }
+                if (nread == 0) eof = 1;
+                end += nread;
+            }
+            continue;
+        }
+
+        if (*count == cap) {
+            schunk *grown = realloc(*chunks, (cap = cap ? 2 * cap : 64) * sizeof(schunk));
+            if (!grown) {
+                perror("Error allocating memory");
+                goto error;
+            }
+            *chunks = grown;
+        }
+
+        schunk *chunk = &(*chunks)[(*count)++];
+        const void *data[2] = { buffer + start, buffer + start };
+        size_t sizes[2];
+
+        chunk->offset = offset;
+        chunk->size = cdc_cut(buffer + start, end - start);
+        sizes[0] = sizes[1] = chunk->size;
+
+        // El fragmento y todo el contenido se calculan juntos, en dos lineas de la misma instruccion
+        sha256_init(&chunk_digest);
+        sha256_update_multi(digests, data, sizes, 2);
+        sha256_finalize(&chunk_digest);
+        sha256_read(&chunk_digest, chunk->hash);
+
+        start += chunk->size;
+        offset += chunk->size;
+    }
+
+    free(buffer);
+    close(fd);
+    if (*count == 0) return -1; // Un archivo vacio no se divide
+
+    sha256_finalize(&file_digest);
+    sha256_read_hex(&file_digest, hash);
+    hash[TRAILER_HASH_SIZE] = '\0';
+    return 0;
+
+error:
+    free(buffer);
+    free(*chunks);
+    *chunks = NULL;
+    *count = 0;
+    close(fd);
+    return -1;
+}
+
+int list_files(const char * dir, char *** files, size_t * count) {
+    sfile_list list = { 0 };
+    char root[PATH_MAX];
+    size_t len;
+
+    // Sin la barra final las rutas no quedan con barras dobles
+    snprintf(root, sizeof(root), "%s", dir);
+    for (len = strlen(root); len > 1 && root[len - 1] == '/'; len--) {
+        root[len - 1] = '\0';
+    }
+
+    if (collect_files(root, &list) < 0) {
+        for (size_t i = 0; i < list.count; i++) {
+            free(list.paths[i]);
+        }
+        free(list.paths);
+        return -1;
+    }
+
+    qsort(list.paths, list.count, sizeof(char *), compare_paths);
+    *files = list.paths;
+    *count = list.count;
+    return 0;
+}
+
+return_code add_request(int socket, sadd * request, shindex * index) {
     ssize_t nwrite;
     operation_type op = ADD;
+    return_code result;
+    struct stat s; // Estado del archivo antes de enviarlo en una adicion en flujo
+    int streamed = request->hash[0] == '\0';
 
 
     // Envia el codigo de operacion
@@ -60,11 +353,31 @@ return_code add_request(int socket, sadd * request) {
         return ERROR;
     }
 
-    if (remote_copy(request -> filename, socket) == VERSION_ERROR) {
+    // El servidor responde si necesita el contenido antes de que se envie
+    if (recv_all(socket, &result, sizeof(return_code)) < 0) {
         return ERROR;
     }
 
-    return SUCCESS;
+    if (result != CONTENT_REQUIRED) {
+        return result; // La version ya existe o el servidor ya tenia el contenido
+    }
+
+    // En una adicion en flujo el hash se calcula y se envia junto con el contenido
+    if ((streamed && stat(request->filename, &s) < 0) ||
+        remote_copy(request -> filename, socket, streamed ? request->hash : NULL) == VERSION_ERROR) {
+        return ERROR;
+    }
+
+    if (recv_all(socket, &result, sizeof(return_code)) < 0) {
+        return ERROR;
+    }
+
+    // El servidor verifico el hash: si el archivo cambio mientras se enviaba responde VERSION_ERROR
+    if (streamed && (result == VERSION_ADDED || result == VERSION_ALREADY_EXISTS)) {
+        hindex_update(index, request->filename, &s, request->hash);
+    }
+
+    return result;
 }
 
 return_code list_request(int socket, slist * request) {
@@ -105,39 +418,76 @@ return_code get_request(int socket, sget * request) {
     return SUCCESS;
 }
 
+return_code get_version(int socket, sget * request) {
+    return_code result;
+
+    if (get_request(socket, request) == ERROR || recv_all(socket, &result, sizeof(return_code)) < 0) {
+        return ERROR;
+    }
+    if (result == VERSION_NOT_FOUND) {
+        return result;
+    }
+    return local_copy(socket, request->filename);
+}
+
+return_code list_versions(int socket, slist * request) {
+    return_code result;
+
+    if (list_request(socket, request) == ERROR || recv_all(socket, &result, sizeof(return_code)) < 0) {
+        return ERROR;
+    }
+    if (result != VERSION_CREATED) {
+        return result;
+    }
+    return print_list(socket) == SUCCESS ? VERSION_CREATED : ERROR;
+}
+
 return_code print_list(int socket) {
     char buffer[BUFFSIZE];
-    char temp_buffer[BUFFSIZE];
-    int nread;
-    int total_bytes = 0;
     int msg_size = 0;
 
     printf("List of versions:\n");
 
-    recv(socket, &msg_size, sizeof(int),0); // Espera el tamaño del primer mensaje
-    do {
-        memset(buffer, 0, sizeof(buffer));
-        nread = recv(socket, buffer, msg_size, MSG_DONTWAIT);
-        
-        if (nread > 0) {
-            printf("%s", buffer); // Solo imprimir si hay datos leídos
-        } else if (nread == -1) {
-            // Verificar si el error es EAGAIN o EWOULDBLOCK
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                perror("recv"); // Solo imprimir error si es un error diferente
-            }
+    while (1) {
+        // Cada linea esta precedida por su tamaño, una linea de tamaño 0 indica el final
+        if (recv_all(socket, &msg_size, sizeof(int)) < 0) {
+            perror("recv");
+            return ERROR;
+        }
+
+        if (msg_size == 0) break;
+
+        if (msg_size < 0 || msg_size >= (int)sizeof(buffer)) {
+            fprintf(stderr, "Invalid list entry size %d\n", msg_size);
+            return ERROR;
         }
-        
-        // Lee el tamaño del siguiente mensaje
-        if (recv(socket, &msg_size, sizeof(int), MSG_DONTWAIT) <= 0) {
-            break; // Salir si hay un error o si no hay más datos
+
+        if (recv_all(socket, buffer, msg_size) < 0) {
+            perror("recv");
+            return ERROR;
         }
 
-    } while (1);
+        buffer[msg_size] = '\0';
+        printf("%s", buffer);
+    }
 
     return SUCCESS;
 }
 
+static int recv_all(int socket, void * buffer, size_t size) {
+    size_t total = 0;
+    ssize_t nread;
+
+    while (total < size) {
+        nread = recv(socket, (char *)buffer + total, size - total, 0);
+        if (nread < 0 && errno == EINTR) continue;
+        if (nread <= 0) return -1;
+        total += nread;
+    }
+
+    return 0;
+}
+
 char *get_file_hash(char * filename, char * hash) {
 	char *comando;
 	FILE * fp;
@@ -150,7 +500,99 @@ char *get_file_hash(char * filename, char * hash) {
 		return NULL;
 	}
 
-	sha256_hash_file_hex(filename, hash);
+	if (sha256_hash_file_hex(filename, hash) < 0) {
+		perror(filename);
+		return NULL;
+	}
 
 	return hash;
 }
+
+static int collect_files(const char * dir, sfile_list * list) {
+    char path[PATH_MAX];
+    struct dirent *entry;
+    struct stat s;
+    int failed = 0;
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return -1;
+    }
+
+    while (!failed && (entry = readdir(d))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || strcmp(entry->d_name, HINDEX_FILE) == 0) {
+            continue;
+        }
+
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path) || lstat(path, &s) < 0) {
+            continue;
+        }
+
+        if (S_ISDIR(s.st_mode)) {
+            failed = collect_files(path, list) < 0;
+            continue;
+        }
+
+        if (!S_ISREG(s.st_mode)) {
+            continue;
+        }
+
+        if (list->count == list->cap) {
+            size_t cap = list->cap ? 2 * list->cap : 256;
+            char **paths = realloc(list->paths, cap * sizeof(char *));
+            if (!paths) {
+                failed = 1;
+                break;
+            }
+            list->paths = paths;
+            list->cap = cap;
+        }
+
+        if (!(list->paths[list->count] = strdup(path))) {
+            failed = 1;
+            break;
+        }
+        list->count++;
+    }
+
+    closedir(d);
+    return failed ? -1 : 0;
+}
+
+static int compare_paths(const void * a, const void * b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void gear_init(void) {
+    uint64_t seed = 0x5eed5eed5eed5eedULL;
+
+    if (gear[0]) return;
+
+    for (int i = 0; i < 256; i++) { // splitmix64
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+static uint32_t cdc_cut(const uint8_t * data, size_t size) {
+    size_t normal = CDC_AVG_SIZE, i = CDC_MIN_SIZE;
+    uint64_t fp = 0;
+
+    if (size <= CDC_MIN_SIZE) return size;
+    if (size > CDC_MAX_SIZE) size = CDC_MAX_SIZE;
+    if (size < normal) normal = size;
+
+    // Los primeros CDC_MIN_SIZE bytes no pueden ser un final: no se recorren
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & CDC_MASK_SMALL)) return i + 1;
+    }
+    for (; i < size; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & CDC_MASK_LARGE)) return i + 1;
+    }
+    return size;
+}
@@ -7,22 +7,122 @@
  */
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 #include <errno.h>
 
 #include "protocol.h"
 #include "sha256.h"
+#include "hashindex.h"
+
+#define USERNAME_SIZE 50 /**< Tamaño del nombre de usuario enviado al conectarse */
+#define STREAM_ADD_MIN (64 * 1024 * 1024) /**< Tamaño desde el cual el hash se calcula mientras se envia el archivo */
+#define CDC_MIN_SIZE (256 * 1024) /**< Tamaño minimo de un fragmento (salvo el ultimo) */
+#define CDC_AVG_SIZE (1024 * 1024) /**< Tamaño promedio esperado de un fragmento */
+#define CDC_MAX_SIZE (4 * 1024 * 1024) /**< Tamaño maximo de un fragmento */
+
+/**
+ * @brief Fragmento de un archivo, con limites definidos por el contenido
+ */
+typedef struct {
+    off_t offset; /**< Posicion del fragmento en el archivo */
+    uint32_t size; /**< Tamaño del fragmento */
+    uint8_t hash[32]; /**< SHA-256 del fragmento */
+} schunk;
+
+/**
+ * @brief Inicia una conexion con el protocolo v2 (FRAME_HELLO)
+ *
+ * Si el servidor solo habla v1 cierra la conexion: el cliente debe volver a
+ * conectarse y usar login_request.
+ *
+ * Desde PROTOCOL_COMPRESS el saludo ofrece los codecs de compresion de frames.
+ *
+ * @param socket Socket de comunicacion
+ * @param username Nombre de usuario
+ * @param codecs Codecs que se ofrecen (FRAME_CODEC_LZ), 0 para no comprimir
+ * @param version Version del protocolo que eligio el servidor (entre FRAME_VERSION y PROTOCOL_VERSION)
+ * @param codec Codec que eligio el servidor, 0 si no se comprime
+ * @return return_code SUCCESS si el servidor acepto v2, ERROR en otro caso
+ */
+return_code hello_request(int socket, const char * username, int codecs, int * version, int * codec);
+
+/**
+ * @brief Envia el nombre de usuario al servidor, debe ser lo primero que se envia al conectarse
+ * 
+ * @param socket Socket de comunicacion
+ * @param username Nombre de usuario
+ * @return return_code ERROR si ocurre un error al escribir, SUCCESS si la operacion es exitosa
+ */
+return_code login_request(int socket, const char * username);
 
 /**
  * @brief Crea una estructura de solicitud de adición acorde al protocolo
+ *
+ * Para archivos de al menos STREAM_ADD_MIN bytes el hash queda vacio: se
+ * calcula mientras se envia el contenido (adicion en flujo), asi el archivo
+ * solo se lee una vez.
+ *
+ * Si el archivo no cambio desde que se guardo su hash en el indice, se usa
+ * ese hash sin leer el archivo.
  * 
  * @param filename Nombre del archivo
  * @param comment Comentario de la version
  * @param result Estructura de version
+ * @param index Indice de hashes, NULL si no se usa
  * 
  * @return Codigo de la operacion (VERSION_CREATED si la operacion es exitosa, VERSION_ERROR si ocurre un error)
  */
-return_code create_sadd(char * filename, char * comment, sadd * result);
+return_code create_sadd(char * filename, char * comment, sadd * result, shindex * index);
+
+/**
+ * @brief Divide un archivo en fragmentos definidos por su contenido (FastCDC)
+ *
+ * Los limites se eligen con un hash rodante sobre los ultimos bytes, asi una
+ * modificacion solo cambia los fragmentos que la contienen: los demas se
+ * repiten entre versiones y el servidor no los vuelve a pedir. Los fragmentos
+ * miden entre CDC_MIN_SIZE y CDC_MAX_SIZE, en promedio cerca de CDC_AVG_SIZE.
+ *
+ * El archivo se lee una vez: en la misma lectura se calcula el hash de cada
+ * fragmento y el de todo el contenido.
+ *
+ * @param filename Nombre del archivo
+ * @param chunks Arreglo de fragmentos creado con malloc (se libera con free)
+ * @param count Cantidad de fragmentos
+ * @param hash Buffer de HASH_SIZE para el hash de todo el contenido, en hexadecimal
+ * @return 0 en caso de exito, -1 si el archivo no se puede leer o no hay memoria
+ */
+int chunk_file(const char * filename, schunk ** chunks, uint32_t * count, char * hash);
+
+/**
+ * @brief Crea las solicitudes de adición de varios archivos con el mismo comentario
+ *
+ * Los hashes se calculan en paralelo, varios archivos a la vez en las lineas
+ * de las instrucciones vectoriales. Solo se leen los archivos que cambiaron
+ * desde que se guardo su hash en el indice. Igual que en create_sadd, el hash
+ * de un archivo de al menos STREAM_ADD_MIN bytes queda vacio.
+ *
+ * @param filenames Nombres de los archivos
+ * @param count Cantidad de archivos
+ * @param comment Comentario de las versiones
+ * @param results Estructuras de version (una por archivo)
+ * @param codes Resultado de cada archivo (VERSION_CREATED, o VERSION_ERROR si no es un archivo regular o no se puede leer)
+ * @param index Indice de hashes, NULL si no se usa
+ */
+void create_sadd_batch(char ** filenames, size_t count, char * comment, sadd * results, return_code * codes, shindex * index);
+
+/**
+ * @brief Lista los archivos regulares de un directorio y de sus subdirectorios
+ *
+ * Los enlaces simbolicos no se siguen y se omite el indice de hashes (HINDEX_FILE).
+ * Las rutas empiezan con dir y quedan ordenadas.
+ *
+ * @param dir Directorio
+ * @param files Arreglo de rutas creado con malloc, cada ruta tambien (se libera con free)
+ * @param count Cantidad de rutas
+ * @return 0 en caso de exito, -1 si el directorio no se puede leer o no hay memoria
+ */
+int list_files(const char * dir, char *** files, size_t * count);
 
 /**
  * @brief Crea un archivo con el resultado de la operacion get
@@ -44,12 +144,17 @@ return_code print_list(int socket);
 /**
  * @brief Peticion de operacion add al servidor
  * 
+ * Envia la solicitud con el hash y solo envia el contenido si el servidor lo pide.
+ * Si el hash esta vacio se envia el contenido y despues su hash, que queda en request
+ * y se guarda en el indice.
+ * 
  * @param socket Socket de comunicacion
  * @param request  Estructura de operacion de adicion
- * @return int  Resultado de la operacion (result), si ocurre un error al escribir retorna ERROR
- *           si la operacion es exitosa, retorna SUCCESS
+ * @param index Indice de hashes, NULL si no se usa
+ * @return int  Respuesta final del servidor (VERSION_ADDED, VERSION_ALREADY_EXISTS o VERSION_ERROR),
+ *           ERROR si ocurre un error de comunicacion
  */
-return_code add_request(int socket, sadd * request);
+return_code add_request(int socket, sadd * request, shindex * index);
 
 /**
  * @brief Peticion de operacion get al servidor
@@ -70,3 +175,26 @@ return_code get_request(int socket, sget * request);
  *           si la operacion es exitosa, retorna SUCCESS
  */
 return_code list_request(int socket, slist * request);
+
+/**
+ * @brief Obtiene una version de un archivo y la escribe en filename (v1)
+ *
+ * Con v2 las solicitudes se envian con pipeline_get.
+ *
+ * @param socket Socket de comunicacion
+ * @param request Estructura de operacion de obtencion
+ * @return return_code VERSION_NOT_FOUND si la version no existe, VERSION_CREATED si se escribio el archivo,
+ *           ERROR o VERSION_ERROR si ocurre un error
+ */
+return_code get_version(int socket, sget * request);
+
+/**
+ * @brief Lista las versiones de un archivo, o de todos si el nombre esta vacio, y las imprime en consola (v1)
+ *
+ * Con v2 las solicitudes se envian con pipeline_list.
+ *
+ * @param socket Socket de comunicacion
+ * @param request Estructura de operacion de listado
+ * @return return_code VERSION_CREATED si se imprimio el listado, otro codigo si no hay versiones o ERROR
+ */
+return_code list_versions(int socket, slist * request);
@@ -27,8 +27,39 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "sha256.h"
 
+#define SHA256_FILE_CHUNK (64 * 1024) /* Bytes read from each file per pass of sha256_hash_files_hex */
+#define SHA256_MAP_WINDOW ((off_t)256 * 1024 * 1024) /* Bytes of a file mapped at once by sha256_hash_file_hex */
+#define SHA256_READ_CHUNK (1024 * 1024) /* Read size when a file can't be mapped */
+
+/* Hashes size bytes of a regular file through mmap. Returns 0, -1 if the file can't be mapped
+   (nothing was hashed) or -2 if a later window fails */
+static int sha256_hash_mapped(struct sha256_buff* buff, int fd, off_t size);
+
+/* Hashes what is left of fd with large aligned reads */
+static int sha256_hash_read(struct sha256_buff* buff, int fd);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/* Compression function over consecutive 64-byte blocks, selected at startup by sha256_select */
+static void sha256_blocks_scalar(uint32_t* h, const uint8_t* data, size_t blocks);
+static void (*sha256_blocks)(uint32_t* h, const uint8_t* data, size_t blocks) = sha256_blocks_scalar;
+
+/* Multi-buffer kernel: hashes the same number of blocks of sha256_lanes independent streams,
+   one stream per 32-bit vector lane. NULL when the CPU has no vector unit worth using */
+static void (*sha256_blocks_multi)(uint32_t** h, const uint8_t** data, size_t blocks) = NULL;
+static int sha256_lanes = 1;
+
 void sha256_init(struct sha256_buff* buff) {
 	buff->h[0] = 0x6a09e667;
 	buff->h[1] = 0xbb67ae85;
@@ -55,7 +86,7 @@ const static uint32_t k[64] = {
 
 #define rotate_r(val, bits) (val >> bits | val << (32 - bits))
 
-static void sha256_calc_chunk(struct sha256_buff* buff, const uint8_t* chunk) {
+static void sha256_calc_chunk(uint32_t* h, const uint8_t* chunk) {
 	uint32_t w[64];
 	uint32_t tv[8];
 	uint32_t i;
@@ -72,7 +103,7 @@ static void sha256_calc_chunk(struct sha256_buff* buff, const uint8_t* chunk) {
 	}
 
 	for (i = 0; i < 8; ++i)
-		tv[i] = buff->h[i];
+		tv[i] = h[i];
 
 	for (i=0; i<64; ++i){
 		uint32_t S1 = rotate_r(tv[4], 6) ^ rotate_r(tv[4], 11) ^ rotate_r(tv[4], 25);
@@ -93,34 +124,541 @@ static void sha256_calc_chunk(struct sha256_buff* buff, const uint8_t* chunk) {
 	}
 
 	for (i = 0; i < 8; ++i)
-		buff->h[i] += tv[i];
+		h[i] += tv[i];
 }
 
-void sha256_update(struct sha256_buff* buff, const void* data, size_t size) {
-	const uint8_t* ptr = (const uint8_t*)data;
-	buff->data_size += size;
+static void sha256_blocks_scalar(uint32_t* h, const uint8_t* data, size_t blocks) {
+	for (; blocks; --blocks, data += 64)
+		sha256_calc_chunk(h, data);
+}
+
+#ifdef SHA256_X86
+
+/* Rounds over a message schedule that already includes the round constants (w[i] + k[i]).
+   Inlined into each kernel, so it is compiled for that kernel's instruction set (rorx with BMI2) */
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, x) do { \
+	uint32_t t1 = h + (rotate_r(e, 6) ^ rotate_r(e, 11) ^ rotate_r(e, 25)) + ((e & f) ^ (~e & g)) + (x); \
+	uint32_t t2 = (rotate_r(a, 2) ^ rotate_r(a, 13) ^ rotate_r(a, 22)) + ((a & b) ^ (a & c) ^ (b & c)); \
+	d += t1; \
+	h = t1 + t2; \
+} while (0)
+
+static inline __attribute__((always_inline)) void sha256_rounds(uint32_t* h, const uint32_t* wk) {
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+	uint32_t i;
+
+	for (i = 0; i < 64; i += 8) {
+		SHA256_ROUND(a, b, c, d, e, f, g, hh, wk[i]);
+		SHA256_ROUND(hh, a, b, c, d, e, f, g, wk[i + 1]);
+		SHA256_ROUND(g, hh, a, b, c, d, e, f, wk[i + 2]);
+		SHA256_ROUND(f, g, hh, a, b, c, d, e, wk[i + 3]);
+		SHA256_ROUND(e, f, g, hh, a, b, c, d, wk[i + 4]);
+		SHA256_ROUND(d, e, f, g, hh, a, b, c, wk[i + 5]);
+		SHA256_ROUND(c, d, e, f, g, hh, a, b, wk[i + 6]);
+		SHA256_ROUND(b, c, d, e, f, g, hh, a, wk[i + 7]);
+	}
+
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+#define SSE_ROR(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define SSE_S0(x) _mm_xor_si128(_mm_xor_si128(SSE_ROR(x, 7), SSE_ROR(x, 18)), _mm_srli_epi32(x, 3))
+#define SSE_S1(x) _mm_xor_si128(_mm_xor_si128(SSE_ROR(x, 17), SSE_ROR(x, 19)), _mm_srli_epi32(x, 10))
+
+/* Next four schedule words from the previous sixteen (x0 oldest). sigma1 depends on
+   words of the same group, so the upper two lanes are completed in a second step */
+__attribute__((target("ssse3,sse4.1")))
+static inline __m128i sha256_schedule_sse(__m128i x0, __m128i x1, __m128i x2, __m128i x3) {
+	__m128i w15 = _mm_alignr_epi8(x1, x0, 4);
+	__m128i w7 = _mm_alignr_epi8(x3, x2, 4);
+	__m128i t = _mm_add_epi32(_mm_add_epi32(x0, SSE_S0(w15)), w7);
+	__m128i w2 = _mm_shuffle_epi32(x3, _MM_SHUFFLE(3, 3, 3, 2));
+
+	t = _mm_add_epi32(t, _mm_move_epi64(SSE_S1(w2)));
+	w2 = _mm_shuffle_epi32(t, _MM_SHUFFLE(1, 0, 1, 0));
+	return _mm_blend_epi16(t, _mm_add_epi32(t, SSE_S1(w2)), 0xF0);
+}
+
+__attribute__((target("ssse3,sse4.1")))
+static void sha256_blocks_sse4(uint32_t* h, const uint8_t* data, size_t blocks) {
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint32_t wk[64] __attribute__((aligned(16)));
+	uint32_t i;
+
+	for (; blocks; --blocks, data += 64) {
+		__m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap);
+		__m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap);
+		__m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap);
+		__m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap);
+
+		_mm_store_si128((__m128i*)wk, _mm_add_epi32(x0, _mm_loadu_si128((const __m128i*)k)));
+		_mm_store_si128((__m128i*)(wk + 4), _mm_add_epi32(x1, _mm_loadu_si128((const __m128i*)(k + 4))));
+		_mm_store_si128((__m128i*)(wk + 8), _mm_add_epi32(x2, _mm_loadu_si128((const __m128i*)(k + 8))));
+		_mm_store_si128((__m128i*)(wk + 12), _mm_add_epi32(x3, _mm_loadu_si128((const __m128i*)(k + 12))));
+
+		for (i = 16; i < 64; i += 4) {
+			__m128i next = sha256_schedule_sse(x0, x1, x2, x3);
+			_mm_store_si128((__m128i*)(wk + i), _mm_add_epi32(next, _mm_loadu_si128((const __m128i*)(k + i))));
+			x0 = x1; x1 = x2; x2 = x3; x3 = next;
+		}
+
+		sha256_rounds(h, wk);
+	}
+}
+
+#define AVX_ROR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define AVX_S0(x) _mm256_xor_si256(_mm256_xor_si256(AVX_ROR(x, 7), AVX_ROR(x, 18)), _mm256_srli_epi32(x, 3))
+#define AVX_S1(x) _mm256_xor_si256(_mm256_xor_si256(AVX_ROR(x, 17), AVX_ROR(x, 19)), _mm256_srli_epi32(x, 10))
+
+/* Same as sha256_schedule_sse for two blocks at once, one in each 128-bit lane */
+__attribute__((target("avx2,bmi2")))
+static inline __m256i sha256_schedule_avx2(__m256i x0, __m256i x1, __m256i x2, __m256i x3) {
+	__m256i w15 = _mm256_alignr_epi8(x1, x0, 4);
+	__m256i w7 = _mm256_alignr_epi8(x3, x2, 4);
+	__m256i t = _mm256_add_epi32(_mm256_add_epi32(x0, AVX_S0(w15)), w7);
+	__m256i w2 = _mm256_shuffle_epi32(x3, _MM_SHUFFLE(3, 3, 3, 2));
+
+	t = _mm256_add_epi32(t, _mm256_blend_epi32(_mm256_setzero_si256(), AVX_S1(w2), 0x33));
+	w2 = _mm256_shuffle_epi32(t, _MM_SHUFFLE(1, 0, 1, 0));
+	return _mm256_blend_epi32(t, _mm256_add_epi32(t, AVX_S1(w2)), 0xCC);
+}
+
+__attribute__((target("avx2,bmi2")))
+static inline __m256i sha256_load_avx2(const uint8_t* data, __m256i bswap) {
+	__m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)data)),
+		_mm_loadu_si128((const __m128i*)(data + 64)), 1);
+	return _mm256_shuffle_epi8(x, bswap);
+}
+
+__attribute__((target("avx2,bmi2")))
+static inline void sha256_store_avx2(uint32_t* wk0, uint32_t* wk1, __m256i x, const uint32_t* kp) {
+	x = _mm256_add_epi32(x, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kp)));
+	_mm_store_si128((__m128i*)wk0, _mm256_castsi256_si128(x));
+	_mm_store_si128((__m128i*)wk1, _mm256_extracti128_si256(x, 1));
+}
+
+__attribute__((target("avx2,bmi2")))
+static void sha256_blocks_avx2(uint32_t* h, const uint8_t* data, size_t blocks) {
+	const __m256i bswap = _mm256_broadcastsi128_si256(_mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+	uint32_t wk0[64] __attribute__((aligned(16)));
+	uint32_t wk1[64] __attribute__((aligned(16)));
+	uint32_t i;
+
+	/* The schedules of two consecutive blocks are computed together, the rounds stay sequential */
+	for (; blocks >= 2; blocks -= 2, data += 128) {
+		__m256i x0 = sha256_load_avx2(data, bswap);
+		__m256i x1 = sha256_load_avx2(data + 16, bswap);
+		__m256i x2 = sha256_load_avx2(data + 32, bswap);
+		__m256i x3 = sha256_load_avx2(data + 48, bswap);
+
+		sha256_store_avx2(wk0, wk1, x0, k);
+		sha256_store_avx2(wk0 + 4, wk1 + 4, x1, k + 4);
+		sha256_store_avx2(wk0 + 8, wk1 + 8, x2, k + 8);
+		sha256_store_avx2(wk0 + 12, wk1 + 12, x3, k + 12);
+
+		for (i = 16; i < 64; i += 4) {
+			__m256i next = sha256_schedule_avx2(x0, x1, x2, x3);
+			sha256_store_avx2(wk0 + i, wk1 + i, next, k + i);
+			x0 = x1; x1 = x2; x2 = x3; x3 = next;
+		}
+
+		sha256_rounds(h, wk0);
+		sha256_rounds(h, wk1);
+	}
+
+	if (blocks)
+		sha256_blocks_sse4(h, data, blocks);
+}
+
+/* Four rounds with the SHA extensions: sha256rnds2 does two rounds with the low half of msg */
+#define SHANI_ROUNDS(msg, i) do { \
+	__m128i wk = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)(k + (i)))); \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, wk); \
+	state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E)); \
+} while (0)
+
+/* Completes the schedule words of the next group (msg2) and starts the one three groups ahead (msg1) */
+#define SHANI_MSG2(next, cur, prev) next = _mm_sha256msg2_epu32(_mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4)), cur)
+#define SHANI_MSG1(prev, cur) prev = _mm_sha256msg1_epu32(prev, cur)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256_blocks_shani(uint32_t* h, const uint8_t* data, size_t blocks) {
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m128i state0, state1, tmp;
+
+	/* The instructions keep the state as ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)h), 0xB1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(h + 4)), 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; blocks; --blocks, data += 64) {
+		__m128i abef = state0, cdgh = state1;
+		__m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap);
+		__m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap);
+		__m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap);
+		__m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap);
+
+		SHANI_ROUNDS(m0, 0);
+		SHANI_ROUNDS(m1, 4);  SHANI_MSG1(m0, m1);
+		SHANI_ROUNDS(m2, 8);  SHANI_MSG1(m1, m2);
+		SHANI_ROUNDS(m3, 12); SHANI_MSG2(m0, m3, m2); SHANI_MSG1(m2, m3);
+		SHANI_ROUNDS(m0, 16); SHANI_MSG2(m1, m0, m3); SHANI_MSG1(m3, m0);
+		SHANI_ROUNDS(m1, 20); SHANI_MSG2(m2, m1, m0); SHANI_MSG1(m0, m1);
+		SHANI_ROUNDS(m2, 24); SHANI_MSG2(m3, m2, m1); SHANI_MSG1(m1, m2);
+		SHANI_ROUNDS(m3, 28); SHANI_MSG2(m0, m3, m2); SHANI_MSG1(m2, m3);
+		SHANI_ROUNDS(m0, 32); SHANI_MSG2(m1, m0, m3); SHANI_MSG1(m3, m0);
+		SHANI_ROUNDS(m1, 36); SHANI_MSG2(m2, m1, m0); SHANI_MSG1(m0, m1);
+		SHANI_ROUNDS(m2, 40); SHANI_MSG2(m3, m2, m1); SHANI_MSG1(m1, m2);
+		SHANI_ROUNDS(m3, 44); SHANI_MSG2(m0, m3, m2); SHANI_MSG1(m2, m3);
+		SHANI_ROUNDS(m0, 48); SHANI_MSG2(m1, m0, m3); SHANI_MSG1(m3, m0);
+		SHANI_ROUNDS(m1, 52); SHANI_MSG2(m2, m1, m0);
+		SHANI_ROUNDS(m2, 56); SHANI_MSG2(m3, m2, m1);
+		SHANI_ROUNDS(m3, 60);
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i*)h, _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i*)(h + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+/* Multi-buffer kernels. The state and message words are transposed: vector j holds word j
+   of every stream, so the rounds run unchanged for all lanes at once */
+#define SSE_E0(x) _mm_xor_si128(_mm_xor_si128(SSE_ROR(x, 2), SSE_ROR(x, 13)), SSE_ROR(x, 22))
+#define SSE_E1(x) _mm_xor_si128(_mm_xor_si128(SSE_ROR(x, 6), SSE_ROR(x, 11)), SSE_ROR(x, 25))
+
+__attribute__((target("ssse3")))
+static void sha256_multi_sse4(uint32_t** h, const uint8_t** data, size_t blocks) {
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint32_t lane[4] __attribute__((aligned(16)));
+	__m128i s[8], w[16];
+	size_t off;
+	int i, l;
+
+	for (i = 0; i < 8; ++i) {
+		for (l = 0; l < 4; ++l)
+			lane[l] = h[l][i];
+		s[i] = _mm_load_si128((const __m128i*)lane);
+	}
+
+	for (off = 0; blocks; --blocks, off += 64) {
+		__m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], hh = s[7];
+
+		for (i = 0; i < 16; i += 4) {
+			__m128i r0 = _mm_loadu_si128((const __m128i*)(data[0] + off + i * 4));
+			__m128i r1 = _mm_loadu_si128((const __m128i*)(data[1] + off + i * 4));
+			__m128i r2 = _mm_loadu_si128((const __m128i*)(data[2] + off + i * 4));
+			__m128i r3 = _mm_loadu_si128((const __m128i*)(data[3] + off + i * 4));
+			__m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+			__m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+
+			w[i] = _mm_shuffle_epi8(_mm_unpacklo_epi64(t0, t1), bswap);
+			w[i + 1] = _mm_shuffle_epi8(_mm_unpackhi_epi64(t0, t1), bswap);
+			w[i + 2] = _mm_shuffle_epi8(_mm_unpacklo_epi64(t2, t3), bswap);
+			w[i + 3] = _mm_shuffle_epi8(_mm_unpackhi_epi64(t2, t3), bswap);
+		}
+
+		for (i = 0; i < 64; ++i) {
+			__m128i t1, t2;
+			if (i >= 16)
+				w[i & 15] = _mm_add_epi32(_mm_add_epi32(w[i & 15], SSE_S0(w[(i + 1) & 15])),
+					_mm_add_epi32(w[(i + 9) & 15], SSE_S1(w[(i + 14) & 15])));
+			t1 = _mm_add_epi32(_mm_add_epi32(hh, SSE_E1(e)), _mm_xor_si128(_mm_and_si128(e, f), _mm_andnot_si128(e, g)));
+			t1 = _mm_add_epi32(t1, _mm_add_epi32(w[i & 15], _mm_set1_epi32(k[i])));
+			t2 = _mm_add_epi32(SSE_E0(a), _mm_or_si128(_mm_and_si128(a, b), _mm_and_si128(c, _mm_or_si128(a, b))));
+			hh = g; g = f; f = e; e = _mm_add_epi32(d, t1);
+			d = c; c = b; b = a; a = _mm_add_epi32(t1, t2);
+		}
+
+		s[0] = _mm_add_epi32(s[0], a); s[1] = _mm_add_epi32(s[1], b);
+		s[2] = _mm_add_epi32(s[2], c); s[3] = _mm_add_epi32(s[3], d);
+		s[4] = _mm_add_epi32(s[4], e); s[5] = _mm_add_epi32(s[5], f);
+		s[6] = _mm_add_epi32(s[6], g); s[7] = _mm_add_epi32(s[7], hh);
+	}
+
+	for (i = 0; i < 8; ++i) {
+		_mm_store_si128((__m128i*)lane, s[i]);
+		for (l = 0; l < 4; ++l)
+			h[l][i] = lane[l];
+	}
+}
+
+#define AVX_E0(x) _mm256_xor_si256(_mm256_xor_si256(AVX_ROR(x, 2), AVX_ROR(x, 13)), AVX_ROR(x, 22))
+#define AVX_E1(x) _mm256_xor_si256(_mm256_xor_si256(AVX_ROR(x, 6), AVX_ROR(x, 11)), AVX_ROR(x, 25))
+
+/* Loads 32 bytes of eight streams and transposes them: r[i] gets word i of every stream */
+__attribute__((target("avx2")))
+static inline void sha256_transpose_avx2(__m256i* r, const uint8_t** data, size_t off) {
+	__m256i t[8], u[8];
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		r[i] = _mm256_loadu_si256((const __m256i*)(data[i] + off));
+
+	for (i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (i = 0; i < 4; ++i) {
+		r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+
+__attribute__((target("avx2")))
+static void sha256_multi_avx2(uint32_t** h, const uint8_t** data, size_t blocks) {
+	const __m256i bswap = _mm256_broadcastsi128_si256(_mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+	uint32_t lane[8] __attribute__((aligned(32)));
+	__m256i s[8], w[16];
+	size_t off;
+	int i, l;
+
+	for (i = 0; i < 8; ++i) {
+		for (l = 0; l < 8; ++l)
+			lane[l] = h[l][i];
+		s[i] = _mm256_load_si256((const __m256i*)lane);
+	}
+
+	for (off = 0; blocks; --blocks, off += 64) {
+		__m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], hh = s[7];
+
+		sha256_transpose_avx2(w, data, off);
+		sha256_transpose_avx2(w + 8, data, off + 32);
+		for (i = 0; i < 16; ++i)
+			w[i] = _mm256_shuffle_epi8(w[i], bswap);
+
+		for (i = 0; i < 64; ++i) {
+			__m256i t1, t2;
+			if (i >= 16)
+				w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], AVX_S0(w[(i + 1) & 15])),
+					_mm256_add_epi32(w[(i + 9) & 15], AVX_S1(w[(i + 14) & 15])));
+			t1 = _mm256_add_epi32(_mm256_add_epi32(hh, AVX_E1(e)), _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)));
+			t1 = _mm256_add_epi32(t1, _mm256_add_epi32(w[i & 15], _mm256_set1_epi32(k[i])));
+			t2 = _mm256_add_epi32(AVX_E0(a), _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b))));
+			hh = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+			d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+		}
+
+		s[0] = _mm256_add_epi32(s[0], a); s[1] = _mm256_add_epi32(s[1], b);
+		s[2] = _mm256_add_epi32(s[2], c); s[3] = _mm256_add_epi32(s[3], d);
+		s[4] = _mm256_add_epi32(s[4], e); s[5] = _mm256_add_epi32(s[5], f);
+		s[6] = _mm256_add_epi32(s[6], g); s[7] = _mm256_add_epi32(s[7], hh);
+	}
+
+	for (i = 0; i < 8; ++i) {
+		_mm256_store_si256((__m256i*)lane, s[i]);
+		for (l = 0; l < 8; ++l)
+			h[l][i] = lane[l];
+	}
+}
+
+/* AVX-512 has native rotates and three-input logic (0x96 xor, 0xCA choose, 0xE8 majority) */
+#define V16_XOR3(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+#define V16_S0(x) V16_XOR3(_mm512_ror_epi32(x, 7), _mm512_ror_epi32(x, 18), _mm512_srli_epi32(x, 3))
+#define V16_S1(x) V16_XOR3(_mm512_ror_epi32(x, 17), _mm512_ror_epi32(x, 19), _mm512_srli_epi32(x, 10))
+#define V16_E0(x) V16_XOR3(_mm512_ror_epi32(x, 2), _mm512_ror_epi32(x, 13), _mm512_ror_epi32(x, 22))
+#define V16_E1(x) V16_XOR3(_mm512_ror_epi32(x, 6), _mm512_ror_epi32(x, 11), _mm512_ror_epi32(x, 25))
+
+__attribute__((target("avx512f,avx2")))
+static void sha256_multi_avx512(uint32_t** h, const uint8_t** data, size_t blocks) {
+	const __m256i bswap = _mm256_broadcastsi128_si256(_mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+	uint32_t lane[16] __attribute__((aligned(64)));
+	__m256i lo[16], hi[16];
+	__m512i s[8], w[16];
+	size_t off;
+	int i, l;
+
+	for (i = 0; i < 8; ++i) {
+		for (l = 0; l < 16; ++l)
+			lane[l] = h[l][i];
+		s[i] = _mm512_load_si512(lane);
+	}
+
+	for (off = 0; blocks; --blocks, off += 64) {
+		__m512i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], hh = s[7];
+
+		/* Streams 0-7 go to the low half of each vector and 8-15 to the high half */
+		sha256_transpose_avx2(lo, data, off);
+		sha256_transpose_avx2(lo + 8, data, off + 32);
+		sha256_transpose_avx2(hi, data + 8, off);
+		sha256_transpose_avx2(hi + 8, data + 8, off + 32);
+		for (i = 0; i < 16; ++i)
+			w[i] = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_shuffle_epi8(lo[i], bswap)),
+				_mm256_shuffle_epi8(hi[i], bswap), 1);
+
+		for (i = 0; i < 64; ++i) {
+			__m512i t1, t2;
+			if (i >= 16)
+				w[i & 15] = _mm512_add_epi32(_mm512_add_epi32(w[i & 15], V16_S0(w[(i + 1) & 15])),
+					_mm512_add_epi32(w[(i + 9) & 15], V16_S1(w[(i + 14) & 15])));
+			t1 = _mm512_add_epi32(_mm512_add_epi32(hh, V16_E1(e)), _mm512_ternarylogic_epi32(e, f, g, 0xCA));
+			t1 = _mm512_add_epi32(t1, _mm512_add_epi32(w[i & 15], _mm512_set1_epi32(k[i])));
+			t2 = _mm512_add_epi32(V16_E0(a), _mm512_ternarylogic_epi32(a, b, c, 0xE8));
+			hh = g; g = f; f = e; e = _mm512_add_epi32(d, t1);
+			d = c; c = b; b = a; a = _mm512_add_epi32(t1, t2);
+		}
+
+		s[0] = _mm512_add_epi32(s[0], a); s[1] = _mm512_add_epi32(s[1], b);
+		s[2] = _mm512_add_epi32(s[2], c); s[3] = _mm512_add_epi32(s[3], d);
+		s[4] = _mm512_add_epi32(s[4], e); s[5] = _mm512_add_epi32(s[5], f);
+		s[6] = _mm512_add_epi32(s[6], g); s[7] = _mm512_add_epi32(s[7], hh);
+	}
+
+	for (i = 0; i < 8; ++i) {
+		_mm512_store_si512(lane, s[i]);
+		for (l = 0; l < 16; ++l)
+			h[l][i] = lane[l];
+	}
+}
+
+/* Picks the fastest kernel the CPU supports; every kernel produces the same digest */
+__attribute__((constructor))
+static void sha256_select(void) {
+	unsigned int eax, ebx, ecx, edx;
+	int sha = 0;
+
+	__builtin_cpu_init();
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		sha = (ebx >> 29) & 1;
+
+	if (!__builtin_cpu_supports("ssse3") || !__builtin_cpu_supports("sse4.1"))
+		sha256_blocks = sha256_blocks_scalar;
+	else if (sha)
+		sha256_blocks = sha256_blocks_shani;
+	else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+		sha256_blocks = sha256_blocks_avx2;
+	else
+		sha256_blocks = sha256_blocks_sse4;
+
+	/* With the SHA extensions one stream already runs at about twice the aggregate
+	   speed of eight AVX2 lanes: only the sixteen AVX-512 lanes are faster */
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")) {
+		sha256_blocks_multi = sha256_multi_avx512;
+		sha256_lanes = 16;
+	} else if (sha) {
+		sha256_blocks_multi = NULL;
+		sha256_lanes = 1;
+	} else if (__builtin_cpu_supports("avx2")) {
+		sha256_blocks_multi = sha256_multi_avx2;
+		sha256_lanes = 8;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		sha256_blocks_multi = sha256_multi_sse4;
+		sha256_lanes = 4;
+	}
+}
+
+#endif
+
+/* Completes the pending chunk of buff with the start of data; returns the rest of the data */
+static const uint8_t* sha256_update_head(struct sha256_buff* buff, const uint8_t* ptr, size_t* size) {
+	buff->data_size += *size;
 	/* If there is data left in buff, concatenate it to process as new chunk */
-	if (size + buff->chunk_size >= 64) {
+	if (*size + buff->chunk_size >= 64) {
 		uint8_t tmp_chunk[64];
 		memcpy(tmp_chunk, buff->last_chunk, buff->chunk_size);
 		memcpy(tmp_chunk + buff->chunk_size, ptr, 64 - buff->chunk_size);
 		ptr += (64 - buff->chunk_size);
-		size -= (64 - buff->chunk_size);
+		*size -= (64 - buff->chunk_size);
 		buff->chunk_size = 0;
-		sha256_calc_chunk(buff, tmp_chunk);
-	}
-	/* Run over data chunks */
-	while (size  >= 64) {
-		sha256_calc_chunk(buff, ptr);
-		ptr += 64;
-		size -= 64; 
+		sha256_blocks(buff->h, tmp_chunk, 1);
 	}
+	return ptr;
+}
 
-	/* Save remaining data in buff, will be reused on next call or finalize */
+/* Save remaining data in buff, will be reused on next call or finalize */
+static void sha256_update_tail(struct sha256_buff* buff, const uint8_t* ptr, size_t size) {
 	memcpy(buff->last_chunk + buff->chunk_size, ptr, size);
 	buff->chunk_size += size;
 }
 
+void sha256_update(struct sha256_buff* buff, const void* data, size_t size) {
+	const uint8_t* ptr = sha256_update_head(buff, (const uint8_t*)data, &size);
+
+	/* Run over data chunks */
+	if (size >= 64) {
+		sha256_blocks(buff->h, ptr, size / 64);
+		ptr += size & ~(size_t)63;
+		size &= 63;
+	}
+
+	sha256_update_tail(buff, ptr, size);
+}
+
+int sha256_multi_lanes(void) {
+	return sha256_lanes;
+}
+
+void sha256_update_multi(struct sha256_buff** buffs, const void** data, const size_t* sizes, size_t count) {
+	const uint8_t* ptr[SHA256_MULTI_MAX];
+	size_t blocks[SHA256_MULTI_MAX], tail[SHA256_MULTI_MAX];
+	uint32_t spare[SHA256_MULTI_MAX][8]; /* State of the unused lanes */
+	size_t i;
+
+	if (count > SHA256_MULTI_MAX)
+		count = SHA256_MULTI_MAX;
+
+	for (i = 0; i < count; ++i) {
+		size_t size = sizes[i];
+		ptr[i] = sha256_update_head(buffs[i], (const uint8_t*)data[i], &size);
+		blocks[i] = size / 64;
+		tail[i] = size & 63;
+	}
+
+	/* Every pass runs the streams that still have blocks for as many blocks as the shortest one */
+	while (sha256_blocks_multi) {
+		uint32_t* h[SHA256_MULTI_MAX];
+		const uint8_t* lane_data[SHA256_MULTI_MAX];
+		size_t lane_stream[SHA256_MULTI_MAX];
+		size_t active = 0, n = 0;
+
+		for (i = 0; i < count && active < (size_t)sha256_lanes; ++i) {
+			if (!blocks[i])
+				continue;
+			if (!active || blocks[i] < n)
+				n = blocks[i];
+			lane_stream[active++] = i;
+		}
+		if (active < 2)
+			break; /* A single stream is faster with its own kernel */
+
+		for (i = 0; i < (size_t)sha256_lanes; ++i) {
+			if (i < active) {
+				h[i] = buffs[lane_stream[i]]->h;
+				lane_data[i] = ptr[lane_stream[i]];
+			} else { /* Unused lanes repeat the first stream on a scratch state */
+				memcpy(spare[i], h[0], sizeof(spare[i]));
+				h[i] = spare[i];
+				lane_data[i] = lane_data[0];
+			}
+		}
+		sha256_blocks_multi(h, lane_data, n);
+
+		for (i = 0; i < active; ++i) {
+			ptr[lane_stream[i]] += n * 64;
+			blocks[lane_stream[i]] -= n;
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (blocks[i]) {
+			sha256_blocks(buffs[i]->h, ptr[i], blocks[i]);
+			ptr[i] += blocks[i] * 64;
+		}
+		sha256_update_tail(buffs[i], ptr[i], tail[i]);
+	}
+}
+
 void sha256_finalize(struct sha256_buff* buff) {
 	buff->last_chunk[buff->chunk_size] = 0x80;
 	buff->chunk_size++;
@@ -128,7 +666,7 @@ void sha256_finalize(struct sha256_buff* buff) {
 
 	/* If there isn't enough space to fit int64, pad chunk with zeroes and prepare next chunk */
 	if (buff->chunk_size > 56) {
-		sha256_calc_chunk(buff, buff->last_chunk);
+		sha256_blocks(buff->h, buff->last_chunk, 1);
 		memset(buff->last_chunk, 0, 64);
 	}
 
@@ -140,7 +678,7 @@ void sha256_finalize(struct sha256_buff* buff) {
 		size >>= 8;
 	}
 
-	sha256_calc_chunk(buff, buff->last_chunk);
+	sha256_blocks(buff->h, buff->last_chunk, 1);
 }
 
 void sha256_read(const struct sha256_buff* buff, uint8_t* hash) {
@@ -183,23 +721,124 @@ void sha256_hash_hex(const void* data, size_t size, char* hex) {
 	bin_to_hex(hash, 32, hex);
 }
 
-void sha256_hash_file_hex(char * path, char * hex) {
-	FILE* file = fopen(path, "rb");
-	if (!file){
-		return;
-	}
-	char buffer[1024];
-	size_t size;
+int sha256_hash_file_hex(char * path, char * hex) {
 	struct sha256_buff buff;
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	int status = -1;
+
+	if (fd < 0)
+		return -1;
+
 	sha256_init(&buff);
-	while (!feof(file)){
-		/* Hash file by 1kb chunks, instead of loading into RAM at once */
-		size = fread(buffer, 1, 1024, file);
-		sha256_update(&buff, buffer, size);
+	if (fstat(fd, &st) == 0) {
+		status = S_ISREG(st.st_mode) ? sha256_hash_mapped(&buff, fd, st.st_size) : -1;
+		if (status == -1) /* Pipes, devices or a file that can't be mapped */
+			status = sha256_hash_read(&buff, fd);
 	}
-	char hash[65] = {0}; /* hash[64] is null-byte */
-	sha256_finalize(&buff);
+	close(fd);
 
+	if (status < 0)
+		return -1;
+
+	sha256_finalize(&buff);
 	hex[64] = 0;
 	sha256_read_hex(&buff, hex);
+	return 0;
+}
+
+static int sha256_hash_mapped(struct sha256_buff* buff, int fd, off_t size) {
+	off_t off;
+
+	/* Large files are mapped by windows, so the address space used stays bounded */
+	for (off = 0; off < size; off += SHA256_MAP_WINDOW) {
+		size_t len = (size - off < SHA256_MAP_WINDOW) ? (size_t)(size - off) : SHA256_MAP_WINDOW;
+		void* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, off);
+
+		if (map == MAP_FAILED)
+			return off == 0 ? -1 : -2; /* Only an untouched stream can fall back to reads */
+		madvise(map, len, MADV_SEQUENTIAL);
+		sha256_update(buff, map, len);
+		munmap(map, len);
+	}
+	return 0;
+}
+
+static int sha256_hash_read(struct sha256_buff* buff, int fd) {
+	void* buffer;
+	ssize_t size;
+
+	if (posix_memalign(&buffer, 4096, SHA256_READ_CHUNK) != 0)
+		return -1;
+
+	while ((size = read(fd, buffer, SHA256_READ_CHUNK)) != 0) {
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size < 0) {
+			free(buffer);
+			return -1;
+		}
+		sha256_update(buff, buffer, size);
+	}
+
+	free(buffer);
+	return 0;
+}
+
+void sha256_hash_files_hex(char ** paths, char ** hex, size_t count) {
+	struct sha256_buff buff[SHA256_MULTI_MAX], *lane_buff[SHA256_MULTI_MAX];
+	const void* lane_data[SHA256_MULTI_MAX];
+	size_t lane_size[SHA256_MULTI_MAX], lane_file[SHA256_MULTI_MAX];
+	int fd[SHA256_MULTI_MAX];
+	size_t lanes = sha256_multi_lanes(), next = 0, active = 0, i;
+	uint8_t* buffer;
+
+	if (lanes < 2 || !(buffer = malloc(lanes * SHA256_FILE_CHUNK))) {
+		for (i = 0; i < count; ++i)
+			sha256_hash_file_hex(paths[i], hex[i]);
+		return;
+	}
+
+	for (i = 0; i < lanes; ++i)
+		fd[i] = -1;
+
+	/* Each lane hashes one file; when it ends the lane takes the next file, so small files keep every lane busy */
+	do {
+		active = 0;
+		for (i = 0; i < lanes; ++i) {
+			ssize_t size = 0;
+
+			while (size <= 0) {
+				while (fd[i] < 0 && next < count) {
+					lane_file[i] = next++;
+					if ((fd[i] = open(paths[lane_file[i]], O_RDONLY | O_CLOEXEC)) >= 0)
+						sha256_init(&buff[i]);
+				}
+				if (fd[i] < 0)
+					break;
+
+				size = read(fd[i], buffer + i * SHA256_FILE_CHUNK, SHA256_FILE_CHUNK);
+				if (size <= 0) { /* End of file (on a read error the hash is left untouched) */
+					if (size == 0) {
+						sha256_finalize(&buff[i]);
+						hex[lane_file[i]][64] = 0;
+						sha256_read_hex(&buff[i], hex[lane_file[i]]);
+					}
+					close(fd[i]);
+					fd[i] = -1;
+				}
+			}
+			if (size <= 0)
+				continue;
+
+			lane_buff[active] = &buff[i];
+			lane_data[active] = buffer + i * SHA256_FILE_CHUNK;
+			lane_size[active] = size;
+			++active;
+		}
+
+		sha256_update_multi(lane_buff, lane_data, lane_size, active);
+	} while (active);
+
+	free(buffer);
 }
@@ -46,6 +46,16 @@ void sha256_init(struct sha256_buff* buff);
 /* Process block of data of arbitary length, can be used on data streams (files, etc) */
 void sha256_update(struct sha256_buff* buff, const void* data, size_t size);
 
+/* Maximum number of streams for sha256_update_multi */
+#define SHA256_MULTI_MAX 16
+
+/* Number of streams the CPU hashes in parallel vector lanes (1 if there is no multi-buffer kernel) */
+int sha256_multi_lanes(void);
+
+/* Same as calling sha256_update on each of count (at most SHA256_MULTI_MAX) independent streams.
+   Streams with blocks left are hashed together in vector lanes, so equal sizes work best */
+void sha256_update_multi(struct sha256_buff** buffs, const void** data, const size_t* sizes, size_t count);
+
 /* Produces final hash values (digest) to be read
    If the buffer is reused later, init must be called again */
 void sha256_finalize(struct sha256_buff* buff);
@@ -62,8 +72,13 @@ void sha256_hash(const void* data, size_t size, uint8_t* hash);
 /* Hashes single contiguous block of data and reads digest into 64-char string (without null-byte) */
 void sha256_hash_hex(const void* data, size_t size, char* hex);
 
-/* Hashes a file */
-void sha256_hash_file_hex(char * path, char * hex);
+/* Hashes a file into hex (64 chars plus null-byte), mapping it in memory when possible.
+   Returns 0, or -1 (errno set, hex untouched) if the file can't be opened or read */
+int sha256_hash_file_hex(char * path, char * hex);
+
+/* Hashes count files into hex[i] (64 chars plus null-byte), several at once in vector lanes.
+   hex[i] is left untouched if paths[i] can't be read */
+void sha256_hash_files_hex(char ** paths, char ** hex, size_t count);
 
 #ifdef __cplusplus
 }
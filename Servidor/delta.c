@@ -0,0 +1,198 @@
+/**
+ * @file
+ * @brief Implementacion de la codificacion por diferencias
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+
+#define DELTA_PRIME 0x01000193u /**< Multiplicador del hash rodante */
+#define DELTA_INSERT 0 /**< Operacion: insertar bytes nuevos */
+#define DELTA_COPY 1 /**< Operacion: copiar un rango del base */
+
+/**
+ * @brief Diferencia que se esta escribiendo
+ */
+typedef struct {
+	uint8_t *data; /**< Buffer */
+	size_t cap; /**< Capacidad */
+	size_t off; /**< Bytes escritos */
+	int full; /**< 1 si algo no cupo */
+} sdelta_out;
+
+/**
+ * @brief Hash de un bloque de DELTA_BLOCK bytes, el mismo que se obtiene al rodar
+ *
+ * @param data Bloque
+ * @return Hash
+ */
+static uint32_t block_hash(const uint8_t *data);
+
+/**
+ * @brief Posicion de un hash en la tabla del base
+ *
+ * @param hash Hash de un bloque
+ * @param bits Bits de la tabla
+ * @return Posicion
+ */
+static size_t block_slot(uint32_t hash, int bits);
+
+/**
+ * @brief Escribe un entero de longitud variable
+ *
+ * @param out Diferencia
+ * @param value Valor
+ */
+static void put_varint(sdelta_out *out, uint64_t value);
+
+/**
+ * @brief Escribe una insercion de los bytes [start, end) del destino, si no esta vacia
+ *
+ * @param out Diferencia
+ * @param target Contenido destino
+ * @param start Primer byte
+ * @param end Byte siguiente al ultimo
+ */
+static void put_insert(sdelta_out *out, const uint8_t *target, size_t start, size_t end);
+
+/**
+ * @brief Lee un entero de longitud variable
+ *
+ * @param data Diferencia
+ * @param size Bytes de la diferencia
+ * @param off Posicion, avanza despues del entero
+ * @param value Valor
+ * @return 0 en caso de exito, -1 si el entero no termina o es demasiado largo
+ */
+static int get_varint(const uint8_t *data, size_t size, size_t *off, uint64_t *value);
+
+int delta_encode(const uint8_t *base, size_t base_size, const uint8_t *target, size_t target_size,
+	uint8_t *out, size_t cap, size_t *size) {
+	sdelta_out delta = { out, cap, 0, 0 };
+	uint32_t *table = NULL; // Posicion + 1 de un bloque del base por cada hash, 0 si no hay
+	uint32_t pow = 1; // DELTA_PRIME^(DELTA_BLOCK - 1): peso del byte que sale de la ventana
+	size_t literal = 0; // Inicio de los bytes del destino que aun no se escriben
+	size_t i = 0;
+	uint32_t hash = 0;
+	int bits = 10;
+
+	if (base_size >= DELTA_BLOCK && target_size >= DELTA_BLOCK && base_size < UINT32_MAX) {
+		while (((size_t)1 << bits) < 2 * (base_size / DELTA_BLOCK)) bits++;
+		if (!(table = calloc((size_t)1 << bits, sizeof(uint32_t)))) return -1;
+
+		for (size_t off = 0; off + DELTA_BLOCK <= base_size; off += DELTA_BLOCK)
+			table[block_slot(block_hash(base + off), bits)] = off + 1;
+		for (int k = 1; k < DELTA_BLOCK; k++) pow *= DELTA_PRIME;
+		hash = block_hash(target);
+	}
+
+	while (table && i + DELTA_BLOCK <= target_size && !delta.full) {
+		uint32_t slot = table[block_slot(hash, bits)];
+
+		if (slot && memcmp(base + slot - 1, target + i, DELTA_BLOCK) == 0) {
+			size_t start = i, from = slot - 1; // La coincidencia se extiende sobre los bytes pendientes
+			size_t end = i + DELTA_BLOCK, to = from + DELTA_BLOCK;
+
+			while (start > literal && from > 0 && base[from - 1] == target[start - 1]) {
+				start--;
+				from--;
+			}
+			while (end < target_size && to < base_size && base[to] == target[end]) {
+				end++;
+				to++;
+			}
+
+			put_insert(&delta, target, literal, start);
+			put_varint(&delta, (uint64_t)(end - start) << 1 | DELTA_COPY);
+			put_varint(&delta, from);
+			i = literal = end;
+			if (i + DELTA_BLOCK <= target_size) hash = block_hash(target + i);
+			continue;
+		}
+
+		if (i + DELTA_BLOCK < target_size) hash = (hash - target[i] * pow) * DELTA_PRIME + target[i + DELTA_BLOCK];
+		i++;
+	}
+
+	put_insert(&delta, target, literal, target_size);
+	free(table);
+	*size = delta.off;
+	return delta.full ? 1 : 0;
+}
+
+int delta_apply(const uint8_t *base, size_t base_size, const uint8_t *delta, size_t delta_size,
+	uint8_t *target, size_t target_size) {
+	size_t off = 0, written = 0;
+
+	while (off < delta_size) {
+		uint64_t op, length, from;
+
+		if (get_varint(delta, delta_size, &off, &op) < 0) return -1;
+		length = op >> 1;
+		if (length > target_size - written) return -1;
+
+		if ((op & 1) == DELTA_COPY) {
+			if (get_varint(delta, delta_size, &off, &from) < 0 || from > base_size || length > base_size - from) return -1;
+			memcpy(target + written, base + from, length);
+		}
+		else {
+			if (length > delta_size - off) return -1;
+			memcpy(target + written, delta + off, length);
+			off += length;
+		}
+		written += length;
+	}
+
+	return written == target_size ? 0 : -1;
+}
+
+static uint32_t block_hash(const uint8_t *data) {
+	uint32_t hash = 0;
+
+	for (int i = 0; i < DELTA_BLOCK; i++) hash = hash * DELTA_PRIME + data[i];
+	return hash;
+}
+
+static size_t block_slot(uint32_t hash, int bits) {
+	return (uint32_t)(hash * 2654435761u) >> (32 - bits);
+}
+
+static void put_varint(sdelta_out *out, uint64_t value) {
+	do {
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		if (out->off == out->cap) {
+			out->full = 1;
+			return;
+		}
+		out->data[out->off++] = byte | (value ? 0x80 : 0);
+	} while (value);
+}
+
+static void put_insert(sdelta_out *out, const uint8_t *target, size_t start, size_t end) {
+	if (start == end) return;
+
+	put_varint(out, (uint64_t)(end - start) << 1 | DELTA_INSERT);
+	if (out->full || end - start > out->cap - out->off) {
+		out->full = 1;
+		return;
+	}
+	memcpy(out->data + out->off, target + start, end - start);
+	out->off += end - start;
+}
+
+static int get_varint(const uint8_t *data, size_t size, size_t *off, uint64_t *value) {
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (*off == size) return -1;
+
+		uint8_t byte = data[(*off)++];
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return 0;
+	}
+	return -1;
+}
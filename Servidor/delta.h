@@ -0,0 +1,53 @@
+/**
+ * @file
+ * @brief Codificacion de un contenido como diferencia (delta) contra otro
+ *
+ * La diferencia es una lista de operaciones que reconstruyen el contenido
+ * destino a partir del contenido base: copiar un rango del base o insertar
+ * bytes nuevos. Las coincidencias se buscan como en rsync: el base se indexa
+ * por bloques de DELTA_BLOCK bytes y el destino se recorre con un hash
+ * rodante, extendiendo cada coincidencia hacia atras y hacia adelante.
+ *
+ * Cada operacion empieza con un entero de longitud variable (7 bits por byte)
+ * con la longitud y el tipo en el bit menos significativo: una insercion (0)
+ * sigue con los bytes, una copia (1) con la posicion en el base.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_BLOCK 16 /**< Bytes de los bloques del base que se indexan, coincidencia minima */
+
+/**
+ * @brief Codifica target como diferencia contra base
+ *
+ * @param base Contenido base
+ * @param base_size Bytes del base
+ * @param target Contenido destino
+ * @param target_size Bytes del destino
+ * @param out Buffer de la diferencia
+ * @param cap Capacidad de out: si la diferencia no cabe no vale la pena guardarla
+ * @param size Bytes de la diferencia
+ * @return 0 en caso de exito, 1 si la diferencia no cabe en cap, -1 si no hay memoria
+ */
+int delta_encode(const uint8_t *base, size_t base_size, const uint8_t *target, size_t target_size,
+	uint8_t *out, size_t cap, size_t *size);
+
+/**
+ * @brief Reconstruye un contenido a partir del base y la diferencia
+ *
+ * @param base Contenido base
+ * @param base_size Bytes del base
+ * @param delta Diferencia creada con delta_encode
+ * @param delta_size Bytes de la diferencia
+ * @param target Buffer del contenido reconstruido
+ * @param target_size Bytes del contenido reconstruido
+ * @return 0 en caso de exito, -1 si la diferencia no es valida o no produce exactamente target_size bytes
+ */
+int delta_apply(const uint8_t *base, size_t base_size, const uint8_t *delta, size_t delta_size,
+	uint8_t *target, size_t target_size);
@@ -0,0 +1,232 @@
+/**
+ * @file
+ * @brief Implementacion de la compresion LZ
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS 14 /**< Bits de la tabla de posiciones */
+#define LZ_LAST_LITERALS 5 /**< Bytes finales que siempre son literales */
+#define LZ_MATCH_LIMIT 12 /**< Bytes finales donde ya no empieza una coincidencia */
+#define LZ_SKIP_TRIGGER 6 /**< Cada 2^LZ_SKIP_TRIGGER posiciones sin coincidencia el paso crece en 1 */
+#define LZ_WILD_COPY 16 /**< Bytes que se copian de una vez si hay espacio, aunque sobren */
+
+/**
+ * @brief Resultado que se esta escribiendo
+ */
+typedef struct {
+	uint8_t *data; /**< Buffer */
+	size_t cap; /**< Capacidad */
+	size_t off; /**< Bytes escritos */
+	int full; /**< 1 si algo no cupo */
+} slz_out;
+
+/**
+ * @brief Lee 4 bytes sin requerir alineacion
+ *
+ * @param data Datos
+ * @return Valor
+ */
+static uint32_t read32(const uint8_t *data);
+
+/**
+ * @brief Cantidad de bytes iguales al inicio de dos posiciones, comparando de a 8 bytes
+ *
+ * @param a Primera posicion
+ * @param b Segunda posicion, anterior a a
+ * @param limit Bytes maximos que se comparan
+ * @return Bytes iguales
+ */
+static size_t common_length(const uint8_t *a, const uint8_t *b, size_t limit);
+
+/**
+ * @brief Posicion de 4 bytes en la tabla de posiciones
+ *
+ * @param value 4 bytes de los datos
+ * @return Posicion
+ */
+static uint32_t lz_hash(uint32_t value);
+
+/**
+ * @brief Escribe la extension de una longitud de 15 o mas
+ *
+ * @param out Resultado
+ * @param length Longitud menos 15
+ */
+static void put_length(slz_out *out, size_t length);
+
+/**
+ * @brief Escribe una secuencia: literales y, si length no es 0, una coincidencia
+ *
+ * @param out Resultado
+ * @param literals Literales
+ * @param count Cantidad de literales
+ * @param offset Distancia de la coincidencia
+ * @param length Longitud de la coincidencia, 0 en la ultima secuencia
+ */
+static void put_sequence(slz_out *out, const uint8_t *literals, size_t count, size_t offset, size_t length);
+
+/**
+ * @brief Lee la extension de una longitud
+ *
+ * @param src Bloque comprimido
+ * @param size Bytes del bloque
+ * @param off Posicion, avanza despues de la extension
+ * @param length Longitud, se le suma la extension
+ * @return 0 en caso de exito, -1 si el bloque termina antes
+ */
+static int get_length(const uint8_t *src, size_t size, size_t *off, size_t *length);
+
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap) {
+	uint32_t table[1 << LZ_HASH_BITS]; // Ultima posicion vista de cada hash de 4 bytes
+	slz_out out = { dst, cap, 0, 0 };
+	size_t anchor = 0, i = 0; // Los literales pendientes empiezan en anchor
+	size_t misses = 1 << LZ_SKIP_TRIGGER;
+
+	memset(table, 0, sizeof(table));
+
+	while (size >= LZ_MATCH_LIMIT && i <= size - LZ_MATCH_LIMIT && !out.full) {
+		uint32_t value = read32(src + i), h = lz_hash(value);
+		size_t ref = table[h];
+
+		table[h] = i;
+		if (ref >= i || i - ref > LZ_MAX_OFFSET || read32(src + ref) != value) {
+			i += misses++ >> LZ_SKIP_TRIGGER;
+			continue;
+		}
+
+		// La coincidencia se extiende hacia atras sobre los literales y hacia adelante
+		while (i > anchor && ref > 0 && src[i - 1] == src[ref - 1]) {
+			i--;
+			ref--;
+		}
+		size_t length = LZ_MIN_MATCH + common_length(src + i + LZ_MIN_MATCH, src + ref + LZ_MIN_MATCH,
+			size - LZ_LAST_LITERALS - i - LZ_MIN_MATCH);
+
+		put_sequence(&out, src + anchor, i - anchor, i - ref, length);
+		i = anchor = i + length;
+		misses = 1 << LZ_SKIP_TRIGGER;
+	}
+
+	put_sequence(&out, src + anchor, size - anchor, 0, 0);
+	return out.full ? 0 : out.off;
+}
+
+ssize_t lz_decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap) {
+	size_t ip = 0, op = 0;
+
+	while (ip < size) {
+		uint8_t token = src[ip++];
+		size_t literals = token >> 4, length = (token & 0xf) + LZ_MIN_MATCH, offset;
+
+		if ((token >> 4) == 0xf && get_length(src, size, &ip, &literals) < 0) return -1;
+		if (literals > size - ip || literals > cap - op) return -1;
+		if (literals <= LZ_WILD_COPY && size - ip >= LZ_WILD_COPY && cap - op >= LZ_WILD_COPY)
+			memcpy(dst + op, src + ip, LZ_WILD_COPY); // Los bytes de mas se sobrescriben despues
+		else
+			memcpy(dst + op, src + ip, literals);
+		ip += literals;
+		op += literals;
+		if (ip == size) break; // Ultima secuencia: solo literales
+
+		if (size - ip < 2) return -1;
+		offset = src[ip] | (size_t)src[ip + 1] << 8;
+		ip += 2;
+		if ((token & 0xf) == 0xf && get_length(src, size, &ip, &length) < 0) return -1;
+		if (offset == 0 || offset > op || length > cap - op) return -1;
+
+		uint8_t *out = dst + op;
+		if (cap - op >= length + 8) {
+			size_t k = 0, step = offset;
+
+			// Con una distancia menor a 8 se repite el patron hasta un multiplo de la distancia de 8 o mas
+			while (step < 8) step += offset;
+			for (; k < step - offset && k < length; k++) out[k] = out[k - offset];
+			for (; k < length; k += 8) memcpy(out + k, out + k - step, 8); // Cada copia lee bytes ya escritos
+		}
+		else if (offset >= length)
+			memcpy(out, out - offset, length);
+		else // La coincidencia se solapa con lo que escribe: repite los ultimos offset bytes
+			for (size_t k = 0; k < length; k++) out[k] = out[k - offset];
+		op += length;
+	}
+
+	return op;
+}
+
+static uint32_t read32(const uint8_t *data) {
+	uint32_t value;
+
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static size_t common_length(const uint8_t *a, const uint8_t *b, size_t limit) {
+	size_t length = 0;
+
+	while (length + 8 <= limit) {
+		uint64_t x, y;
+
+		memcpy(&x, a + length, 8);
+		memcpy(&y, b + length, 8);
+		if (x != y) return length + (__builtin_ctzll(x ^ y) >> 3); // El primer byte distinto (little endian)
+		length += 8;
+	}
+	while (length < limit && a[length] == b[length]) length++;
+	return length;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+	return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void put_length(slz_out *out, size_t length) {
+	for (; length >= 255 && !out->full; length -= 255) {
+		if (out->off == out->cap) out->full = 1;
+		else out->data[out->off++] = 255;
+	}
+	if (out->off == out->cap) out->full = 1;
+	else if (!out->full) out->data[out->off++] = length;
+}
+
+static void put_sequence(slz_out *out, const uint8_t *literals, size_t count, size_t offset, size_t length) {
+	size_t code = length ? length - LZ_MIN_MATCH : 0;
+
+	if (out->full || out->off == out->cap) {
+		out->full = 1;
+		return;
+	}
+	out->data[out->off++] = (count < 15 ? count : 15) << 4 | (code < 15 ? code : 15);
+	if (count >= 15) put_length(out, count - 15);
+
+	if (out->full || count > out->cap - out->off) {
+		out->full = 1;
+		return;
+	}
+	memcpy(out->data + out->off, literals, count);
+	out->off += count;
+	if (!length) return;
+
+	if (out->cap - out->off < 2) {
+		out->full = 1;
+		return;
+	}
+	out->data[out->off++] = offset & 0xff;
+	out->data[out->off++] = offset >> 8;
+	if (code >= 15) put_length(out, code - 15);
+}
+
+static int get_length(const uint8_t *src, size_t size, size_t *off, size_t *length) {
+	uint8_t byte;
+
+	do {
+		if (*off == size) return -1;
+		byte = src[(*off)++];
+		*length += byte;
+	} while (byte == 255);
+	return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file
+ * @brief Compresion LZ rapida (de la familia de LZ4), sin dependencias externas
+ *
+ * El resultado es una serie de secuencias: un byte de control con la cantidad
+ * de literales (4 bits altos) y la longitud de la coincidencia menos
+ * LZ_MIN_MATCH (4 bits bajos), los bytes de extension de ambas longitudes
+ * (255 mientras continua), los literales y la distancia de la coincidencia
+ * (2 bytes, little endian). La ultima secuencia solo tiene literales.
+ *
+ * La compresion busca coincidencias con una tabla hash de posiciones, sin
+ * cadenas: prioriza la velocidad sobre la tasa de compresion. Avanza mas rapido
+ * sobre los datos que no coinciden, asi los datos incompresibles cuestan poco.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LZ_MIN_MATCH 4 /**< Longitud minima de una coincidencia */
+#define LZ_MAX_OFFSET 65535 /**< Distancia maxima de una coincidencia */
+#define LZ_BOUND(size) ((size) + (size) / 255 + 16) /**< Tamaño maximo del resultado de comprimir size bytes */
+
+/**
+ * @brief Comprime un bloque
+ *
+ * @param src Datos
+ * @param size Bytes de los datos
+ * @param dst Buffer del resultado
+ * @param cap Capacidad de dst: con LZ_BOUND(size) siempre cabe, con menos se
+ *            detiene en cuanto no cabe (la compresion no vale la pena)
+ * @return Bytes del resultado, 0 si no cabe en cap
+ */
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap);
+
+/**
+ * @brief Descomprime un bloque
+ *
+ * Verifica cada longitud y distancia: un bloque corrupto nunca escribe ni lee fuera de los buffers.
+ *
+ * @param src Bloque comprimido
+ * @param size Bytes del bloque
+ * @param dst Buffer de los datos
+ * @param cap Capacidad de dst
+ * @return Bytes de los datos, -1 si el bloque no es valido o no cabe en cap
+ */
+ssize_t lz_decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap);
@@ -0,0 +1,190 @@
+/**
+ * @file
+ * @brief Convierte las bases de datos de versiones al formato compacto
+ *
+ * Las bases de datos anteriores guardan cada version como una estructura sadd
+ * completa (mas de 4 KB por registro, casi todo relleno). Esta herramienta
+ * reescribe cada <usuario>.db con registros de tamaño variable y conserva
+ * una copia de la base de datos original en <usuario>.db.legacy.
+ * Tambien mueve los contenidos guardados como <directorio>/<hash> al
+ * almacen de contenidos (objects/ab/cd/<hash>) y empaqueta todos los
+ * contenidos pequeños (ver objects_repack): con el servidor detenido no hace
+ * falta esperar OBJECT_PACK_MIN_AGE segundos.
+ *
+ * El servidor debe estar detenido mientras se ejecuta la migracion.
+ *
+ * Uso: migrate [directorio]
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "objects.h"
+#include "versiondb.h"
+#include "versions.h"
+
+#define LEGACY_EXT ".legacy" /**< Extension de la copia de la base de datos original */
+#define MIGRATING_EXT ".migrating" /**< Extension de la base de datos mientras se convierte */
+
+/**
+ * @brief Convierte una base de datos del formato anterior
+ *
+ * @param path Ruta de la base de datos
+ * @return 1 si se convirtio, 0 si ya estaba en el formato actual, -1 si ocurre un error
+ */
+int migrate_db(const char *path);
+
+/**
+ * @brief Mueve un contenido guardado con el formato anterior al almacen de contenidos
+ *
+ * @param dir Directorio del repositorio
+ * @param hash Nombre del archivo (hash del contenido)
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int migrate_object(const char *dir, const char *hash);
+
+/**
+ * @brief Elimina el indice asociado a una base de datos
+ *
+ * @param path Ruta de la base de datos
+ */
+void remove_index(const char *path);
+
+int main(int argc, char *argv[]) {
+	const char *dir = argc > 1 ? argv[1] : VERSIONS_DIR;
+	char path[PATH_MAX];
+	struct dirent *entry;
+	int migrated = 0, objects = 0, packed, errors = 0;
+
+	DIR *d = opendir(dir);
+	if (!d) {
+		perror("Error opening versions directory");
+		exit(EXIT_FAILURE);
+	}
+
+	if (objects_init(dir) < 0) {
+		perror("Error creating object store");
+		exit(EXIT_FAILURE);
+	}
+
+	while ((entry = readdir(d)) != NULL) {
+		size_t len = strlen(entry->d_name);
+
+		if (object_valid_hash(entry->d_name)) {
+			if (migrate_object(dir, entry->d_name) < 0) errors++;
+			else objects++;
+			continue;
+		}
+
+		if (len <= 3 || strcmp(entry->d_name + len - 3, ".db") != 0) continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		switch (migrate_db(path)) {
+			case 1: migrated++; break;
+			case -1: errors++; break;
+		}
+	}
+
+	closedir(d);
+
+	if ((packed = objects_repack(dir, 0)) < 0) {
+		perror("Error packing small objects");
+		errors++;
+	}
+	else
+		printf("%d small objects packed\n", packed);
+
+	printf("%d databases and %d files migrated, %d errors\n", migrated, objects, errors);
+	exit(errors ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+int migrate_db(const char *path) {
+	char tmp_path[PATH_MAX], legacy_path[PATH_MAX];
+	char magic[VDB_DB_HEADER_SIZE];
+	sadd record;
+	svdb db;
+	long count = 0;
+
+	FILE *in = fopen(path, "rb");
+	if (!in) {
+		perror(path);
+		return -1;
+	}
+
+	size_t nread = fread(magic, 1, sizeof(magic), in);
+	if (nread == 0 || (nread == sizeof(magic) && memcmp(magic, VDB_DB_MAGIC, VDB_DB_HEADER_SIZE) == 0)) {
+		fclose(in);
+		return 0; // Vacia o ya convertida
+	}
+	rewind(in);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s%s", path, MIGRATING_EXT);
+	snprintf(legacy_path, sizeof(legacy_path), "%s%s", path, LEGACY_EXT);
+	unlink(tmp_path);
+	remove_index(tmp_path);
+
+	if (vdb_open(&db, tmp_path, 1) < 0) {
+		fprintf(stderr, "Error creating %s\n", tmp_path);
+		fclose(in);
+		return -1;
+	}
+
+	while (fread(&record, sizeof(record), 1, in) == 1) {
+		// Los campos del formato anterior no siempre terminan en NULL
+		record.filename[PATH_MAX - 1] = '\0';
+		record.hash[HASH_SIZE - 1] = '\0';
+		record.comment[COMMENT_SIZE - 1] = '\0';
+
+		if (vdb_append(&db, &record) < 0) {
+			fprintf(stderr, "%s: skipping invalid record %ld\n", path, count);
+			continue;
+		}
+		count++;
+	}
+
+	int failed = ferror(in) || fsync(db.db_fd) < 0;
+	fclose(in);
+	vdb_close(&db);
+	remove_index(tmp_path);
+
+	// Se conserva la base de datos original y se reemplaza de forma atomica
+	if (failed || (unlink(legacy_path) < 0 && access(legacy_path, F_OK) == 0) ||
+		link(path, legacy_path) < 0 || rename(tmp_path, path) < 0) {
+		perror(path);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	remove_index(path); // El servidor lo reconstruye con las nuevas posiciones
+	printf("%s: %ld versions migrated\n", path, count);
+	return 1;
+}
+
+int migrate_object(const char *dir, const char *hash) {
+	char path[PATH_MAX];
+
+	// Si falla la publicacion, el original no se pierde
+	snprintf(path, sizeof(path), "%s/%s", dir, hash);
+	if (object_import(dir, hash, path) < 0 || unlink(path) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+void remove_index(const char *path) {
+	char index_path[PATH_MAX];
+	size_t len = strlen(path);
+
+	if (len > 3 && strcmp(path + len - 3, ".db") == 0) len -= 3;
+	snprintf(index_path, sizeof(index_path), "%.*s%s", (int)len, path, VDB_INDEX_EXT);
+	unlink(index_path);
+}
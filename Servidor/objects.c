@@ -0,0 +1,1261 @@
+/**
+ * @file
+ * @brief Implementacion del almacen de contenidos direccionado por hash
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "objects.h"
+#include "delta.h"
+#include "lz.h"
+#include "pack.h"
+
+/**
+ * @brief Encabezado de un contenido guardado como diferencia, despues de OBJECT_DELTA_MAGIC
+ */
+typedef struct {
+	uint8_t base[32]; /**< SHA-256 del contenido base */
+	uint32_t depth; /**< Diferencias en la cadena hasta un contenido completo, contando esta */
+	uint64_t size; /**< Tamaño del contenido */
+} sobject_delta;
+
+#define DELTA_HEADER_SIZE (sizeof(OBJECT_DELTA_MAGIC) - 1 + 32 + 4 + 8) /**< Bytes del identificador y el encabezado */
+#define COMPRESSED_HEADER_SIZE (sizeof(OBJECT_COMPRESSED_MAGIC) - 1 + 4 + 4 + 8 + 4) /**< Bytes del identificador y el encabezado, sin la tabla de bloques */
+#define PACK_CANDIDATES_MIN 256 /**< Capacidad inicial de la lista de contenidos por empaquetar */
+
+/**
+ * @brief Sufijo de cada forma de guardar un contenido; su posicion es la forma en el indice de los paquetes
+ */
+static const char *const object_kinds[] = { "", OBJECT_RECIPE_SUFFIX, OBJECT_DELTA_SUFFIX, OBJECT_COMPRESSED_SUFFIX };
+
+/**
+ * @brief Archivo de un contenido que se puede empaquetar
+ */
+typedef struct {
+	uint8_t hash[32]; /**< SHA-256 del contenido */
+	uint8_t kind; /**< Forma en que se guardo, posicion en object_kinds */
+	uint8_t packed; /**< 1 si se agrego al paquete */
+} spack_candidate;
+
+/**
+ * @brief Bloques de un contenido comprimido que se esta leyendo
+ */
+struct sobject_blocks {
+	uint32_t block_size; /**< Bytes de cada bloque descomprimido, salvo el ultimo */
+	uint32_t count; /**< Cantidad de bloques */
+	uint64_t size; /**< Tamaño del contenido */
+	off_t *offsets; /**< Posicion de cada bloque en el archivo, count + 1 (la ultima es el final) */
+	uint8_t *packed; /**< Buffer de un bloque guardado */
+	uint8_t *plain; /**< Bloque descomprimido */
+	uint32_t current; /**< Bloque que esta en plain, count si ninguno */
+};
+
+/**
+ * @brief Contenido reconstruido en la cache
+ */
+typedef struct {
+	char hash[OBJECT_HASH_LEN + 1]; /**< Hash del contenido, vacio si la posicion esta libre */
+	int fd; /**< Archivo en memoria (memfd) con el contenido */
+	off_t size; /**< Tamaño del contenido */
+	uint64_t used; /**< Momento del ultimo uso, para descartar el usado hace mas tiempo */
+} sdelta_cached;
+
+/**
+ * @brief Cache de contenidos reconstruidos, compartida por los hilos trabajadores
+ */
+static struct {
+	pthread_mutex_t lock; /**< Candado de la cache */
+	sdelta_cached entries[OBJECT_DELTA_CACHE_ENTRIES]; /**< Contenidos */
+	size_t bytes; /**< Memoria usada */
+	uint64_t clock; /**< Contador de usos */
+} delta_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Crea un directorio si no existe
+ *
+ * @param path Ruta del directorio
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int ensure_dir(const char *path);
+
+/**
+ * @brief Sincroniza un directorio para que sus entradas nuevas lleguen a disco
+ *
+ * @param path Ruta del directorio
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int sync_dir(const char *path);
+
+/**
+ * @brief Ruta de un contenido guardado con un sufijo (lista de fragmentos, diferencia o comprimido)
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param suffix Sufijo
+ * @param path Buffer de PATH_MAX + sizeof(OBJECT_RECIPE_SUFFIX) bytes
+ * @return 0 en caso de exito, -1 si el hash no es valido
+ */
+static int suffix_path(const char *root, const char *hash, const char *suffix, char *path);
+
+/**
+ * @brief Abre un contenido guardado en una forma, empaquetado o en su archivo
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param suffix Sufijo de la forma, uno de object_kinds
+ * @param base Posicion del contenido guardado en el descriptor
+ * @param size Bytes guardados
+ * @param borrowed 1 si el descriptor es de un paquete y no se cierra
+ * @return Descriptor abierto para lectura, -1 si no esta guardado en esa forma
+ */
+static int stored_open(const char *root, const char *hash, const char *suffix, off_t *base, off_t *size, int *borrowed);
+
+/**
+ * @brief Busca un contenido guardado en una forma en el indice de los paquetes
+ *
+ * @param hash SHA-256 del contenido
+ * @param suffix Sufijo de la forma
+ * @param base Posicion del contenido guardado en el paquete
+ * @param size Bytes guardados
+ * @return Descriptor del paquete (no se cierra), -1 si no esta empaquetado en esa forma
+ */
+static int packed_open(const uint8_t *hash, const char *suffix, off_t *base, off_t *size);
+
+/**
+ * @brief Cierra un descriptor de stored_open
+ *
+ * @param fd Descriptor
+ * @param borrowed 1 si es de un paquete
+ */
+static void stored_close(int fd, int borrowed);
+
+/**
+ * @brief Abre la diferencia de un contenido y lee su encabezado
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param header Encabezado
+ * @param base Posicion de la diferencia en el descriptor
+ * @param size Bytes de la diferencia, con el encabezado
+ * @param borrowed 1 si el descriptor es de un paquete y no se cierra
+ * @return Descriptor abierto para lectura, -1 si no existe o no es valida
+ */
+static int delta_open(const char *root, const char *hash, sobject_delta *header, off_t *base, off_t *size, int *borrowed);
+
+/**
+ * @brief Abre un contenido comprimido y lee su tabla de bloques
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param blocks Bloques del contenido (se liberan con free)
+ * @param size Tamaño del contenido descomprimido
+ * @param borrowed 1 si el descriptor es de un paquete y no se cierra
+ * @return Descriptor abierto para lectura, -1 si no existe, su codec no se conoce o no es valido
+ */
+static int compressed_open(const char *root, const char *hash, struct sobject_blocks **blocks, off_t *size, int *borrowed);
+
+/**
+ * @brief Agrega al paquete los archivos de los contenidos y los marca, o elimina los que ya estaban empaquetados
+ *
+ * @param root Directorio del repositorio
+ * @param writer Contenidos que se agregan
+ * @param list Archivos ordenados por hash
+ * @param count Cantidad de archivos
+ * @return Contenidos agregados, -1 si ocurre un error
+ */
+static int repack_add(const char *root, spack_writer *writer, spack_candidate *list, size_t count);
+
+/**
+ * @brief Compara dos archivos por hash y forma
+ *
+ * @param a Primer archivo
+ * @param b Segundo archivo
+ * @return Menor, igual o mayor a 0 como memcmp
+ */
+static int candidate_compare(const void *a, const void *b);
+
+/**
+ * @brief Descomprime el bloque de la posicion actual de una parte comprimida y copia lo que se pide de el
+ *
+ * @param reader Lector, con una parte comprimida y bytes para leer
+ * @param buffer Buffer
+ * @param size Bytes maximos
+ * @return Bytes leidos, -1 si ocurre un error o el bloque no es valido
+ */
+static ssize_t blocks_read(sobject_reader *reader, void *buffer, size_t size);
+
+/**
+ * @brief Cierra la parte que se esta leyendo
+ *
+ * @param reader Lector
+ */
+static void part_close(sobject_reader *reader);
+
+/**
+ * @brief Lee en memoria un contenido completo, comprimido o guardado como diferencia
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param depth Diferencias ya recorridas para llegar a este contenido
+ * @param data Buffer creado con malloc con el contenido
+ * @param size Tamaño del contenido
+ * @return 0 en caso de exito, -1 si no existe, mide mas de OBJECT_DELTA_MAX_SIZE o no se puede reconstruir
+ */
+static int object_load(const char *root, const char *hash, uint32_t depth, uint8_t **data, size_t *size);
+
+/**
+ * @brief Reconstruye un contenido guardado como diferencia y lo agrega a la cache
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param depth Diferencias ya recorridas para llegar a este contenido
+ * @param data Buffer creado con malloc con el contenido, NULL si no se necesita
+ * @param size Tamaño del contenido
+ * @return Archivo en memoria con el contenido, -1 si ocurre un error
+ */
+static int delta_rebuild(const char *root, const char *hash, uint32_t depth, uint8_t **data, size_t *size);
+
+/**
+ * @brief Busca un contenido reconstruido en la cache
+ *
+ * @param hash Hash del contenido
+ * @param size Tamaño del contenido
+ * @return Copia del descriptor del archivo en memoria (se cierra con close), -1 si no esta
+ */
+static int cache_find(const char *hash, off_t *size);
+
+/**
+ * @brief Copia un contenido a un archivo en memoria y lo agrega a la cache
+ *
+ * Si no cabe en OBJECT_DELTA_CACHE_BUDGET se descartan los contenidos usados hace mas tiempo.
+ *
+ * @param hash Hash del contenido
+ * @param data Contenido
+ * @param size Tamaño del contenido
+ * @return Descriptor del archivo en memoria (se cierra con close), -1 si ocurre un error
+ */
+static int cache_add(const char *hash, const uint8_t *data, size_t size);
+
+/**
+ * @brief Convierte un hash hexadecimal a binario
+ *
+ * @param hex Hash de OBJECT_HASH_LEN caracteres
+ * @param hash SHA-256 (32 bytes)
+ */
+static void hex_bytes(const char *hex, uint8_t *hash);
+
+/**
+ * @brief Lee exactamente size bytes desde una posicion de un archivo
+ *
+ * @param fd Archivo
+ * @param buffer Buffer
+ * @param size Bytes
+ * @param off Posicion
+ * @return 0 en caso de exito, -1 si ocurre un error o el archivo es mas corto
+ */
+static int read_full(int fd, void *buffer, size_t size, off_t off);
+
+/**
+ * @brief Escribe exactamente size bytes en un archivo
+ *
+ * @param fd Archivo
+ * @param data Bytes
+ * @param size Cantidad de bytes
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int write_full(int fd, const void *data, size_t size);
+
+int objects_init(const char *root) {
+	char path[PATH_MAX];
+	struct dirent *entry;
+	struct stat st;
+	time_t now = time(NULL);
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "%s/%s", root, OBJECTS_DIR);
+	if (ensure_dir(path) < 0) return -1;
+	snprintf(path, sizeof(path), "%s/%s/%s", root, OBJECTS_DIR, OBJECTS_TMP_DIR);
+	if (ensure_dir(path) < 0 || !(dir = opendir(path))) return -1;
+
+	// Los temporales que quedaron son recepciones interrumpidas
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') continue;
+		unlinkat(dirfd(dir), entry->d_name, 0);
+	}
+	closedir(dir);
+
+	snprintf(path, sizeof(path), "%s/%s/%s", root, OBJECTS_DIR, PACK_DIR);
+	if (pack_init(path) < 0) return -1;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", root, OBJECTS_DIR, OBJECTS_PARTIAL_DIR);
+	if (ensure_dir(path) < 0 || !(dir = opendir(path))) return -1;
+
+	// Las recepciones interrumpidas se conservan para continuarlas, salvo las abandonadas
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') continue;
+		if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && now - st.st_mtime > OBJECT_PARTIAL_TTL)
+			unlinkat(dirfd(dir), entry->d_name, 0);
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+int objects_repack(const char *root, int min_age) {
+	char path[PATH_MAX], name[OBJECT_HASH_LEN + 1];
+	spack_candidate *list = NULL, *grown;
+	size_t count = 0, cap = 0;
+	struct dirent *entry, *sub, *file;
+	spack_writer writer;
+	struct stat st;
+	time_t now = time(NULL);
+	DIR *top, *dir, *leaf;
+	int packed = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", root, OBJECTS_DIR);
+	if (!(top = opendir(path))) return -1;
+
+	// Solo objects/ab/cd/<hash><sufijo>: tmp, partial y pack no tienen nombres de dos caracteres hexadecimales
+	while ((entry = readdir(top)) != NULL) {
+		int fd;
+
+		if (strlen(entry->d_name) != 2 || !isxdigit((unsigned char)entry->d_name[0]) || !isxdigit((unsigned char)entry->d_name[1])) continue;
+		if ((fd = openat(dirfd(top), entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) continue;
+		if (!(dir = fdopendir(fd))) {
+			close(fd);
+			continue;
+		}
+
+		while ((sub = readdir(dir)) != NULL) {
+			if (strlen(sub->d_name) != 2 || (fd = openat(dirfd(dir), sub->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) continue;
+			if (!(leaf = fdopendir(fd))) {
+				close(fd);
+				continue;
+			}
+
+			while ((file = readdir(leaf)) != NULL) {
+				size_t kind = sizeof(object_kinds) / sizeof(object_kinds[0]);
+
+				if (strlen(file->d_name) < OBJECT_HASH_LEN) continue;
+				snprintf(name, sizeof(name), "%s", file->d_name);
+				if (!object_valid_hash(name)) continue;
+				while (kind-- > 0 && strcmp(file->d_name + OBJECT_HASH_LEN, object_kinds[kind]) != 0);
+				if (kind == (size_t)-1) continue;
+
+				// Los archivos recientes pueden estar por convertirse a otra forma (store_delta, store_compressed)
+				if (fstatat(dirfd(leaf), file->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode) || st.st_size > OBJECT_PACK_MAX ||
+					now - st.st_mtime < min_age)
+					continue;
+
+				if (count == cap) {
+					cap = cap ? 2 * cap : PACK_CANDIDATES_MIN;
+					if (!(grown = realloc(list, cap * sizeof(spack_candidate)))) {
+						closedir(leaf);
+						closedir(dir);
+						goto error;
+					}
+					list = grown;
+				}
+				hex_bytes(name, list[count].hash);
+				list[count].kind = kind;
+				list[count].packed = 0;
+				count++;
+			}
+			closedir(leaf);
+		}
+		closedir(dir);
+	}
+	closedir(top);
+	top = NULL;
+
+	if (count == 0) {
+		free(list);
+		return 0;
+	}
+
+	// Ordenados por hash: las formas de un mismo contenido quedan juntas
+	qsort(list, count, sizeof(spack_candidate), candidate_compare);
+	if (pack_begin(&writer) < 0) goto error;
+	if ((packed = repack_add(root, &writer, list, count)) < 0) {
+		pack_abort(&writer);
+		goto error;
+	}
+	if (pack_commit(&writer) < 0) goto error;
+
+	// Los archivos se eliminan despues de publicar el indice: una lectura encuentra el contenido en uno u otro
+	for (size_t i = 0; i < count; i++) {
+		if (!list[i].packed) continue;
+		object_hex(list[i].hash, name);
+		if (suffix_path(root, name, object_kinds[list[i].kind], path) == 0) unlink(path);
+	}
+
+	free(list);
+	return packed;
+
+error:
+	if (top) closedir(top);
+	free(list);
+	return -1;
+}
+
+int object_valid_hash(const char *hash) {
+	size_t i;
+	for (i = 0; hash[i] != '\0'; i++) {
+		if (!((hash[i] >= '0' && hash[i] <= '9') || (hash[i] >= 'a' && hash[i] <= 'f'))) return 0;
+	}
+	return i == OBJECT_HASH_LEN;
+}
+
+int object_path(const char *root, const char *hash, char *path) {
+	if (!object_valid_hash(hash)) return -1;
+	snprintf(path, PATH_MAX, "%s/%s/%.2s/%.2s/%s", root, OBJECTS_DIR, hash, hash + 2, hash);
+	return 0;
+}
+
+void object_hex(const uint8_t *hash, char *hex) {
+	static const char digits[] = "0123456789abcdef";
+
+	for (int i = 0; i < OBJECT_HASH_LEN / 2; i++) {
+		hex[2 * i] = digits[hash[i] >> 4];
+		hex[2 * i + 1] = digits[hash[i] & 0xf];
+	}
+	hex[OBJECT_HASH_LEN] = '\0';
+}
+
+int object_exists(const char *root, const char *hash) {
+	char path[PATH_MAX + sizeof(OBJECT_RECIPE_SUFFIX)];
+	uint8_t key[32];
+	spack_entry entry;
+	struct stat st;
+
+	if (object_path(root, hash, path) < 0) return 0;
+	hex_bytes(hash, key);
+	if (pack_find(key, &entry) >= 0) return 1;
+	if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) return 1;
+	if (suffix_path(root, hash, OBJECT_RECIPE_SUFFIX, path) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode)) return 1;
+	if (suffix_path(root, hash, OBJECT_COMPRESSED_SUFFIX, path) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode)) return 1;
+	if (suffix_path(root, hash, OBJECT_DELTA_SUFFIX, path) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode)) return 1;
+	return pack_find(key, &entry) >= 0; // Se empaqueto mientras se buscaba su archivo
+}
+
+int object_create(const char *root, sobject_writer *writer, const char *hash) {
+	int fd;
+
+	writer->tmp_path[0] = '\0';
+	writer->partial = 0;
+	writer->suffix = "";
+	if (hash && !object_valid_hash(hash)) return -1;
+
+	snprintf(writer->hash, sizeof(writer->hash), "%s", hash ? hash : "");
+	snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s/%s/%s/%.16s.XXXXXX", root, OBJECTS_DIR, OBJECTS_TMP_DIR, hash ? hash : "stream");
+
+	if ((fd = mkostemp(writer->tmp_path, O_CLOEXEC)) < 0) {
+		writer->tmp_path[0] = '\0';
+		return -1;
+	}
+
+	fchmod(fd, 0644);
+	return fd;
+}
+
+int object_resume(const char *root, sobject_writer *writer, const char *hash, const char *key, off_t *size) {
+	struct stat st, current;
+	int fd;
+
+	*size = 0;
+	writer->tmp_path[0] = '\0';
+	writer->partial = 0;
+	writer->suffix = "";
+	if ((hash && !object_valid_hash(hash)) || !object_valid_hash(key)) return -1;
+
+	snprintf(writer->hash, sizeof(writer->hash), "%s", hash ? hash : "");
+	snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s/%s/%s/%s", root, OBJECTS_DIR, OBJECTS_PARTIAL_DIR, key);
+
+	if ((fd = open(writer->tmp_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		writer->tmp_path[0] = '\0';
+		return -1;
+	}
+
+	// Otra conexion lo esta recibiendo, o lo publico o descarto entre open y flock
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0 || fstat(fd, &st) < 0 || stat(writer->tmp_path, &current) < 0 ||
+		st.st_ino != current.st_ino || st.st_dev != current.st_dev) {
+		close(fd);
+		return object_create(root, writer, hash);
+	}
+
+	writer->partial = 1;
+	*size = st.st_size;
+	return fd;
+}
+
+int object_create_recipe(const char *root, sobject_writer *writer, const char *hash, const sobject_chunk *chunks, uint32_t count) {
+	unsigned char header[sizeof(OBJECT_RECIPE_MAGIC) - 1 + sizeof(uint32_t)];
+	int fd;
+
+	if (!hash || (fd = object_create(root, writer, hash)) < 0) return -1;
+
+	memcpy(header, OBJECT_RECIPE_MAGIC, sizeof(OBJECT_RECIPE_MAGIC) - 1);
+	memcpy(header + sizeof(OBJECT_RECIPE_MAGIC) - 1, &count, sizeof(uint32_t));
+	if (write_full(fd, header, sizeof(header)) < 0 || write_full(fd, chunks, count * sizeof(sobject_chunk)) < 0) {
+		close(fd);
+		object_abort(writer);
+		return -1;
+	}
+
+	writer->suffix = OBJECT_RECIPE_SUFFIX;
+	return fd;
+}
+
+int object_create_delta(const char *root, sobject_writer *writer, const char *hash, const char *base, uint32_t max_depth) {
+	unsigned char header[DELTA_HEADER_SIZE];
+	uint8_t *target = NULL, *source = NULL, *delta = NULL, *check = NULL;
+	size_t target_size, source_size, delta_size;
+	char current[OBJECT_HASH_LEN + 1];
+	sobject_delta info;
+	off_t size, base_off;
+	int fd = -1, depth = 1, borrowed;
+
+	if (!object_valid_hash(hash) || !object_valid_hash(base) || strcmp(hash, base) == 0) return -1;
+	if ((fd = object_open(root, hash, &size)) < 0) return -1; // Solo se convierte un contenido completo
+	close(fd);
+	if (size > OBJECT_DELTA_MAX_SIZE || size < 2 * DELTA_BLOCK) return -1;
+
+	// El base no puede depender del contenido: se recorre su cadena hasta un contenido completo
+	snprintf(current, sizeof(current), "%s", base);
+	for (uint32_t i = 0; (fd = delta_open(root, current, &info, &base_off, &size, &borrowed)) >= 0; i++) {
+		stored_close(fd, borrowed);
+		if (i == 0) depth = info.depth + 1;
+		object_hex(info.base, current);
+		if (strcmp(current, hash) == 0 || i == OBJECT_DELTA_CHAIN_LIMIT) return -1;
+	}
+	if (depth >= (int)max_depth) return -1; // Contenido completo: corta la cadena
+
+	if (object_load(root, hash, OBJECT_DELTA_CHAIN_LIMIT, &target, &target_size) < 0) return -1;
+	if (object_load(root, base, 0, &source, &source_size) < 0 ||
+		!(delta = malloc(target_size / 2)) || !(check = malloc(target_size)) ||
+		delta_encode(source, source_size, target, target_size, delta, target_size / 2, &delta_size) != 0 ||
+		delta_apply(source, source_size, delta, delta_size, check, target_size) < 0 || // Nunca se guarda una diferencia que no reconstruye el contenido
+		memcmp(check, target, target_size) != 0 || (fd = object_create(root, writer, hash)) < 0)
+		goto done;
+
+	memset(&info, 0, sizeof info);
+	hex_bytes(base, info.base);
+	info.depth = depth;
+	info.size = target_size;
+	memcpy(header, OBJECT_DELTA_MAGIC, sizeof(OBJECT_DELTA_MAGIC) - 1);
+	memcpy(header + sizeof(OBJECT_DELTA_MAGIC) - 1, info.base, 32);
+	memcpy(header + sizeof(OBJECT_DELTA_MAGIC) - 1 + 32, &info.depth, 4);
+	memcpy(header + sizeof(OBJECT_DELTA_MAGIC) - 1 + 36, &info.size, 8);
+	if (write_full(fd, header, sizeof(header)) < 0 || write_full(fd, delta, delta_size) < 0) {
+		close(fd);
+		object_abort(writer);
+		fd = -1;
+		goto done;
+	}
+	writer->suffix = OBJECT_DELTA_SUFFIX;
+
+	// Sera el base de la siguiente version del mismo archivo
+	int cached = cache_add(hash, target, target_size);
+	if (cached >= 0) close(cached);
+
+done:
+	free(target);
+	free(source);
+	free(delta);
+	free(check);
+	return fd;
+}
+
+int object_create_compressed(const char *root, sobject_writer *writer, const char *hash) {
+	unsigned char header[COMPRESSED_HEADER_SIZE] = { 0 };
+	uint8_t *plain = NULL, *packed = NULL;
+	uint32_t *table = NULL, count, block_size = OBJECT_BLOCK_SIZE;
+	off_t size, total;
+	int source, fd = -1;
+
+	if ((source = object_open(root, hash, &size)) < 0) return -1; // Solo se comprime un contenido completo
+	count = (size + OBJECT_BLOCK_SIZE - 1) / OBJECT_BLOCK_SIZE;
+	total = COMPRESSED_HEADER_SIZE + (off_t)count * sizeof(uint32_t);
+	if (size < OBJECT_COMPRESS_MIN || !(plain = malloc(OBJECT_BLOCK_SIZE)) || !(packed = malloc(OBJECT_BLOCK_SIZE)) ||
+		!(table = malloc(count * sizeof(uint32_t))))
+		goto done;
+
+	// Prueba: si el primer bloque no se reduce lo suficiente, el contenido probablemente tampoco
+	size_t first = size < OBJECT_BLOCK_SIZE ? size : OBJECT_BLOCK_SIZE;
+	if (read_full(source, plain, first, 0) < 0 || !lz_compress(plain, first, packed, first - first / OBJECT_COMPRESS_RATIO) ||
+		(fd = object_create(root, writer, hash)) < 0 || lseek(fd, total, SEEK_SET) < 0)
+		goto error;
+
+	for (uint32_t i = 0; i < count; i++) {
+		size_t length = (i + 1 < count) ? OBJECT_BLOCK_SIZE : size - (off_t)i * OBJECT_BLOCK_SIZE;
+		size_t stored;
+
+		if (read_full(source, plain, length, (off_t)i * OBJECT_BLOCK_SIZE) < 0) goto error;
+
+		// Un bloque que no se reduce se guarda tal cual: mide lo mismo que descomprimido
+		stored = lz_compress(plain, length, packed, length - 1);
+		table[i] = stored ? stored : length;
+		if (write_full(fd, stored ? packed : plain, table[i]) < 0) goto error;
+		total += table[i];
+	}
+	if (total > size - size / OBJECT_COMPRESS_RATIO) goto error;
+
+	memcpy(header, OBJECT_COMPRESSED_MAGIC, sizeof(OBJECT_COMPRESSED_MAGIC) - 1);
+	header[sizeof(OBJECT_COMPRESSED_MAGIC) - 1] = OBJECT_CODEC_LZ;
+	memcpy(header + sizeof(OBJECT_COMPRESSED_MAGIC) - 1 + 4, &block_size, 4);
+	memcpy(header + sizeof(OBJECT_COMPRESSED_MAGIC) - 1 + 8, &size, 8);
+	memcpy(header + sizeof(OBJECT_COMPRESSED_MAGIC) - 1 + 16, &count, 4);
+	if (lseek(fd, 0, SEEK_SET) < 0 || write_full(fd, header, sizeof(header)) < 0 ||
+		write_full(fd, table, count * sizeof(uint32_t)) < 0)
+		goto error;
+
+	writer->suffix = OBJECT_COMPRESSED_SUFFIX;
+	goto done;
+
+error:
+	if (fd >= 0) {
+		close(fd);
+		object_abort(writer);
+		fd = -1;
+	}
+done:
+	close(source);
+	free(plain);
+	free(packed);
+	free(table);
+	return fd;
+}
+
+int object_unlink(const char *root, const char *hash) {
+	char path[PATH_MAX];
+
+	if (object_path(root, hash, path) < 0) return -1;
+	return unlink(path);
+}
+
+int object_publish(const char *root, sobject_writer *writer, int durable) {
+	char path[PATH_MAX + sizeof(OBJECT_RECIPE_SUFFIX)], dir[PATH_MAX];
+
+	if (writer->tmp_path[0] == '\0' || suffix_path(root, writer->hash, writer->suffix, path) < 0) {
+		object_abort(writer);
+		return -1;
+	}
+
+	// objects/ab y objects/ab/cd se crean a medida que se necesitan
+	snprintf(dir, sizeof(dir), "%s/%s/%.2s", root, OBJECTS_DIR, writer->hash);
+	if (ensure_dir(dir) < 0) goto error;
+	snprintf(dir, sizeof(dir), "%s/%s/%.2s/%.2s", root, OBJECTS_DIR, writer->hash, writer->hash + 2);
+	if (ensure_dir(dir) < 0) goto error;
+
+	if (rename(writer->tmp_path, path) < 0) goto error;
+	writer->tmp_path[0] = '\0';
+
+	if (durable && sync_dir(dir) < 0) return -1;
+	return 0;
+
+error:
+	perror("Error publishing version file");
+	object_abort(writer);
+	return -1;
+}
+
+int object_import(const char *root, const char *hash, const char *path) {
+	sobject_writer writer;
+
+	if (!object_valid_hash(hash)) return -1;
+	writer.partial = 0;
+	writer.suffix = "";
+	snprintf(writer.hash, sizeof(writer.hash), "%s", hash);
+	snprintf(writer.tmp_path, sizeof(writer.tmp_path), "%s/%s/%s/%s.import", root, OBJECTS_DIR, OBJECTS_TMP_DIR, hash);
+
+	if (link(path, writer.tmp_path) < 0) return -1;
+	return object_publish(root, &writer, 1);
+}
+
+void object_abort(sobject_writer *writer) {
+	if (writer->tmp_path[0] != '\0') {
+		unlink(writer->tmp_path);
+		writer->tmp_path[0] = '\0';
+	}
+}
+
+void object_suspend(sobject_writer *writer) {
+	if (writer->partial)
+		writer->tmp_path[0] = '\0'; // Queda en objects/partial, el bloqueo se libera al cerrar el descriptor
+	else
+		object_abort(writer);
+}
+
+int object_open(const char *root, const char *hash, off_t *size) {
+	char path[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	if (object_path(root, hash, path) < 0) return -1;
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return -1;
+	}
+
+	*size = st.st_size;
+	return fd;
+}
+
+void object_reader_init(sobject_reader *reader) {
+	memset(reader, 0, sizeof *reader);
+	reader->fd = -1;
+}
+
+int object_reader_open(const char *root, const char *hash, sobject_reader *reader, off_t *size) {
+	unsigned char header[sizeof(OBJECT_RECIPE_MAGIC) - 1 + sizeof(uint32_t)];
+	off_t base, stored;
+	uint32_t count;
+	int fd, borrowed;
+
+	object_reader_init(reader);
+	reader->root = root;
+	if ((reader->fd = stored_open(root, hash, "", &reader->base, size, &reader->borrowed)) >= 0 ||
+		(reader->fd = cache_find(hash, size)) >= 0 ||
+		(reader->fd = compressed_open(root, hash, &reader->blocks, size, &reader->borrowed)) >= 0) {
+		reader->off = reader->base;
+		reader->left = *size;
+		return 0;
+	}
+
+	// Contenido guardado por fragmentos: la lista tiene el identificador, la cantidad y los fragmentos
+	if ((fd = stored_open(root, hash, OBJECT_RECIPE_SUFFIX, &base, &stored, &borrowed)) < 0) {
+		size_t rebuilt;
+
+		// Contenido guardado como diferencia: se lee del contenido reconstruido
+		if ((reader->fd = delta_rebuild(root, hash, 0, NULL, &rebuilt)) < 0) return -1;
+		*size = reader->left = rebuilt;
+		return 0;
+	}
+	if (stored < (off_t)sizeof(header) || read_full(fd, header, sizeof(header), base) < 0 ||
+		memcmp(header, OBJECT_RECIPE_MAGIC, sizeof(OBJECT_RECIPE_MAGIC) - 1) != 0) {
+		stored_close(fd, borrowed);
+		return -1;
+	}
+
+	memcpy(&count, header + sizeof(OBJECT_RECIPE_MAGIC) - 1, sizeof(uint32_t));
+	if (stored != (off_t)(sizeof(header) + (size_t)count * sizeof(sobject_chunk)) ||
+		(count && !(reader->chunks = malloc(count * sizeof(sobject_chunk)))) ||
+		read_full(fd, reader->chunks, count * sizeof(sobject_chunk), base + sizeof(header)) < 0) {
+		stored_close(fd, borrowed);
+		object_reader_close(reader);
+		return -1;
+	}
+	stored_close(fd, borrowed);
+
+	reader->count = count;
+	*size = 0;
+	for (uint32_t i = 0; i < count; i++) *size += reader->chunks[i].size;
+	return 0;
+}
+
+int object_reader_chunks(const char *root, sobject_reader *reader, const sobject_chunk *chunks, uint32_t count) {
+	object_reader_init(reader);
+	reader->root = root;
+	if (count && !(reader->chunks = malloc(count * sizeof(sobject_chunk)))) return -1;
+
+	if (count) memcpy(reader->chunks, chunks, count * sizeof(sobject_chunk));
+	reader->count = count;
+	return 0;
+}
+
+void object_reader_file(sobject_reader *reader, int fd, off_t size) {
+	object_reader_init(reader);
+	reader->fd = fd;
+	reader->borrowed = 1;
+	reader->left = size;
+}
+
+int object_reader_seek(sobject_reader *reader, off_t offset) {
+	off_t start = 0; // Posicion del fragmento en el contenido
+
+	if (!reader->chunks) { // Un solo archivo: off + left es su final
+		off_t end = reader->off + reader->left;
+		if (offset > end - reader->base) return -1;
+		reader->off = reader->base + offset;
+		reader->left = end - reader->off;
+		return 0;
+	}
+
+	part_close(reader);
+	reader->off = reader->left = 0;
+
+	for (reader->next = 0; reader->next < reader->count; reader->next++) {
+		if (offset < start + reader->chunks[reader->next].size) break;
+		start += reader->chunks[reader->next].size;
+	}
+	if (reader->next == reader->count) return offset == start ? 0 : -1;
+
+	if (object_reader_ready(reader) < 0) return -1;
+	reader->off += offset - start;
+	reader->left -= offset - start;
+	return 0;
+}
+
+int object_reader_ready(sobject_reader *reader) {
+	char hash[OBJECT_HASH_LEN + 1];
+	off_t size;
+
+	while (reader->left == 0) {
+		if (!reader->chunks || reader->next == reader->count) return 0;
+
+		sobject_chunk *chunk = &reader->chunks[reader->next++];
+		part_close(reader);
+
+		object_hex(chunk->hash, hash);
+		if ((reader->fd = stored_open(reader->root, hash, "", &reader->base, &size, &reader->borrowed)) < 0)
+			reader->fd = compressed_open(reader->root, hash, &reader->blocks, &size, &reader->borrowed);
+		if (reader->fd >= 0 && size != chunk->size) part_close(reader);
+		if (reader->fd < 0) return -1;
+
+		reader->off = reader->base;
+		reader->left = size;
+	}
+
+	return 1;
+}
+
+int object_reader_direct(const sobject_reader *reader) {
+	return reader->blocks == NULL;
+}
+
+ssize_t object_reader_read(sobject_reader *reader, void *buffer, size_t size) {
+	int ready = object_reader_ready(reader);
+	ssize_t nread;
+
+	if (ready <= 0) return ready;
+	if ((off_t)size > reader->left) size = reader->left;
+	if (reader->blocks) return blocks_read(reader, buffer, size);
+
+	do nread = pread(reader->fd, buffer, size, reader->off);
+	while (nread < 0 && errno == EINTR);
+
+	if (nread == 0) { // El archivo es mas corto que su parte del contenido
+		errno = EIO;
+		return -1;
+	}
+	if (nread < 0) return -1;
+
+	reader->off += nread;
+	reader->left -= nread;
+	return nread;
+}
+
+void object_reader_close(sobject_reader *reader) {
+	part_close(reader);
+	free(reader->chunks);
+	object_reader_init(reader);
+}
+
+static int repack_add(const char *root, spack_writer *writer, spack_candidate *list, size_t count) {
+	char hash[OBJECT_HASH_LEN + 1], path[PATH_MAX + sizeof(OBJECT_RECIPE_SUFFIX)];
+	uint8_t *buffer;
+	spack_entry entry;
+	struct stat st;
+	int packed = 0;
+
+	if (!(buffer = malloc(OBJECT_PACK_MAX))) return -1;
+
+	for (size_t i = 0; i < count; i++) {
+		int fd;
+
+		object_hex(list[i].hash, hash);
+		if (suffix_path(root, hash, object_kinds[list[i].kind], path) < 0) continue;
+
+		// Ya empaquetado en alguna forma: el archivo sobra. Otra forma del mismo contenido se elimina en la siguiente pasada
+		if (pack_find(list[i].hash, &entry) >= 0) {
+			unlink(path);
+			continue;
+		}
+		if (i > 0 && memcmp(list[i].hash, list[i - 1].hash, 32) == 0) continue;
+
+		if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) continue; // Se convirtio a otra forma
+		if (fstat(fd, &st) < 0 || st.st_size > OBJECT_PACK_MAX || read_full(fd, buffer, st.st_size, 0) < 0) {
+			close(fd);
+			continue;
+		}
+		close(fd);
+
+		if (pack_add(writer, list[i].hash, list[i].kind, buffer, st.st_size) < 0) {
+			free(buffer);
+			return -1;
+		}
+		list[i].packed = 1;
+		packed++;
+	}
+
+	free(buffer);
+	return packed;
+}
+
+static int candidate_compare(const void *a, const void *b) {
+	const spack_candidate *x = a, *y = b;
+	int cmp = memcmp(x->hash, y->hash, 32);
+
+	return cmp ? cmp : (int)x->kind - (int)y->kind;
+}
+
+static int ensure_dir(const char *path) {
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) return -1;
+	return 0;
+}
+
+static int sync_dir(const char *path) {
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	int status;
+
+	if (fd < 0) return -1;
+	status = fsync(fd);
+	close(fd);
+	return status;
+}
+
+static int suffix_path(const char *root, const char *hash, const char *suffix, char *path) {
+	if (object_path(root, hash, path) < 0) return -1;
+	strcat(path, suffix);
+	return 0;
+}
+
+static int stored_open(const char *root, const char *hash, const char *suffix, off_t *base, off_t *size, int *borrowed) {
+	char path[PATH_MAX + sizeof(OBJECT_RECIPE_SUFFIX)];
+	uint8_t key[32];
+	struct stat st;
+	int fd;
+
+	*base = 0;
+	*borrowed = 0;
+	if (suffix_path(root, hash, suffix, path) < 0) return -1;
+
+	hex_bytes(hash, key);
+	if ((fd = packed_open(key, suffix, base, size)) >= 0) {
+		*borrowed = 1;
+		return fd;
+	}
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		// objects_repack pudo empaquetarlo y eliminar el archivo despues de buscarlo en el indice
+		if (errno == ENOENT && (fd = packed_open(key, suffix, base, size)) >= 0) *borrowed = 1;
+		return fd;
+	}
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return -1;
+	}
+	*size = st.st_size;
+	return fd;
+}
+
+static int packed_open(const uint8_t *hash, const char *suffix, off_t *base, off_t *size) {
+	spack_entry entry;
+	int fd = pack_find(hash, &entry);
+
+	if (fd < 0 || entry.kind >= sizeof(object_kinds) / sizeof(object_kinds[0]) || strcmp(object_kinds[entry.kind], suffix) != 0)
+		return -1;
+	*base = entry.offset;
+	*size = entry.length;
+	return fd;
+}
+
+static void stored_close(int fd, int borrowed) {
+	if (!borrowed) close(fd);
+}
+
+static int delta_open(const char *root, const char *hash, sobject_delta *header, off_t *base, off_t *size, int *borrowed) {
+	unsigned char buffer[DELTA_HEADER_SIZE];
+	int fd;
+
+	if ((fd = stored_open(root, hash, OBJECT_DELTA_SUFFIX, base, size, borrowed)) < 0) return -1;
+	if (*size < (off_t)sizeof(buffer) || read_full(fd, buffer, sizeof(buffer), *base) < 0 ||
+		memcmp(buffer, OBJECT_DELTA_MAGIC, sizeof(OBJECT_DELTA_MAGIC) - 1) != 0) {
+		stored_close(fd, *borrowed);
+		return -1;
+	}
+
+	memcpy(header->base, buffer + sizeof(OBJECT_DELTA_MAGIC) - 1, 32);
+	memcpy(&header->depth, buffer + sizeof(OBJECT_DELTA_MAGIC) - 1 + 32, 4);
+	memcpy(&header->size, buffer + sizeof(OBJECT_DELTA_MAGIC) - 1 + 36, 8);
+	return fd;
+}
+
+static int object_load(const char *root, const char *hash, uint32_t depth, uint8_t **data, size_t *size) {
+	sobject_reader reader;
+	off_t full, done = 0;
+	int fd;
+
+	*data = NULL;
+	object_reader_init(&reader);
+	if ((reader.fd = stored_open(root, hash, "", &reader.base, &full, &reader.borrowed)) < 0 &&
+		(reader.fd = cache_find(hash, &full)) < 0 &&
+		(reader.fd = compressed_open(root, hash, &reader.blocks, &full, &reader.borrowed)) < 0) {
+		if ((fd = delta_rebuild(root, hash, depth, data, size)) < 0) return -1;
+		close(fd);
+		return 0;
+	}
+
+	reader.off = reader.base;
+	reader.left = full;
+	if (full > OBJECT_DELTA_MAX_SIZE || !(*data = malloc(full ? full : 1))) goto error;
+	while (done < full) {
+		ssize_t nread = object_reader_read(&reader, *data + done, full - done);
+		if (nread <= 0) goto error;
+		done += nread;
+	}
+
+	object_reader_close(&reader);
+	*size = full;
+	return 0;
+
+error:
+	free(*data);
+	*data = NULL;
+	object_reader_close(&reader);
+	return -1;
+}
+
+static int compressed_open(const char *root, const char *hash, struct sobject_blocks **blocks, off_t *size, int *borrowed) {
+	unsigned char header[COMPRESSED_HEADER_SIZE];
+	struct sobject_blocks *info = NULL;
+	uint32_t *table = NULL, block_size, count;
+	uint64_t full;
+	off_t off, base, stored;
+	int fd;
+
+	if ((fd = stored_open(root, hash, OBJECT_COMPRESSED_SUFFIX, &base, &stored, borrowed)) < 0) return -1;
+	if (stored < (off_t)sizeof(header) || read_full(fd, header, sizeof(header), base) < 0 ||
+		memcmp(header, OBJECT_COMPRESSED_MAGIC, sizeof(OBJECT_COMPRESSED_MAGIC) - 1) != 0 ||
+		header[sizeof(OBJECT_COMPRESSED_MAGIC) - 1] != OBJECT_CODEC_LZ) // Codec que esta version no conoce
+		goto error;
+
+	memcpy(&block_size, header + sizeof(OBJECT_COMPRESSED_MAGIC) - 1 + 4, 4);
+	memcpy(&full, header + sizeof(OBJECT_COMPRESSED_MAGIC) - 1 + 8, 8);
+	memcpy(&count, header + sizeof(OBJECT_COMPRESSED_MAGIC) - 1 + 16, 4);
+	if (block_size == 0 || block_size > OBJECT_BLOCK_SIZE || count != (full + block_size - 1) / block_size ||
+		stored < (off_t)(sizeof(header) + (size_t)count * sizeof(uint32_t)) || !(table = malloc(count * sizeof(uint32_t) + 1)) ||
+		read_full(fd, table, count * sizeof(uint32_t), base + sizeof(header)) < 0)
+		goto error;
+
+	// Una sola reserva: la estructura, las posiciones de los bloques y los dos buffers
+	if (!(info = malloc(sizeof(*info) + (count + 1) * sizeof(off_t) + 2 * (size_t)block_size))) goto error;
+	info->block_size = block_size;
+	info->count = info->current = count;
+	info->size = full;
+	info->offsets = (off_t *)(info + 1);
+	info->packed = (uint8_t *)(info->offsets + count + 1);
+	info->plain = info->packed + block_size;
+
+	off = base + sizeof(header) + (off_t)count * sizeof(uint32_t);
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t length = (i + 1 < count) ? block_size : full - (uint64_t)i * block_size;
+		if (table[i] == 0 || table[i] > length) goto error;
+		info->offsets[i] = off;
+		off += table[i];
+	}
+	info->offsets[count] = off;
+	if (off != base + stored) goto error;
+
+	free(table);
+	*blocks = info;
+	*size = full;
+	return fd;
+
+error:
+	free(table);
+	free(info);
+	stored_close(fd, *borrowed);
+	return -1;
+}
+
+static ssize_t blocks_read(sobject_reader *reader, void *buffer, size_t size) {
+	struct sobject_blocks *blocks = reader->blocks;
+	uint32_t index = reader->off / blocks->block_size;
+	size_t start = reader->off % blocks->block_size;
+	size_t length = (index + 1 < blocks->count) ? blocks->block_size : blocks->size - (uint64_t)index * blocks->block_size;
+
+	if (index >= blocks->count) {
+		errno = EIO;
+		return -1;
+	}
+	if (index != blocks->current) {
+		size_t stored = blocks->offsets[index + 1] - blocks->offsets[index];
+
+		// Un bloque que mide lo mismo que descomprimido se guardo tal cual
+		blocks->current = blocks->count;
+		if (read_full(reader->fd, stored == length ? blocks->plain : blocks->packed, stored, blocks->offsets[index]) < 0) {
+			errno = EIO;
+			return -1;
+		}
+		if (stored != length && lz_decompress(blocks->packed, stored, blocks->plain, length) != (ssize_t)length) {
+			errno = EIO;
+			return -1;
+		}
+		blocks->current = index;
+	}
+
+	if (size > length - start) size = length - start;
+	memcpy(buffer, blocks->plain + start, size);
+	reader->off += size;
+	reader->left -= size;
+	return size;
+}
+
+static void part_close(sobject_reader *reader) {
+	if (reader->fd >= 0 && !reader->borrowed) close(reader->fd);
+	free(reader->blocks);
+	reader->blocks = NULL;
+	reader->borrowed = 0;
+	reader->base = 0;
+	reader->fd = -1;
+}
+
+static int delta_rebuild(const char *root, const char *hash, uint32_t depth, uint8_t **data, size_t *size) {
+	uint8_t *source = NULL, *delta = NULL, *target = NULL;
+	char base[OBJECT_HASH_LEN + 1];
+	size_t source_size;
+	sobject_delta header;
+	off_t file_size, base_off;
+	int fd, memfd = -1, borrowed;
+
+	if (data) *data = NULL;
+	if (depth >= OBJECT_DELTA_CHAIN_LIMIT || (fd = delta_open(root, hash, &header, &base_off, &file_size, &borrowed)) < 0) return -1;
+
+	// El base se lee completo (de la cache si ya se reconstruyo) y se aplican las operaciones
+	object_hex(header.base, base);
+	if (header.size <= OBJECT_DELTA_MAX_SIZE && (delta = malloc(file_size - DELTA_HEADER_SIZE + 1)) &&
+		read_full(fd, delta, file_size - DELTA_HEADER_SIZE, base_off + DELTA_HEADER_SIZE) == 0 &&
+		object_load(root, base, depth + 1, &source, &source_size) == 0 && (target = malloc(header.size + 1)) &&
+		delta_apply(source, source_size, delta, file_size - DELTA_HEADER_SIZE, target, header.size) == 0)
+		memfd = cache_add(hash, target, header.size);
+
+	stored_close(fd, borrowed);
+	free(source);
+	free(delta);
+	if (memfd >= 0 && data)
+		*data = target;
+	else
+		free(target);
+	*size = header.size;
+	return memfd;
+}
+
+static int cache_find(const char *hash, off_t *size) {
+	int fd = -1;
+
+	pthread_mutex_lock(&delta_cache.lock);
+	for (int i = 0; i < OBJECT_DELTA_CACHE_ENTRIES; i++) {
+		sdelta_cached *entry = &delta_cache.entries[i];
+		if (strcmp(entry->hash, hash) != 0 || entry->hash[0] == '\0') continue;
+
+		if ((fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0)) >= 0) { // El descartado de la cache no cierra la copia
+			entry->used = ++delta_cache.clock;
+			*size = entry->size;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&delta_cache.lock);
+	return fd;
+}
+
+static int cache_add(const char *hash, const uint8_t *data, size_t size) {
+	sdelta_cached *slot = NULL;
+	int fd;
+
+	if ((fd = memfd_create("object", MFD_CLOEXEC)) < 0) return -1;
+	if (write_full(fd, data, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (size > OBJECT_DELTA_CACHE_BUDGET) return fd;
+
+	pthread_mutex_lock(&delta_cache.lock);
+	for (int i = 0; i < OBJECT_DELTA_CACHE_ENTRIES; i++) {
+		if (strcmp(delta_cache.entries[i].hash, hash) == 0) { // Otro hilo lo reconstruyo al mismo tiempo
+			pthread_mutex_unlock(&delta_cache.lock);
+			return fd;
+		}
+	}
+
+	// Se descartan los usados hace mas tiempo hasta que haya una posicion libre y memoria
+	while (!slot || delta_cache.bytes + size > OBJECT_DELTA_CACHE_BUDGET) {
+		sdelta_cached *oldest = NULL;
+
+		slot = NULL;
+		for (int i = 0; i < OBJECT_DELTA_CACHE_ENTRIES; i++) {
+			sdelta_cached *entry = &delta_cache.entries[i];
+			if (entry->hash[0] == '\0') {
+				if (!slot) slot = entry;
+			}
+			else if (!oldest || entry->used < oldest->used)
+				oldest = entry;
+		}
+		if (slot && delta_cache.bytes + size <= OBJECT_DELTA_CACHE_BUDGET) break;
+
+		close(oldest->fd);
+		delta_cache.bytes -= oldest->size;
+		oldest->hash[0] = '\0';
+		slot = oldest;
+	}
+
+	if ((slot->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) >= 0) {
+		snprintf(slot->hash, sizeof(slot->hash), "%s", hash);
+		slot->size = size;
+		slot->used = ++delta_cache.clock;
+		delta_cache.bytes += size;
+	}
+	pthread_mutex_unlock(&delta_cache.lock);
+	return fd;
+}
+
+static void hex_bytes(const char *hex, uint8_t *hash) {
+	for (int i = 0; i < OBJECT_HASH_LEN / 2; i++) {
+		char digits[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+		hash[i] = strtoul(digits, NULL, 16);
+	}
+}
+
+static int read_full(int fd, void *buffer, size_t size, off_t off) {
+	char *next = buffer;
+
+	while (size > 0) {
+		ssize_t nread = pread(fd, next, size, off);
+		if (nread < 0 && errno == EINTR) continue;
+		if (nread <= 0) return -1;
+		next += nread;
+		off += nread;
+		size -= nread;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *data, size_t size) {
+	const char *next = data;
+
+	while (size > 0) {
+		ssize_t nwritten = write(fd, next, size);
+		if (nwritten < 0 && errno == EINTR) continue;
+		if (nwritten < 0) return -1;
+		next += nwritten;
+		size -= nwritten;
+	}
+	return 0;
+}
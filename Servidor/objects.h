@@ -0,0 +1,397 @@
+/**
+ * @file
+ * @brief Almacen de contenidos direccionado por hash
+ *
+ * Cada contenido se guarda una sola vez en objects/ab/cd/<hash>, donde ab y cd
+ * son los primeros caracteres del hash. Los dos niveles de directorios
+ * mantienen pocos archivos por directorio aun con millones de contenidos.
+ *
+ * Los contenidos se reciben en un archivo temporal (objects/tmp) y se publican
+ * con rename: una lectura nunca ve un contenido escrito a medias.
+ *
+ * Un contenido que se puede continuar si la recepcion se interrumpe se recibe en
+ * objects/partial/<clave> y se conserva al desconectarse el cliente; la conexion
+ * que lo recibe lo tiene bloqueado (flock) hasta publicarlo, descartarlo o cerrarlo.
+ *
+ * Un contenido grande se puede guardar por fragmentos: cada fragmento es un contenido
+ * del almacen y objects/ab/cd/<hash>.recipe lista sus hashes en orden. Un cambio
+ * pequeño en un archivo solo agrega los fragmentos que cambiaron.
+ *
+ * Un contenido pequeño tambien se puede guardar como diferencia contra otro
+ * (objects/ab/cd/<hash>.delta, ver delta.h). La diferencia puede ser contra otra
+ * diferencia: al leerla se reconstruye la cadena hasta un contenido completo, y los
+ * contenidos reconstruidos se conservan en una cache en memoria (hasta
+ * OBJECT_DELTA_CACHE_BUDGET bytes) para las siguientes lecturas y diferencias.
+ *
+ * Un contenido que no se guardo como diferencia se puede guardar comprimido
+ * (objects/ab/cd/<hash>.z) por bloques independientes de OBJECT_BLOCK_SIZE bytes:
+ * una lectura desde cualquier posicion solo descomprime los bloques que lee. El
+ * encabezado indica el codec (OBJECT_CODEC_LZ, ver lz.h); un bloque que no se reduce
+ * se guarda tal cual, y el contenido no se comprime si la prueba con su primer
+ * bloque o el resultado no ahorran al menos 1/OBJECT_COMPRESS_RATIO.
+ *
+ * Los contenidos pequeños (hasta OBJECT_PACK_MAX bytes guardados, en cualquiera de
+ * las formas anteriores) se mueven despues de OBJECT_PACK_MIN_AGE segundos a los
+ * paquetes de objects/pack (ver pack.h) con objects_repack: muchos contenidos
+ * pequeños ocupan un archivo grande en vez de un archivo y un inodo cada uno. Un
+ * contenido se busca primero en el indice de los paquetes y despues en su archivo.
+ *
+ * Los contenidos se leen con sobject_reader sin importar como se guardaron.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+#define OBJECTS_DIR "objects" /**< Directorio de contenidos dentro del repositorio */
+#define OBJECTS_TMP_DIR "tmp" /**< Directorio de archivos temporales dentro de OBJECTS_DIR */
+#define OBJECTS_PARTIAL_DIR "partial" /**< Directorio de recepciones interrumpidas dentro de OBJECTS_DIR */
+#define OBJECT_PARTIAL_TTL (7 * 24 * 60 * 60) /**< Segundos sin cambios tras los que se elimina una recepcion interrumpida */
+#define OBJECT_HASH_LEN 64 /**< Caracteres del hash SHA-256 en hexadecimal */
+#define OBJECT_RECIPE_SUFFIX ".recipe" /**< Sufijo de la lista de fragmentos de un contenido guardado por fragmentos */
+#define OBJECT_RECIPE_MAGIC "VRCP" /**< Identificador al inicio de una lista de fragmentos, seguido de la cantidad (4 bytes) */
+#define OBJECT_DELTA_SUFFIX ".delta" /**< Sufijo de un contenido guardado como diferencia contra otro */
+#define OBJECT_DELTA_MAGIC "VDLT" /**< Identificador al inicio de una diferencia, seguido del hash del base (32 bytes),
+                                       la profundidad en la cadena (4 bytes), el tamaño (8 bytes) y las operaciones */
+#define OBJECT_DELTA_MAX_SIZE (16 * 1024 * 1024) /**< Tamaño maximo de un contenido guardado como diferencia y de su base */
+#define OBJECT_DELTA_CHAIN_LIMIT 1024 /**< Diferencias que se recorren como maximo al reconstruir un contenido */
+#define OBJECT_DELTA_CACHE_BUDGET (64 * 1024 * 1024) /**< Memoria maxima de los contenidos reconstruidos en cache */
+#define OBJECT_DELTA_CACHE_ENTRIES 64 /**< Contenidos reconstruidos en cache como maximo */
+#define OBJECT_COMPRESSED_SUFFIX ".z" /**< Sufijo de un contenido guardado comprimido */
+#define OBJECT_COMPRESSED_MAGIC "VLZB" /**< Identificador al inicio de un contenido comprimido, seguido del codec (1 byte),
+                                            3 bytes en 0, el tamaño de los bloques (4 bytes), el tamaño (8 bytes), la cantidad
+                                            de bloques (4 bytes), los bytes guardados de cada bloque (4 bytes) y los bloques */
+#define OBJECT_CODEC_LZ 1 /**< Codec de un contenido comprimido: lz_compress */
+#define OBJECT_BLOCK_SIZE (64 * 1024) /**< Bytes de los bloques que se comprimen por separado */
+#define OBJECT_COMPRESS_MIN 4096 /**< Tamaño minimo de un contenido que se comprime: uno menor ocupa un bloque del disco */
+#define OBJECT_COMPRESS_RATIO 8 /**< Un contenido se guarda comprimido si ahorra al menos 1/OBJECT_COMPRESS_RATIO */
+#define OBJECT_PACK_MAX (64 * 1024) /**< Bytes guardados maximos de un contenido que se mueve a los paquetes */
+#define OBJECT_PACK_MIN_AGE 10 /**< Segundos desde que se publico un contenido para moverlo a los paquetes */
+
+/**
+ * @brief Contenido que se esta recibiendo
+ */
+typedef struct {
+	char tmp_path[PATH_MAX]; /**< Archivo temporal, vacio si no hay un contenido pendiente */
+	char hash[OBJECT_HASH_LEN + 1]; /**< Hash con el que se publicara */
+	int partial; /**< 1 si tmp_path es una recepcion que se puede continuar (objects/partial) */
+	const char *suffix; /**< Sufijo con el que se publica: "", OBJECT_RECIPE_SUFFIX, OBJECT_DELTA_SUFFIX u OBJECT_COMPRESSED_SUFFIX */
+} sobject_writer;
+
+/**
+ * @brief Fragmento de un contenido guardado por fragmentos, tal como se guarda en la lista
+ */
+typedef struct {
+	uint32_t size; /**< Bytes del fragmento */
+	uint8_t hash[32]; /**< SHA-256 del fragmento */
+} sobject_chunk;
+
+struct sobject_blocks;
+
+/**
+ * @brief Lector de un contenido del almacen
+ *
+ * El contenido se lee por partes: el archivo del contenido, o uno tras otro los
+ * archivos de sus fragmentos. Se lee con pread (o sendfile con posicion, ver
+ * object_reader_direct): la posicion de los archivos no cambia. En una parte
+ * comprimida off y left son posiciones del contenido descomprimido. Una parte
+ * empaquetada se lee del paquete, que no se cierra, a partir de base.
+ */
+typedef struct {
+	const char *root; /**< Directorio del repositorio */
+	int fd; /**< Archivo de la parte que se esta leyendo, -1 si no hay */
+	int borrowed; /**< 1 si fd es del llamador y no se cierra */
+	off_t base; /**< Posicion del inicio de la parte en fd, distinta de 0 en un paquete */
+	off_t off; /**< Posicion de lectura en fd */
+	off_t left; /**< Bytes de la parte actual desde off */
+	struct sobject_blocks *blocks; /**< Bloques de la parte actual si esta comprimida, NULL si se lee tal cual */
+	sobject_chunk *chunks; /**< Fragmentos en orden, NULL si el contenido es un solo archivo */
+	uint32_t count; /**< Cantidad de fragmentos */
+	uint32_t next; /**< Siguiente fragmento por abrir */
+} sobject_reader;
+
+/**
+ * @brief Crea los directorios del almacen, abre los paquetes, elimina los temporales de una
+ * ejecucion anterior y las recepciones interrumpidas sin cambios en OBJECT_PARTIAL_TTL segundos
+ *
+ * @param root Directorio del repositorio
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int objects_init(const char *root);
+
+/**
+ * @brief Mueve a los paquetes los contenidos pequeños publicados hace al menos min_age segundos
+ *
+ * Los archivos de los contenidos se eliminan despues de publicar el indice. Un
+ * contenido que ya estaba empaquetado solo elimina su archivo.
+ *
+ * @param root Directorio del repositorio
+ * @param min_age Segundos desde la ultima modificacion de un archivo para empaquetarlo
+ * @return Contenidos empaquetados, -1 si ocurre un error u otro proceso esta empaquetando
+ */
+int objects_repack(const char *root, int min_age);
+
+/**
+ * @brief Verifica que un hash sea una cadena hexadecimal de 64 caracteres en minusculas
+ *
+ * El hash se usa como nombre de archivo, por lo que no debe contener separadores de ruta.
+ *
+ * @param hash Hash a verificar
+ * @return 1 si el hash es valido, 0 en caso contrario
+ */
+int object_valid_hash(const char *hash);
+
+/**
+ * @brief Ruta de un contenido en el almacen
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param path Buffer de PATH_MAX bytes
+ * @return 0 en caso de exito, -1 si el hash no es valido
+ */
+int object_path(const char *root, const char *hash, char *path);
+
+/**
+ * @brief Convierte un hash binario a la cadena hexadecimal con la que se nombra en el almacen
+ *
+ * @param hash SHA-256 (32 bytes)
+ * @param hex Buffer de OBJECT_HASH_LEN + 1 bytes
+ */
+void object_hex(const uint8_t *hash, char *hex);
+
+/**
+ * @brief Verifica si un contenido ya esta en el almacen, en un archivo, por fragmentos, como diferencia o comprimido
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @return 1 si existe, 0 si no existe
+ */
+int object_exists(const char *root, const char *hash);
+
+/**
+ * @brief Crea el archivo temporal donde se recibe un contenido
+ *
+ * @param root Directorio del repositorio
+ * @param writer Contenido pendiente
+ * @param hash Hash del contenido, NULL si se conoce al terminar de recibirlo
+ *             (se debe copiar en writer->hash antes de publicar)
+ * @return Descriptor abierto para escritura, -1 si ocurre un error
+ */
+int object_create(const char *root, sobject_writer *writer, const char *hash);
+
+/**
+ * @brief Abre la recepcion de un contenido que se puede continuar si se interrumpe
+ *
+ * Si otra conexion esta recibiendo el mismo contenido, se crea un temporal como en
+ * object_create y size es 0.
+ *
+ * @param root Directorio del repositorio
+ * @param writer Contenido pendiente
+ * @param hash Hash del contenido, NULL si se conoce al terminar de recibirlo
+ * @param key Clave de la recepcion (64 caracteres hexadecimales): el hash, o una que
+ *            identifique la adicion si el hash no se conoce
+ * @param size Bytes que ya se recibieron en una recepcion anterior
+ * @return Descriptor abierto para lectura y escritura, -1 si ocurre un error
+ */
+int object_resume(const char *root, sobject_writer *writer, const char *hash, const char *key, off_t *size);
+
+/**
+ * @brief Crea el archivo temporal con la lista de fragmentos de un contenido
+ *
+ * No verifica que los fragmentos esten en el almacen ni que formen el contenido.
+ *
+ * @param root Directorio del repositorio
+ * @param writer Contenido pendiente, se publica con object_publish
+ * @param hash Hash de todo el contenido
+ * @param chunks Fragmentos en orden
+ * @param count Cantidad de fragmentos
+ * @return Descriptor abierto para escritura, -1 si ocurre un error
+ */
+int object_create_recipe(const char *root, sobject_writer *writer, const char *hash, const sobject_chunk *chunks, uint32_t count);
+
+/**
+ * @brief Crea el archivo temporal con un contenido guardado en un solo archivo, codificado como diferencia contra otro
+ *
+ * Solo se crea si el contenido y el base miden a lo sumo OBJECT_DELTA_MAX_SIZE, el
+ * base no es una lista de fragmentos ni depende del contenido, la cadena de
+ * diferencias no llega a max_depth y la diferencia mide menos de la mitad del
+ * contenido. Despues de publicarla, el archivo completo se elimina con object_unlink.
+ *
+ * @param root Directorio del repositorio
+ * @param writer Contenido pendiente, se publica con object_publish
+ * @param hash Hash del contenido
+ * @param base Hash del contenido base
+ * @param max_depth Diferencias seguidas como maximo antes de guardar un contenido completo
+ * @return Descriptor abierto para escritura, -1 si no se crea
+ */
+int object_create_delta(const char *root, sobject_writer *writer, const char *hash, const char *base, uint32_t max_depth);
+
+/**
+ * @brief Crea el archivo temporal con un contenido guardado en un solo archivo, comprimido
+ *
+ * Solo se crea si el contenido mide al menos OBJECT_COMPRESS_MIN y la compresion
+ * de su primer bloque y la de todo el contenido ahorran al menos
+ * 1/OBJECT_COMPRESS_RATIO. Despues de publicarlo, el archivo completo se elimina
+ * con object_unlink.
+ *
+ * @param root Directorio del repositorio
+ * @param writer Contenido pendiente, se publica con object_publish
+ * @param hash Hash del contenido
+ * @return Descriptor abierto para escritura, -1 si no se crea
+ */
+int object_create_compressed(const char *root, sobject_writer *writer, const char *hash);
+
+/**
+ * @brief Elimina el archivo de un contenido guardado en un solo archivo
+ *
+ * Solo se usa despues de publicar el mismo contenido de otra forma.
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int object_unlink(const char *root, const char *hash);
+
+/**
+ * @brief Publica un contenido recibido moviendolo a su ruta definitiva
+ *
+ * Si otro cliente ya publico el mismo contenido, se reemplaza por uno identico.
+ *
+ * @param root Directorio del repositorio
+ * @param writer Contenido pendiente
+ * @param durable 1 para sincronizar el directorio despues de publicar
+ * @return 0 en caso de exito, -1 si ocurre un error (el temporal se elimina)
+ */
+int object_publish(const char *root, sobject_writer *writer, int durable);
+
+/**
+ * @brief Publica como contenido un archivo que ya existe, guardado tal cual
+ *
+ * Se publica un enlace al archivo como si se hubiera recibido: si falla, el archivo
+ * no se pierde. Quien llama lo elimina despues si ya no lo necesita.
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param path Ruta del archivo, en el mismo sistema de archivos que el repositorio
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int object_import(const char *root, const char *hash, const char *path);
+
+/**
+ * @brief Descarta un contenido pendiente
+ *
+ * @param writer Contenido pendiente
+ */
+void object_abort(sobject_writer *writer);
+
+/**
+ * @brief Deja un contenido pendiente para continuarlo en otra conexion
+ *
+ * Si no se abrio con object_resume se descarta.
+ *
+ * @param writer Contenido pendiente
+ */
+void object_suspend(sobject_writer *writer);
+
+/**
+ * @brief Abre el archivo de un contenido guardado en un solo archivo, sin empaquetar
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param size Tamaño del contenido
+ * @return Descriptor abierto para lectura, -1 si no existe
+ */
+int object_open(const char *root, const char *hash, off_t *size);
+
+/**
+ * @brief Inicializa un lector vacio
+ *
+ * @param reader Lector
+ */
+void object_reader_init(sobject_reader *reader);
+
+/**
+ * @brief Abre un contenido del almacen para leerlo, guardado en un archivo, por fragmentos, como diferencia o comprimido
+ *
+ * Una diferencia se lee desde el contenido reconstruido, de la cache o reconstruido al abrirla.
+ * Un contenido comprimido (o un fragmento comprimido) se descomprime por bloques al leerlo.
+ *
+ * @param root Directorio del repositorio
+ * @param hash Hash del contenido
+ * @param reader Lector, al inicio del contenido
+ * @param size Tamaño del contenido
+ * @return 0 en caso de exito, -1 si no existe, su lista de fragmentos no es valida o no se puede reconstruir
+ */
+int object_reader_open(const char *root, const char *hash, sobject_reader *reader, off_t *size);
+
+/**
+ * @brief Prepara la lectura de fragmentos del almacen, uno tras otro
+ *
+ * @param root Directorio del repositorio
+ * @param reader Lector, al inicio del primer fragmento
+ * @param chunks Fragmentos en orden (se copian)
+ * @param count Cantidad de fragmentos
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+int object_reader_chunks(const char *root, sobject_reader *reader, const sobject_chunk *chunks, uint32_t count);
+
+/**
+ * @brief Prepara la lectura de un archivo abierto; el descriptor sigue siendo del llamador
+ *
+ * @param reader Lector, al inicio del archivo
+ * @param fd Archivo
+ * @param size Bytes que se leen
+ */
+void object_reader_file(sobject_reader *reader, int fd, off_t size);
+
+/**
+ * @brief Mueve la lectura a una posicion del contenido
+ *
+ * @param reader Lector
+ * @param offset Posicion desde el inicio del contenido
+ * @return 0 en caso de exito, -1 si la posicion esta despues del final o falta un fragmento
+ */
+int object_reader_seek(sobject_reader *reader, off_t offset);
+
+/**
+ * @brief Abre la siguiente parte del contenido si se termino de leer la actual
+ *
+ * Despues de retornar 1, reader->fd tiene reader->left bytes para leer desde reader->off.
+ *
+ * @param reader Lector
+ * @return 1 si hay bytes para leer, 0 al final del contenido, -1 si falta un fragmento o no coincide su tamaño
+ */
+int object_reader_ready(sobject_reader *reader);
+
+/**
+ * @brief Indica si la parte actual se puede leer directamente de reader->fd
+ *
+ * Una parte comprimida solo se lee con object_reader_read.
+ *
+ * @param reader Lector
+ * @return 1 si reader->fd tiene los bytes del contenido desde reader->off (admite sendfile), 0 en caso contrario
+ */
+int object_reader_direct(const sobject_reader *reader);
+
+/**
+ * @brief Lee el contenido desde la posicion actual, sin cruzar el final de una parte
+ *
+ * @param reader Lector
+ * @param buffer Buffer
+ * @param size Bytes maximos
+ * @return Bytes leidos, 0 al final del contenido, -1 si ocurre un error
+ */
+ssize_t object_reader_read(sobject_reader *reader, void *buffer, size_t size);
+
+/**
+ * @brief Cierra un lector
+ *
+ * @param reader Lector
+ */
+void object_reader_close(sobject_reader *reader);
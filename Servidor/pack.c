@@ -0,0 +1,384 @@
+/**
+ * @file
+ * @brief Implementacion de los paquetes de contenidos pequeños
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+
+#define INDEX_HEADER_SIZE (sizeof(PACK_INDEX_MAGIC) - 1 + 3 * sizeof(uint32_t)) /**< Bytes del identificador y el encabezado */
+#define INDEX_FANOUT_SIZE (256 * sizeof(uint32_t)) /**< Bytes de la tabla del primer byte */
+#define INDEX_TMP PACK_INDEX ".tmp" /**< Indice que se esta escribiendo, dentro de PACK_DIR */
+
+/**
+ * @brief Indice proyectado y paquetes abiertos, compartidos por los hilos
+ */
+static struct {
+	pthread_rwlock_t lock; /**< Se toma para escribir solo al cambiar de indice */
+	char dir[PATH_MAX - NAME_MAX - 1]; /**< Directorio de los paquetes, deja espacio para el nombre de un archivo */
+	void *map; /**< Indice proyectado, NULL si no hay */
+	size_t map_size; /**< Bytes proyectados */
+	const uint32_t *fanout; /**< Entradas cuyo hash empieza con un byte menor o igual a cada valor */
+	const spack_entry *entries; /**< Entradas ordenadas por hash */
+	uint32_t count; /**< Cantidad de entradas */
+	int *fds; /**< Paquetes abiertos para lectura */
+	uint32_t packs; /**< Cantidad de paquetes */
+} packs = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+/**
+ * @brief Proyecta el indice publicado y abre los paquetes nuevos; con el candado tomado para escribir
+ *
+ * Si ocurre un error se conserva el indice anterior.
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error o el indice no es valido
+ */
+static int index_load(void);
+
+/**
+ * @brief Ruta de un archivo dentro del directorio de los paquetes
+ *
+ * @param name Nombre del archivo
+ * @param path Buffer de PATH_MAX bytes
+ */
+static void pack_path(const char *name, char *path);
+
+/**
+ * @brief Abre para agregar contenidos un paquete, o el siguiente si esta lleno
+ *
+ * @param writer Contenidos que se agregan
+ * @param pack Numero del paquete
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int writer_open(spack_writer *writer, uint32_t pack);
+
+/**
+ * @brief Compara dos entradas por su hash
+ *
+ * @param a Primera entrada
+ * @param b Segunda entrada
+ * @return Menor, igual o mayor a 0 como memcmp
+ */
+static int entry_compare(const void *a, const void *b);
+
+/**
+ * @brief Escribe exactamente size bytes en una posicion de un archivo
+ *
+ * @param fd Archivo
+ * @param data Bytes
+ * @param size Cantidad de bytes
+ * @param off Posicion
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int write_at(int fd, const void *data, size_t size, off_t off);
+
+int pack_init(const char *dir) {
+	int status;
+
+	if (strlen(dir) >= sizeof(packs.dir)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) return -1;
+
+	pthread_rwlock_wrlock(&packs.lock);
+	if (strcmp(packs.dir, dir) != 0) { // Otro repositorio: sus paquetes son otros
+		for (uint32_t i = 0; i < packs.packs; i++) close(packs.fds[i]);
+		if (packs.map) munmap(packs.map, packs.map_size);
+		free(packs.fds);
+		packs.map = NULL;
+		packs.fds = NULL;
+		packs.count = packs.packs = 0;
+		snprintf(packs.dir, sizeof(packs.dir), "%s", dir);
+	}
+	status = index_load();
+	pthread_rwlock_unlock(&packs.lock);
+	return status;
+}
+
+int pack_find(const uint8_t *hash, spack_entry *entry) {
+	int fd = -1;
+
+	pthread_rwlock_rdlock(&packs.lock);
+	if (packs.count) {
+		// La tabla del primer byte acota la busqueda binaria
+		uint32_t low = hash[0] ? packs.fanout[hash[0] - 1] : 0, high = packs.fanout[hash[0]];
+
+		while (low < high) {
+			uint32_t mid = low + (high - low) / 2;
+			int cmp = memcmp(hash, packs.entries[mid].hash, 32);
+
+			if (cmp == 0) {
+				*entry = packs.entries[mid];
+				fd = packs.fds[entry->pack];
+				break;
+			}
+			if (cmp < 0) high = mid;
+			else low = mid + 1;
+		}
+	}
+	pthread_rwlock_unlock(&packs.lock);
+	return fd;
+}
+
+int pack_begin(spack_writer *writer) {
+	uint32_t last;
+
+	memset(writer, 0, sizeof *writer);
+	writer->fd = -1;
+	if ((writer->lock = open(packs.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return -1;
+	if (flock(writer->lock, LOCK_EX | LOCK_NB) < 0) {
+		close(writer->lock);
+		return -1;
+	}
+
+	// Otro proceso pudo publicar un indice: las entradas nuevas se agregan al ultimo
+	pthread_rwlock_wrlock(&packs.lock);
+	int status = index_load();
+	last = packs.packs ? packs.packs - 1 : 0;
+	pthread_rwlock_unlock(&packs.lock);
+
+	if (status < 0 || writer_open(writer, last) < 0) {
+		pack_abort(writer);
+		return -1;
+	}
+	return 0;
+}
+
+int pack_add(spack_writer *writer, const uint8_t *hash, uint8_t kind, const void *data, uint32_t length) {
+	spack_entry *entry;
+
+	// El paquete lleno queda en disco antes de seguir con el siguiente
+	if (writer->size > (off_t)(sizeof(PACK_MAGIC) - 1) && writer->size + length > PACK_SIZE_MAX &&
+		(fdatasync(writer->fd) < 0 || writer_open(writer, writer->pack + 1) < 0))
+		return -1;
+
+	if (writer->count == writer->cap) {
+		size_t cap = writer->cap ? 2 * writer->cap : 256;
+		spack_entry *entries = realloc(writer->entries, cap * sizeof(spack_entry));
+
+		if (!entries) return -1;
+		writer->entries = entries;
+		writer->cap = cap;
+	}
+	if (write_at(writer->fd, data, length, writer->size) < 0) return -1;
+
+	entry = &writer->entries[writer->count++];
+	memset(entry, 0, sizeof *entry);
+	memcpy(entry->hash, hash, 32);
+	entry->offset = writer->size;
+	entry->length = length;
+	entry->pack = writer->pack;
+	entry->kind = kind;
+	writer->size += length;
+	return 0;
+}
+
+int pack_commit(spack_writer *writer) {
+	unsigned char header[INDEX_HEADER_SIZE] = { 0 };
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	uint32_t fanout[256] = { 0 }, count = 0, pack_count;
+	spack_entry *merged = NULL;
+	int fd = -1, status = -1, published = 0;
+
+	if (fdatasync(writer->fd) < 0) goto done;
+	qsort(writer->entries, writer->count, sizeof(spack_entry), entry_compare);
+
+	// Las entradas anteriores y las nuevas ya estan ordenadas: se mezclan en un solo recorrido
+	pthread_rwlock_rdlock(&packs.lock);
+	pack_count = packs.packs > (uint32_t)writer->pack + 1 ? packs.packs : (uint32_t)writer->pack + 1;
+	if ((merged = malloc(((size_t)packs.count + writer->count) * sizeof(spack_entry) + 1))) {
+		size_t i = 0, j = 0;
+
+		while (i < packs.count || j < writer->count) {
+			int cmp = i == packs.count ? 1 : j == writer->count ? -1 : memcmp(packs.entries[i].hash, writer->entries[j].hash, 32);
+
+			if (cmp <= 0) merged[count++] = packs.entries[i++];
+			if (cmp >= 0) {
+				if (cmp > 0 && (count == 0 || memcmp(merged[count - 1].hash, writer->entries[j].hash, 32) != 0))
+					merged[count++] = writer->entries[j];
+				j++; // Un contenido que ya estaba, o repetido entre los nuevos, conserva la primera entrada
+			}
+		}
+	}
+	pthread_rwlock_unlock(&packs.lock);
+	if (!merged) goto done;
+
+	for (uint32_t i = 0; i < count; i++) fanout[merged[i].hash[0]]++;
+	for (int b = 1; b < 256; b++) fanout[b] += fanout[b - 1];
+
+	memcpy(header, PACK_INDEX_MAGIC, sizeof(PACK_INDEX_MAGIC) - 1);
+	memcpy(header + sizeof(PACK_INDEX_MAGIC) - 1, &count, 4);
+	memcpy(header + sizeof(PACK_INDEX_MAGIC) - 1 + 4, &pack_count, 4);
+
+	// El indice nuevo se escribe aparte y reemplaza al anterior con rename
+	pack_path(INDEX_TMP, tmp_path);
+	pack_path(PACK_INDEX, path);
+	if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0 ||
+		write_at(fd, header, sizeof(header), 0) < 0 || write_at(fd, fanout, sizeof(fanout), sizeof(header)) < 0 ||
+		write_at(fd, merged, (size_t)count * sizeof(spack_entry), sizeof(header) + sizeof(fanout)) < 0 ||
+		fsync(fd) < 0 || rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+		goto done;
+	}
+
+	// El indice publicado apunta a los bytes agregados: desde aqui el paquete no se trunca aunque algo falle
+	published = 1;
+	if (fsync(writer->lock) < 0) goto done;
+
+	pthread_rwlock_wrlock(&packs.lock);
+	status = index_load();
+	pthread_rwlock_unlock(&packs.lock);
+
+done:
+	if (fd >= 0) close(fd);
+	free(merged);
+	if (status < 0 && !published) {
+		pack_abort(writer);
+		return -1;
+	}
+
+	close(writer->fd);
+	close(writer->lock); // Libera el bloqueo
+	free(writer->entries);
+	return status;
+}
+
+void pack_abort(spack_writer *writer) {
+	if (writer->fd >= 0) {
+		if (ftruncate(writer->fd, writer->start) < 0) perror("Error truncating pack"); // Los bytes quedan sin referenciar
+		close(writer->fd);
+	}
+	close(writer->lock);
+	free(writer->entries);
+	writer->fd = writer->lock = -1;
+	writer->entries = NULL;
+}
+
+static int index_load(void) {
+	char path[PATH_MAX], name[32];
+	unsigned char header[INDEX_HEADER_SIZE];
+	uint32_t count, pack_count;
+	struct stat st;
+	void *map;
+	int *fds;
+	int fd;
+
+	pack_path(PACK_INDEX, path);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return errno == ENOENT ? 0 : -1; // Aun no hay paquetes
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)(INDEX_HEADER_SIZE + INDEX_FANOUT_SIZE) ||
+		pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+		memcmp(header, PACK_INDEX_MAGIC, sizeof(PACK_INDEX_MAGIC) - 1) != 0) {
+		close(fd);
+		return -1;
+	}
+	memcpy(&count, header + sizeof(PACK_INDEX_MAGIC) - 1, 4);
+	memcpy(&pack_count, header + sizeof(PACK_INDEX_MAGIC) - 1 + 4, 4);
+	if (pack_count > UINT16_MAX + 1 || pack_count < packs.packs ||
+		st.st_size != (off_t)(INDEX_HEADER_SIZE + INDEX_FANOUT_SIZE + (size_t)count * sizeof(spack_entry))) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); // La proyeccion sigue valida
+	if (map == MAP_FAILED) return -1;
+
+	const uint32_t *fanout = (const uint32_t *)((const char *)map + INDEX_HEADER_SIZE);
+	const spack_entry *entries = (const spack_entry *)(fanout + 256);
+	int valid = fanout[255] == count;
+
+	for (int b = 1; b < 256 && valid; b++) valid = fanout[b] >= fanout[b - 1];
+	for (uint32_t i = 0; i < count && valid; i++) valid = entries[i].pack < pack_count;
+	if (!valid || !(fds = realloc(packs.fds, (pack_count + 1) * sizeof(int)))) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	packs.fds = fds;
+
+	// Los paquetes que ya estaban abiertos se conservan: otras lecturas pueden estar usandolos
+	for (uint32_t i = packs.packs; i < pack_count; i++) {
+		snprintf(name, sizeof(name), "%u.pack", i);
+		pack_path(name, path);
+		if ((fds[i] = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+			while (i-- > packs.packs) close(fds[i]);
+			munmap(map, st.st_size);
+			return -1;
+		}
+	}
+
+	if (packs.map) munmap(packs.map, packs.map_size);
+	packs.map = map;
+	packs.map_size = st.st_size;
+	packs.fanout = fanout;
+	packs.entries = entries;
+	packs.count = count;
+	packs.packs = pack_count;
+	return 0;
+}
+
+static void pack_path(const char *name, char *path) {
+	snprintf(path, PATH_MAX, "%s/%s", packs.dir, name);
+}
+
+static int writer_open(spack_writer *writer, uint32_t pack) {
+	char path[PATH_MAX], name[32];
+	struct stat st;
+
+	if (writer->fd >= 0) close(writer->fd);
+	writer->fd = -1;
+
+	for (;; pack++) {
+		if (pack > UINT16_MAX) return -1;
+		snprintf(name, sizeof(name), "%u.pack", pack);
+		pack_path(name, path);
+		if ((writer->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) return -1;
+		if (fstat(writer->fd, &st) < 0) {
+			close(writer->fd);
+			writer->fd = -1;
+			return -1;
+		}
+		if (st.st_size < PACK_SIZE_MAX) break;
+		close(writer->fd);
+		writer->fd = -1;
+	}
+
+	writer->pack = pack;
+	writer->size = writer->start = st.st_size;
+	if (writer->size == 0) { // Paquete nuevo
+		if (write_at(writer->fd, PACK_MAGIC, sizeof(PACK_MAGIC) - 1, 0) < 0) return -1;
+		writer->size = sizeof(PACK_MAGIC) - 1;
+	}
+	return 0;
+}
+
+static int entry_compare(const void *a, const void *b) {
+	return memcmp(((const spack_entry *)a)->hash, ((const spack_entry *)b)->hash, 32);
+}
+
+static int write_at(int fd, const void *data, size_t size, off_t off) {
+	const char *next = data;
+
+	while (size > 0) {
+		ssize_t nwritten = pwrite(fd, next, size, off);
+		if (nwritten < 0 && errno == EINTR) continue;
+		if (nwritten < 0) return -1;
+		next += nwritten;
+		off += nwritten;
+		size -= nwritten;
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file
+ * @brief Paquetes de contenidos pequeños con un indice ordenado
+ *
+ * Los contenidos pequeños se agregan uno tras otro a archivos grandes
+ * (objects/pack/<n>.pack, de hasta PACK_SIZE_MAX bytes) en vez de ocupar un archivo
+ * y un inodo cada uno. Un solo indice (objects/pack/index) lista los contenidos
+ * empaquetados ordenados por hash, con el paquete, la posicion y la longitud de
+ * cada uno, y una tabla con la cantidad de entradas hasta cada valor del primer
+ * byte del hash.
+ *
+ * El indice se proyecta en memoria (mmap) y los paquetes quedan abiertos mientras
+ * el proceso este en ejecucion: buscar un contenido no hace llamadas al sistema y
+ * leerlo es un solo pread (o sendfile) sobre un archivo abierto.
+ *
+ * Los paquetes solo crecen. Quien agrega contenidos (spack_writer) escribe al final
+ * del paquete, lo sincroniza y publica (rename) un indice nuevo con las entradas
+ * anteriores y las nuevas; hasta entonces las lecturas usan el indice anterior.
+ * Los bytes que una interrupcion dejo al final de un paquete no se referencian.
+ *
+ * Hay un solo almacen de paquetes por proceso, el de pack_init.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define PACK_DIR "pack" /**< Directorio de los paquetes dentro de OBJECTS_DIR */
+#define PACK_INDEX "index" /**< Nombre del indice dentro de PACK_DIR */
+#define PACK_MAGIC "VPCK" /**< Identificador al inicio de un paquete, seguido de los contenidos */
+#define PACK_INDEX_MAGIC "VPIX" /**< Identificador al inicio del indice, seguido de la cantidad de entradas (4 bytes),
+                                     la cantidad de paquetes (4 bytes), 4 bytes en 0, la tabla del primer byte
+                                     (256 * 4 bytes) y las entradas */
+#define PACK_SIZE_MAX (256 * 1024 * 1024) /**< Tamaño a partir del cual se empieza un paquete nuevo */
+
+/**
+ * @brief Entrada del indice, tal como se guarda
+ */
+typedef struct {
+	uint8_t hash[32]; /**< SHA-256 del contenido */
+	uint64_t offset; /**< Posicion en el paquete */
+	uint32_t length; /**< Bytes guardados */
+	uint16_t pack; /**< Numero del paquete */
+	uint8_t kind; /**< Forma en que se guardo el contenido, la define quien lo agrega */
+	uint8_t reserved; /**< En 0 */
+} spack_entry;
+
+/**
+ * @brief Contenidos que se estan agregando a los paquetes
+ */
+typedef struct {
+	int lock; /**< Directorio de los paquetes, bloqueado (flock) hasta terminar */
+	int fd; /**< Paquete al que se agregan los contenidos */
+	uint16_t pack; /**< Numero de ese paquete */
+	off_t size; /**< Tamaño de ese paquete */
+	off_t start; /**< Tamaño de ese paquete al abrirlo: lo que sigue se descarta si no se publica */
+	spack_entry *entries; /**< Entradas nuevas */
+	size_t count; /**< Cantidad de entradas nuevas */
+	size_t cap; /**< Capacidad de entries */
+} spack_writer;
+
+/**
+ * @brief Crea el directorio de los paquetes, proyecta el indice y abre los paquetes
+ *
+ * @param dir Directorio de los paquetes
+ * @return 0 en caso de exito, -1 si ocurre un error o el indice no es valido
+ */
+int pack_init(const char *dir);
+
+/**
+ * @brief Busca un contenido en el indice
+ *
+ * @param hash SHA-256 del contenido
+ * @param entry Entrada del contenido
+ * @return Descriptor del paquete (no se cierra: sigue abierto mientras el proceso este en ejecucion), -1 si no esta
+ */
+int pack_find(const uint8_t *hash, spack_entry *entry);
+
+/**
+ * @brief Empieza a agregar contenidos al ultimo paquete, o a uno nuevo si esta lleno
+ *
+ * Solo un escritor a la vez, de cualquier proceso, puede agregar contenidos.
+ *
+ * @param writer Contenidos que se agregan
+ * @return 0 en caso de exito, -1 si otro escritor esta agregando contenidos u ocurre un error
+ */
+int pack_begin(spack_writer *writer);
+
+/**
+ * @brief Escribe un contenido al final del paquete
+ *
+ * @param writer Contenidos que se agregan
+ * @param hash SHA-256 del contenido
+ * @param kind Forma en que se guardo el contenido
+ * @param data Bytes guardados
+ * @param length Cantidad de bytes
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int pack_add(spack_writer *writer, const uint8_t *hash, uint8_t kind, const void *data, uint32_t length);
+
+/**
+ * @brief Sincroniza los paquetes y publica el indice con los contenidos agregados
+ *
+ * Un contenido que ya estaba en el indice conserva su entrada anterior.
+ *
+ * @param writer Contenidos que se agregan (se liberan)
+ * @return 0 en caso de exito, -1 si ocurre un error. Si el error ocurre despues de publicar
+ *         el indice, las entradas quedan publicadas y el paquete no se modifica
+ */
+int pack_commit(spack_writer *writer);
+
+/**
+ * @brief Descarta los contenidos agregados sin publicarlos
+ *
+ * @param writer Contenidos que se agregan (se liberan)
+ */
+void pack_abort(spack_writer *writer);
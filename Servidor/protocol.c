@@ -6,138 +6,380 @@
  * @copyright MIT Liscense
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
 #include "protocol.h"
 #include "versions.h"
+#include "lz.h"
+
+void transfer_init(stransfer * transfer) {
+	memset(transfer, 0, sizeof *transfer);
+	transfer->fd = -1;
+	object_reader_init(&transfer->source);
+}
 
-return_code local_copy(int socket, char * destination) {
-	// Copia el contenido de source a destination (se debe usar open-read-write-close, o fopen-fread-fwrite-fclose)
-	FILE *fd; // Archivos fuente y destino
-	char buffer[BUFFSIZE]; // Buffer de lectura/escritura, mas 1 para el caracter nulo
-	ssize_t filesz, nread; // Cantidad de bytes leidos
-	if(recv(socket, &filesz, sizeof(filesz), 0) != sizeof(filesz)) return VERSION_ERROR; // Recibe el tamaño del archivo
-	// Abre los archivos fuente y destino y retorna VERSION_ERROR si no se pueden abrir
+void transfer_expect(stransfer * transfer, off_t size) {
+	transfer->remaining = size;
+	if (transfer->fd < 0) return;
 
-	if(!(fd = fopen(destination, "w"))) return VERSION_ERROR;
+	// Si el sistema de archivos no admite la reserva, el archivo crece al escribir. El tamaño
+	// no cambia: un contenido parcial mide lo que se recibio y se puede continuar
+	if (size > 0) fallocate(transfer->fd, FALLOC_FL_KEEP_SIZE, 0, size);
+}
 
-	printf("File %s created\n", destination);
-	printf("File size: %ld\n", filesz);
-	while (filesz != 0) // Lee el archivo fuente
+transfer_status local_copy(int socket, stransfer * transfer) {
+	size_t budget = TRANSFER_BUDGET; // Bytes que se pueden recibir antes de ceder el hilo
+
+	while (transfer->remaining > 0) // Recibe el contenido del archivo
 	{
-		memset(buffer, 0, BUFFSIZE);
-		// Determinar tamaño de lectura (si filesz es negativo, usar su valor absoluto) 
-		ssize_t to_read = (filesz > 0) ? 
-					(filesz<BUFFSIZE) ? filesz :BUFFSIZE : -filesz; //(si el filesz es menor que BUFFSIZE, usar filesz)
-		
-		
-		// Recibe el contenido del archivo
-		ssize_t total_read = 0;
-		ssize_t nread = recv(socket, &buffer, to_read, 0);
-		total_read += nread;
-		while (total_read < to_read)
-		{
-			nread = recv(socket, buffer + total_read, to_read - total_read, 0);
-			
-			if (nread < 0)
-			{
-				fclose(fd);
-				printf("Error reading file\n");
-				return VERSION_ERROR;
-			}
-			
-			if (nread == 0) // Se alcanzó el final de la transmisión
-			{
-				break;
-			}
+		if (budget == 0) return TRANSFER_PENDING;
 
-			total_read += nread;
+		// Determinar tamaño de lectura (si remaining es menor que el buffer, usar remaining)
+		size_t to_read = (transfer->remaining < (off_t)transfer->buf_cap) ? (size_t)transfer->remaining : transfer->buf_cap;
+		ssize_t nread = recv(socket, transfer->buffer, to_read, 0);
+
+		if (nread < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return TRANSFER_PENDING;
+			if (errno == EINTR) continue;
+			perror("Error reading file");
+			return TRANSFER_ERROR;
 		}
 
-		if (total_read != to_read)
+		if (nread == 0) // El cliente cerro la conexion antes de terminar
 		{
-			fclose(fd);
 			printf("Incomplete file read\n");
-			return VERSION_ERROR;
+			return TRANSFER_ERROR;
 		}
 
-		// Escribe el archivo destino
-		if(fwrite(buffer, sizeof(char), to_read, fd) != to_read)
-		{
-			fclose(fd);
-			printf("Error writing file\n");
+		if (transfer->digest) sha256_update(transfer->digest, transfer->buffer, nread);
 
-			return VERSION_ERROR;
+		// Escribe el archivo destino (si fd es -1 el contenido se descarta)
+		if (transfer->fd >= 0 && write(transfer->fd, transfer->buffer, nread) != nread)
+		{
+			perror("Error writing file");
+			close(transfer->fd);
+			transfer->fd = -1; // Se sigue drenando el socket para mantener el protocolo sincronizado
+			transfer->failed = 1;
 		}
 
-		// Reducir filesz según el número de bytes leídos
-		filesz -= to_read;
+		// Reducir remaining según el número de bytes leídos
+		transfer->remaining -= nread;
+		budget = (budget > (size_t)nread) ? budget - nread : 0;
 	}
 
-	fclose(fd);
-	printf("File %s copied\n", destination);
-	return VERSION_CREATED;
+	return TRANSFER_DONE;
 }
 
-return_code remote_copy(char * source, int socket) {
-	FILE *fr; // Archivo fuente
-	char buffer[BUFFSIZE + 1]; // Buffer de lectura/escritura, mas 1 para el caracter nulo
-	ssize_t nread; // Cantidad de bytes leidos
-    struct stat st; // Estructura de estadisticas de archivos
-
-	if(!(fr = fopen(source, "r"))) return VERSION_ERROR; // Abre el archivo fuente y retorna VERSION_ERROR si no se puede abrir
-	
-	if(stat(source, &st) != 0) return VERSION_ERROR; // Obtiene las estadisticas del archivo fuente y retorna VERSION_ERROR si no se puede obtener
+void transfer_write(stransfer * transfer, const void * data, size_t size) {
+	const char *next = data;
 
-	if(send(socket, &st.st_size, sizeof(st.st_size), 0) != sizeof(st.st_size) ) return VERSION_ERROR; // Envía el tamaño del archivo al socket
+	if (transfer->digest) sha256_update(transfer->digest, data, size);
 
-	while(nread = fread(buffer , sizeof(char), BUFFSIZE, fr), nread > 0) // Lee el archivo fuente
+	while (transfer->fd >= 0 && size > 0)
 	{
-		if(send(socket, buffer, nread, 0) != nread) // Envía el contenido del archivo al socket
+		ssize_t nwritten = write(transfer->fd, next, size);
+		if (nwritten < 0 && errno == EINTR) continue;
+		if (nwritten <= 0)
 		{
-			fclose(fr);
-			return VERSION_ERROR;
+			perror("Error writing file");
+			close(transfer->fd);
+			transfer->fd = -1; // El resto del contenido se descarta, la adicion responde VERSION_ERROR
+			transfer->failed = 1;
+			break;
 		}
+		next += nwritten;
+		size -= nwritten;
 	}
+}
 
-	if (nread == 0) // Si se leyó todo el archivo, retorna VERSION_CREATED
+transfer_status remote_copy(stransfer * transfer, int socket) {
+	size_t budget = TRANSFER_BUDGET; // Bytes que se pueden enviar antes de ceder el hilo
+
+	while (1)
 	{
-		fclose(fr);
-		return VERSION_CREATED;
+		// Envía el contenido pendiente del buffer
+		while (transfer->buf_off < transfer->buf_len)
+		{
+			// Si sigue el archivo, el encabezado se une a su primer segmento
+			int more = transfer->remaining > 0 ? MSG_MORE : 0;
+			ssize_t nsent = send(socket, transfer->buffer + transfer->buf_off,
+				transfer->buf_len - transfer->buf_off, MSG_NOSIGNAL | more);
+
+			if (nsent < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK) return TRANSFER_PENDING;
+				if (errno == EINTR) continue;
+				perror("Error sending file");
+				return TRANSFER_ERROR;
+			}
+
+			transfer->buf_off += nsent;
+			budget = (budget > (size_t)nsent) ? budget - nsent : 0;
+		}
+
+		if (transfer->remaining == 0) return TRANSFER_DONE;
+		if (budget == 0) return TRANSFER_PENDING;
+
+		// Cada paso lee de una sola parte del contenido: su archivo o uno de sus fragmentos
+		int ready = object_reader_ready(&transfer->source);
+		if (ready <= 0)
+		{
+			if (ready == 0) printf("Incomplete file send\n");
+			else perror("Error reading file");
+			return TRANSFER_ERROR;
+		}
+		off_t part = (transfer->remaining < transfer->source.left) ? transfer->remaining : transfer->source.left;
+
+		if (transfer->zero_copy && object_reader_direct(&transfer->source)) // El kernel copia directamente del archivo al socket
+		{
+			size_t to_send = (part < (off_t)budget) ? (size_t)part : budget;
+			ssize_t nsent = sendfile(socket, transfer->source.fd, &transfer->source.off, to_send);
+
+			if (nsent < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK) return TRANSFER_PENDING;
+				if (errno == EINTR) continue;
+				if (errno == EINVAL || errno == ENOSYS) // El origen no admite sendfile
+				{
+					transfer->zero_copy = 0;
+					continue;
+				}
+				perror("Error sending file");
+				return TRANSFER_ERROR;
+			}
+
+			if (nsent == 0) // El archivo es mas corto que el tamaño anunciado
+			{
+				printf("Incomplete file send\n");
+				return TRANSFER_ERROR;
+			}
+
+			transfer->source.left -= nsent;
+			transfer->remaining -= nsent;
+			budget = (budget > (size_t)nsent) ? budget - nsent : 0;
+			continue;
+		}
+
+		// Lee el siguiente bloque del archivo fuente
+		size_t to_read = (part < (off_t)transfer->buf_cap) ? (size_t)part : transfer->buf_cap;
+		ssize_t nread = object_reader_read(&transfer->source, transfer->buffer, to_read);
+		if (nread <= 0)
+		{
+			perror("Error reading file");
+			return TRANSFER_ERROR;
+		}
+
+		transfer->buf_len = nread;
+		transfer->buf_off = 0;
+		transfer->remaining -= nread;
 	}
+}
+
+void transfer_reset(stransfer * transfer) {
+	if (transfer->fd >= 0) close(transfer->fd);
+	object_reader_close(&transfer->source);
+	free(transfer->buffer);
+	transfer_init(transfer);
+}
 
-	return VERSION_ERROR;
+void frame_pack(unsigned char *out, frame_opcode opcode, uint32_t id, uint32_t length) {
+	swire wire;
+
+	wire_init(&wire, out, FRAME_HEADER_SIZE);
+	wire_put_uint(&wire, FRAME_MAGIC, 2);
+	wire_put_uint(&wire, FRAME_VERSION, 1);
+	wire_put_uint(&wire, opcode, 1);
+	wire_put_uint(&wire, id, 4);
+	wire_put_uint(&wire, length, 4);
+}
+
+int frame_unpack(const unsigned char *in, sframe *frame) {
+	swire wire;
+
+	wire_init(&wire, (void *)in, FRAME_HEADER_SIZE);
+	if (wire_get_uint(&wire, 2) != FRAME_MAGIC) return -1;
+	frame->version = wire_get_uint(&wire, 1);
+	frame->opcode = wire_get_uint(&wire, 1);
+	frame->id = wire_get_uint(&wire, 4);
+	frame->length = wire_get_uint(&wire, 4);
+	return 0;
 }
 
-void fake_local_copy(int socket) {
-// Copia el contenido de source a destination (se debe usar open-read-write-close, o fopen-fread-fwrite-fclose)
-	char buffer[BUFFSIZE]; // Buffer de lectura/escritura, mas 1 para el caracter nulo
-	ssize_t filesz, nread; // Cantidad de bytes leidos
-	if(recv(socket, &filesz, sizeof(filesz), 0) != sizeof(filesz)) return ; // Recibe el tamaño del archivo
-	// Abre los archivos fuente y destino y retorna VERSION_ERROR si no se pueden abrir
+void packer_init(spacker *packer, int codec) {
+	packer->codec = codec;
+	packer->skip = 0;
+	packer->backoff = 1;
+}
 
-	printf("File size: %ld\n", filesz);
-	while (filesz != 0) // Lee el archivo fuente
+int packer_ready(spacker *packer) {
+	if (!packer->codec) return 0;
+	if (packer->skip == 0) return 1;
+	packer->skip--;
+	return 0;
+}
+
+size_t frame_compress(spacker *packer, unsigned char *frame, unsigned char *scratch) {
+	sframe header;
+	size_t size, limit;
+	swire wire;
+
+	frame_unpack(frame, &header);
+	if (!packer->codec || header.length < FRAME_PACKED_MIN || header.length > FRAME_DATA_MAX)
+		return FRAME_HEADER_SIZE + header.length;
+
+	// Solo se envia comprimido si ahorra al menos 1/FRAME_PACKED_RATIO, contando el encabezado de FRAME_PACKED
+	limit = header.length - header.length / FRAME_PACKED_RATIO - FRAME_PACKED_HEADER;
+	if (!(size = lz_compress(frame + FRAME_HEADER_SIZE, header.length, scratch, limit))) {
+		packer->skip = packer->backoff;
+		if (packer->backoff < FRAME_PACKED_BACKOFF_MAX) packer->backoff *= 2;
+		return FRAME_HEADER_SIZE + header.length;
+	}
+	packer->backoff = 1;
+
+	frame_pack(frame, FRAME_PACKED, header.id, FRAME_PACKED_HEADER + size);
+	wire_init(&wire, frame + FRAME_HEADER_SIZE, FRAME_PACKED_HEADER + size);
+	wire_put_uint(&wire, header.opcode, 1);
+	wire_put_uint(&wire, header.length, 4);
+	wire_put_bytes(&wire, scratch, size);
+	return FRAME_HEADER_SIZE + wire.off;
+}
+
+int frame_decompress(const unsigned char *payload, sframe *frame, unsigned char *out, size_t cap) {
+	uint32_t length;
+	uint8_t opcode;
+	swire wire;
+
+	wire_init(&wire, (void *)payload, frame->length);
+	opcode = wire_get_uint(&wire, 1);
+	length = wire_get_uint(&wire, 4);
+	if (wire.error || opcode == FRAME_PACKED || length > cap || length > FRAME_DATA_MAX ||
+		lz_decompress(payload + wire.off, frame->length - wire.off, out, length) != (ssize_t)length)
+		return -1;
+
+	frame->opcode = opcode;
+	frame->length = length;
+	return 0;
+}
+
+void wire_init(swire *wire, void *data, size_t size) {
+	wire->data = data;
+	wire->size = size;
+	wire->off = 0;
+	wire->error = 0;
+}
+
+void wire_put_uint(swire *wire, uint64_t value, size_t bytes) {
+	if (wire->error || wire->size - wire->off < bytes) {
+		wire->error = 1;
+		return;
+	}
+
+	for (size_t i = bytes; i > 0; i--, value >>= 8)
+		wire->data[wire->off + i - 1] = value & 0xff;
+	wire->off += bytes;
+}
+
+void wire_put_bytes(swire *wire, const void *data, size_t size) {
+	if (wire->error || wire->size - wire->off < size) {
+		wire->error = 1;
+		return;
+	}
+
+	memcpy(wire->data + wire->off, data, size);
+	wire->off += size;
+}
+
+void wire_put_string(swire *wire, const char *s) {
+	size_t len = strlen(s);
+
+	if (len > UINT16_MAX) {
+		wire->error = 1;
+		return;
+	}
+
+	wire_put_uint(wire, len, 2);
+	wire_put_bytes(wire, s, len);
+}
+
+uint64_t wire_get_uint(swire *wire, size_t bytes) {
+	uint64_t value = 0;
+
+	if (wire->error || wire->size - wire->off < bytes) {
+		wire->error = 1;
+		return 0;
+	}
+
+	for (size_t i = 0; i < bytes; i++)
+		value = (value << 8) | wire->data[wire->off + i];
+	wire->off += bytes;
+	return value;
+}
+
+void wire_get_bytes(swire *wire, void *data, size_t size) {
+	if (wire->error || wire->size - wire->off < size) {
+		wire->error = 1;
+		return;
+	}
+
+	memcpy(data, wire->data + wire->off, size);
+	wire->off += size;
+}
+
+void wire_get_string(swire *wire, char *s, size_t cap) {
+	size_t len = wire_get_uint(wire, 2);
+
+	if (wire->error || len >= cap || wire->size - wire->off < len) {
+		wire->error = 1;
+		s[0] = '\0';
+		return;
+	}
+
+	memcpy(s, wire->data + wire->off, len);
+	s[len] = '\0';
+	wire->off += len;
+}
+
+uint64_t resume_checkpoint(const struct sha256_buff *digest) {
+	return ((uint64_t)digest->h[0] << 32) | digest->h[1];
+}
+
+uint32_t resume_scan(sobject_reader *source, struct sha256_buff *digest, uint32_t count, const uint64_t *expected, struct sha256_buff *states) {
+	struct sha256_buff block = *digest; // Hash hasta el final de lo leido del bloque en curso
+	char *buffer = malloc(TRANSFER_BUFFSIZE);
+	uint32_t accepted = 0;
+	off_t off = 0;
+
+	if (!buffer) return 0;
+
+	while (accepted < count)
 	{
-		memset(buffer, 0, BUFFSIZE);
-		// Determinar tamaño de lectura (si filesz es negativo, usar su valor absoluto) 
-		ssize_t to_read = (filesz > 0) ? 
-					(filesz<BUFFSIZE) ? filesz :BUFFSIZE : -filesz; //(si el filesz es menor que BUFFSIZE, usar filesz)
-		
-		
-		// Recibe el contenido del archivo
-		ssize_t nread = recv(socket, &buffer, to_read, 0);
-		if (nread != to_read)
-		{
-			printf("Error reading file\n");
+		// Las lecturas no cruzan el final del bloque
+		size_t to_read = RESUME_CHUNK - off % RESUME_CHUNK;
+		if (to_read > TRANSFER_BUFFSIZE) to_read = TRANSFER_BUFFSIZE;
 
-			return ;
-		}
+		ssize_t nread = object_reader_read(source, buffer, to_read);
+		if (nread <= 0) break; // Bloque incompleto o error de lectura: no se acepta
 
-		// Reducir filesz según el número de bytes leídos
-		filesz -= to_read;
+		sha256_update(&block, buffer, nread);
+		off += nread;
+		if (off % RESUME_CHUNK) continue;
+
+		if (expected && resume_checkpoint(&block) != expected[accepted]) break;
+		*digest = block;
+		if (states) states[accepted] = block;
+		accepted++;
 	}
 
-	return ;
+	free(buffer);
+	return accepted;
 }
+
 void get_user_db_path(const char *username, char *db_path, size_t size) {
-    snprintf(db_path, size, "versions/%s.db", username);
-}
\ No newline at end of file
+    snprintf(db_path, size, "%s/%s.db", VERSIONS_DIR, username);
+}
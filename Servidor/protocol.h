@@ -13,9 +13,14 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <stdint.h>
+
+#include "../Cliente/sha256.h"
+#include "objects.h"
 
 #define HASH_SIZE 256 /**< Longitud del hash incluyendo NULL*/
 #define COMMENT_SIZE 80 /** < Longitud del comentario */
+#define TRAILER_HASH_SIZE 64 /**< Caracteres del hash enviado despues del contenido en una adicion en flujo */
 #define BUFFSIZE 4086 /**< Tamaño del buffer de lectura/escritura. */
 
 /**
@@ -29,7 +34,8 @@ typedef enum {
 	VERSION_NOT_FOUND, /*!< Version no encontrada */
 	FILE_ADDED, /*<! Archivo adicionado  */
     SUCCESS, /*<! Comunicacion exitosa */
-    ERROR /*<! Error de comunicacion */
+    ERROR, /*<! Error de comunicacion */
+    CONTENT_REQUIRED /*<! El servidor no tiene el contenido de la adicion: el cliente debe enviarlo */
 	/* .. */
 }return_code;
 
@@ -39,7 +45,9 @@ typedef enum {
 typedef enum {
 	ADD, /*!< Adicionar un archivo */
     GET, /*!< Obtener una version de un archivo */
-    LIST /*!< Listar versiones de un archivo */
+    LIST, /*!< Listar versiones de un archivo */
+    MANIFEST, /*!< Adicionar varios archivos (solo v2) */
+    CHUNKS /*!< Adicionar un archivo por fragmentos (solo v2, desde PROTOCOL_CHUNKS) */
 }operation_type;
 
  
@@ -48,7 +56,19 @@ typedef enum {
  * Para realizar una  petición de adición de un archivo al repositorio
  * se envía el nombre del archivo, el hash de su contenido y un comentario
  * 
- * La respuesta se enviara mediante el socket
+ * Antes del contenido el servidor responde si lo necesita:
+ * CONTENT_REQUIRED si el cliente debe enviar el tamaño del archivo y su contenido,
+ * seguido de la respuesta final; cualquier otro codigo es la respuesta final y el
+ * contenido no se envia (la version ya existe o el servidor ya tiene ese contenido).
+ *
+ * El servidor calcula el hash del contenido mientras lo recibe y responde VERSION_ERROR
+ * si no coincide con el hash de la solicitud; el contenido no se guarda.
+ *
+ * Si hash esta vacio (adicion en flujo) el servidor siempre pide el contenido y, despues
+ * del contenido, el cliente envia los TRAILER_HASH_SIZE caracteres del hash que calculo
+ * mientras lo enviaba, que se verifica de la misma forma; asi el archivo solo se lee una vez.
+ *
+ * La respuesta final se enviara mediante el socket
  * en el caso de que la operación sea exitosa, se envía el código de retorno VERSION_ADDED
  * en caso de que la versión ya exista, se envía el código de retorno VERSION_ALREADY_EXISTS
  * en caso de que ocurra un error, se envía el código de retorno VERSION_ERROR
@@ -85,45 +105,407 @@ typedef struct {
  * 
  * La respuesta se enviara mediante el socket
  * en el caso de que la operación sea exitosa, se envía el código de retorno VERSION_CREATED
- * y luego una lista de versiones en las líneas siguientes
+ * y luego una lista de versiones, primero se envia el tamaño (int) de la linea y luego la linea,
  * con el formato "filename hash(Primeros y ultimos 3 caracteres) comment"
- * cuando se pasa un filename diferente de NULL, adicionalmente se envía el número de versión
- * en caso de que no se encuentren versiones, se envía el código de retorno VERSION_NOT_FOUND
+ * una linea de tamaño 0 indica el final del listado
+ * en caso de que no se encuentren versiones, solo se envía el código de retorno VERSION_NOT_FOUND
  */
 typedef struct {
 	char username[50];
     char filename[HASH_SIZE];  /**< Nombre del archivo original. */
 } slist;
 
+/**
+ * @brief Protocolo v2: mensajes con encabezado fijo y campos con longitud
+ *
+ * Cada mensaje (frame) empieza con un encabezado de FRAME_HEADER_SIZE bytes:
+ *  - magic (2 bytes, FRAME_MAGIC): el primer byte es 0, que nunca es un nombre de
+ *    usuario valido de v1, asi el servidor distingue ambas versiones
+ *  - version (1 byte) y codigo del frame (1 byte, frame_opcode)
+ *  - id de la solicitud (4 bytes): las respuestas y el contenido llevan el id de su solicitud
+ *  - longitud del contenido del frame (4 bytes)
+ * Los enteros van en orden de red (big-endian). Las cadenas van precedidas de
+ * su longitud (2 bytes) y sin NULL; los codigos de retorno ocupan 1 byte.
+ *
+ * Negociacion: el cliente envia FRAME_HELLO (version maxima y nombre de usuario),
+ * rellenado hasta FRAME_HELLO_MIN bytes. Un servidor que solo habla v1 lo lee como
+ * un nombre de usuario vacio y cierra la conexion: el cliente se vuelve a conectar
+ * con v1. El servidor responde FRAME_HELLO con la version elegida (la menor entre
+ * la del cliente y PROTOCOL_VERSION) y SUCCESS o ERROR. Todas las versiones usan
+ * frames de FRAME_VERSION; desde PROTOCOL_MANIFEST existe FRAME_MANIFEST, desde
+ * PROTOCOL_RESUME se continuan las transferencias interrumpidas, desde
+ * PROTOCOL_CHUNKS existe FRAME_CHUNKS y desde PROTOCOL_COMPRESS FRAME_PACKED.
+ *
+ * Solicitudes (el nombre de usuario es el del saludo):
+ *  - FRAME_ADD: tamaño (8 bytes), hash (vacio en una adicion en flujo), comentario y nombre
+ *  - FRAME_GET: version (8 bytes) y nombre; desde PROTOCOL_RESUME, ademas, los bytes
+ *    que el cliente ya tiene (8 bytes, multiplo de RESUME_CHUNK) y sus puntos de control
+ *  - FRAME_RESUME: durante una adicion, antes del contenido, la posicion desde la que
+ *    el cliente lo envia (8 bytes); solo si el servidor ofrecio continuar
+ *  - FRAME_LIST: nombre (vacio para listar todo el repositorio)
+ *  - FRAME_MANIFEST: comentario y, por cada archivo, tamaño (8 bytes), hash (vacio
+ *    en una adicion en flujo) y nombre; hasta completar FRAME_CONTROL_MAX bytes
+ *  - FRAME_CHUNKS: tamaño (8 bytes), hash de todo el contenido, comentario y nombre,
+ *    seguidos de los fragmentos del archivo en orden, cada uno con su tamaño (4 bytes)
+ *    y su SHA-256 (32 bytes); hasta FRAME_CHUNKS_MAX bytes
+ * Respuestas (FRAME_STATUS, con el codigo de retorno):
+ *  - ADD: CONTENT_REQUIRED, y el cliente envia el contenido en frames FRAME_DATA
+ *    seguidos de FRAME_END (con el hash si es una adicion en flujo) antes de la
+ *    respuesta final; cualquier otro codigo es la respuesta final. Desde
+ *    PROTOCOL_RESUME, CONTENT_REQUIRED lleva la posicion desde la que se puede
+ *    continuar (8 bytes, multiplo de RESUME_CHUNK) y sus puntos de control
+ *  - GET: VERSION_CREATED y el tamaño (8 bytes), seguido del contenido en frames
+ *    FRAME_DATA y FRAME_END; o VERSION_NOT_FOUND. Desde PROTOCOL_RESUME, despues
+ *    del tamaño va la posicion desde la que se envia el contenido (8 bytes)
+ *  - LIST: VERSION_CREATED y una cadena por linea del listado; o VERSION_NOT_FOUND
+ *  - MANIFEST: CONTENT_REQUIRED y los indices (4 bytes) de los archivos cuyo
+ *    contenido no tiene el servidor; el cliente envia esos contenidos uno tras otro,
+ *    en ese orden y cada uno como en ADD, sin esperar respuesta entre ellos. La
+ *    respuesta final es SUCCESS y el codigo de retorno de cada archivo (1 byte)
+ *  - CHUNKS: como ADD, pero CONTENT_REQUIRED lleva los indices (4 bytes) de los
+ *    fragmentos que no tiene el servidor y el cliente los envia como los contenidos
+ *    de un manifiesto. El servidor verifica que los fragmentos formen el contenido
+ *    anunciado antes de registrar la version
+ *
+ * Un cliente puede enviar hasta FRAME_PIPELINE_MAX solicitudes sin esperar sus
+ * respuestas. El servidor las procesa en orden, pero el contenido de cada obtencion
+ * se envia de a un frame, intercalado con los de otras obtenciones y con las
+ * respuestas de las solicitudes siguientes; el cliente asocia cada frame a su
+ * solicitud por el id. Las solicitudes recibidas mientras se espera el contenido
+ * de una adicion se procesan al terminarla.
+ *
+ * Transferencias interrumpidas (desde PROTOCOL_RESUME): el servidor conserva el
+ * contenido parcial de una adicion que se corta, identificado por su hash (en una
+ * adicion en flujo, por el usuario, el nombre y el tamaño), y el cliente conserva
+ * el de una obtencion en el archivo destino con el sufijo ".part". Al repetirla,
+ * quien tiene el contenido parcial envia un punto de control (8 bytes) por cada
+ * bloque de RESUME_CHUNK bytes (resume_checkpoint): el otro lado lee sus bloques y
+ * la transferencia sigue despues del ultimo que coincide. Un bloque incompleto se
+ * vuelve a transferir y el hash de todo el contenido se sigue verificando al final.
+ *
+ * Fragmentos (desde PROTOCOL_CHUNKS): el cliente corta un archivo grande donde lo
+ * indica su contenido (FastCDC), asi una edicion solo cambia los fragmentos que la
+ * contienen. El servidor guarda cada fragmento una vez y la version apunta a la
+ * lista de fragmentos: lo que se envia y se guarda es proporcional al cambio.
+ *
+ * Compresion (desde PROTOCOL_COMPRESS): en el saludo, despues del nombre de
+ * usuario, el cliente envia los codecs que admite (1 byte, FRAME_CODEC_LZ) y la
+ * respuesta lleva el codec elegido (1 byte, 0 para no comprimir). Con un codec, un
+ * frame se puede enviar como FRAME_PACKED: el codigo del frame original (1 byte), su
+ * longitud (4 bytes) y su contenido comprimido; ambas longitudes son a lo sumo
+ * FRAME_DATA_MAX. El cliente comprime los FRAME_DATA de las adiciones y el servidor
+ * los de las obtenciones y la respuesta de los listados. Cada frame se comprime por
+ * separado; uno que no se reduce se envia tal cual y se deja de intentar por unos
+ * frames (spacker), asi el contenido ya comprimido no cuesta CPU.
+ */
+#define FRAME_MAGIC 0x0056 /**< Identificador de un frame (bytes 0x00 'V') */
+#define FRAME_VERSION 2 /**< Version del formato de los frames (primera version del protocolo con frames) */
+#define PROTOCOL_VERSION 6 /**< Version mas reciente del protocolo, se negocia con FRAME_HELLO */
+#define PROTOCOL_MANIFEST 3 /**< Primera version del protocolo con FRAME_MANIFEST */
+#define PROTOCOL_RESUME 4 /**< Primera version del protocolo que continua transferencias interrumpidas */
+#define PROTOCOL_CHUNKS 5 /**< Primera version del protocolo con FRAME_CHUNKS */
+#define PROTOCOL_COMPRESS 6 /**< Primera version del protocolo que negocia la compresion de frames (FRAME_PACKED) */
+#define FRAME_HEADER_SIZE 12 /**< Tamaño del encabezado de un frame */
+#define FRAME_HELLO_MIN 50 /**< Tamaño minimo del saludo, igual al nombre de usuario de v1 */
+#define FRAME_DATA_MAX (1024 * 1024) /**< Bytes maximos de contenido por frame FRAME_DATA */
+#define FRAME_CONTROL_MAX (16 * 1024) /**< Bytes maximos de contenido de un frame que no es FRAME_DATA ni FRAME_CHUNKS */
+#define FRAME_CHUNKS_MAX (1024 * 1024) /**< Bytes maximos de contenido de un frame FRAME_CHUNKS */
+#define CHUNK_ENTRY_SIZE (4 + 32) /**< Bytes de cada fragmento en FRAME_CHUNKS: tamaño y SHA-256 */
+#define FRAME_PIPELINE_MAX 32 /**< Solicitudes sin respuesta completa que un cliente puede tener en curso */
+#define RESUME_CHUNK (8 * 1024 * 1024) /**< Bytes de cada bloque con punto de control de una transferencia interrumpida */
+#define RESUME_CHECKPOINTS_MAX 1536 /**< Puntos de control maximos por transferencia, caben en un frame de control */
+#define FRAME_CODEC_LZ 0x01 /**< Codec de los frames FRAME_PACKED: lz_compress (bit en los codecs del saludo) */
+#define FRAME_PACKED_HEADER 5 /**< Bytes de FRAME_PACKED antes del contenido comprimido: codigo y longitud del frame original */
+#define FRAME_PACKED_MIN 256 /**< Bytes minimos del contenido de un frame para intentar comprimirlo */
+#define FRAME_PACKED_RATIO 8 /**< Un frame se envia comprimido si se reduce al menos 1/FRAME_PACKED_RATIO */
+#define FRAME_PACKED_BACKOFF_MAX 64 /**< Frames maximos que se envian sin intentar comprimirlos despues de uno que no se reduce */
 
 /**
- * @brief Copia de un socket hacia un archivo local
- * @param socket Socket de comunicacion
- * @param destination Archivo destino
+ * @brief Codigo de un frame del protocolo v2
+ */
+typedef enum {
+	FRAME_HELLO = 1, /*!< Saludo y negociacion de version */
+	FRAME_ADD, /*!< Solicitud de adicion */
+	FRAME_GET, /*!< Solicitud de obtencion */
+	FRAME_LIST, /*!< Solicitud de listado */
+	FRAME_STATUS, /*!< Respuesta a una solicitud */
+	FRAME_DATA, /*!< Bloque del contenido de un archivo */
+	FRAME_END, /*!< Fin del contenido de un archivo */
+	FRAME_MANIFEST, /*!< Solicitud de adicion de varios archivos */
+	FRAME_RESUME, /*!< Posicion desde la que sigue el contenido de una adicion */
+	FRAME_CHUNKS, /*!< Solicitud de adicion de un archivo por fragmentos */
+	FRAME_PACKED /*!< Frame comprimido con el codec negociado */
+}frame_opcode;
+
+/**
+ * @brief Encabezado de un frame
+ */
+typedef struct {
+	uint8_t version; /**< Version del protocolo */
+	uint8_t opcode; /**< Codigo del frame (frame_opcode) */
+	uint32_t id; /**< Id de la solicitud */
+	uint32_t length; /**< Bytes del contenido del frame */
+} sframe;
+
+/**
+ * @brief Cursor de lectura o escritura de los campos de un frame
+ *
+ * Si un campo no cabe (o al leer, si el frame es mas corto) error queda en 1
+ * y las siguientes operaciones no hacen nada.
+ */
+typedef struct {
+	unsigned char *data; /**< Contenido del frame */
+	size_t size; /**< Capacidad (escritura) o tamaño (lectura) */
+	size_t off; /**< Bytes escritos o leidos */
+	int error; /**< 1 si un campo no cabe o el frame esta incompleto */
+} swire;
+
+/**
+ * @brief Escribe un encabezado de frame
+ *
+ * @param out Buffer de FRAME_HEADER_SIZE bytes
+ * @param opcode Codigo del frame
+ * @param id Id de la solicitud
+ * @param length Bytes del contenido del frame
+ */
+void frame_pack(unsigned char *out, frame_opcode opcode, uint32_t id, uint32_t length);
+
+/**
+ * @brief Lee un encabezado de frame
+ *
+ * @param in Buffer de FRAME_HEADER_SIZE bytes
+ * @param frame Encabezado leido
+ * @return 0 en caso de exito, -1 si no es un frame
+ */
+int frame_unpack(const unsigned char *in, sframe *frame);
+
+/**
+ * @brief Compresion adaptativa de los frames que se envian
+ *
+ * Despues de un frame que no se reduce, los siguientes se envian sin intentarlo:
+ * 1, 2, 4... hasta FRAME_PACKED_BACKOFF_MAX frames, mientras sigan sin reducirse.
+ */
+typedef struct {
+	int codec; /**< Codec negociado, 0 si no se comprime */
+	uint32_t skip; /**< Frames que aun se envian sin intentar comprimirlos */
+	uint32_t backoff; /**< Frames que se saltan despues del siguiente que no se reduce */
+} spacker;
+
+/**
+ * @brief Inicializa la compresion adaptativa de un contenido
+ *
+ * @param packer Compresion
+ * @param codec Codec negociado, 0 si no se comprime
+ */
+void packer_init(spacker *packer, int codec);
+
+/**
+ * @brief Indica si se intenta comprimir el siguiente frame; si no, cuenta uno de los que se saltan
  *
- * @return Resultado de la operacion (VERSION_ERROR o VERSION_CREATED)
+ * @param packer Compresion
+ * @return 1 si se intenta, 0 si se envia tal cual
  */
-return_code local_copy(int socket, char * destination);
+int packer_ready(spacker *packer);
 
 /**
- * @brief Copia un archivo hacia un socket de comunicacion
+ * @brief Reemplaza un frame por su version FRAME_PACKED si se reduce lo suficiente
  *
- * @param source Archivo fuente
+ * Un contenido menor a FRAME_PACKED_MIN o mayor a FRAME_DATA_MAX no se comprime.
+ *
+ * @param packer Compresion
+ * @param frame Frame completo (encabezado y contenido); se reescribe si se comprime
+ * @param scratch Buffer de tantos bytes como el contenido del frame
+ * @return Bytes del frame que se envia
+ */
+size_t frame_compress(spacker *packer, unsigned char *frame, unsigned char *scratch);
+
+/**
+ * @brief Descomprime el contenido de un frame FRAME_PACKED
+ *
+ * @param payload Contenido del frame FRAME_PACKED
+ * @param frame Encabezado del frame; se reemplazan el codigo y la longitud por los del frame original
+ * @param out Buffer del contenido original
+ * @param cap Capacidad de out
+ * @return 0 en caso de exito, -1 si el frame no es valido o no cabe en cap
+ */
+int frame_decompress(const unsigned char *payload, sframe *frame, unsigned char *out, size_t cap);
+
+/**
+ * @brief Inicializa un cursor
+ *
+ * @param wire Cursor
+ * @param data Buffer
+ * @param size Capacidad o tamaño del buffer
+ */
+void wire_init(swire *wire, void *data, size_t size);
+
+/**
+ * @brief Escribe un entero de 1, 2, 4 u 8 bytes en orden de red
+ *
+ * @param wire Cursor
+ * @param value Valor
+ * @param bytes Tamaño del campo
+ */
+void wire_put_uint(swire *wire, uint64_t value, size_t bytes);
+
+/**
+ * @brief Escribe bytes sin longitud
+ *
+ * @param wire Cursor
+ * @param data Bytes
+ * @param size Cantidad de bytes
+ */
+void wire_put_bytes(swire *wire, const void *data, size_t size);
+
+/**
+ * @brief Escribe una cadena precedida de su longitud
+ *
+ * @param wire Cursor
+ * @param s Cadena
+ */
+void wire_put_string(swire *wire, const char *s);
+
+/**
+ * @brief Lee un entero de 1, 2, 4 u 8 bytes en orden de red
+ *
+ * @param wire Cursor
+ * @param bytes Tamaño del campo
+ * @return Valor, 0 si el frame esta incompleto
+ */
+uint64_t wire_get_uint(swire *wire, size_t bytes);
+
+/**
+ * @brief Lee bytes sin longitud
+ *
+ * @param wire Cursor
+ * @param data Buffer de size bytes
+ * @param size Cantidad de bytes
+ */
+void wire_get_bytes(swire *wire, void *data, size_t size);
+
+/**
+ * @brief Lee una cadena precedida de su longitud
+ *
+ * @param wire Cursor
+ * @param s Buffer para la cadena (termina en NULL)
+ * @param cap Capacidad del buffer, si la cadena no cabe se marca error
+ */
+void wire_get_string(swire *wire, char *s, size_t cap);
+
+/**
+ * @brief Punto de control de un contenido parcial
+ *
+ * @param digest Hash del contenido desde el inicio hasta el final de un bloque de RESUME_CHUNK bytes
+ * @return Primeros 8 bytes del estado del hash
+ */
+uint64_t resume_checkpoint(const struct sha256_buff *digest);
+
+/**
+ * @brief Calcula el hash de los primeros bloques de RESUME_CHUNK bytes de un contenido
+ *
+ * Se detiene despues de count bloques, al llegar a un bloque incompleto o en el
+ * primer bloque cuyo punto de control no coincide con expected.
+ *
+ * @param source Contenido, se lee desde su posicion actual
+ * @param digest Hash inicializado; al terminar, hash de los bloques aceptados
+ * @param count Bloques maximos
+ * @param expected Puntos de control esperados (count), NULL para aceptar todos los bloques
+ * @param states Hash al final de cada bloque aceptado (count), NULL si no se necesita
+ * @return Cantidad de bloques aceptados
+ */
+uint32_t resume_scan(sobject_reader *source, struct sha256_buff *digest, uint32_t count, const uint64_t *expected, struct sha256_buff *states);
+
+
+/**
+ * @brief Resultado de un paso de transferencia no bloqueante
+ */
+typedef enum {
+	TRANSFER_DONE, /*!< La transferencia termino */
+	TRANSFER_PENDING, /*!< El socket no esta listo, se debe esperar un nuevo evento */
+	TRANSFER_ERROR /*!< Error de lectura/escritura o el cliente se desconecto */
+}transfer_status;
+
+/**
+ * @brief Estado de una transferencia de archivo sobre un socket no bloqueante
+ *
+ * Para el envio, primero se vacia el contenido de buffer (buf_off..buf_len)
+ * y luego se leen remaining bytes desde source, un archivo o los fragmentos de
+ * un contenido. Si zero_copy es 1, el contenido se envia con sendfile (sin pasar
+ * por el buffer); si el archivo no lo admite se vuelve a la lectura por bloques.
+ * Para la recepcion, se reciben remaining bytes del socket y se escriben en fd,
+ * si fd es -1 el contenido se descarta. Si digest no es NULL, el contenido recibido
+ * se agrega a ese hash.
+ */
+typedef struct {
+	int fd; /**< Archivo destino, -1 si no hay archivo */
+	sobject_reader source; /**< Contenido que se envia despues del buffer */
+	off_t remaining; /**< Bytes del archivo pendientes por transferir */
+	char *buffer; /**< Buffer de lectura/escritura */
+	size_t buf_cap; /**< Capacidad del buffer */
+	size_t buf_len; /**< Bytes validos en el buffer */
+	size_t buf_off; /**< Bytes del buffer que ya fueron enviados */
+	int failed; /**< 1 si no se pudo escribir el archivo destino */
+	int zero_copy; /**< 1 para enviar el contenido con sendfile */
+	struct sha256_buff *digest; /**< Hash del contenido recibido, NULL si no se calcula */
+} stransfer;
+
+#define TRANSFER_BUFFSIZE (64 * 1024) /**< Tamaño del buffer de una transferencia */
+#define TRANSFER_BUDGET (1024 * 1024) /**< Bytes maximos por paso antes de ceder el hilo a otra conexion */
+
+/**
+ * @brief Inicializa una transferencia vacia
+ *
+ * @param transfer Estado de la transferencia
+ */
+void transfer_init(stransfer * transfer);
+
+/**
+ * @brief Prepara la recepcion de un archivo de tamaño conocido
+ *
+ * Reserva el espacio del archivo destino para que la escritura no tenga que
+ * extenderlo bloque a bloque.
+ *
+ * @param transfer Estado de la transferencia
+ * @param size Bytes que se recibiran
+ */
+void transfer_expect(stransfer * transfer, off_t size);
+
+/**
+ * @brief Copia de un socket hacia un archivo local (no bloqueante)
  * @param socket Socket de comunicacion
+ * @param transfer Estado de la transferencia
+ *
+ * @return TRANSFER_DONE al recibir todo el archivo, TRANSFER_PENDING si se debe esperar datos
+ */
+transfer_status local_copy(int socket, stransfer * transfer);
+
+/**
+ * @brief Escribe en el archivo destino datos que no vienen del socket (contenido descomprimido)
  *
- * @return Resultado de la operacion (VERSION_ERROR o VERSION_CREATED)
+ * Como en local_copy, se agregan al hash y un error de escritura solo marca la transferencia como fallida.
+ *
+ * @param transfer Estado de la transferencia
+ * @param data Datos
+ * @param size Bytes de los datos
  */
-return_code remote_copy(char * source, int socket);
+void transfer_write(stransfer * transfer, const void * data, size_t size);
 
 /**
- * @brief Obtiene los datos del socket sin copiarlos
+ * @brief Copia un archivo hacia un socket de comunicacion (no bloqueante)
  *
- * @param source Archivo fuente
+ * @param transfer Estado de la transferencia
  * @param socket Socket de comunicacion
  *
- * @return Resultado de la operacion (VERSION_ERROR o VERSION_CREATED)
+ * @return TRANSFER_DONE al enviar todo el archivo, TRANSFER_PENDING si el socket esta lleno
+ */
+transfer_status remote_copy(stransfer * transfer, int socket);
+
+/**
+ * @brief Libera los recursos de una transferencia
+ *
+ * @param transfer Estado de la transferencia
  */
-void fake_local_copy(int socket);
+void transfer_reset(stransfer * transfer);
 
 /**
  * @brief Genera la ruta de la base de datos de versiones para un usuario específico
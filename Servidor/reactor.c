@@ -0,0 +1,272 @@
+/**
+ * @file
+ * @brief Implementacion del bucle de eventos del servidor
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "reactor.h"
+
+/**
+ * @brief Ciclo de un hilo del bucle de eventos
+ *
+ * @param arg Estructura del bucle
+ * @return void* NULL
+ */
+static void *reactor_loop(void *arg);
+
+/**
+ * @brief Acepta todas las conexiones pendientes del socket de escucha
+ *
+ * @param reactor Estructura del bucle
+ */
+static void reactor_accept(sreactor *reactor);
+
+/**
+ * @brief Atiende un evento de una conexion y la vuelve a registrar o la cierra
+ *
+ * @param reactor Estructura del bucle
+ * @param conn Conexion con el evento
+ */
+static void reactor_dispatch(sreactor *reactor, sconnection *conn);
+
+/**
+ * @brief Cierra una conexion y libera sus recursos
+ *
+ * @param reactor Estructura del bucle
+ * @param conn Conexion a cerrar
+ */
+static void reactor_close(sreactor *reactor, sconnection *conn);
+
+/**
+ * @brief Registra (o vuelve a registrar) un descriptor en epoll con EPOLLONESHOT
+ *
+ * @param reactor Estructura del bucle
+ * @param conn Conexion a registrar
+ * @param events Eventos a esperar
+ * @param op EPOLL_CTL_ADD o EPOLL_CTL_MOD
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int reactor_arm(sreactor *reactor, sconnection *conn, uint32_t events, int op);
+
+int set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int reactor_init(sreactor *reactor, int listen_fd, int thread_count, sreactor_handlers handlers) {
+	memset(reactor, 0, sizeof *reactor);
+	reactor->thread_count = thread_count > 0 ? thread_count : REACTOR_DEFAULT_THREADS;
+	reactor->handlers = handlers;
+	reactor->listener.fd = listen_fd;
+	reactor->running = 1;
+	pthread_mutex_init(&reactor->lock, NULL);
+
+	if (set_nonblocking(listen_fd) < 0) {
+		perror("Error configuring listening socket");
+		return -1;
+	}
+
+	if ((reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		perror("Error creating epoll instance");
+		return -1;
+	}
+
+	if ((reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		perror("Error creating eventfd");
+		close(reactor->epoll_fd);
+		return -1;
+	}
+
+	// El eventfd no usa EPOLLONESHOT: al escribirlo todos los hilos despiertan
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &reactor->wake_fd };
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev) < 0 ||
+		reactor_arm(reactor, &reactor->listener, EPOLLIN, EPOLL_CTL_ADD) < 0) {
+		perror("Error registering descriptors in epoll");
+		close(reactor->wake_fd);
+		close(reactor->epoll_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int reactor_start(sreactor *reactor) {
+	reactor->threads = malloc(reactor->thread_count * sizeof(pthread_t));
+	if (!reactor->threads) {
+		perror("Error allocating memory for threads");
+		return -1;
+	}
+
+	for (int i = 0; i < reactor->thread_count; i++) {
+		if (pthread_create(&reactor->threads[i], NULL, reactor_loop, reactor) != 0) {
+			perror("Error creating thread");
+			reactor->thread_count = i;
+			reactor_stop(reactor);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void reactor_stop(sreactor *reactor) {
+	uint64_t one = 1;
+	reactor->running = 0;
+	if (write(reactor->wake_fd, &one, sizeof(one)) < 0) {
+		// El contador del eventfd ya es distinto de cero, los hilos despertaran igual
+	}
+}
+
+void reactor_wait(sreactor *reactor) {
+	for (int i = 0; i < reactor->thread_count; i++)
+		pthread_join(reactor->threads[i], NULL);
+}
+
+void reactor_destroy(sreactor *reactor) {
+	// Ningun hilo atiende eventos, se pueden cerrar las conexiones restantes
+	while (reactor->connections) {
+		printf("Closing client %d\n", reactor->connections->fd);
+		reactor_close(reactor, reactor->connections);
+	}
+
+	close(reactor->wake_fd);
+	close(reactor->epoll_fd);
+	free(reactor->threads);
+	reactor->threads = NULL;
+	pthread_mutex_destroy(&reactor->lock);
+}
+
+static void *reactor_loop(void *arg) {
+	sreactor *reactor = arg;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while (reactor->running) {
+		int n = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("Error waiting for events");
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			void *ptr = events[i].data.ptr;
+
+			if (ptr == &reactor->wake_fd) return NULL;
+
+			if (ptr == &reactor->listener)
+				reactor_accept(reactor);
+			else
+				reactor_dispatch(reactor, ptr);
+		}
+	}
+
+	return NULL;
+}
+
+static void reactor_accept(sreactor *reactor) {
+	while (!reactor->accept_paused) {
+		int client_socket = accept4(reactor->listener.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (client_socket < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("Error accepting connection");
+			break;
+		}
+
+		sconnection *conn = calloc(1, sizeof *conn);
+		if (!conn) { // Verificar errores
+			perror("Error allocating memory");
+			close(client_socket);
+			continue;
+		}
+
+		conn->fd = client_socket;
+		if (reactor->handlers.on_accept(conn) < 0) {
+			close(client_socket);
+			free(conn);
+			continue;
+		}
+
+		pthread_mutex_lock(&reactor->lock);
+		conn->next = reactor->connections;
+		if (reactor->connections) reactor->connections->prev = conn;
+		reactor->connections = conn;
+		reactor->connection_count++;
+		pthread_mutex_unlock(&reactor->lock);
+
+		if (reactor_arm(reactor, conn, EPOLLIN, EPOLL_CTL_ADD) < 0) {
+			perror("Error registering client in epoll");
+			reactor_close(reactor, conn);
+		}
+	}
+
+	// El socket de escucha tambien usa EPOLLONESHOT para que un solo hilo acepte a la vez
+	pthread_mutex_lock(&reactor->lock);
+	if (!reactor->accept_paused)
+		reactor_arm(reactor, &reactor->listener, EPOLLIN, EPOLL_CTL_MOD);
+	pthread_mutex_unlock(&reactor->lock);
+}
+
+void reactor_pause_accept(sreactor *reactor) {
+	pthread_mutex_lock(&reactor->lock);
+	if (!reactor->accept_paused) {
+		reactor->accept_paused = 1;
+		reactor_arm(reactor, &reactor->listener, 0, EPOLL_CTL_MOD); // Sin eventos: desactivado
+		printf("Server saturated, new connections wait in the backlog\n");
+	}
+	pthread_mutex_unlock(&reactor->lock);
+}
+
+void reactor_resume_accept(sreactor *reactor) {
+	pthread_mutex_lock(&reactor->lock);
+	if (reactor->accept_paused) {
+		reactor->accept_paused = 0;
+		reactor_arm(reactor, &reactor->listener, EPOLLIN, EPOLL_CTL_MOD);
+		printf("Server accepting connections again\n");
+	}
+	pthread_mutex_unlock(&reactor->lock);
+}
+
+void reactor_resume(sreactor *reactor, sconnection *conn, int events) {
+	if (events <= 0 || reactor_arm(reactor, conn, events, EPOLL_CTL_MOD) < 0)
+		reactor_close(reactor, conn);
+}
+
+static void reactor_dispatch(sreactor *reactor, sconnection *conn) {
+	int events = reactor->handlers.on_event(conn);
+
+	if (events == REACTOR_DETACHED) return; // Otro hilo llamara a reactor_resume
+
+	reactor_resume(reactor, conn, events);
+}
+
+static void reactor_close(sreactor *reactor, sconnection *conn) {
+	pthread_mutex_lock(&reactor->lock);
+	if (conn->prev) conn->prev->next = conn->next;
+	else reactor->connections = conn->next;
+	if (conn->next) conn->next->prev = conn->prev;
+	reactor->connection_count--;
+	pthread_mutex_unlock(&reactor->lock);
+
+	reactor->handlers.on_close(conn);
+	close(conn->fd); // Al cerrar el descriptor epoll lo elimina de su lista
+	free(conn);
+}
+
+static int reactor_arm(sreactor *reactor, sconnection *conn, uint32_t events, int op) {
+	struct epoll_event ev = { .events = events | EPOLLONESHOT, .data.ptr = conn };
+	return epoll_ctl(reactor->epoll_fd, op, conn->fd, &ev);
+}
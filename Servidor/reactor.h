@@ -0,0 +1,137 @@
+/**
+ * @file
+ * @brief Interfaz del bucle de eventos del servidor
+ *
+ * Un numero pequeño de hilos espera eventos sobre una unica instancia de epoll.
+ * Cada conexion se registra con EPOLLONESHOT, de modo que solo un hilo
+ * a la vez atiende una conexion y no se requieren bloqueos sobre su estado.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define REACTOR_MAX_EVENTS 16 /**< Eventos procesados por cada llamada a epoll_wait */
+#define REACTOR_DEFAULT_THREADS 4 /**< Hilos del bucle de eventos por defecto */
+
+/**
+ * @brief Conexion registrada en el bucle de eventos
+ */
+typedef struct sconnection {
+	int fd; /**< Socket del cliente (no bloqueante) */
+	void *data; /**< Estado del protocolo asociado a la conexion */
+	struct sconnection *prev; /**< Conexion anterior en la lista de conexiones */
+	struct sconnection *next; /**< Conexion siguiente en la lista de conexiones */
+} sconnection;
+
+#define REACTOR_DETACHED 0 /**< La conexion quedo en manos de un trabajo, que llamara a reactor_resume */
+
+/**
+ * @brief Manejadores de eventos de las conexiones
+ *
+ * on_event retorna los eventos que se deben esperar a continuacion (EPOLLIN o EPOLLOUT),
+ * REACTOR_DETACHED si otro hilo continua la conexion, o -1 si la conexion se debe cerrar.
+ */
+typedef struct {
+	int (*on_accept)(sconnection *conn); /**< Nueva conexion, retorna -1 para rechazarla */
+	int (*on_event)(sconnection *conn); /**< El socket esta listo para leer o escribir */
+	void (*on_close)(sconnection *conn); /**< La conexion se va a cerrar */
+} sreactor_handlers;
+
+/**
+ * @brief Estructura del bucle de eventos
+ */
+typedef struct {
+	int epoll_fd; /**< Instancia de epoll compartida por todos los hilos */
+	int wake_fd; /**< eventfd para despertar a los hilos al terminar */
+	sconnection listener; /**< Socket de escucha */
+	sreactor_handlers handlers; /**< Manejadores de las conexiones */
+	int thread_count; /**< Cantidad de hilos del bucle */
+	pthread_t *threads; /**< Hilos del bucle */
+	pthread_mutex_t lock; /**< Protege la lista de conexiones */
+	sconnection *connections; /**< Lista de conexiones abiertas */
+	int connection_count; /**< Cantidad de conexiones abiertas */
+	int accept_paused; /**< 1 si no se estan aceptando conexiones nuevas */
+	volatile int running; /**< 0 cuando el servidor se esta cerrando */
+} sreactor;
+
+/**
+ * @brief Inicializa el bucle de eventos
+ *
+ * @param reactor Estructura del bucle
+ * @param listen_fd Socket de escucha (se configura como no bloqueante)
+ * @param thread_count Cantidad de hilos que atienden eventos
+ * @param handlers Manejadores de las conexiones
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int reactor_init(sreactor *reactor, int listen_fd, int thread_count, sreactor_handlers handlers);
+
+/**
+ * @brief Crea los hilos del bucle de eventos
+ *
+ * @param reactor Estructura del bucle
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int reactor_start(sreactor *reactor);
+
+/**
+ * @brief Solicita la terminacion de los hilos del bucle
+ *
+ * Puede llamarse desde un manejador de señales.
+ *
+ * @param reactor Estructura del bucle
+ */
+void reactor_stop(sreactor *reactor);
+
+/**
+ * @brief Espera a que terminen los hilos del bucle
+ *
+ * @param reactor Estructura del bucle
+ */
+void reactor_wait(sreactor *reactor);
+
+/**
+ * @brief Cierra todas las conexiones y libera el bucle
+ *
+ * Solo debe llamarse cuando ningun hilo atiende conexiones.
+ *
+ * @param reactor Estructura del bucle
+ */
+void reactor_destroy(sreactor *reactor);
+
+/**
+ * @brief Devuelve al bucle una conexion que habia quedado en manos de otro hilo
+ *
+ * @param reactor Estructura del bucle
+ * @param conn Conexion
+ * @param events Eventos a esperar (EPOLLIN o EPOLLOUT), -1 para cerrar la conexion
+ */
+void reactor_resume(sreactor *reactor, sconnection *conn, int events);
+
+/**
+ * @brief Deja de aceptar conexiones nuevas, que esperan en la cola del kernel (backlog)
+ *
+ * @param reactor Estructura del bucle
+ */
+void reactor_pause_accept(sreactor *reactor);
+
+/**
+ * @brief Vuelve a aceptar conexiones nuevas
+ *
+ * @param reactor Estructura del bucle
+ */
+void reactor_resume_accept(sreactor *reactor);
+
+/**
+ * @brief Configura un descriptor como no bloqueante
+ *
+ * @param fd Descriptor
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int set_nonblocking(int fd);
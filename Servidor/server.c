@@ -2,10 +2,13 @@
  * @file
  * @brief Programa servidor
  * 
- * Este archivo contiene la implementación de un servidor que acepta conexiones de clientes y maneja la comunicación con ellos en hilos separados.
+ * Este archivo contiene la implementación de un servidor que acepta conexiones de clientes y maneja la comunicación con ellos.
  * 
- * @details El servidor utiliza sockets para la comunicación y crea un nuevo hilo para cada cliente que se conecta. 
- * El servidor puede manejar múltiples clientes de manera concurrente.
+ * @details El servidor utiliza sockets no bloqueantes y un bucle de eventos (epoll) atendido por pocos hilos.
+ * Cada conexion tiene una maquina de estados que avanza cada vez que su socket esta listo,
+ * de modo que miles de clientes inactivos no consumen un hilo cada uno.
+ * El trabajo que accede a disco se encola en un conjunto acotado de hilos trabajadores;
+ * cuando la cola se llena el servidor deja de aceptar conexiones hasta que se libere.
  * El servicdor maneja peticiónes de adición, obtención y listado de archivos en un repositorio.
  * 
  * @version 1.0
@@ -25,9 +28,134 @@
 #include <signal.h>
 #include <pthread.h>
 #include "versions.h"
+#include "reactor.h"
+#include "threadpool.h"
 #include <limits.h>
+#include <errno.h>
+
+#define USERNAME_SIZE 50 ///< Tamaño del nombre de usuario enviado al conectarse
+#define FRAME_PACKED_BLOCK (128 * 1024) ///< Bytes de contenido de cada frame comprimido de una obtencion
+
+/**
+ * @brief Estado de la maquina de estados de una conexion
+ */
+typedef enum {
+    SESSION_USERNAME, /*!< Esperando el nombre de usuario */
+    SESSION_OPCODE, /*!< Esperando el codigo de operacion */
+    SESSION_REQUEST, /*!< Esperando la estructura de la solicitud */
+    SESSION_FILESIZE, /*!< Esperando el tamaño del archivo de una adicion */
+    SESSION_RECEIVE, /*!< Recibiendo el contenido del archivo de una adicion */
+    SESSION_TRAILER, /*!< Esperando el hash enviado despues del contenido de una adicion en flujo */
+    SESSION_SEND, /*!< Enviando la respuesta de la operacion (o la negociacion de una adicion) */
+    SESSION_FRAME_HEADER, /*!< v2: esperando el encabezado de un frame */
+    SESSION_FRAME_PAYLOAD, /*!< v2: recibiendo el contenido de un frame de control */
+    SESSION_FRAME_DATA /*!< v2: recibiendo un bloque del archivo de una adicion */
+} session_state;
+
+/**
+ * @brief Contenido de una obtencion v2 que se esta enviando
+ *
+ * El contenido se envia de a un frame FRAME_DATA por turno, intercalado con
+ * los frames de las demas obtenciones y con las respuestas de otras solicitudes.
+ */
+typedef struct {
+    uint32_t id; // Id de la solicitud
+    off_t left; // Bytes del archivo que aun no tienen frame
+    int ended; // 1 si el frame en curso es FRAME_END
+    stransfer transfer; // Frame en curso: encabezado en buffer y contenido desde source
+    spacker packer; // v6: compresion de los frames FRAME_DATA
+} sstream;
+
+/**
+ * @brief Archivo de una adicion v2 de varios archivos
+ */
+typedef struct {
+    char *filename; // Nombre del archivo
+    char hash[HASH_SIZE]; // Hash del contenido, vacio en una adicion en flujo hasta recibirlo
+    off_t size; // Tamaño del contenido
+    return_code result; // Resultado de la adicion del archivo
+} smanifest_entry;
+
+/**
+ * @brief Adicion v2 de varios archivos en curso
+ *
+ * Se piden de una vez los contenidos que no tiene el servidor; el cliente los
+ * envia uno tras otro y las versiones se registran al recibir el ultimo.
+ */
+typedef struct {
+    char comment[COMMENT_SIZE]; // Comentario de todas las versiones
+    smanifest_entry *entries; // Archivos
+    uint32_t count; // Cantidad de archivos
+    uint32_t *missing; // Indices de los archivos cuyo contenido se pidio
+    uint32_t missing_count; // Cantidad de indices en missing
+    uint32_t next; // Posicion en missing del contenido que se esta recibiendo
+} smanifest;
+
+/**
+ * @brief Adicion v5 de un archivo por fragmentos en curso
+ *
+ * Se piden de una vez los fragmentos que no tiene el servidor; el cliente los envia
+ * uno tras otro y la version se registra al recibir el ultimo.
+ */
+typedef struct {
+    sadd add; // Solicitud del archivo, con el hash de todo el contenido
+    sobject_chunk *chunks; // Fragmentos en orden
+    uint32_t count; // Cantidad de fragmentos
+    uint32_t *missing; // Indices de los fragmentos cuyo contenido se pidio
+    uint32_t missing_count; // Cantidad de indices en missing
+    uint32_t next; // Posicion en missing del fragmento que se esta recibiendo
+    int failed; // 1 si algun fragmento no se pudo guardar
+} schunked;
+
+/** 
+ * @brief Estado del protocolo de una conexion
+ * Guarda lo necesario para continuar la operacion cuando el socket vuelve a estar listo.
+*/
+typedef struct {
+    session_state state; // Estado actual
+    char username[USERNAME_SIZE]; // Nombre de usuario de la conexion
+    char db_path[PATH_MAX]; // Base de datos del usuario
+    operation_type op_type; // Codigo de operacion en curso
+    union {
+        sadd add;
+        sget get;
+        slist list;
+    } request; // Solicitud en curso
+    size_t received; // Bytes recibidos del campo actual
+    ssize_t filesz; // Tamaño del archivo recibido
+    return_code result; // Resultado de la operacion en curso
+    session_state after_send; // Estado al terminar de enviar la respuesta
+    stransfer transfer; // Transferencia en curso
+    sobject_writer upload; // Contenido que se esta recibiendo en una adicion
+    struct sha256_buff digest; // Hash calculado al recibir el contenido de una adicion
+    int uploading; // 1 desde que se pide el contenido de una adicion hasta registrarla
+    int version; // Version del protocolo de la conexion (1, o la negociada con FRAME_HELLO)
+    session_state idle; // Estado en el que se espera la siguiente solicitud
+    unsigned char header[FRAME_HEADER_SIZE]; // v2: encabezado del frame en curso
+    sframe frame; // v2: frame en curso
+    unsigned char *payload; // v2: contenido del frame de control en curso
+    size_t payload_cap; // v2: capacidad de payload
+    uint32_t request_id; // v2: id de la solicitud en curso
+    off_t content_received; // v2: bytes recibidos del archivo de una adicion
+    sstream streams[FRAME_PIPELINE_MAX]; // v2: contenidos de obtenciones que se estan enviando
+    int stream_count; // v2: cantidad de contenidos en streams
+    int stream_next; // v2: contenido al que le toca el siguiente frame
+    int stream_active; // v2: contenido con un frame a medio enviar, -1 si no hay
+    unsigned char *deferred; // v2: frames de solicitudes recibidos durante una adicion (encabezado y contenido)
+    size_t deferred_len; // v2: bytes validos en deferred
+    size_t deferred_off; // v2: bytes de deferred ya procesados
+    int deferred_count; // v2: frames pendientes en deferred
+    smanifest manifest; // v2: adicion de varios archivos en curso
+    schunked chunked; // v5: adicion por fragmentos en curso
+    off_t resume_offset; // v4: adicion: bytes de una recepcion interrumpida que se ofrecen; obtencion: bytes que tiene el cliente
+    uint32_t resume_count; // v4: obtencion: cantidad de puntos de control del cliente
+    uint64_t *resume_sums; // v4: obtencion: puntos de control del contenido que tiene el cliente
+    struct sha256_buff *resume_states; // v4: adicion: hash del contenido parcial al inicio y al final de cada bloque ofrecido
+    int codec; // v6: codec de los frames FRAME_PACKED, 0 si no se comprime
+    unsigned char *packed; // v6: bloque comprimido de un frame que se envia (FRAME_PACKED_BLOCK bytes)
+    unsigned char *unpacked; // v6: contenido descomprimido de un frame recibido (FRAME_DATA_MAX bytes)
+} ssession;
 
-#define MAX_THREADS 100 ///< Máximo número de hilos que se pueden manejar
 /**
  * @brief Inicializa el servidor creando el directorio de versiones si no existe
  */
@@ -43,51 +171,411 @@ void initialize_server();
  */
 void sig_handler(int signo);
 
+/**
+ * @brief Crea el estado de una conexion nueva
+ * 
+ * @param conn Conexion aceptada
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+int client_accept(sconnection *conn);
+
 /**
  * @brief Manejador de clientes
  * 
- * Esta función se ejecuta en un hilo separado para cada cliente que se conecta al servidor.
- * Se encarga de recibir y enviar saludos al cliente.
+ * Envia el contenido pendiente de las obtenciones v2 y avanza la maquina de
+ * estados de la conexion. Nunca bloquea al hilo del bucle de eventos.
+ * 
+ * @param conn Conexion lista para leer o escribir
+ * @return EPOLLIN y/o EPOLLOUT segun los eventos que se deben esperar, -1 para cerrar la conexion
+ */
+int client_handler(sconnection *conn);
+
+/**
+ * @brief Avanza la maquina de estados de la conexion mientras el socket tenga datos
+ * (o espacio para escribir)
+ * 
+ * @param conn Conexion lista para leer o escribir
+ * @return EPOLLIN o EPOLLOUT segun el evento que se debe esperar, REACTOR_DETACHED si
+ *         continua un hilo trabajador, -1 para cerrar la conexion
+ */
+int client_step(sconnection *conn);
+
+/**
+ * @brief Libera el estado de una conexion
+ * 
+ * @param conn Conexion que se va a cerrar
+ */
+void client_close(sconnection *conn);
+
+/**
+ * @brief Trabajo de una conexion ejecutado en un hilo trabajador
+ * 
+ * Realiza la parte de la operacion que accede a disco (preparar la operacion
+ * o registrar una version recibida) y devuelve la conexion al bucle de eventos.
+ * 
+ * @param arg Conexion
+ */
+void client_job(void *arg);
+
+/**
+ * @brief Notificacion de saturacion de la cola de trabajos
  * 
- * @param arg Puntero al socket del cliente
- * @return void* 
+ * @param ctx Bucle de eventos
+ * @param saturated 1 si la cola se lleno, 0 si se libero
  */
-void * client_handler(void * arg);
+void pool_saturation(void *ctx, int saturated);
 
 /**
  * @brief Recibir estructura
  * 
- * Esta función se encarga de recibir una estructura de un socket.
+ * Esta función se encarga de recibir una estructura de un socket no bloqueante.
+ * Puede llamarse varias veces hasta que se reciba la estructura completa.
  * 
  * @param sockfd Socket del que se va a recibir la estructura
  * @param struct_ptr Puntero a la estructura donde se va a guardar la información
  * @param struct_size Tamaño de la estructura
- * @return ssize_t Cantidad de bytes leidos
+ * @param received Bytes de la estructura recibidos hasta el momento
+ * @return 1 si la estructura esta completa, 0 si faltan datos, -1 si ocurre un error o el cliente se desconecto
  */
-ssize_t recvs(int sockfd, void *struct_ptr, size_t struct_size) ;
+int recvs(int sockfd, void *struct_ptr, size_t struct_size, size_t *received);
 
-/** 
- * @brief Estructura de Gestion de hilos
- * Guarda la información necesaria para gestionar los hilos del servidor.
-*/
-typedef struct {
-    int thread_count; // Cantidad de hilos actauales
-    int *threads; // Arreglo de sockets de hilos
-} sserver_handler;
+/**
+ * @brief Procesa una solicitud recibida completamente y prepara su respuesta
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ */
+void begin_operation(int client_socket, ssession *session);
+
+/**
+ * @brief Publica el contenido recibido, registra la version y prepara la respuesta de la adicion
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ */
+void finish_add(int client_socket, ssession *session);
+
+/**
+ * @brief Clasifica los archivos de una adicion de varios archivos y pide los contenidos que faltan
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con el manifiesto recibido
+ */
+void begin_manifest(int client_socket, ssession *session);
+
+/**
+ * @brief Guarda el resultado del contenido recibido de un archivo del manifiesto y
+ * prepara la recepcion del siguiente o, si era el ultimo, la respuesta final
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con el resultado del contenido recibido
+ */
+void manifest_received(int client_socket, ssession *session);
+
+/**
+ * @brief Prepara la recepcion del siguiente contenido pedido de un manifiesto
+ * 
+ * @param session Estado de la conexion
+ * @return 0 en caso de exito, -1 si no se puede crear el archivo temporal
+ */
+int manifest_expect(ssession *session);
+
+/**
+ * @brief Registra las versiones de un manifiesto y prepara la respuesta final
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ */
+void finish_manifest(int client_socket, ssession *session);
+
+/**
+ * @brief Lee un frame FRAME_MANIFEST
+ * 
+ * @param session Estado de la conexion
+ * @param wire Cursor sobre el contenido del frame, despues del comentario
+ * @return 0 en caso de exito, -1 si el frame no es valido o no hay memoria
+ */
+int manifest_parse(ssession *session, swire *wire);
+
+/**
+ * @brief Libera el manifiesto de la conexion
+ * 
+ * @param session Estado de la conexion
+ */
+void manifest_free(ssession *session);
+
+/**
+ * @brief Prepara la recepcion de un contenido que el cliente envia sin esperar respuesta
+ * (un archivo de un manifiesto o un fragmento)
+ * 
+ * @param session Estado de la conexion, con la solicitud del contenido en request.add
+ * @param size Tamaño del contenido
+ * @return 0 en caso de exito, -1 si no se puede crear el archivo temporal
+ */
+int session_expect_upload(ssession *session, off_t size);
+
+/**
+ * @brief Pide los fragmentos de una adicion que no tiene el servidor
+ * 
+ * Si la version ya existe o el servidor ya tiene el contenido se responde sin pedir nada.
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con la lista de fragmentos recibida
+ */
+void begin_chunks(int client_socket, ssession *session);
+
+/**
+ * @brief Guarda el resultado del fragmento recibido y prepara la recepcion del siguiente
+ * o, si era el ultimo, registra la version
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con el resultado del fragmento recibido
+ */
+void chunks_received(int client_socket, ssession *session);
+
+/**
+ * @brief Guarda la lista de fragmentos, registra la version y prepara la respuesta final
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ */
+void finish_chunks(int client_socket, ssession *session);
+
+/**
+ * @brief Lee los fragmentos de un frame FRAME_CHUNKS
+ * 
+ * @param session Estado de la conexion, con la solicitud de adicion
+ * @param wire Cursor sobre el contenido del frame, despues del nombre
+ * @param size Tamaño del archivo, igual a la suma de los fragmentos
+ * @return 0 en caso de exito, -1 si el frame no es valido o no hay memoria
+ */
+int chunks_parse(ssession *session, swire *wire, uint64_t size);
+
+/**
+ * @brief Libera la adicion por fragmentos de la conexion
+ * 
+ * @param session Estado de la conexion
+ */
+void chunks_free(ssession *session);
+
+/**
+ * @brief Compara dos fragmentos por su hash y luego por su posicion, para ordenarlos con qsort
+ * 
+ * @param a Puntero a un fragmento
+ * @param b Puntero a un fragmento
+ * @return Menor, igual o mayor que 0, como memcmp
+ */
+int chunk_compare(const void *a, const void *b);
+
+/**
+ * @brief Compara dos archivos de un manifiesto por su hash y luego por su posicion, para ordenarlos con qsort
+ * 
+ * @param a Puntero a un archivo del manifiesto
+ * @param b Puntero a un archivo del manifiesto
+ * @return Menor, igual o mayor que 0, como strcmp
+ */
+int manifest_compare(const void *a, const void *b);
+
+/**
+ * @brief Registra la version de una adicion (si corresponde) y prepara la respuesta final
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con el resultado de la adicion hasta el momento
+ */
+void register_version(int client_socket, ssession *session);
+
+/**
+ * @brief Valida el nombre de usuario de la conexion y crea su base de datos si no existe
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con el nombre de usuario
+ * @return 0 en caso de exito, -1 si el nombre no es valido o no se puede crear la base de datos
+ */
+int session_login(int client_socket, ssession *session);
+
+/**
+ * @brief Procesa un frame v2 de control recibido completamente
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con el frame en header y su contenido en payload
+ * @return 1 si se debe continuar en un hilo trabajador, 0 si se continua en el bucle de eventos,
+ *         -1 si el frame no es valido y se debe cerrar la conexion
+ */
+int session_frame(int client_socket, ssession *session);
+
+/**
+ * @brief Prepara el codigo de retorno de la solicitud en curso (v1: el codigo, v2: un frame FRAME_STATUS)
+ * 
+ * @param session Estado de la conexion
+ * @param code Codigo de retorno
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+int session_status(ssession *session, return_code code);
 
-sserver_handler *server_handler; // Estructura de gestión de hilos
+/**
+ * @brief Crea el archivo donde se recibe el contenido de una adicion
+ * 
+ * Desde PROTOCOL_RESUME el archivo conserva lo recibido en una adicion interrumpida del
+ * mismo contenido (resume_offset); se identifica por el hash o, en una adicion en flujo,
+ * por el usuario, el nombre y el tamaño del archivo.
+ * 
+ * @param session Estado de la conexion, con la solicitud de adicion
+ * @return Descriptor del archivo, -1 si ocurre un error
+ */
+int session_create_upload(ssession *session);
+
+/**
+ * @brief Prepara la respuesta CONTENT_REQUIRED de una adicion
+ * 
+ * Desde PROTOCOL_RESUME la respuesta ofrece continuar despues de los bloques completos
+ * del contenido parcial, con sus puntos de control; el resto del contenido parcial se descarta.
+ * 
+ * @param session Estado de la conexion, con el archivo y el hash de la adicion inicializados
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int session_require_content(ssession *session);
+
+/**
+ * @brief Procesa un frame FRAME_RESUME: el contenido de la adicion sigue desde la posicion indicada
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ * @return 0 en caso de exito, -1 si el frame no es valido
+ */
+int session_resume(int client_socket, ssession *session);
+
+/**
+ * @brief Procesa un frame FRAME_PACKED: un bloque comprimido del contenido de la adicion
+ * 
+ * Se descomprime y se valida igual que un frame FRAME_DATA.
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ * @return 0 en caso de exito, -1 si el frame no es valido o no hay memoria
+ */
+int session_unpack(int client_socket, ssession *session);
+
+/**
+ * @brief Prepara la recepcion del contenido de una adicion despues de enviar CONTENT_REQUIRED
+ * 
+ * @param session Estado de la conexion, con la respuesta CONTENT_REQUIRED preparada
+ */
+void session_expect_content(ssession *session);
+
+/**
+ * @brief Agrega el contenido de una obtencion v2 a los que se estan enviando
+ * 
+ * @param session Estado de la conexion
+ * @param source Contenido desde la posicion que se envia (pasa a la obtencion; se cierra si ocurre un error)
+ * @param size Bytes que se envian
+ * @return 0 en caso de exito, -1 si hay demasiadas obtenciones en curso o no hay memoria
+ */
+int session_open_stream(ssession *session, sobject_reader *source, off_t size);
+
+/**
+ * @brief Envia frames del contenido de las obtenciones v2, uno por obtencion en cada turno
+ * 
+ * Cada bloque de hasta FRAME_DATA_MAX bytes va en un frame FRAME_DATA; al final se envia FRAME_END.
+ * Un frame empezado se termina antes de enviar cualquier otro; mientras hay una respuesta
+ * por enviar no se empiezan frames nuevos.
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ * @return 0 si se debe esperar a que el socket admita escritura o no hay mas contenido, -1 si ocurre un error
+ */
+int session_pump(int client_socket, ssession *session);
+
+/**
+ * @brief Prepara un frame comprimido del contenido de una obtencion
+ * 
+ * Lee un bloque de hasta FRAME_PACKED_BLOCK bytes al buffer del contenido y lo
+ * comprime; si no se reduce lo suficiente se envia como FRAME_DATA.
+ * 
+ * @param session Estado de la conexion
+ * @param stream Contenido
+ * @return Bytes de contenido del frame, -1 si ocurre un error de lectura
+ */
+ssize_t session_pack_stream(ssession *session, sstream *stream);
+
+/**
+ * @brief Guarda un frame de solicitud recibido durante una adicion para procesarlo al terminarla
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion, con el frame en header y su contenido en payload
+ * @return 0 en caso de exito, -1 si hay demasiadas solicitudes pendientes o no hay memoria
+ */
+int session_defer(int client_socket, ssession *session);
+
+/**
+ * @brief Procesa el siguiente frame guardado durante una adicion
+ * 
+ * @param client_socket Socket del cliente
+ * @param session Estado de la conexion
+ * @return Igual que session_frame
+ */
+int session_replay(int client_socket, ssession *session);
+
+/**
+ * @brief Convierte la respuesta de un listado al formato v2
+ * 
+ * @param session Estado de la conexion
+ * @param response Respuesta en el formato v1 (codigo, lineas con su tamaño y linea de tamaño 0)
+ * @param response_len Tamaño de la respuesta
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+int session_list_reply(ssession *session, const char *response, size_t response_len);
+
+/**
+ * @brief Prepara una respuesta para enviar desde el buffer de la transferencia
+ * 
+ * @param session Estado de la conexion
+ * @param data Datos de la respuesta
+ * @param size Tamaño de los datos
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+int session_reply(ssession *session, const void *data, size_t size);
+
+sreactor reactor; // Bucle de eventos
+sthread_pool pool; // Hilos trabajadores
 int server_socket; // Socket del servidor
 
 int main(int argc, char *argv[])
 {
+    int io_threads = REACTOR_DEFAULT_THREADS; // Hilos del bucle de eventos
+    int workers = THREADPOOL_DEFAULT_WORKERS; // Hilos trabajadores
+    int queue_size = THREADPOOL_DEFAULT_QUEUE; // Capacidad de la cola de trabajos
+    int backlog = SOMAXCONN; // Conexiones que esperan en el kernel
+    size_t cache_mb = 0; // Memoria de la cache de versiones en MB (0: valor por defecto)
+    wal_mode durability = WAL_BATCHED; // Durabilidad de las adiciones
+    unsigned int latency_us = WAL_DEFAULT_LATENCY_US; // Latencia maxima de un lote
+    unsigned int keyframe = VERSIONS_DEFAULT_KEYFRAME; // Cada cuantas versiones se guarda una completa
+    int compress = 1; // Guardar comprimidos los contenidos que lo valen
+    unsigned int pack_interval = VERSIONS_DEFAULT_PACK_INTERVAL; // Segundos entre pasadas del empaquetado
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:w:q:b:c:d:k:z:p:")) != -1) {
+        switch (opt) {
+            case 't': io_threads = atoi(optarg); break;
+            case 'w': workers = atoi(optarg); break;
+            case 'q': queue_size = atoi(optarg); break;
+            case 'b': backlog = atoi(optarg); break;
+            case 'c': cache_mb = strtoul(optarg, NULL, 10); break;
+            case 'd':
+                if (wal_parse_mode(optarg, &durability, &latency_us) < 0) optind = argc + 1;
+                break;
+            case 'k': keyframe = strtoul(optarg, NULL, 10); break;
+            case 'z': compress = atoi(optarg) != 0; break;
+            case 'p': pack_interval = strtoul(optarg, NULL, 10); break;
+            default: optind = argc + 1; break;
+        }
+    }
+
     initialize_server();
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s <port> [-t io_threads] [-w workers] [-q queue_size] [-b backlog] [-c cache_mb] [-d none|batched[:usec]|strict] [-k keyframe_interval] [-z 0|1] [-p pack_interval]\n", argv[0]);
         exit(EXIT_FAILURE);
     }   
 
-    struct stat s;
-
         //Crear el directorio ".versions/" si no existe
     #ifdef __linux__
         mkdir(VERSIONS_DIR, 0755);
@@ -95,35 +583,23 @@ int main(int argc, char *argv[])
         mkdir(VERSIONS_DIR);
     #endif
 
-	// Crea el archivo .versions/versions.db si no existe
-	//if (stat(VERSIONS_DB_PATH, &s) != 0) {
-	//	creat(VERSIONS_DB_PATH, 0755);
-	//}
+    if (versions_init(cache_mb * 1024 * 1024, durability, latency_us, keyframe, compress, pack_interval) < 0) exit(EXIT_FAILURE);
 
     struct sockaddr_in server_addr;
-    server_handler = malloc(sizeof *server_handler);
-    int port = atoi(argv[1]); 
+    int port = atoi(argv[optind]); 
+    int reuse = 1;
 
     //0. Instalar los manejadores SIGINT, SIGTERM
     signal(SIGINT, sig_handler);
     signal(SIGTERM, sig_handler);
-    //1. Obtener un conector
-    if (!server_handler) {
-        perror("Error allocating memory for server handler");
-        exit(EXIT_FAILURE);
-    }
-
-    server_handler->thread_count = 0;
-    server_handler->threads = malloc(MAX_THREADS*sizeof(int)); // Reservar memoria para los hilos
-    if (!server_handler->threads) {
-        perror("Error allocating memory for threads");
-        exit(EXIT_FAILURE);
-    }
+    signal(SIGPIPE, SIG_IGN); // Un cliente desconectado no debe terminar el servidor
 
+    //1. Obtener un conector
     if ((server_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("Error creating socket");
         exit(EXIT_FAILURE);
     }
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     //2. Asociar una direccion al conector -bindb
     memset(&server_addr, 0, sizeof(struct sockaddr_in));
@@ -137,188 +613,1464 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_socket, MAX_THREADS) == -1) { // Escuchar conexiones
+    if (listen(server_socket, backlog) == -1) { // Escuchar conexiones
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    printf("Waiting for a client...\n");
-    while (1) // Aceptar conexiones
-    {
-        struct sockaddr_in client_addr; // Dirección del cliente
-        socklen_t clilen = sizeof(struct sockaddr_in); // Tamaño de la dirección del cliente
-        int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &clilen); // Aceptar la conexión
-        printf("(después de aceptar la conexión)\n");
-
-        if (client_socket < 0) { // Verificar errores
-            perror("Error accepting connection");
-            continue;
-        }
+    //3. Atender las conexiones desde el bucle de eventos, el trabajo de disco se hace en los trabajadores
+    sreactor_handlers handlers = { client_accept, client_handler, client_close };
+    if (reactor_init(&reactor, server_socket, io_threads, handlers) < 0) {
+        close(server_socket);
+        exit(EXIT_FAILURE);
+    }
 
-        printf("Client %d connected\n", client_socket);
-        int *client_socket_ptr = malloc(sizeof(int));
-        if (!client_socket_ptr) { // Verificar errores
-            perror("Error allocating memory");
-            close(client_socket);
-            continue;
-        }
+    if (threadpool_init(&pool, workers, queue_size, pool_saturation, &reactor) < 0 || reactor_start(&reactor) < 0) {
+        close(server_socket);
+        exit(EXIT_FAILURE);
+    }
 
-        *client_socket_ptr = client_socket;
-        pthread_t thread_id;
+    printf("Waiting for a client...\n");
+    reactor_wait(&reactor); // Retorna cuando se recibe SIGINT o SIGTERM
+    threadpool_destroy(&pool); // Termina los trabajos en curso antes de cerrar las conexiones
+    reactor_destroy(&reactor);
+    versions_cleanup();
+    close(server_socket);
+    exit(EXIT_SUCCESS);
+}
 
-        if (pthread_create(&thread_id, NULL, client_handler, (void *) client_socket_ptr) < 0) {
-            perror("Error creating thread");
-            close(client_socket);
-            free(client_socket_ptr);
-            continue;
-        }
+void sig_handler(int signo) {
+    static const char msg[] = "Shutting down server...\n";
+    // printf no es seguro aqui: otro hilo puede tener tomado el candado de stdout
+    if (write(STDOUT_FILENO, msg, sizeof(msg) - 1) < 0) { }
+    reactor_stop(&reactor);
+}
 
-        server_handler->threads[server_handler->thread_count++] = client_socket;
-        pthread_detach(thread_id);
+int client_accept(sconnection *conn) {
+    ssession *session = calloc(1, sizeof *session);
+    if (!session) {
+        perror("Error allocating memory");
+        return -1;
     }
+
+    session->state = SESSION_USERNAME;
+    session->version = 1;
+    session->idle = session->after_send = SESSION_OPCODE;
+    session->stream_active = -1;
+    transfer_init(&session->transfer);
+    conn->data = session;
+    printf("Client %d connected\n", conn->fd);
+    return 0;
 }
 
-void sig_handler(int signo) {
-    printf("Shutting down server...\n");
-    for (int i = 0; i < server_handler->thread_count; i++) {
-        printf("Closing client %d\n", server_handler->threads[i]);
-        close(server_handler->threads[i]);
-    }
-    close(server_socket);
-    free(server_handler->threads);
-    free(server_handler);
-    exit(EXIT_SUCCESS);
+void client_close(sconnection *conn) {
+    ssession *session = conn->data;
+    suspend_file(&session->upload); // Recepcion interrumpida: no se publica, desde v4 se puede continuar
+    transfer_reset(&session->transfer);
+    for (int i = 0; i < session->stream_count; i++)
+        transfer_reset(&session->streams[i].transfer);
+    free(session->deferred);
+    free(session->payload);
+    free(session->resume_sums);
+    free(session->resume_states);
+    free(session->packed);
+    free(session->unpacked);
+    manifest_free(session);
+    chunks_free(session);
+    free(session);
 }
 
-void * client_handler(void * arg)
-{
-    printf("estoy en client handler");
-    int client_socket = *(int *)arg; // Socket del cliente
-    free(arg); // Liberar memoria del argumento
-    operation_type op_type ; // Codigo de operacion
-    return_code result; // Resultado de la operacion
-    ssize_t nread; // Cantidad de bytes leidos
-    sadd sadd_request; // Estructura de solicitud de adición
-
-    // Leer el nombre de usuario al conectarse
-    nread = recv(client_socket, sadd_request.username, sizeof(sadd_request.username), 0);
-    if (nread <= 0) {
-        printf("Error reading username or client disconnected.\n");
-        close(client_socket);
-        return NULL;
-    }
+int client_handler(sconnection *conn) {
+    ssession *session = conn->data;
+    int events;
 
-    // Generar la ruta de la base de datos del usuario
-    char db_path[PATH_MAX];
-    get_user_db_path(sadd_request.username, db_path, sizeof(db_path));
-    
-    printf("antes de");
-    // Verificar si el archivo de base de datos del usuario existe, si no, crearlo
-    struct stat st;
-    if (stat(db_path, &st) != 0) { // Si el archivo no existe
-        FILE *fp = fopen(db_path, "wb"); // Crear el archivo en modo binario
-        if (fp) {
-            printf("Database file %s created for user %s.\n", db_path, sadd_request.username);
-            fclose(fp);
-        } else {
-            perror("Error creating user database file");
-            close(client_socket);
-            return NULL;
-        }
-    }
-    printf("despues de");
+    // v2: el contenido de las obtenciones se envia intercalado con las demas solicitudes
+    if (session_pump(conn->fd, session) < 0) return -1;
 
-    while(1) {
-        nread = recv(client_socket,&op_type, sizeof(operation_type), 0); // Recibir el codigo de operacion
-        if (nread < 0) {
-            printf("Error reading operation type\n");
-            break;
-        }
+    events = client_step(conn);
+    if (events == -1 || events == REACTOR_DETACHED) return events;
 
-        if (nread == 0) {
-            printf("Client %d disconnected\n", client_socket);
-            break;
-        }
+    if (session->stream_count) events |= EPOLLOUT;
+    return events;
+}
+
+int client_step(sconnection *conn)
+{
+    int client_socket = conn->fd; // Socket del cliente
+    ssession *session = conn->data; // Estado de la conexion
+    transfer_status status; // Resultado de una transferencia
+    int r;
 
-        switch (op_type)
+    while (1) {
+        switch (session->state)
         {
-            case ADD:
-                memset(&sadd_request, 0, sizeof(sadd));
-                if((nread = recvs(client_socket, &sadd_request, sizeof(sadd))) < 0) {
-                    perror("Error reading ADD request");
-                    continue;
+            case SESSION_USERNAME: // Leer el nombre de usuario al conectarse (v1) o el saludo (v2)
+                // Primero se reciben los bytes de un encabezado: un frame empieza con 0, un nombre de usuario no
+                if ((r = recvs(client_socket, session->username,
+                        session->received < FRAME_HEADER_SIZE ? FRAME_HEADER_SIZE : USERNAME_SIZE, &session->received)) <= 0) {
+                    if (r < 0) printf("Error reading username or client disconnected.\n");
+                    return r == 0 ? EPOLLIN : -1;
                 }
 
-                result = add(client_socket, &sadd_request); // Realizar la operación de adición
-                if (result == VERSION_ALREADY_EXISTS)
-                {
-                    printf("Client %d requested ADD operation with an existing version\n", client_socket);
-                    fake_local_copy(client_socket); // Simular la copia del archivo
+                if (session->received == FRAME_HEADER_SIZE && session->username[0] == '\0') {
+                    memcpy(session->header, session->username, FRAME_HEADER_SIZE);
+                    memset(session->username, 0, USERNAME_SIZE);
+                    session->version = FRAME_VERSION;
+                    session->idle = session->after_send = SESSION_FRAME_HEADER;
+                    session->received = 0;
+                    if (frame_unpack(session->header, &session->frame) < 0 || session->frame.opcode != FRAME_HELLO ||
+                        session->frame.length > FRAME_CONTROL_MAX || !(session->payload = malloc(FRAME_CONTROL_MAX))) {
+                        printf("Client %d sent an invalid greeting\n", client_socket);
+                        return -1;
+                    }
+                    session->payload_cap = FRAME_CONTROL_MAX;
+                    session->state = SESSION_FRAME_PAYLOAD;
+                    break;
                 }
-                else if (result == VERSION_ERROR)
-                    printf("Client %d requested ADD operation but an error occurred\n", client_socket);
-                else
-                    printf("Client %d requested ADD operation and it was successful\n", client_socket);
+                if (session->received < USERNAME_SIZE) break;
+
+                session->username[USERNAME_SIZE - 1] = '\0';
+                if (session_login(client_socket, session) < 0) return -1;
 
+                session->received = 0;
+                session->state = SESSION_OPCODE;
                 break;
 
-            case GET:
-                sget sget_request; // Estructura de solicitud de obtención
-                nread = recv(client_socket, &sget_request, sizeof(sget),0); // Recibir la solicitud de obtención
-                if(nread != sizeof(sget)){
-                    perror("Error reading GET request");
-                    break;
+            case SESSION_OPCODE: // Recibir el codigo de operacion
+                if ((r = recvs(client_socket, &session->op_type, sizeof(operation_type), &session->received)) <= 0) {
+                    if (r < 0) printf("Client %d disconnected\n", client_socket);
+                    return r == 0 ? EPOLLIN : -1;
                 }
 
-                printf("Client %d requested GET operation\n", client_socket);
-
-                result = get(client_socket, &sget_request); // Realizar la operación de obtención
-                if (result == VERSION_NOT_FOUND)
-                    printf("Client %d requested GET operation with a non-existing version\n", client_socket);
-                else
-                    printf("Client %d requested GET operation and it was successful\n", client_socket);
+                if (session->op_type != ADD && session->op_type != GET && session->op_type != LIST) {
+                    // No se puede saber cuantos bytes descartar, el protocolo queda desincronizado
+                    printf("Client %d requested an unknown operation (%d)\n", client_socket, session->op_type);
+                    return -1;
+                }
 
+                session->received = 0;
+                memset(&session->request, 0, sizeof(session->request));
+                session->state = SESSION_REQUEST;
                 break;
 
-            case LIST:
-                slist slist_request; // Estructura de solicitud de listado
-                nread = recv(client_socket, &slist_request, sizeof(slist),0); // Recibir la solicitud de listado
-                if(nread != sizeof(slist)){
-                    perror("Error reading LIST request");
-                    break;
+            case SESSION_REQUEST: // Recibir la estructura de la solicitud
+                r = recvs(client_socket, &session->request,
+                    session->op_type == ADD ? sizeof(sadd) : session->op_type == GET ? sizeof(sget) : sizeof(slist),
+                    &session->received);
+                if (r <= 0) {
+                    if (r < 0) perror("Error reading request");
+                    return r == 0 ? EPOLLIN : -1;
+                }
+
+                session->received = 0;
+                // La operacion accede a disco: se continua en un hilo trabajador
+                return threadpool_submit(&pool, client_job, conn) < 0 ? -1 : REACTOR_DETACHED;
+
+            case SESSION_FILESIZE: // Recibir el tamaño del archivo de una adicion
+                if ((r = recvs(client_socket, &session->filesz, sizeof(session->filesz), &session->received)) <= 0) {
+                    if (r < 0) perror("Error reading ADD request");
+                    return r == 0 ? EPOLLIN : -1;
                 }
 
-                printf("Client %d requested LIST operation\n", client_socket);
+                if (session->filesz < 0) {
+                    printf("Client %d sent an invalid file size\n", client_socket);
+                    return -1;
+                }
 
-                list(client_socket, &slist_request); // Realizar la operación de listado
-                printf("Client %d requested LIST operation and it ends\n", client_socket);
+                printf("File size: %ld\n", session->filesz);
+                session->received = 0;
+                transfer_expect(&session->transfer, session->filesz);
+                session->state = SESSION_RECEIVE;
                 break;
 
-            default:
-                printf("Client %d requested an unknown operation (%d)\n", client_socket, op_type);
-                continue;
-        }    
-    }
-    close(client_socket);
-}
+            case SESSION_RECEIVE: // Recibir el contenido del archivo
+                status = local_copy(client_socket, &session->transfer);
+                if (status == TRANSFER_PENDING) return EPOLLIN;
+                if (status == TRANSFER_ERROR) return -1;
 
-ssize_t recvs(int sockfd, void *struct_ptr, size_t struct_size) {
-    ssize_t nread = 0;
-    ssize_t n = 0;
-    while (nread < struct_size) {
-        n = recv(sockfd, struct_ptr + nread, struct_size - nread, 0);
-        if (n < 0) {
-            perror("Error reading from socket");
-            return n;
-        }
-        nread += n;
-    }
-    return nread == struct_size ? nread : -1;
-}
+                if (session->request.add.hash[0] == '\0') { // Adicion en flujo: falta el hash del cliente
+                    session->state = SESSION_TRAILER;
+                    break;
+                }
+
+                // El registro de la version accede a disco: se continua en un hilo trabajador
+                return threadpool_submit(&pool, client_job, conn) < 0 ? -1 : REACTOR_DETACHED;
+
+            case SESSION_TRAILER: // Recibir el hash calculado por el cliente al enviar el contenido
+                if ((r = recvs(client_socket, session->request.add.hash, TRAILER_HASH_SIZE, &session->received)) <= 0) {
+                    if (r < 0) perror("Error reading ADD trailer");
+                    return r == 0 ? EPOLLIN : -1;
+                }
+
+                session->request.add.hash[TRAILER_HASH_SIZE] = '\0';
+                session->received = 0;
+                return threadpool_submit(&pool, client_job, conn) < 0 ? -1 : REACTOR_DETACHED;
+
+            case SESSION_SEND: // Enviar la respuesta
+                if (session->stream_active >= 0) return EPOLLOUT; // Primero se termina el frame de contenido en curso
+
+                status = remote_copy(&session->transfer, client_socket);
+                if (status == TRANSFER_PENDING) return EPOLLOUT;
+                if (status == TRANSFER_ERROR) return -1;
+
+                session->transfer.buf_len = session->transfer.buf_off = 0;
+                if (!session->uploading)
+                    transfer_reset(&session->transfer);
+                // Si se pidio el contenido de una adicion se conserva el archivo destino
+                session->state = session->after_send;
+                session->after_send = session->idle;
+                break;
+
+            case SESSION_FRAME_HEADER: // v2: recibir el encabezado del siguiente frame
+                if (session->deferred_count && !session->uploading) { // Solicitudes recibidas durante la adicion anterior
+                    if ((r = session_replay(client_socket, session)) < 0) return -1;
+                    if (r == 0) break;
+                    return threadpool_submit(&pool, client_job, conn) < 0 ? -1 : REACTOR_DETACHED;
+                }
+
+                if ((r = recvs(client_socket, session->header, FRAME_HEADER_SIZE, &session->received)) <= 0) {
+                    if (r < 0) printf("Client %d disconnected\n", client_socket);
+                    return r == 0 ? EPOLLIN : -1;
+                }
+
+                session->received = 0;
+                if (frame_unpack(session->header, &session->frame) < 0 || session->frame.version != FRAME_VERSION) {
+                    printf("Client %d sent an invalid frame\n", client_socket);
+                    return -1;
+                }
+
+                if (session->frame.opcode == FRAME_DATA) { // Bloque del archivo: se recibe sin pasar por payload
+                    if (!session->uploading || session->frame.id != session->request_id || session->frame.length > FRAME_DATA_MAX ||
+                        session->frame.length > session->filesz - session->content_received) {
+                        printf("Client %d sent unexpected file data\n", client_socket);
+                        return -1;
+                    }
+                    session->content_received += session->frame.length;
+                    session->transfer.remaining = session->frame.length;
+                    session->state = SESSION_FRAME_DATA;
+                    break;
+                }
+
+                if (session->frame.opcode == FRAME_PACKED && (!session->codec || !session->uploading ||
+                        session->frame.id != session->request_id || session->frame.length > FRAME_DATA_MAX)) {
+                    printf("Client %d sent unexpected file data\n", client_socket);
+                    return -1;
+                }
+
+                if (session->frame.length > session->payload_cap) {
+                    // v5: la lista de fragmentos de un archivo grande no cabe en FRAME_CONTROL_MAX; v6: bloque comprimido
+                    unsigned char *payload = NULL;
+                    int large = session->frame.opcode == FRAME_PACKED ||
+                        (session->frame.opcode == FRAME_CHUNKS && session->version >= PROTOCOL_CHUNKS);
+                    if (!large || session->frame.length > FRAME_CHUNKS_MAX || !(payload = realloc(session->payload, session->frame.length))) {
+                        printf("Client %d sent a frame too large (%u bytes)\n", client_socket, session->frame.length);
+                        return -1;
+                    }
+                    session->payload = payload;
+                    session->payload_cap = session->frame.length;
+                }
+                session->state = SESSION_FRAME_PAYLOAD;
+                break;
+
+            case SESSION_FRAME_PAYLOAD: // v2: recibir el contenido de un frame de control
+                if ((r = recvs(client_socket, session->payload, session->frame.length, &session->received)) <= 0) {
+                    if (r < 0) perror("Error reading frame");
+                    return r == 0 ? EPOLLIN : -1;
+                }
+
+                session->received = 0;
+                if ((r = session_frame(client_socket, session)) < 0) return -1;
+                if (r == 0) break;
+
+                // La operacion accede a disco: se continua en un hilo trabajador
+                return threadpool_submit(&pool, client_job, conn) < 0 ? -1 : REACTOR_DETACHED;
+
+            case SESSION_FRAME_DATA: // v2: recibir un bloque del archivo de una adicion
+                status = local_copy(client_socket, &session->transfer);
+                if (status == TRANSFER_PENDING) return EPOLLIN;
+                if (status == TRANSFER_ERROR) return -1;
+
+                session->state = SESSION_FRAME_HEADER;
+                break;
+        }
+    }
+}
+
+void client_job(void *arg) {
+    sconnection *conn = arg;
+    ssession *session = conn->data;
+    session_state previous = session->state;
+
+    if (session->state == SESSION_REQUEST)
+        begin_operation(conn->fd, session);
+    else
+        finish_add(conn->fd, session);
+
+    if (session->state == previous) { // No se pudo preparar la respuesta
+        reactor_resume(&reactor, conn, -1);
+        return;
+    }
+
+    int events = session->state == SESSION_SEND ? EPOLLOUT : EPOLLIN;
+    if (session->stream_count) events |= EPOLLOUT; // Falta enviar contenido de obtenciones v2
+    reactor_resume(&reactor, conn, events);
+}
+
+void pool_saturation(void *ctx, int saturated) {
+    if (saturated)
+        reactor_pause_accept(ctx);
+    else
+        reactor_resume_accept(ctx);
+}
+
+void begin_operation(int client_socket, ssession *session) {
+    char hash[HASH_SIZE]; // Hash de la version solicitada
+    char *response; // Respuesta del listado
+    size_t response_len; // Tamaño de la respuesta del listado
+    off_t filesz; // Tamaño del archivo solicitado
+    sobject_reader content; // Contenido de la version solicitada
+
+    switch (session->op_type)
+    {
+        case ADD:
+            sadd *sadd_request = &session->request.add; // Estructura de solicitud de adición
+            memcpy(sadd_request->username, session->username, USERNAME_SIZE);
+            sadd_request->filename[PATH_MAX - 1] = '\0';
+            sadd_request->hash[HASH_SIZE - 1] = '\0';
+            sadd_request->comment[COMMENT_SIZE - 1] = '\0';
+
+            session->transfer.buffer = malloc(TRANSFER_BUFFSIZE);
+            if (!session->transfer.buffer) {
+                perror("Error allocating memory");
+                return;
+            }
+            session->transfer.buf_cap = TRANSFER_BUFFSIZE;
+
+            // Adicion en flujo: el hash se conoce al terminar de recibir el contenido
+            if (sadd_request->hash[0] == '\0') {
+                if ((session->transfer.fd = session_create_upload(session)) < 0) {
+                    perror("Error creating version file");
+                    return;
+                }
+                sha256_init(&session->digest);
+                session->transfer.digest = &session->digest;
+                session->result = VERSION_ADDED;
+                if (session_require_content(session) < 0) return;
+                session_expect_content(session);
+                return;
+            }
+
+            // El contenido solo se pide si el servidor no lo tiene: si la version ya existe,
+            // o si otro archivo tiene el mismo contenido, se responde sin recibirlo
+            if (version_exists(session->db_path, sadd_request->filename, sadd_request->hash) == VERSION_ALREADY_EXISTS)
+                session->result = VERSION_ALREADY_EXISTS;
+            else if (file_stored(sadd_request->hash))
+                session->result = VERSION_ADDED;
+            else if ((session->transfer.fd = session_create_upload(session)) < 0) {
+                perror("Error creating version file");
+                session->result = VERSION_ERROR;
+            }
+            else {
+                session->result = VERSION_ADDED;
+                sha256_init(&session->digest); // El contenido se verifica mientras se recibe
+                session->transfer.digest = &session->digest;
+                if (session_require_content(session) < 0) return;
+                session_expect_content(session);
+                return;
+            }
+
+            register_version(client_socket, session);
+            return;
+
+        case MANIFEST:
+            begin_manifest(client_socket, session);
+            return;
+
+        case CHUNKS:
+            begin_chunks(client_socket, session);
+            return;
+
+        case GET:
+            printf("Client %d requested GET operation\n", client_socket);
+            session->request.get.filename[HASH_SIZE - 1] = '\0';
+
+            session->result = get(session->db_path, &session->request.get, hash); // Realizar la operación de obtención
+            if (session->result == VERSION_CREATED && retrieve_file(hash, &content, &filesz) < 0)
+                session->result = VERSION_NOT_FOUND;
+
+            if (session->result != VERSION_CREATED) {
+                printf("Client %d requested GET operation with a non-existing version\n", client_socket);
+                if (session_status(session, session->result) < 0) return;
+                session->state = SESSION_SEND;
+                return;
+            }
+
+            if (session->version != 1) { // v2: FRAME_STATUS con el tamaño, el contenido sigue intercalado con otras respuestas
+                unsigned char reply[FRAME_HEADER_SIZE + 1 + 8 + 8];
+                off_t offset = 0; // Bytes que el cliente ya tiene y no se envian
+                swire wire;
+
+                if (session->resume_count) { // v4: se continua despues del ultimo bloque que coincide con el del cliente
+                    uint32_t count = filesz / RESUME_CHUNK < session->resume_count ? filesz / RESUME_CHUNK : session->resume_count;
+                    struct sha256_buff digest;
+
+                    sha256_init(&digest);
+                    offset = (off_t)resume_scan(&content, &digest, count, session->resume_sums, NULL) * RESUME_CHUNK;
+                }
+
+                if (object_reader_seek(&content, offset) < 0) {
+                    object_reader_close(&content);
+                    session->result = VERSION_ERROR;
+                }
+                else if (session_open_stream(session, &content, filesz - offset) < 0)
+                    session->result = VERSION_ERROR;
+
+                wire_init(&wire, reply + FRAME_HEADER_SIZE, sizeof(reply) - FRAME_HEADER_SIZE);
+                wire_put_uint(&wire, session->result, 1);
+                if (session->result == VERSION_CREATED) {
+                    wire_put_uint(&wire, filesz, 8);
+                    if (session->version >= PROTOCOL_RESUME) wire_put_uint(&wire, offset, 8);
+                }
+                frame_pack(reply, FRAME_STATUS, session->request_id, wire.off);
+                if (session_reply(session, reply, FRAME_HEADER_SIZE + wire.off) < 0) return;
+                session->state = SESSION_SEND;
+                if (session->result != VERSION_CREATED) return;
+                if (offset) printf("Client %d resumed a GET operation at %ld bytes\n", client_socket, (long)offset);
+                printf("Client %d requested GET operation and it was successful\n", client_socket);
+                return;
+            }
+
+            // Respuesta: codigo de retorno, tamaño del archivo y luego su contenido
+            ssize_t size = filesz;
+            session->transfer.buffer = malloc(TRANSFER_BUFFSIZE);
+            if (!session->transfer.buffer) {
+                perror("Error allocating memory");
+                object_reader_close(&content);
+                return;
+            }
+            session->transfer.buf_cap = TRANSFER_BUFFSIZE;
+            session->transfer.source = content;
+            session->transfer.zero_copy = 1; // Los contenidos del almacen son archivos regulares
+            memcpy(session->transfer.buffer, &session->result, sizeof(return_code));
+            memcpy(session->transfer.buffer + sizeof(return_code), &size, sizeof(size));
+            session->transfer.buf_len = sizeof(return_code) + sizeof(size);
+            session->transfer.buf_off = 0;
+            session->transfer.remaining = filesz;
+            session->state = SESSION_SEND;
+            printf("Client %d requested GET operation and it was successful\n", client_socket);
+            return;
+
+        case LIST:
+            printf("Client %d requested LIST operation\n", client_socket);
+            session->request.list.filename[HASH_SIZE - 1] = '\0';
+
+            session->result = list(session->db_path, &session->request.list, &response, &response_len); // Realizar la operación de listado
+            if (session->result == VERSION_ERROR) {
+                if (session_status(session, session->result) < 0) return;
+            }
+            else if (session->version != 1) {
+                int failed = session_list_reply(session, response, response_len);
+                free(response);
+                if (failed < 0) return;
+            }
+            else {
+                session->transfer.buffer = response;
+                session->transfer.buf_cap = response_len;
+                session->transfer.buf_len = response_len;
+                session->transfer.buf_off = 0;
+            }
+
+            session->state = SESSION_SEND;
+            printf("Client %d requested LIST operation and it ends\n", client_socket);
+            return;
+    }
+}
+
+void finish_add(int client_socket, ssession *session) {
+    free(session->resume_states);
+    session->resume_states = NULL;
+
+    if (session->transfer.digest) { // Se verifica el hash antes de publicar el contenido
+        char hash[HASH_SIZE];
+        sadd *sadd_request = &session->request.add;
+
+        sha256_finalize(&session->digest);
+        sha256_read_hex(&session->digest, hash);
+        session->transfer.digest = NULL;
+
+        if (session->transfer.failed || strcmp(hash, sadd_request->hash) != 0) {
+            if (!session->transfer.failed)
+                printf("Client %d sent content that does not match its hash\n", client_socket);
+            session->transfer.failed = 1;
+        }
+        else if (session->op_type != CHUNKS && // Un fragmento no es una version
+            version_exists(session->db_path, sadd_request->filename, sadd_request->hash) == VERSION_ALREADY_EXISTS)
+            session->result = VERSION_ALREADY_EXISTS;
+        else if (file_stored(sadd_request->hash))
+            session->upload.hash[0] = '\0'; // Otra conexion lo publico mientras se recibia
+        else
+            memcpy(session->upload.hash, hash, sizeof(session->upload.hash));
+
+        // Solo se publica si es un contenido nuevo y valido. Se descarta antes de cerrarlo:
+        // otra conexion no debe continuar un contenido parcial que se va a eliminar
+        if (session->transfer.failed || session->result != VERSION_ADDED || session->upload.hash[0] == '\0') {
+            discard_file(&session->upload);
+            if (session->transfer.fd >= 0) close(session->transfer.fd);
+            session->transfer.fd = -1;
+        }
+    }
+
+    if (session->transfer.fd >= 0) { // Contenido nuevo: se publica antes de registrar la version
+        if (publish_file(&session->upload, session->transfer.fd) < 0) session->transfer.failed = 1;
+        else if (session->op_type != CHUNKS && // Si se parece a la version anterior del archivo se guarda la diferencia
+            store_delta(session->db_path, session->request.add.filename, session->upload.hash) > 0)
+            printf("Client %d sent a version stored as a delta\n", client_socket);
+        else // Si no, se comprime cuando vale la pena
+            store_compressed(session->upload.hash);
+        session->transfer.fd = -1;
+    }
+    else
+        discard_file(&session->upload); // La escritura fallo al recibirlo
+
+    if (session->transfer.failed) session->result = VERSION_ERROR;
+    session->uploading = 0;
+    if (session->op_type == MANIFEST) { // Falta el contenido de los demas archivos del manifiesto
+        manifest_received(client_socket, session);
+        return;
+    }
+    if (session->op_type == CHUNKS) { // Faltan los demas fragmentos del archivo
+        chunks_received(client_socket, session);
+        return;
+    }
+    register_version(client_socket, session);
+}
+
+void begin_manifest(int client_socket, ssession *session) {
+    smanifest *manifest = &session->manifest;
+    const smanifest_entry **order; // Archivos nuevos ordenados por hash, para pedir una vez los contenidos repetidos
+    uint8_t *wanted; // 1 en el indice de cada archivo cuyo contenido se pide
+    uint32_t pending = 0;
+    unsigned char *reply;
+    swire wire;
+
+    printf("Client %d requested ADD operation for %u files\n", client_socket, manifest->count);
+    if (!(manifest->missing = malloc(manifest->count * sizeof(uint32_t))) || !(order = malloc(manifest->count * sizeof(*order)))) {
+        perror("Error allocating memory");
+        return;
+    }
+    if (!(wanted = calloc(manifest->count, 1))) {
+        perror("Error allocating memory");
+        free(order);
+        return;
+    }
+
+    for (uint32_t i = 0; i < manifest->count; i++) {
+        smanifest_entry *entry = &manifest->entries[i];
+
+        if (entry->hash[0] != '\0' &&
+            version_exists(session->db_path, entry->filename, entry->hash) == VERSION_ALREADY_EXISTS) {
+            entry->result = VERSION_ALREADY_EXISTS;
+            continue;
+        }
+
+        // Se registra al final: el contenido ya esta en el almacen o llega con el de otro archivo
+        entry->result = VERSION_ADDED;
+        if (entry->hash[0] == '\0') wanted[i] = 1; // Adicion en flujo: el hash llega con el contenido
+        else order[pending++] = entry;
+    }
+
+    qsort(order, pending, sizeof(*order), manifest_compare);
+
+    // De los archivos con el mismo contenido solo se pide el primero; se marca su indice
+    for (uint32_t i = 0; i < pending; i++) {
+        if (i > 0 && strcmp(order[i]->hash, order[i - 1]->hash) == 0) continue;
+        if (!file_stored(order[i]->hash)) wanted[order[i] - manifest->entries] = 1;
+    }
+    free(order);
+
+    // Un recorrido de las marcas deja missing en orden de indices
+    for (uint32_t i = 0; i < manifest->count; i++)
+        if (wanted[i]) manifest->missing[manifest->missing_count++] = i;
+    free(wanted);
+
+    if (manifest->missing_count == 0) {
+        finish_manifest(client_socket, session);
+        return;
+    }
+
+    // CONTENT_REQUIRED con los indices de los contenidos que faltan
+    size_t size = FRAME_HEADER_SIZE + 1 + 4 * manifest->missing_count;
+    if (!(reply = malloc(size))) {
+        perror("Error allocating memory");
+        return;
+    }
+    wire_init(&wire, reply + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE);
+    wire_put_uint(&wire, CONTENT_REQUIRED, 1);
+    for (uint32_t i = 0; i < manifest->missing_count; i++)
+        wire_put_uint(&wire, manifest->missing[i], 4);
+    frame_pack(reply, FRAME_STATUS, session->request_id, wire.off);
+
+    int failed = session_reply(session, reply, size) < 0 || manifest_expect(session) < 0;
+    free(reply);
+    if (failed) return;
+    session->state = SESSION_SEND;
+}
+
+void manifest_received(int client_socket, ssession *session) {
+    smanifest *manifest = &session->manifest;
+    smanifest_entry *entry = &manifest->entries[manifest->missing[manifest->next++]];
+
+    entry->result = session->result;
+    memcpy(entry->hash, session->request.add.hash, HASH_SIZE); // Adicion en flujo: el hash llego al final
+
+    if (manifest->next < manifest->missing_count) {
+        // El cliente ya esta enviando el siguiente contenido, no se responde nada
+        if (manifest_expect(session) < 0) return;
+        session->state = SESSION_FRAME_HEADER;
+        return;
+    }
+
+    finish_manifest(client_socket, session);
+}
+
+int manifest_expect(ssession *session) {
+    smanifest *manifest = &session->manifest;
+    smanifest_entry *entry = &manifest->entries[manifest->missing[manifest->next]];
+    sadd *sadd_request = &session->request.add;
+
+    memcpy(sadd_request->username, session->username, USERNAME_SIZE);
+    snprintf(sadd_request->filename, PATH_MAX, "%s", entry->filename);
+    memcpy(sadd_request->hash, entry->hash, HASH_SIZE);
+    memcpy(sadd_request->comment, manifest->comment, COMMENT_SIZE);
+    return session_expect_upload(session, entry->size);
+}
+
+void finish_manifest(int client_socket, ssession *session) {
+    smanifest *manifest = &session->manifest;
+    sadd *requests = malloc(manifest->count * sizeof(sadd)); // Versiones que se registran
+    return_code *results = malloc(manifest->count * sizeof(return_code));
+    size_t size = FRAME_HEADER_SIZE + 1 + manifest->count;
+    unsigned char *reply = malloc(size);
+    uint32_t count = 0, added = 0;
+    swire wire;
+
+    if (!requests || !results || !reply) {
+        perror("Error allocating memory");
+        free(requests);
+        free(results);
+        free(reply);
+        return;
+    }
+
+    for (uint32_t i = 0; i < manifest->count; i++) {
+        smanifest_entry *entry = &manifest->entries[i];
+        if (entry->result != VERSION_ADDED) continue;
+
+        // El contenido compartido con otro archivo pudo no llegar completo
+        if (!file_stored(entry->hash)) {
+            entry->result = VERSION_ERROR;
+            continue;
+        }
+
+        sadd *request = &requests[count++];
+        memcpy(request->username, session->username, USERNAME_SIZE);
+        snprintf(request->filename, PATH_MAX, "%s", entry->filename);
+        memcpy(request->hash, entry->hash, HASH_SIZE);
+        memcpy(request->comment, manifest->comment, COMMENT_SIZE);
+    }
+
+    // Todas las versiones del manifiesto esperan juntas al disco
+    add_new_versions(session->db_path, requests, count, results);
+
+    wire_init(&wire, reply + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE);
+    wire_put_uint(&wire, SUCCESS, 1);
+    for (uint32_t i = 0, j = 0; i < manifest->count; i++) {
+        smanifest_entry *entry = &manifest->entries[i];
+
+        if (entry->result == VERSION_ADDED) { // Los resultados de add_new_versions estan en el mismo orden
+            return_code result = results[j++];
+            if (result != VERSION_CREATED) entry->result = result;
+            else added++;
+        }
+        wire_put_uint(&wire, entry->result, 1);
+    }
+    frame_pack(reply, FRAME_STATUS, session->request_id, wire.off);
+
+    printf("Client %d requested ADD operation for %u files and %u versions were added\n", client_socket, manifest->count, added);
+    manifest_free(session);
+    int failed = session_reply(session, reply, size);
+    free(requests);
+    free(results);
+    free(reply);
+    if (failed < 0) return;
+    session->state = SESSION_SEND;
+}
+
+int manifest_parse(ssession *session, swire *wire) {
+    smanifest *manifest = &session->manifest;
+    uint32_t cap = 0;
+
+    while (!wire->error && wire->off < wire->size) {
+        char filename[PATH_MAX];
+
+        if (manifest->count == cap) {
+            cap = cap ? 2 * cap : 64;
+            smanifest_entry *entries = realloc(manifest->entries, cap * sizeof(smanifest_entry));
+            if (!entries) {
+                perror("Error allocating memory");
+                return -1;
+            }
+            manifest->entries = entries;
+        }
+
+        smanifest_entry *entry = &manifest->entries[manifest->count];
+        uint64_t size = wire_get_uint(wire, 8);
+        wire_get_string(wire, entry->hash, HASH_SIZE);
+        wire_get_string(wire, filename, PATH_MAX);
+        if (wire->error || size > INT64_MAX || filename[0] == '\0') return -1;
+        if (!(entry->filename = strdup(filename))) {
+            perror("Error allocating memory");
+            return -1;
+        }
+        entry->size = size;
+        manifest->count++;
+    }
+
+    return wire->error || manifest->count == 0 ? -1 : 0;
+}
+
+void manifest_free(ssession *session) {
+    smanifest *manifest = &session->manifest;
+
+    for (uint32_t i = 0; i < manifest->count; i++)
+        free(manifest->entries[i].filename);
+    free(manifest->entries);
+    free(manifest->missing);
+    memset(manifest, 0, sizeof *manifest);
+}
+
+int session_expect_upload(ssession *session, off_t size) {
+    sadd *sadd_request = &session->request.add;
+
+    if (session->transfer.buf_cap < TRANSFER_BUFFSIZE) { // Conserva la respuesta que aun no se envia
+        char *buffer = realloc(session->transfer.buffer, TRANSFER_BUFFSIZE);
+        if (!buffer) {
+            perror("Error allocating memory");
+            return -1;
+        }
+        session->transfer.buffer = buffer;
+        session->transfer.buf_cap = TRANSFER_BUFFSIZE;
+    }
+
+    if ((session->transfer.fd = store_file(&session->upload, sadd_request->hash[0] ? sadd_request->hash : NULL)) < 0) {
+        perror("Error creating version file");
+        return -1;
+    }
+    sha256_init(&session->digest); // El contenido se verifica mientras se recibe
+    session->transfer.digest = &session->digest;
+    session->transfer.failed = 0;
+    session->result = VERSION_ADDED;
+    session->filesz = size;
+    session->uploading = 1;
+
+    transfer_expect(&session->transfer, session->filesz);
+    session->transfer.remaining = 0;
+    session->content_received = 0;
+    return 0;
+}
+
+void begin_chunks(int client_socket, ssession *session) {
+    schunked *chunked = &session->chunked;
+    sadd *sadd_request = &session->request.add;
+    const sobject_chunk **order = NULL; // Fragmentos ordenados por hash, para pedir una vez los repetidos
+    uint8_t *wanted = NULL; // 1 en el indice de cada fragmento que se pide
+    char hash[OBJECT_HASH_LEN + 1];
+    unsigned char *reply;
+    swire wire;
+
+    memcpy(sadd_request->username, session->username, USERNAME_SIZE);
+    chunked->add = *sadd_request;
+    printf("Client %d requested ADD operation for %u chunks\n", client_socket, chunked->count);
+
+    // Igual que en una adicion, el contenido solo se pide si el servidor no lo tiene
+    if (version_exists(session->db_path, sadd_request->filename, sadd_request->hash) == VERSION_ALREADY_EXISTS)
+        session->result = VERSION_ALREADY_EXISTS;
+    else if (file_stored(sadd_request->hash))
+        session->result = VERSION_ADDED;
+    else {
+        if (!(chunked->missing = malloc(chunked->count * sizeof(uint32_t))) || !(order = malloc(chunked->count * sizeof(*order))) ||
+            !(wanted = calloc(chunked->count, 1))) {
+            perror("Error allocating memory");
+            free(order);
+            return;
+        }
+
+        for (uint32_t i = 0; i < chunked->count; i++) order[i] = &chunked->chunks[i];
+        qsort(order, chunked->count, sizeof(*order), chunk_compare);
+
+        // De los fragmentos iguales solo se pide el primero; se marca su indice
+        for (uint32_t i = 0; i < chunked->count; i++) {
+            if (i > 0 && memcmp(order[i]->hash, order[i - 1]->hash, sizeof(order[i]->hash)) == 0) continue;
+            object_hex(order[i]->hash, hash);
+            if (!file_stored(hash)) wanted[order[i] - chunked->chunks] = 1;
+        }
+        free(order);
+
+        // Un recorrido de las marcas deja missing en orden de indices
+        for (uint32_t i = 0; i < chunked->count; i++)
+            if (wanted[i]) chunked->missing[chunked->missing_count++] = i;
+        free(wanted);
+
+        if (chunked->missing_count == 0) {
+            finish_chunks(client_socket, session);
+            return;
+        }
+
+        // CONTENT_REQUIRED con los indices de los fragmentos que faltan
+        size_t size = FRAME_HEADER_SIZE + 1 + 4 * chunked->missing_count;
+        if (!(reply = malloc(size))) {
+            perror("Error allocating memory");
+            return;
+        }
+        wire_init(&wire, reply + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE);
+        wire_put_uint(&wire, CONTENT_REQUIRED, 1);
+        for (uint32_t i = 0; i < chunked->missing_count; i++)
+            wire_put_uint(&wire, chunked->missing[i], 4);
+        frame_pack(reply, FRAME_STATUS, session->request_id, wire.off);
+
+        int failed = session_reply(session, reply, size) < 0;
+        free(reply);
+        if (failed) return;
+
+        sobject_chunk *chunk = &chunked->chunks[chunked->missing[0]];
+        object_hex(chunk->hash, sadd_request->hash);
+        if (session_expect_upload(session, chunk->size) < 0) return;
+        printf("Client %d sends %u of %u chunks\n", client_socket, chunked->missing_count, chunked->count);
+        session->state = SESSION_SEND;
+        return;
+    }
+
+    chunks_free(session);
+    register_version(client_socket, session);
+}
+
+void chunks_received(int client_socket, ssession *session) {
+    schunked *chunked = &session->chunked;
+
+    if (session->result != VERSION_ADDED) chunked->failed = 1;
+
+    if (++chunked->next < chunked->missing_count) {
+        // El cliente ya esta enviando el siguiente fragmento, no se responde nada
+        sobject_chunk *chunk = &chunked->chunks[chunked->missing[chunked->next]];
+        object_hex(chunk->hash, session->request.add.hash);
+        if (session_expect_upload(session, chunk->size) < 0) return;
+        session->state = SESSION_FRAME_HEADER;
+        return;
+    }
+
+    finish_chunks(client_socket, session);
+}
+
+void finish_chunks(int client_socket, ssession *session) {
+    schunked *chunked = &session->chunked;
+
+    // La version se registra con el hash de todo el contenido, que se verifica al guardar la lista
+    session->request.add = chunked->add;
+    if (chunked->failed || store_recipe(chunked->add.hash, chunked->chunks, chunked->count) < 0) {
+        if (!chunked->failed) printf("Client %d sent chunks that do not match the content hash\n", client_socket);
+        session->result = VERSION_ERROR;
+    }
+    else
+        session->result = VERSION_ADDED;
+
+    chunks_free(session);
+    register_version(client_socket, session);
+}
+
+int chunks_parse(ssession *session, swire *wire, uint64_t size) {
+    schunked *chunked = &session->chunked;
+    uint64_t total = 0; // Suma de los tamaños de los fragmentos
+
+    if (wire->error || !object_valid_hash(session->request.add.hash) || session->request.add.filename[0] == '\0' ||
+        (wire->size - wire->off) % CHUNK_ENTRY_SIZE || wire->size == wire->off)
+        return -1;
+
+    chunked->count = (wire->size - wire->off) / CHUNK_ENTRY_SIZE;
+    if (!(chunked->chunks = malloc(chunked->count * sizeof(sobject_chunk)))) {
+        perror("Error allocating memory");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < chunked->count; i++) {
+        sobject_chunk *chunk = &chunked->chunks[i];
+        chunk->size = wire_get_uint(wire, 4);
+        wire_get_bytes(wire, chunk->hash, sizeof(chunk->hash));
+        if (chunk->size == 0) return -1;
+        total += chunk->size;
+    }
+
+    return wire->error || total != size ? -1 : 0;
+}
+
+void chunks_free(ssession *session) {
+    schunked *chunked = &session->chunked;
+
+    free(chunked->chunks);
+    free(chunked->missing);
+    memset(chunked, 0, sizeof *chunked);
+}
+
+int chunk_compare(const void *a, const void *b) {
+    const sobject_chunk *x = *(const sobject_chunk * const *)a, *y = *(const sobject_chunk * const *)b;
+    int diff = memcmp(x->hash, y->hash, sizeof(x->hash));
+
+    if (diff) return diff;
+    return (x > y) - (x < y);
+}
+
+int manifest_compare(const void *a, const void *b) {
+    const smanifest_entry *x = *(const smanifest_entry * const *)a, *y = *(const smanifest_entry * const *)b;
+    int diff = strcmp(x->hash, y->hash);
+
+    if (diff) return diff;
+    return (x > y) - (x < y);
+}
+
+void register_version(int client_socket, ssession *session) {
+    if (session->result == VERSION_ADDED) {
+        return_code result = add_new_version(session->db_path, &session->request.add); // Realizar la operación de adición
+        if (result != VERSION_CREATED) session->result = result;
+    }
+
+    if (session->result == VERSION_ERROR)
+        printf("Client %d requested ADD operation but an error occurred\n", client_socket);
+    else if (session->result == VERSION_ADDED)
+        printf("Client %d requested ADD operation and it was successful\n", client_socket);
+    else
+        printf("Client %d requested ADD operation with an existing version\n", client_socket);
+
+    if (session_status(session, session->result) < 0) return;
+    session->state = SESSION_SEND;
+}
+
+int session_reply(ssession *session, const void *data, size_t size) {
+    stransfer *transfer = &session->transfer;
+
+    if (transfer->buf_cap < size) {
+        char *buffer = realloc(transfer->buffer, size);
+        if (!buffer) {
+            perror("Error allocating memory");
+            return -1;
+        }
+        transfer->buffer = buffer;
+        transfer->buf_cap = size;
+    }
+
+    memcpy(transfer->buffer, data, size);
+    transfer->buf_len = size;
+    transfer->buf_off = 0;
+    transfer->remaining = 0;
+    transfer->failed = 0;
+    return 0;
+}
+
+int session_login(int client_socket, ssession *session) {
+    struct stat st;
+
+    if (session->username[0] == '\0' || session->username[0] == '.' || strchr(session->username, '/')) {
+        printf("Client %d sent an invalid username\n", client_socket);
+        return -1;
+    }
+
+    // Generar la ruta de la base de datos del usuario
+    get_user_db_path(session->username, session->db_path, sizeof(session->db_path));
+
+    // Verificar si el archivo de base de datos del usuario existe, si no, crearlo
+    if (stat(session->db_path, &st) != 0) { // Si el archivo no existe
+        int fd = open(session->db_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644); // Crear el archivo
+        if (fd < 0) {
+            perror("Error creating user database file");
+            return -1;
+        }
+        printf("Database file %s created for user %s.\n", session->db_path, session->username);
+        close(fd);
+    }
+
+    return 0;
+}
+
+int session_frame(int client_socket, ssession *session) {
+    sframe *frame = &session->frame;
+    unsigned char hello[FRAME_HEADER_SIZE + 3]; // Respuesta al saludo
+    uint64_t value; // Version maxima del cliente, tamaño del archivo o version solicitada
+    swire wire;
+
+    wire_init(&wire, session->payload, frame->length);
+
+    if (session->username[0] == '\0') { // El primer frame es el saludo, el resto es relleno
+        value = wire_get_uint(&wire, 1);
+        wire_get_string(&wire, session->username, USERNAME_SIZE);
+        if (value >= PROTOCOL_COMPRESS) session->codec = wire_get_uint(&wire, 1) & FRAME_CODEC_LZ; // v6: codecs del cliente
+        if (frame->opcode != FRAME_HELLO || wire.error || value < FRAME_VERSION) {
+            printf("Client %d sent an invalid greeting\n", client_socket);
+            return -1;
+        }
+        if (session_login(client_socket, session) < 0) return -1;
+
+        session->version = value < PROTOCOL_VERSION ? value : PROTOCOL_VERSION;
+        frame_pack(hello, FRAME_HELLO, frame->id, session->version < PROTOCOL_COMPRESS ? 2 : 3);
+        hello[FRAME_HEADER_SIZE] = session->version;
+        hello[FRAME_HEADER_SIZE + 1] = SUCCESS;
+        hello[FRAME_HEADER_SIZE + 2] = session->codec;
+        if (session_reply(session, hello, FRAME_HEADER_SIZE + (session->version < PROTOCOL_COMPRESS ? 2 : 3)) < 0) return -1;
+        session->state = SESSION_SEND;
+        return 0;
+    }
+
+    if (session->uploading) { // Se espera el fin del contenido de la adicion en curso
+        if (frame->opcode == FRAME_RESUME) return session_resume(client_socket, session);
+        if (frame->opcode == FRAME_PACKED) return session_unpack(client_socket, session);
+        if (frame->opcode != FRAME_END) return session_defer(client_socket, session); // Solicitud siguiente
+
+        if ( frame->id != session->request_id || session->content_received != session->filesz ||
+            frame->length != (session->request.add.hash[0] == '\0' ? TRAILER_HASH_SIZE : 0)) {
+            printf("Client %d sent an unexpected frame during an upload\n", client_socket);
+            return -1;
+        }
+
+        if (frame->length) { // Adicion en flujo: el frame trae el hash calculado por el cliente
+            memcpy(session->request.add.hash, session->payload, TRAILER_HASH_SIZE);
+            session->request.add.hash[TRAILER_HASH_SIZE] = '\0';
+        }
+        session->state = SESSION_TRAILER;
+        return 1;
+    }
+
+    memset(&session->request, 0, sizeof(session->request));
+    session->request_id = frame->id;
+    free(session->resume_sums); // Puntos de control de la obtencion anterior
+    session->resume_sums = NULL;
+    session->resume_count = 0;
+    switch (frame->opcode) {
+        case FRAME_ADD:
+            session->op_type = ADD;
+            value = wire_get_uint(&wire, 8);
+            wire_get_string(&wire, session->request.add.hash, HASH_SIZE);
+            wire_get_string(&wire, session->request.add.comment, COMMENT_SIZE);
+            wire_get_string(&wire, session->request.add.filename, PATH_MAX);
+            if (value > INT64_MAX) wire.error = 1;
+            session->filesz = value;
+            break;
+
+        case FRAME_GET:
+            session->op_type = GET;
+            session->request.get.version = wire_get_uint(&wire, 8);
+            wire_get_string(&wire, session->request.get.filename, HASH_SIZE);
+            if (session->version < PROTOCOL_RESUME) break;
+
+            // v4: bytes que el cliente ya tiene de una obtencion interrumpida y un punto de control por bloque
+            value = wire_get_uint(&wire, 8);
+            if (wire.error || value % RESUME_CHUNK || value / RESUME_CHUNK > RESUME_CHECKPOINTS_MAX ||
+                wire.size - wire.off != value / RESUME_CHUNK * 8) {
+                wire.error = 1;
+                break;
+            }
+            session->resume_offset = value;
+            session->resume_count = value / RESUME_CHUNK;
+            if (session->resume_count && !(session->resume_sums = malloc(session->resume_count * sizeof(uint64_t)))) {
+                perror("Error allocating memory");
+                return -1;
+            }
+            for (uint32_t i = 0; i < session->resume_count; i++)
+                session->resume_sums[i] = wire_get_uint(&wire, 8);
+            break;
+
+        case FRAME_LIST:
+            session->op_type = LIST;
+            wire_get_string(&wire, session->request.list.filename, HASH_SIZE);
+            break;
+
+        case FRAME_CHUNKS:
+            if (session->version < PROTOCOL_CHUNKS) {
+                printf("Client %d sent an unexpected frame (%d)\n", client_socket, frame->opcode);
+                return -1;
+            }
+            session->op_type = CHUNKS;
+            value = wire_get_uint(&wire, 8);
+            wire_get_string(&wire, session->request.add.hash, HASH_SIZE);
+            wire_get_string(&wire, session->request.add.comment, COMMENT_SIZE);
+            wire_get_string(&wire, session->request.add.filename, PATH_MAX);
+            if (value > INT64_MAX || chunks_parse(session, &wire, value) < 0) {
+                chunks_free(session);
+                wire.error = 1;
+            }
+            session->filesz = value;
+            break;
+
+        case FRAME_MANIFEST:
+            if (session->version < PROTOCOL_MANIFEST) {
+                printf("Client %d sent an unexpected frame (%d)\n", client_socket, frame->opcode);
+                return -1;
+            }
+            session->op_type = MANIFEST;
+            wire_get_string(&wire, session->manifest.comment, COMMENT_SIZE);
+            if (manifest_parse(session, &wire) < 0) {
+                manifest_free(session);
+                wire.error = 1;
+            }
+            break;
+
+        default:
+            printf("Client %d sent an unexpected frame (%d)\n", client_socket, frame->opcode);
+            return -1;
+    }
+
+    if (wire.error || wire.off != frame->length) {
+        printf("Client %d sent a malformed request\n", client_socket);
+        return -1;
+    }
+
+    session->state = SESSION_REQUEST;
+    return 1;
+}
+
+int session_status(ssession *session, return_code code) {
+    unsigned char frame[FRAME_HEADER_SIZE + 1];
+
+    if (session->version == 1) return session_reply(session, &code, sizeof(return_code));
+
+    frame_pack(frame, FRAME_STATUS, session->request_id, 1);
+    frame[FRAME_HEADER_SIZE] = code;
+    return session_reply(session, frame, sizeof(frame));
+}
+
+int session_create_upload(ssession *session) {
+    sadd *sadd_request = &session->request.add;
+    char key[HASH_SIZE]; // Clave de la recepcion
+
+    session->resume_offset = 0;
+    if (session->version < PROTOCOL_RESUME) return store_file(&session->upload, sadd_request->hash[0] ? sadd_request->hash : NULL);
+
+    if (sadd_request->hash[0] != '\0')
+        snprintf(key, sizeof(key), "%s", sadd_request->hash);
+    else { // Adicion en flujo: el hash se conoce al final, la clave identifica la adicion
+        char identity[USERNAME_SIZE + PATH_MAX + 32];
+        int len = snprintf(identity, sizeof(identity), "%s\n%s\n%ld", session->username, sadd_request->filename, (long)session->filesz);
+        sha256_hash_hex(identity, len, key);
+        key[TRAILER_HASH_SIZE] = '\0';
+    }
+
+    return resume_file(&session->upload, sadd_request->hash[0] ? sadd_request->hash : NULL, key, &session->resume_offset);
+}
+
+int session_require_content(ssession *session) {
+    uint32_t count = 0; // Bloques completos del contenido parcial que se ofrecen
+    unsigned char *reply;
+    size_t size;
+    swire wire;
+    int failed;
+
+    if (session->version < PROTOCOL_RESUME) return session_status(session, CONTENT_REQUIRED);
+
+    off_t blocks = (session->resume_offset < session->filesz ? session->resume_offset : session->filesz) / RESUME_CHUNK;
+    if (blocks > RESUME_CHECKPOINTS_MAX) blocks = RESUME_CHECKPOINTS_MAX;
+
+    free(session->resume_states);
+    session->resume_states = NULL;
+    if (blocks > 0 && (session->resume_states = malloc((blocks + 1) * sizeof(struct sha256_buff)))) {
+        struct sha256_buff digest = session->digest;
+
+        // Se lee el contenido parcial: un bloque que no se pudo leer no se ofrece
+        session->resume_states[0] = session->digest;
+        sobject_reader partial; // Se lee sin mover la posicion del archivo
+
+        object_reader_file(&partial, session->transfer.fd, session->resume_offset);
+        count = resume_scan(&partial, &digest, blocks, NULL, session->resume_states + 1);
+    }
+
+    // Lo que sigue al ultimo bloque completo se vuelve a recibir
+    session->resume_offset = (off_t)count * RESUME_CHUNK;
+    if (ftruncate(session->transfer.fd, session->resume_offset) < 0) {
+        perror("Error truncating version file");
+        return -1;
+    }
+
+    size = FRAME_HEADER_SIZE + 1 + 8 + 8 * count;
+    if (!(reply = malloc(size))) {
+        perror("Error allocating memory");
+        return -1;
+    }
+    wire_init(&wire, reply + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE);
+    wire_put_uint(&wire, CONTENT_REQUIRED, 1);
+    wire_put_uint(&wire, session->resume_offset, 8);
+    for (uint32_t i = 1; i <= count; i++)
+        wire_put_uint(&wire, resume_checkpoint(&session->resume_states[i]), 8);
+    frame_pack(reply, FRAME_STATUS, session->request_id, wire.off);
+
+    failed = session_reply(session, reply, size);
+    free(reply);
+    return failed;
+}
+
+int session_resume(int client_socket, ssession *session) {
+    uint64_t offset;
+    swire wire;
+
+    wire_init(&wire, session->payload, session->frame.length);
+    offset = wire_get_uint(&wire, 8);
+    if (session->version < PROTOCOL_RESUME || session->op_type != ADD || session->frame.id != session->request_id ||
+        wire.error || wire.off != session->frame.length || session->content_received != 0 ||
+        offset > (uint64_t)session->resume_offset || offset % RESUME_CHUNK) {
+        printf("Client %d sent an unexpected frame during an upload\n", client_socket);
+        return -1;
+    }
+
+    // El hash sigue desde el final del ultimo bloque que el cliente no vuelve a enviar
+    if (offset) session->digest = session->resume_states[offset / RESUME_CHUNK];
+    if (session->transfer.fd >= 0 && (ftruncate(session->transfer.fd, offset) < 0 || lseek(session->transfer.fd, offset, SEEK_SET) < 0)) {
+        perror("Error writing file");
+        close(session->transfer.fd);
+        session->transfer.fd = -1; // Se sigue drenando el contenido para mantener el protocolo sincronizado
+        session->transfer.failed = 1;
+    }
+
+    session->content_received = offset;
+    if (offset) printf("Client %d resumed an ADD operation at %ld bytes\n", client_socket, (long)offset);
+    session->state = SESSION_FRAME_HEADER;
+    return 0;
+}
+
+int session_unpack(int client_socket, ssession *session) {
+    if (!session->unpacked && !(session->unpacked = malloc(FRAME_DATA_MAX))) {
+        perror("Error allocating memory");
+        return -1;
+    }
+
+    if (frame_decompress(session->payload, &session->frame, session->unpacked, FRAME_DATA_MAX) < 0 ||
+        session->frame.opcode != FRAME_DATA || session->frame.length > session->filesz - session->content_received) {
+        printf("Client %d sent unexpected file data\n", client_socket);
+        return -1;
+    }
+
+    session->content_received += session->frame.length;
+    transfer_write(&session->transfer, session->unpacked, session->frame.length);
+    session->state = SESSION_FRAME_HEADER;
+    return 0;
+}
+
+void session_expect_content(ssession *session) {
+    session->uploading = 1;
+    session->state = SESSION_SEND;
+    if (session->version == 1) {
+        session->after_send = SESSION_FILESIZE;
+        return;
+    }
+
+    // v2: el tamaño llego con la solicitud, cada frame FRAME_DATA indica cuantos bytes siguen
+    transfer_expect(&session->transfer, session->filesz);
+    session->transfer.remaining = 0;
+    session->content_received = 0;
+}
+
+int session_open_stream(ssession *session, sobject_reader *source, off_t size) {
+    sstream *stream = &session->streams[session->stream_count];
+
+    if (session->stream_count == FRAME_PIPELINE_MAX) {
+        printf("Too many GET operations in progress\n");
+        object_reader_close(source);
+        return -1;
+    }
+
+    // v6: con un codec el buffer lleva frames completos de hasta FRAME_PACKED_BLOCK bytes
+    size_t cap = session->codec ? FRAME_HEADER_SIZE + FRAME_PACKED_BLOCK : TRANSFER_BUFFSIZE;
+
+    transfer_init(&stream->transfer);
+    if (!(stream->transfer.buffer = malloc(cap)) ||
+        (session->codec && !session->packed && !(session->packed = malloc(FRAME_PACKED_BLOCK)))) {
+        perror("Error allocating memory");
+        free(stream->transfer.buffer);
+        stream->transfer.buffer = NULL;
+        object_reader_close(source);
+        return -1;
+    }
+    stream->transfer.buf_cap = cap;
+    packer_init(&stream->packer, session->codec);
+    stream->transfer.source = *source;
+    stream->transfer.zero_copy = 1; // Los contenidos del almacen son archivos regulares
+    stream->id = session->request_id;
+    stream->left = size;
+    session->stream_count++;
+    return 0;
+}
+
+int session_pump(int client_socket, ssession *session) {
+    transfer_status status;
+
+    // Una vuelta: a lo sumo un frame de cada contenido antes de volver al bucle de eventos
+    for (int turns = session->stream_count; turns > 0 && session->stream_count; turns--) {
+        if (session->stream_active < 0) {
+            if (session->state == SESSION_SEND) return 0; // La respuesta en curso va primero
+
+            sstream *next = &session->streams[session->stream_next];
+            unsigned char *out = (unsigned char *)next->transfer.buffer;
+            uint32_t chunk = next->left < FRAME_DATA_MAX ? next->left : FRAME_DATA_MAX;
+
+            next->ended = chunk == 0;
+            next->transfer.buf_off = 0;
+            if (chunk && packer_ready(&next->packer)) { // v6: el bloque se lee al buffer y se comprime
+                ssize_t packed = session_pack_stream(session, next);
+                if (packed < 0) return -1;
+                next->left -= packed;
+            }
+            else {
+                frame_pack(out, next->ended ? FRAME_END : FRAME_DATA, next->id, chunk);
+                next->transfer.buf_len = FRAME_HEADER_SIZE;
+                next->transfer.remaining = chunk;
+                next->left -= chunk;
+            }
+            session->stream_active = session->stream_next;
+        }
+
+        sstream *stream = &session->streams[session->stream_active];
+        status = remote_copy(&stream->transfer, client_socket);
+        if (status == TRANSFER_PENDING) return 0;
+        if (status == TRANSFER_ERROR) return -1;
+
+        if (stream->ended) { // El ultimo contenido ocupa su lugar
+            transfer_reset(&stream->transfer);
+            *stream = session->streams[--session->stream_count];
+        }
+        else
+            session->stream_next++;
+
+        if (session->stream_next >= session->stream_count) session->stream_next = 0;
+        session->stream_active = -1;
+    }
+
+    return 0;
+}
+
+ssize_t session_pack_stream(ssession *session, sstream *stream) {
+    unsigned char *out = (unsigned char *)stream->transfer.buffer;
+    size_t chunk = stream->left < FRAME_PACKED_BLOCK ? stream->left : FRAME_PACKED_BLOCK;
+    size_t off = 0;
+
+    while (off < chunk) { // Una lectura no cruza el final de una parte del contenido
+        ssize_t nread = object_reader_read(&stream->transfer.source, out + FRAME_HEADER_SIZE + off, chunk - off);
+        if (nread <= 0) {
+            printf("Error reading file\n");
+            return -1;
+        }
+        off += nread;
+    }
+
+    frame_pack(out, FRAME_DATA, stream->id, chunk);
+    stream->transfer.buf_len = frame_compress(&stream->packer, out, session->packed);
+    stream->transfer.remaining = 0;
+    return chunk;
+}
+
+int session_defer(int client_socket, ssession *session) {
+    size_t size = FRAME_HEADER_SIZE + session->frame.length;
+
+    if (session->deferred_count == FRAME_PIPELINE_MAX) {
+        printf("Client %d sent too many requests during an upload\n", client_socket);
+        return -1;
+    }
+
+    if (session->deferred_off) { // Se descartan los frames ya procesados
+        memmove(session->deferred, session->deferred + session->deferred_off, session->deferred_len - session->deferred_off);
+        session->deferred_len -= session->deferred_off;
+        session->deferred_off = 0;
+    }
+
+    unsigned char *deferred = realloc(session->deferred, session->deferred_len + size);
+    if (!deferred) {
+        perror("Error allocating memory");
+        return -1;
+    }
+    memcpy(deferred + session->deferred_len, session->header, FRAME_HEADER_SIZE);
+    memcpy(deferred + session->deferred_len + FRAME_HEADER_SIZE, session->payload, session->frame.length);
+    session->deferred = deferred;
+    session->deferred_len += size;
+    session->deferred_count++;
+    session->state = SESSION_FRAME_HEADER;
+    return 0;
+}
+
+int session_replay(int client_socket, ssession *session) {
+    unsigned char *next = session->deferred + session->deferred_off;
+
+    // El frame ya se valido al recibirlo
+    memcpy(session->header, next, FRAME_HEADER_SIZE);
+    frame_unpack(session->header, &session->frame);
+    memcpy(session->payload, next + FRAME_HEADER_SIZE, session->frame.length);
+
+    session->deferred_off += FRAME_HEADER_SIZE + session->frame.length;
+    if (--session->deferred_count == 0) session->deferred_len = session->deferred_off = 0;
+    return session_frame(client_socket, session);
+}
+
+int session_list_reply(ssession *session, const char *response, size_t response_len) {
+    size_t cap = FRAME_HEADER_SIZE + response_len; // Cada linea ocupa menos que en v1
+    char *buffer = malloc(cap);
+    size_t off = sizeof(return_code);
+    int line_len;
+    swire wire;
+
+    if (!buffer) {
+        perror("Error allocating memory");
+        return -1;
+    }
+
+    wire_init(&wire, buffer + FRAME_HEADER_SIZE, cap - FRAME_HEADER_SIZE);
+    wire_put_uint(&wire, session->result, 1);
+    while (off + sizeof(int) <= response_len) {
+        memcpy(&line_len, response + off, sizeof(int));
+        off += sizeof(int);
+        if (line_len <= 0 || off + line_len > response_len) break; // Linea de tamaño 0: fin del listado
+
+        wire_put_uint(&wire, line_len, 2);
+        wire_put_bytes(&wire, response + off, line_len);
+        off += line_len;
+    }
+
+    frame_pack((unsigned char *)buffer, FRAME_STATUS, session->request_id, wire.off);
+    if (session->codec && wire.off >= FRAME_PACKED_MIN) { // v6: un listado largo se envia comprimido
+        unsigned char *scratch = malloc(wire.off);
+        spacker packer;
+
+        packer_init(&packer, session->codec);
+        if (scratch) wire.off = frame_compress(&packer, (unsigned char *)buffer, scratch) - FRAME_HEADER_SIZE;
+        free(scratch);
+    }
+    free(session->transfer.buffer);
+    session->transfer.buffer = buffer;
+    session->transfer.buf_cap = cap;
+    session->transfer.buf_len = FRAME_HEADER_SIZE + wire.off;
+    session->transfer.buf_off = 0;
+    return 0;
+}
+
+int recvs(int sockfd, void *struct_ptr, size_t struct_size, size_t *received) {
+    ssize_t n = 0;
+    while (*received < struct_size) {
+        n = recv(sockfd, (char *)struct_ptr + *received, struct_size - *received, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            perror("Error reading from socket");
+            return -1;
+        }
+        if (n == 0) return -1; // El cliente se desconecto
+        *received += n;
+    }
+    return 1;
+}
 
 void initialize_server() {
     struct stat st = {0};
     if (stat(".versions", &st) == -1) {
         mkdir(".versions", 0700);
     }
-}
\ No newline at end of file
+}
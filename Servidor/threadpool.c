@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @brief Implementacion del conjunto de hilos trabajadores
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "threadpool.h"
+
+/**
+ * @brief Ciclo de un hilo trabajador
+ *
+ * @param arg Estructura del conjunto de hilos
+ * @return void* NULL
+ */
+static void *threadpool_worker(void *arg);
+
+int threadpool_init(sthread_pool *pool, int worker_count, int capacity,
+	void (*on_saturation)(void *ctx, int saturated), void *ctx) {
+	memset(pool, 0, sizeof *pool);
+	pool->worker_count = worker_count > 0 ? worker_count : THREADPOOL_DEFAULT_WORKERS;
+	pool->capacity = capacity > 0 ? capacity : THREADPOOL_DEFAULT_QUEUE;
+	pool->on_saturation = on_saturation;
+	pool->ctx = ctx;
+	pool->running = 1;
+
+	pool->jobs = malloc(pool->capacity * sizeof(sjob));
+	pool->workers = malloc(pool->worker_count * sizeof(pthread_t));
+	if (!pool->jobs || !pool->workers) {
+		perror("Error allocating memory for thread pool");
+		free(pool->jobs);
+		free(pool->workers);
+		return -1;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->not_empty, NULL);
+	pthread_cond_init(&pool->not_full, NULL);
+
+	for (int i = 0; i < pool->worker_count; i++) {
+		if (pthread_create(&pool->workers[i], NULL, threadpool_worker, pool) != 0) {
+			perror("Error creating worker thread");
+			pool->worker_count = i;
+			threadpool_destroy(pool);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int threadpool_submit(sthread_pool *pool, void (*run)(void *arg), void *arg) {
+	pthread_mutex_lock(&pool->lock);
+
+	// Cola llena: quien encola espera, y mientras tanto no lee mas solicitudes
+	while (pool->running && pool->count == pool->capacity)
+		pthread_cond_wait(&pool->not_full, &pool->lock);
+
+	if (!pool->running) {
+		pthread_mutex_unlock(&pool->lock);
+		return -1;
+	}
+
+	pool->jobs[(pool->head + pool->count) % pool->capacity] = (sjob){ run, arg };
+	pool->count++;
+
+	if (pool->count == pool->capacity && !pool->saturated) {
+		pool->saturated = 1;
+		if (pool->on_saturation) pool->on_saturation(pool->ctx, 1);
+	}
+
+	pthread_cond_signal(&pool->not_empty);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+void threadpool_destroy(sthread_pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->running = 0;
+	pthread_cond_broadcast(&pool->not_empty);
+	pthread_cond_broadcast(&pool->not_full);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->worker_count; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->not_full);
+	pthread_cond_destroy(&pool->not_empty);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool->jobs);
+	pool->workers = NULL;
+	pool->jobs = NULL;
+}
+
+static void *threadpool_worker(void *arg) {
+	sthread_pool *pool = arg;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->running && pool->count == 0)
+			pthread_cond_wait(&pool->not_empty, &pool->lock);
+
+		// Al cerrar se terminan los trabajos que ya estaban encolados
+		if (pool->count == 0) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+
+		sjob job = pool->jobs[pool->head];
+		pool->head = (pool->head + 1) % pool->capacity;
+		pool->count--;
+
+		if (pool->saturated && pool->count <= pool->capacity / 2) {
+			pool->saturated = 0;
+			if (pool->on_saturation) pool->on_saturation(pool->ctx, 0);
+		}
+
+		pthread_cond_signal(&pool->not_full);
+		pthread_mutex_unlock(&pool->lock);
+
+		job.run(job.arg);
+	}
+}
@@ -0,0 +1,78 @@
+/**
+ * @file
+ * @brief Interfaz del conjunto de hilos trabajadores del servidor
+ *
+ * Los hilos del bucle de eventos solo hacen E/S de red; el trabajo que puede
+ * bloquear (acceso a disco, bases de datos de versiones) se encola aqui.
+ * La cola es acotada: cuando se llena, quien encola espera y se notifica la
+ * saturacion para dejar de aceptar conexiones nuevas.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <pthread.h>
+
+#define THREADPOOL_DEFAULT_WORKERS 8 /**< Hilos trabajadores por defecto */
+#define THREADPOOL_DEFAULT_QUEUE 1024 /**< Capacidad por defecto de la cola de trabajos */
+
+/**
+ * @brief Trabajo encolado
+ */
+typedef struct {
+	void (*run)(void *arg); /**< Funcion a ejecutar */
+	void *arg; /**< Argumento de la funcion */
+} sjob;
+
+/**
+ * @brief Conjunto de hilos trabajadores con una cola acotada de trabajos
+ */
+typedef struct {
+	pthread_mutex_t lock; /**< Protege la cola */
+	pthread_cond_t not_empty; /**< Señalada cuando se encola un trabajo */
+	pthread_cond_t not_full; /**< Señalada cuando se retira un trabajo */
+	sjob *jobs; /**< Cola circular de trabajos */
+	int capacity; /**< Capacidad de la cola */
+	int head; /**< Posicion del siguiente trabajo a retirar */
+	int count; /**< Trabajos en la cola */
+	int saturated; /**< 1 si la cola se lleno y no ha bajado a la mitad */
+	int worker_count; /**< Cantidad de hilos trabajadores */
+	pthread_t *workers; /**< Hilos trabajadores */
+	int running; /**< 0 cuando se debe terminar */
+	void (*on_saturation)(void *ctx, int saturated); /**< Notifica cuando la cola se llena o se libera */
+	void *ctx; /**< Argumento de on_saturation */
+} sthread_pool;
+
+/**
+ * @brief Crea los hilos trabajadores
+ *
+ * @param pool Estructura del conjunto de hilos
+ * @param worker_count Cantidad de hilos
+ * @param capacity Capacidad de la cola de trabajos
+ * @param on_saturation Funcion llamada con 1 cuando la cola se llena y con 0 cuando baja a la mitad (puede ser NULL)
+ * @param ctx Argumento de on_saturation
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int threadpool_init(sthread_pool *pool, int worker_count, int capacity,
+	void (*on_saturation)(void *ctx, int saturated), void *ctx);
+
+/**
+ * @brief Encola un trabajo, esperando si la cola esta llena
+ *
+ * @param pool Estructura del conjunto de hilos
+ * @param run Funcion a ejecutar
+ * @param arg Argumento de la funcion
+ *
+ * @return 0 en caso de exito, -1 si el conjunto se esta cerrando
+ */
+int threadpool_submit(sthread_pool *pool, void (*run)(void *arg), void *arg);
+
+/**
+ * @brief Ejecuta los trabajos pendientes, termina los hilos y libera la cola
+ *
+ * @param pool Estructura del conjunto de hilos
+ */
+void threadpool_destroy(sthread_pool *pool);
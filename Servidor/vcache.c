@@ -0,0 +1,613 @@
+/**
+ * @file
+ * @brief Implementacion de la cache en memoria de las versiones de cada usuario
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "vcache.h"
+#include "versiondb.h"
+#include "versions.h"
+
+#define VCACHE_MIN_SLOTS 64 /**< Capacidad inicial de las tablas hash de archivos y de versiones */
+
+/**
+ * @brief Lectura de la tabla de versiones de la base de datos
+ */
+typedef struct {
+	svcache_entry *entry; /**< Entrada que se esta leyendo */
+	size_t budget; /**< Memoria maxima de la entrada */
+	int over; /**< 1 si la tabla supero budget y se dejo de leer */
+} sload_state;
+
+/**
+ * @brief Busca o crea la entrada de un usuario y la marca como en uso
+ *
+ * @param cache Cache
+ * @param db_path Ruta de la base de datos del usuario
+ * @return Entrada del usuario, NULL si no hay memoria
+ */
+static svcache_entry *vcache_acquire(svcache *cache, const char *db_path);
+
+/**
+ * @brief Marca una entrada como no usada por la operacion actual
+ *
+ * @param cache Cache
+ * @param entry Entrada sin candados tomados por quien llama
+ */
+static void vcache_unref(svcache *cache, svcache_entry *entry);
+
+/**
+ * @brief Lee la tabla de versiones de la base de datos
+ *
+ * Si la tabla no cabe en el limite de la cache, la entrada queda sin versiones en
+ * memoria y sus consultas usan el indice de la base de datos.
+ *
+ * @param cache Cache
+ * @param entry Entrada con el candado de escritura tomado
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int vcache_load(svcache *cache, svcache_entry *entry);
+
+/**
+ * @brief Agrega una version a la tabla en memoria
+ *
+ * @param entry Entrada con el candado de escritura tomado
+ * @param record Registro de la version
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+static int vcache_insert(svcache_entry *entry, const sadd *record);
+
+/**
+ * @brief Busca un archivo en la tabla hash de archivos
+ *
+ * @param entry Entrada
+ * @param filename Nombre del archivo
+ * @param create 1 para crear el archivo si no existe
+ * @return Archivo, NULL si no existe o no hay memoria
+ */
+static svcache_file *vcache_file(svcache_entry *entry, const char *filename, int create);
+
+/**
+ * @brief Duplica la capacidad de la tabla hash de archivos
+ *
+ * @param entry Entrada
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+static int vcache_grow(svcache_entry *entry);
+
+/**
+ * @brief Busca la version de un archivo con un hash en la tabla hash de versiones
+ *
+ * @param entry Entrada con la tabla de versiones creada
+ * @param file Posicion del archivo en la tabla de archivos
+ * @param hash Hash del contenido
+ * @return Posicion de la version en la tabla, o posicion libre donde se insertaria
+ */
+static uint32_t *vcache_version_slot(svcache_entry *entry, uint32_t file, const char *hash);
+
+/**
+ * @brief Duplica la capacidad de la tabla hash de versiones
+ *
+ * @param entry Entrada
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+static int vcache_grow_versions(svcache_entry *entry);
+
+/**
+ * @brief Deja de guardar en memoria la tabla de una entrada: sus consultas usan el indice de la base de datos
+ *
+ * @param entry Entrada con el candado de escritura tomado
+ */
+static void vcache_go_direct(svcache_entry *entry);
+
+/**
+ * @brief Suma al total de la cache la memoria que cambio en una entrada
+ *
+ * @param cache Cache
+ * @param entry Entrada con el candado de escritura tomado
+ */
+static void vcache_charge(svcache *cache, svcache_entry *entry);
+
+/**
+ * @brief Libera las versiones en memoria de una entrada
+ *
+ * @param entry Entrada
+ */
+static void vcache_clear(svcache_entry *entry);
+
+/**
+ * @brief Descarta las entradas usadas hace mas tiempo hasta cumplir el limite de memoria
+ *
+ * @param cache Cache con su candado tomado
+ */
+static void vcache_evict(svcache *cache);
+
+/**
+ * @brief Copia una version en memoria a un registro
+ *
+ * @param entry Entrada
+ * @param index Posicion de la version
+ * @param record Registro
+ */
+static void vcache_fill(svcache_entry *entry, uint32_t index, sadd *record);
+
+/**
+ * @brief Hash FNV-1a de una cadena
+ *
+ * @param s Cadena
+ * @return Hash
+ */
+static uint64_t vcache_hash(const char *s);
+
+void vcache_init(svcache *cache, size_t budget) {
+	memset(cache, 0, sizeof *cache);
+	cache->budget = budget ? budget : VCACHE_DEFAULT_BUDGET;
+	pthread_mutex_init(&cache->lock, NULL);
+}
+
+void vcache_destroy(svcache *cache) {
+	while (cache->head) {
+		svcache_entry *entry = cache->head;
+		cache->head = entry->next;
+		vcache_clear(entry);
+		pthread_rwlock_destroy(&entry->lock);
+		free(entry->db_path);
+		free(entry);
+	}
+
+	memset(cache->buckets, 0, sizeof(cache->buckets));
+	cache->tail = NULL;
+	cache->bytes = 0;
+	pthread_mutex_destroy(&cache->lock);
+}
+
+svcache_entry *vcache_read(svcache *cache, const char *db_path) {
+	svcache_entry *entry = vcache_acquire(cache, db_path);
+	if (!entry) return NULL;
+
+	while (1) {
+		pthread_rwlock_rdlock(&entry->lock);
+		if (entry->loaded) return entry;
+		pthread_rwlock_unlock(&entry->lock);
+
+		// Primer uso: se lee la base de datos con el candado de escritura y se vuelve a intentar
+		pthread_rwlock_wrlock(&entry->lock);
+		int failed = !entry->loaded && vcache_load(cache, entry) < 0;
+		pthread_rwlock_unlock(&entry->lock);
+
+		if (failed) {
+			vcache_unref(cache, entry);
+			return NULL;
+		}
+	}
+}
+
+svcache_entry *vcache_write(svcache *cache, const char *db_path) {
+	svcache_entry *entry = vcache_acquire(cache, db_path);
+	if (!entry) return NULL;
+
+	pthread_rwlock_wrlock(&entry->lock);
+	if (!entry->loaded && vcache_load(cache, entry) < 0) {
+		vcache_release(cache, entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+void vcache_release(svcache *cache, svcache_entry *entry) {
+	pthread_rwlock_unlock(&entry->lock);
+	vcache_unref(cache, entry);
+}
+
+static void vcache_unref(svcache *cache, svcache_entry *entry) {
+	pthread_mutex_lock(&cache->lock);
+	entry->refs--;
+	if (cache->bytes > cache->budget) vcache_evict(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+int vcache_find_version(svcache_entry *entry, const char *filename, const char *hash) {
+	svcache_file *file;
+	svdb db;
+
+	if (entry->direct) {
+		if (vdb_open(&db, entry->db_path, 0) < 0) return 0;
+		int found = vdb_find_version(&db, filename, hash);
+		vdb_close(&db);
+		return found;
+	}
+
+	if (!(file = vcache_file(entry, filename, 0)) || !entry->version_slot_count) return 0;
+	return *vcache_version_slot(entry, file - entry->files, hash) != 0;
+}
+
+uint64_t vcache_count(svcache_entry *entry, const char *filename) {
+	svcache_file *file;
+	svdb db;
+
+	if (entry->direct) {
+		if (vdb_open(&db, entry->db_path, 0) < 0) return 0;
+		uint64_t count = vdb_count(&db, filename);
+		vdb_close(&db);
+		return count;
+	}
+
+	file = vcache_file(entry, filename, 0);
+	return file ? file->count : 0;
+}
+
+int vcache_get(svcache_entry *entry, const char *filename, uint64_t version, sadd *record) {
+	svcache_file *file;
+	svdb db;
+
+	if (entry->direct) {
+		if (vdb_open(&db, entry->db_path, 0) < 0) return 0;
+		int found = vdb_get(&db, filename, version, record);
+		vdb_close(&db);
+		return found;
+	}
+
+	if (!(file = vcache_file(entry, filename, 0)) || version >= file->count) return 0;
+
+	vcache_fill(entry, file->versions[version], record);
+	return 1;
+}
+
+int vcache_scan(svcache_entry *entry, int (*callback)(const sadd *record, void *arg), void *arg) {
+	sadd *record;
+	int status = 0;
+	svdb db;
+
+	if (entry->direct) {
+		if (vdb_open(&db, entry->db_path, 0) < 0) return -1;
+		status = vdb_scan(&db, callback, arg);
+		vdb_close(&db);
+		return status;
+	}
+
+	if (!(record = malloc(sizeof(sadd)))) return -1;
+
+	for (uint32_t i = 0; i < entry->record_count && status == 0; i++) {
+		vcache_fill(entry, i, record);
+		if (callback(record, arg) != 0) status = -1;
+	}
+
+	free(record);
+	return status;
+}
+
+int vcache_append(svcache *cache, svcache_entry *entry, const sadd *record) {
+	svdb db;
+
+	// Primero la base de datos: la tabla en memoria nunca tiene versiones que no esten en disco
+	if (vdb_open(&db, entry->db_path, 1) < 0) return -1;
+	int status = vdb_append(&db, record);
+	vdb_close(&db);
+
+	if (status < 0) return -1;
+
+	if (entry->direct) return 0;
+	if (vcache_insert(entry, record) < 0) {
+		// Sin memoria: se descarta la tabla y se vuelve a leer en el proximo uso
+		vcache_clear(entry);
+		entry->loaded = 0;
+	}
+	else if (entry->bytes > cache->budget)
+		vcache_go_direct(entry); // Ya no cabe en la cache
+
+	vcache_charge(cache, entry);
+	return 0;
+}
+
+static svcache_entry *vcache_acquire(svcache *cache, const char *db_path) {
+	uint64_t bucket = vcache_hash(db_path) % VCACHE_BUCKETS;
+	svcache_entry *entry;
+
+	pthread_mutex_lock(&cache->lock);
+
+	for (entry = cache->buckets[bucket]; entry; entry = entry->hnext)
+		if (EQUALS(entry->db_path, db_path)) break;
+
+	if (entry) { // Se mueve al inicio de la lista LRU
+		if (entry->prev) {
+			entry->prev->next = entry->next;
+			if (entry->next) entry->next->prev = entry->prev;
+			else cache->tail = entry->prev;
+			entry->prev = NULL;
+			entry->next = cache->head;
+			cache->head->prev = entry;
+			cache->head = entry;
+		}
+	} else {
+		pthread_rwlockattr_t attr;
+
+		if (!(entry = calloc(1, sizeof *entry)) || !(entry->db_path = strdup(db_path))) {
+			pthread_mutex_unlock(&cache->lock);
+			free(entry);
+			return NULL;
+		}
+
+		// Las adiciones no deben esperar indefinidamente detras de un flujo continuo de lecturas
+		pthread_rwlockattr_init(&attr);
+		pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+		pthread_rwlock_init(&entry->lock, &attr);
+		pthread_rwlockattr_destroy(&attr);
+
+		entry->bytes = entry->charged = sizeof *entry + strlen(db_path) + 1;
+		cache->bytes += entry->bytes;
+
+		entry->hnext = cache->buckets[bucket];
+		cache->buckets[bucket] = entry;
+		entry->next = cache->head;
+		if (cache->head) cache->head->prev = entry;
+		else cache->tail = entry;
+		cache->head = entry;
+	}
+
+	entry->refs++;
+	pthread_mutex_unlock(&cache->lock);
+	return entry;
+}
+
+/**
+ * @brief Agrega a la tabla en memoria un registro leido de la base de datos
+ *
+ * @param record Registro
+ * @param arg Estado de la lectura
+ * @return 0 en caso de exito, 1 si la tabla ya no cabe en la cache, -1 si no hay memoria
+ */
+static int load_record(const sadd *record, void *arg) {
+	sload_state *state = arg;
+
+	if (vcache_insert(state->entry, record) < 0) return -1;
+	if (state->entry->bytes > state->budget) {
+		state->over = 1;
+		return 1;
+	}
+	return 0;
+}
+
+static int vcache_load(svcache *cache, svcache_entry *entry) {
+	sload_state state = { entry, cache->budget, 0 };
+	struct stat st;
+	svdb db;
+	int status = 0;
+
+	// Cada registro ocupa en memoria mas que en disco: una base de datos mayor que el limite no cabe
+	if (stat(entry->db_path, &st) == 0 && (uint64_t)st.st_size > cache->budget)
+		state.over = 1;
+	else {
+		if (vdb_open(&db, entry->db_path, 0) < 0) return -1;
+		status = vdb_scan(&db, load_record, &state);
+		vdb_close(&db);
+	}
+
+	if (state.over) {
+		vcache_go_direct(entry);
+		status = 0;
+	}
+	else if (status < 0)
+		vcache_clear(entry);
+	else
+		entry->loaded = 1;
+
+	vcache_charge(cache, entry);
+	return status;
+}
+
+static int vcache_insert(svcache_entry *entry, const sadd *record) {
+	svcache_file *file;
+	svcache_record *r;
+
+	if (entry->record_count == entry->record_cap) {
+		uint32_t cap = entry->record_cap ? entry->record_cap * 2 : 16;
+		svcache_record *tmp = realloc(entry->records, cap * sizeof(svcache_record));
+		if (!tmp) return -1;
+		entry->bytes += (cap - entry->record_cap) * sizeof(svcache_record);
+		entry->records = tmp;
+		entry->record_cap = cap;
+	}
+
+	if (!(file = vcache_file(entry, record->filename, 1))) return -1;
+
+	if (file->count == file->cap) {
+		uint32_t cap = file->cap ? file->cap * 2 : 4;
+		uint32_t *tmp = realloc(file->versions, cap * sizeof(uint32_t));
+		if (!tmp) return -1;
+		entry->bytes += (cap - file->cap) * sizeof(uint32_t);
+		file->versions = tmp;
+		file->cap = cap;
+	}
+
+	// La tabla de versiones se mantiene por debajo del 70% de ocupacion
+	if ((uint64_t)(entry->record_count + 1) * 10 > (uint64_t)entry->version_slot_count * 7 &&
+		vcache_grow_versions(entry) < 0)
+		return -1;
+
+	r = &entry->records[entry->record_count];
+	if (!(r->comment = strdup(record->comment))) return -1;
+	r->file = file - entry->files;
+	snprintf(r->hash, sizeof(r->hash), "%.*s", VCACHE_HASH_SIZE - 1, record->hash);
+	entry->bytes += strlen(r->comment) + 1;
+
+	// Una version repetida conserva la primera en la tabla de versiones
+	uint32_t *slot = vcache_version_slot(entry, r->file, r->hash);
+	if (!*slot) *slot = entry->record_count + 1;
+
+	file->versions[file->count++] = entry->record_count++;
+	return 0;
+}
+
+static svcache_file *vcache_file(svcache_entry *entry, const char *filename, int create) {
+	uint32_t mask = entry->slot_count - 1, i = 0;
+
+	if (entry->slot_count) {
+		for (i = vcache_hash(filename) & mask; entry->slots[i]; i = (i + 1) & mask) {
+			svcache_file *file = &entry->files[entry->slots[i] - 1];
+			if (EQUALS(file->filename, filename)) return file;
+		}
+	}
+
+	if (!create) return NULL;
+
+	// La tabla se mantiene por debajo del 70% de ocupacion
+	if ((uint64_t)(entry->file_count + 1) * 10 > (uint64_t)entry->slot_count * 7) {
+		if (vcache_grow(entry) < 0) return NULL;
+		mask = entry->slot_count - 1;
+		for (i = vcache_hash(filename) & mask; entry->slots[i]; i = (i + 1) & mask);
+	}
+
+	if (entry->file_count == entry->file_cap) {
+		uint32_t cap = entry->file_cap ? entry->file_cap * 2 : 16;
+		svcache_file *tmp = realloc(entry->files, cap * sizeof(svcache_file));
+		if (!tmp) return NULL;
+		entry->bytes += (cap - entry->file_cap) * sizeof(svcache_file);
+		entry->files = tmp;
+		entry->file_cap = cap;
+	}
+
+	svcache_file *file = &entry->files[entry->file_count];
+	memset(file, 0, sizeof *file);
+	if (!(file->filename = strdup(filename))) return NULL;
+	entry->bytes += strlen(filename) + 1;
+
+	entry->slots[i] = ++entry->file_count;
+	return file;
+}
+
+static int vcache_grow(svcache_entry *entry) {
+	uint32_t count = entry->slot_count ? entry->slot_count * 2 : VCACHE_MIN_SLOTS;
+	uint32_t *slots = calloc(count, sizeof(uint32_t));
+
+	if (!slots) return -1;
+
+	for (uint32_t f = 0; f < entry->file_count; f++) {
+		uint32_t i = vcache_hash(entry->files[f].filename) & (count - 1);
+		while (slots[i]) i = (i + 1) & (count - 1);
+		slots[i] = f + 1;
+	}
+
+	entry->bytes += (count - entry->slot_count) * sizeof(uint32_t);
+	free(entry->slots);
+	entry->slots = slots;
+	entry->slot_count = count;
+	return 0;
+}
+
+static uint32_t *vcache_version_slot(svcache_entry *entry, uint32_t file, const char *hash) {
+	uint32_t mask = entry->version_slot_count - 1;
+	uint32_t i = (vcache_hash(hash) ^ file * 0x9e3779b9u) & mask;
+
+	for (; entry->version_slots[i]; i = (i + 1) & mask) {
+		svcache_record *r = &entry->records[entry->version_slots[i] - 1];
+		if (r->file == file && EQUALS(r->hash, hash)) break;
+	}
+	return &entry->version_slots[i];
+}
+
+static int vcache_grow_versions(svcache_entry *entry) {
+	uint32_t count = entry->version_slot_count ? entry->version_slot_count * 2 : VCACHE_MIN_SLOTS;
+	uint32_t *old = entry->version_slots, old_count = entry->version_slot_count;
+
+	if (!(entry->version_slots = calloc(count, sizeof(uint32_t)))) {
+		entry->version_slots = old;
+		return -1;
+	}
+	entry->version_slot_count = count;
+
+	for (uint32_t i = 0; i < old_count; i++)
+		if (old[i]) *vcache_version_slot(entry, entry->records[old[i] - 1].file, entry->records[old[i] - 1].hash) = old[i];
+
+	entry->bytes += (count - old_count) * sizeof(uint32_t);
+	free(old);
+	return 0;
+}
+
+static void vcache_go_direct(svcache_entry *entry) {
+	vcache_clear(entry);
+	entry->direct = 1;
+	entry->loaded = 1;
+}
+
+static void vcache_charge(svcache *cache, svcache_entry *entry) {
+	pthread_mutex_lock(&cache->lock);
+	cache->bytes = cache->bytes - entry->charged + entry->bytes;
+	entry->charged = entry->bytes;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static void vcache_clear(svcache_entry *entry) {
+	for (uint32_t i = 0; i < entry->record_count; i++)
+		free(entry->records[i].comment);
+	for (uint32_t i = 0; i < entry->file_count; i++) {
+		free(entry->files[i].filename);
+		free(entry->files[i].versions);
+	}
+
+	free(entry->records);
+	free(entry->files);
+	free(entry->slots);
+	free(entry->version_slots);
+	entry->records = NULL;
+	entry->files = NULL;
+	entry->slots = NULL;
+	entry->version_slots = NULL;
+	entry->record_count = entry->record_cap = 0;
+	entry->file_count = entry->file_cap = 0;
+	entry->slot_count = entry->version_slot_count = 0;
+	entry->bytes = sizeof *entry + strlen(entry->db_path) + 1;
+}
+
+static void vcache_evict(svcache *cache) {
+	svcache_entry *entry = cache->tail;
+
+	while (entry && cache->bytes > cache->budget) {
+		svcache_entry *prev = entry->prev;
+
+		// Una entrada en uso puede tener candados tomados, se conserva
+		if (entry->refs == 0) {
+			svcache_entry **link = &cache->buckets[vcache_hash(entry->db_path) % VCACHE_BUCKETS];
+			while (*link != entry) link = &(*link)->hnext;
+			*link = entry->hnext;
+
+			if (prev) prev->next = entry->next;
+			else cache->head = entry->next;
+			if (entry->next) entry->next->prev = prev;
+			else cache->tail = prev;
+
+			cache->bytes -= entry->charged;
+			vcache_clear(entry);
+			pthread_rwlock_destroy(&entry->lock);
+			free(entry->db_path);
+			free(entry);
+		}
+
+		entry = prev;
+	}
+}
+
+static void vcache_fill(svcache_entry *entry, uint32_t index, sadd *record) {
+	svcache_record *r = &entry->records[index];
+
+	record->username[0] = '\0'; // Implicito en la ruta de la base de datos
+	snprintf(record->filename, sizeof(record->filename), "%s", entry->files[r->file].filename);
+	snprintf(record->hash, sizeof(record->hash), "%s", r->hash);
+	snprintf(record->comment, sizeof(record->comment), "%s", r->comment);
+}
+
+static uint64_t vcache_hash(const char *s) {
+	uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+
+	return h;
+}
@@ -0,0 +1,193 @@
+/**
+ * @file
+ * @brief Cache en memoria de las versiones de cada usuario
+ *
+ * Mantiene en memoria, para los usuarios usados recientemente, la tabla de
+ * versiones leida de su base de datos. Cada usuario tiene un candado de
+ * lectura/escritura: los listados y las consultas se atienden en paralelo
+ * sin acceder al disco, y las adiciones se escriben primero en la base de
+ * datos y luego en la tabla.
+ *
+ * Cuando la memoria usada supera el limite se descartan los usuarios
+ * usados hace mas tiempo (LRU) que no esten en uso. La tabla de un usuario
+ * que no cabe en el limite no se guarda en memoria: sus consultas usan el
+ * indice de su base de datos (ver versiondb.h).
+ *
+ * El servidor debe ser el unico proceso que modifica las bases de datos
+ * mientras se ejecuta, de lo contrario la cache no ve los cambios.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define VCACHE_DEFAULT_BUDGET (64 * 1024 * 1024) /**< Memoria maxima de la cache por defecto */
+#define VCACHE_BUCKETS 1024 /**< Posiciones de la tabla de usuarios */
+#define VCACHE_HASH_SIZE 65 /**< Hash SHA-256 en hexadecimal, con NULL */
+
+/**
+ * @brief Version en memoria
+ */
+typedef struct {
+	uint32_t file; /**< Posicion del archivo en la tabla de archivos */
+	char hash[VCACHE_HASH_SIZE]; /**< Hash del contenido */
+	char *comment; /**< Comentario de la version */
+} svcache_record;
+
+/**
+ * @brief Archivo en memoria con la lista de sus versiones
+ */
+typedef struct {
+	char *filename; /**< Nombre del archivo */
+	uint32_t *versions; /**< Posiciones de las versiones en la tabla de versiones */
+	uint32_t count; /**< Cantidad de versiones */
+	uint32_t cap; /**< Capacidad de la lista */
+} svcache_file;
+
+/**
+ * @brief Tabla de versiones de un usuario
+ */
+typedef struct svcache_entry {
+	char *db_path; /**< Ruta de la base de datos del usuario (clave) */
+	pthread_rwlock_t lock; /**< Candado de lectura/escritura de la tabla */
+	int loaded; /**< 1 si la tabla ya se leyo de la base de datos (o se decidio no leerla) */
+	int direct; /**< 1 si la tabla no cabe en la cache: las consultas usan el indice de la base de datos */
+	int refs; /**< Operaciones que usan la entrada, no se descarta si es distinto de 0 */
+	size_t bytes; /**< Memoria usada por la entrada */
+	size_t charged; /**< Parte de bytes que ya se sumo al total de la cache */
+	svcache_record *records; /**< Versiones en el orden en que fueron agregadas */
+	uint32_t record_count; /**< Cantidad de versiones */
+	uint32_t record_cap; /**< Capacidad de la tabla de versiones */
+	svcache_file *files; /**< Archivos */
+	uint32_t file_count; /**< Cantidad de archivos */
+	uint32_t file_cap; /**< Capacidad de la tabla de archivos */
+	uint32_t *slots; /**< Tabla hash de archivos: posicion + 1, 0 si esta libre */
+	uint32_t slot_count; /**< Capacidad de la tabla hash (potencia de 2) */
+	uint32_t *version_slots; /**< Tabla hash de versiones por archivo y hash: posicion + 1, 0 si esta libre */
+	uint32_t version_slot_count; /**< Capacidad de la tabla hash de versiones (potencia de 2) */
+	struct svcache_entry *hnext; /**< Siguiente entrada en la misma posicion de la tabla de usuarios */
+	struct svcache_entry *prev; /**< Entrada usada mas recientemente */
+	struct svcache_entry *next; /**< Entrada usada menos recientemente */
+} svcache_entry;
+
+/**
+ * @brief Cache de versiones
+ */
+typedef struct {
+	pthread_mutex_t lock; /**< Protege la tabla de usuarios, la lista LRU, refs y bytes */
+	svcache_entry *buckets[VCACHE_BUCKETS]; /**< Tabla de usuarios */
+	svcache_entry *head; /**< Entrada usada mas recientemente */
+	svcache_entry *tail; /**< Entrada usada menos recientemente */
+	size_t bytes; /**< Memoria usada por todas las entradas */
+	size_t budget; /**< Memoria maxima */
+} svcache;
+
+/**
+ * @brief Inicializa la cache
+ *
+ * @param cache Cache
+ * @param budget Memoria maxima en bytes, 0 para usar VCACHE_DEFAULT_BUDGET
+ */
+void vcache_init(svcache *cache, size_t budget);
+
+/**
+ * @brief Libera todas las entradas de la cache
+ *
+ * Solo debe llamarse cuando ninguna operacion usa la cache.
+ *
+ * @param cache Cache
+ */
+void vcache_destroy(svcache *cache);
+
+/**
+ * @brief Obtiene la tabla de un usuario con el candado de lectura tomado
+ *
+ * Si la tabla no esta en memoria se lee de la base de datos.
+ *
+ * @param cache Cache
+ * @param db_path Ruta de la base de datos del usuario
+ *
+ * @return Entrada del usuario, NULL si no se puede leer la base de datos
+ */
+svcache_entry *vcache_read(svcache *cache, const char *db_path);
+
+/**
+ * @brief Obtiene la tabla de un usuario con el candado de escritura tomado
+ *
+ * @param cache Cache
+ * @param db_path Ruta de la base de datos del usuario
+ *
+ * @return Entrada del usuario, NULL si no se puede leer la base de datos
+ */
+svcache_entry *vcache_write(svcache *cache, const char *db_path);
+
+/**
+ * @brief Libera el candado de una entrada obtenida con vcache_read o vcache_write
+ *
+ * Si la cache supera su limite de memoria descarta las entradas usadas hace mas tiempo.
+ *
+ * @param cache Cache
+ * @param entry Entrada
+ */
+void vcache_release(svcache *cache, svcache_entry *entry);
+
+/**
+ * @brief Verifica si existe una version de un archivo con un hash
+ *
+ * @param entry Entrada con un candado tomado
+ * @param filename Nombre del archivo
+ * @param hash Hash del contenido
+ *
+ * @return 1 si existe, 0 si no existe
+ */
+int vcache_find_version(svcache_entry *entry, const char *filename, const char *hash);
+
+/**
+ * @brief Cantidad de versiones de un archivo
+ *
+ * @param entry Entrada con un candado tomado
+ * @param filename Nombre del archivo
+ *
+ * @return Cantidad de versiones
+ */
+uint64_t vcache_count(svcache_entry *entry, const char *filename);
+
+/**
+ * @brief Obtiene la version n (desde 0) de un archivo
+ *
+ * @param entry Entrada con un candado tomado
+ * @param filename Nombre del archivo
+ * @param version Numero de version
+ * @param record Registro de la version
+ *
+ * @return 1 si la version existe, 0 si no existe
+ */
+int vcache_get(svcache_entry *entry, const char *filename, uint64_t version, sadd *record);
+
+/**
+ * @brief Recorre todas las versiones en el orden en que fueron agregadas
+ *
+ * @param entry Entrada con un candado tomado
+ * @param callback Funcion llamada por cada registro, si retorna distinto de 0 se detiene el recorrido
+ * @param arg Argumento de la funcion
+ *
+ * @return 0 en caso de exito, -1 si el recorrido se detuvo
+ */
+int vcache_scan(svcache_entry *entry, int (*callback)(const sadd *record, void *arg), void *arg);
+
+/**
+ * @brief Agrega una version a la base de datos del usuario y luego a la tabla en memoria
+ *
+ * @param cache Cache
+ * @param entry Entrada con el candado de escritura tomado
+ * @param record Registro de la version
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int vcache_append(svcache *cache, svcache_entry *entry, const sadd *record);
@@ -0,0 +1,632 @@
+/**
+ * @file
+ * @brief Implementacion de la base de datos de versiones con indice en disco
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "versions.h"
+#include "versiondb.h"
+
+#define VDB_MAGIC "RVIDX02" /**< Identificador del formato del indice */
+#define VDB_SCAN_BUFFSIZE (64 * 1024) /**< Bytes leidos por cada lectura al recorrer la base de datos */
+
+#define VDB_KIND_VERSION 1ULL /**< Clave (archivo, hash) */
+#define VDB_KIND_NTH 2ULL /**< Clave (archivo, numero de version) */
+#define VDB_KIND_FILE 3ULL /**< Clave (archivo) */
+
+#define VDB_KIND(aux) ((aux) >> 56) /**< Tipo de clave de una posicion */
+#define VDB_VALUE(aux) ((aux) & ((1ULL << 56) - 1)) /**< Numero de version o cantidad de versiones */
+#define VDB_AUX(kind, value) (((kind) << 56) | (value)) /**< Construye el campo aux */
+
+/**
+ * @brief Verifica el encabezado de la base de datos, escribiendolo si esta vacia
+ *
+ * @param db Base de datos
+ * @param db_path Ruta de la base de datos (para los mensajes de error)
+ * @return 0 si el formato es el actual, -1 si es otro formato o ocurre un error
+ */
+static int vdb_check_format(svdb *db, const char *db_path);
+
+/**
+ * @brief Mapea el indice en memoria segun el tamaño actual del archivo
+ *
+ * @param db Base de datos
+ * @return 0 en caso de exito (header es NULL si el indice esta vacio), -1 si ocurre un error
+ */
+static int vdb_map(svdb *db);
+
+/**
+ * @brief Elimina el mapeo del indice
+ *
+ * @param db Base de datos
+ */
+static void vdb_unmap(svdb *db);
+
+/**
+ * @brief Verifica si el indice no corresponde a la base de datos
+ *
+ * @param db Base de datos
+ * @return 1 si se debe actualizar el indice, 0 en caso contrario
+ */
+static int vdb_stale(svdb *db);
+
+/**
+ * @brief Actualiza el indice, reconstruyendolo si es necesario (requiere candado exclusivo)
+ *
+ * @param db Base de datos
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int vdb_repair(svdb *db);
+
+/**
+ * @brief Vacia el indice y le asigna una capacidad
+ *
+ * @param db Base de datos
+ * @param capacity Cantidad de posiciones
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int vdb_reset(svdb *db, uint64_t capacity);
+
+/**
+ * @brief Duplica la capacidad del indice conservando sus claves
+ *
+ * @param db Base de datos
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int vdb_grow(svdb *db);
+
+/**
+ * @brief Indexa los registros de la base de datos desde una posicion hasta el final
+ *
+ * @param db Base de datos
+ * @param from Posicion del primer registro a indexar
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int vdb_catch_up(svdb *db, uint64_t from);
+
+/**
+ * @brief Agrega al indice las claves de un registro
+ *
+ * @param db Base de datos
+ * @param record Registro
+ * @param offset Posicion del registro en la base de datos
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int vdb_index_record(svdb *db, const sadd *record, uint64_t offset);
+
+/**
+ * @brief Busca una clave en el indice, verificando el registro al que apunta
+ *
+ * @param db Base de datos
+ * @param kind Tipo de clave
+ * @param filename Nombre del archivo
+ * @param hash Hash del contenido (solo para VDB_KIND_VERSION)
+ * @param version Numero de version (solo para VDB_KIND_NTH)
+ * @param record Registro al que apunta la clave encontrada
+ * @return Posicion encontrada, NULL si la clave no existe
+ */
+static svdb_slot *vdb_lookup(svdb *db, uint64_t kind, const char *filename, const char *hash,
+	uint64_t version, sadd *record);
+
+/**
+ * @brief Inserta una clave en el indice sin verificar la capacidad
+ *
+ * @param db Base de datos
+ * @param key Hash de la clave
+ * @param offset Posicion del registro
+ * @param aux Tipo de clave y valor
+ */
+static void vdb_put(svdb *db, uint64_t key, uint64_t offset, uint64_t aux);
+
+/**
+ * @brief Calcula el hash de 64 bits de una clave
+ *
+ * @param kind Tipo de clave
+ * @param filename Nombre del archivo
+ * @param hash Hash del contenido (solo para VDB_KIND_VERSION)
+ * @param version Numero de version (solo para VDB_KIND_NTH)
+ * @return Hash distinto de 0
+ */
+static uint64_t vdb_key(uint64_t kind, const char *filename, const char *hash, uint64_t version);
+
+/**
+ * @brief Lee un registro de la base de datos
+ *
+ * @param db Base de datos
+ * @param offset Posicion del registro
+ * @param record Registro leido
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int vdb_read_record(svdb *db, uint64_t offset, sadd *record);
+
+/**
+ * @brief Recorre los registros de la base de datos desde una posicion
+ *
+ * @param db Base de datos
+ * @param from Posicion inicial
+ * @param callback Funcion llamada por cada registro con su posicion
+ * @param arg Argumento de la funcion
+ * @param end Posicion siguiente al ultimo registro completo
+ * @return 0 en caso de exito (al final puede quedar un registro incompleto), -1 si ocurre un error,
+ *         el recorrido se detuvo o hay un registro invalido (errno EINVAL)
+ */
+static int vdb_scan_from(svdb *db, uint64_t from,
+	int (*callback)(const sadd *record, uint64_t offset, void *arg), void *arg, uint64_t *end);
+
+int vdb_open(svdb *db, const char *db_path, int writable) {
+	char index_path[PATH_MAX];
+	size_t len = strlen(db_path);
+
+	memset(db, 0, sizeof *db);
+	db->writable = writable;
+	db->index_fd = -1;
+
+	// <usuario>.db -> <usuario>.idx
+	if (len > 3 && EQUALS(db_path + len - 3, ".db")) len -= 3;
+	snprintf(index_path, sizeof(index_path), "%.*s%s", (int)len, db_path, VDB_INDEX_EXT);
+
+	if ((db->db_fd = open(db_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) return -1;
+
+	if ((db->index_fd = open(index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 ||
+		flock(db->index_fd, writable ? LOCK_EX : LOCK_SH) < 0 ||
+		vdb_check_format(db, db_path) < 0 ||
+		vdb_map(db) < 0) {
+		vdb_close(db);
+		return -1;
+	}
+
+	if (!vdb_stale(db)) return 0;
+
+	if (writable) {
+		if (vdb_repair(db) < 0) {
+			vdb_close(db);
+			return -1;
+		}
+		return 0;
+	}
+
+	// Un lector que encuentra el indice desactualizado lo repara con candado exclusivo.
+	// El cambio de candado no es atomico, por lo que se vuelve a mapear el indice despues de cada cambio.
+	vdb_unmap(db);
+	if (flock(db->index_fd, LOCK_EX) < 0 || vdb_map(db) < 0 ||
+		(vdb_stale(db) && vdb_repair(db) < 0)) {
+		vdb_close(db);
+		return -1;
+	}
+
+	vdb_unmap(db);
+	if (flock(db->index_fd, LOCK_SH) < 0 || vdb_map(db) < 0) {
+		vdb_close(db);
+		return -1;
+	}
+
+	return 0;
+}
+
+void vdb_close(svdb *db) {
+	vdb_unmap(db);
+	if (db->index_fd >= 0) close(db->index_fd); // Al cerrar se libera el candado
+	if (db->db_fd >= 0) close(db->db_fd);
+	db->index_fd = db->db_fd = -1;
+}
+
+int vdb_find_version(svdb *db, const char *filename, const char *hash) {
+	sadd record;
+	return vdb_lookup(db, VDB_KIND_VERSION, filename, hash, 0, &record) != NULL;
+}
+
+uint64_t vdb_count(svdb *db, const char *filename) {
+	sadd record;
+	svdb_slot *slot = vdb_lookup(db, VDB_KIND_FILE, filename, NULL, 0, &record);
+	return slot ? VDB_VALUE(slot->aux) : 0;
+}
+
+int vdb_get(svdb *db, const char *filename, uint64_t version, sadd *record) {
+	return vdb_lookup(db, VDB_KIND_NTH, filename, NULL, version, record) != NULL;
+}
+
+int vdb_append(svdb *db, const sadd *record) {
+	uint64_t offset = db->header->db_size; // El indice cubre toda la base de datos
+	uint8_t data[VDB_RECORD_MAX];
+	size_t size;
+
+	if (!db->writable || !(size = vdb_encode(record, data))) return -1;
+
+	// Si el proceso termina a mitad de la actualizacion, el indice se reconstruye al abrirlo
+	db->header->dirty = 1;
+
+	if (pwrite(db->db_fd, data, size, offset) != (ssize_t)size) {
+		if (ftruncate(db->db_fd, offset) < 0) perror("Error truncating version database");
+		db->header->dirty = 0;
+		return -1;
+	}
+
+	if (vdb_index_record(db, record, offset) < 0) return -1;
+
+	db->header->db_size = offset + size;
+	db->header->dirty = 0;
+	return 0;
+}
+
+/**
+ * @brief Funcion y argumento de un recorrido publico
+ */
+typedef struct {
+	int (*callback)(const sadd *record, void *arg);
+	void *arg;
+} sscan_args;
+
+static int scan_adapter(const sadd *record, uint64_t offset, void *arg) {
+	sscan_args *args = arg;
+
+	(void)offset;
+	return args->callback(record, args->arg);
+}
+
+int vdb_scan(svdb *db, int (*callback)(const sadd *record, void *arg), void *arg) {
+	sscan_args args = { callback, arg };
+	uint64_t end;
+	return vdb_scan_from(db, VDB_DB_HEADER_SIZE, scan_adapter, &args, &end);
+}
+
+static int vdb_map(svdb *db) {
+	struct stat st;
+
+	if (fstat(db->index_fd, &st) < 0) return -1;
+
+	db->header = NULL;
+	db->slots = NULL;
+	db->map_size = 0;
+	if ((size_t)st.st_size < sizeof(svdb_header)) return 0; // Indice vacio, se debe construir
+
+	void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, db->index_fd, 0);
+	if (map == MAP_FAILED) {
+		perror("Error mapping version index");
+		return -1;
+	}
+
+	db->header = map;
+	db->slots = (svdb_slot *)(db->header + 1);
+	db->map_size = st.st_size;
+	return 0;
+}
+
+static void vdb_unmap(svdb *db) {
+	if (db->header) munmap(db->header, db->map_size);
+	db->header = NULL;
+	db->slots = NULL;
+	db->map_size = 0;
+}
+
+static int vdb_stale(svdb *db) {
+	struct stat st;
+
+	if (!db->header || memcmp(db->header->magic, VDB_MAGIC, sizeof(VDB_MAGIC)) != 0 || db->header->dirty) return 1;
+	if (db->map_size != sizeof(svdb_header) + db->header->capacity * sizeof(svdb_slot)) return 1;
+	if (fstat(db->db_fd, &st) < 0) return 1;
+	return db->header->db_size != (uint64_t)st.st_size;
+}
+
+static int vdb_repair(svdb *db) {
+	struct stat st;
+
+	if (fstat(db->db_fd, &st) < 0) return -1;
+
+	if (!db->header || memcmp(db->header->magic, VDB_MAGIC, sizeof(VDB_MAGIC)) != 0 || db->header->dirty ||
+		db->map_size != sizeof(svdb_header) + db->header->capacity * sizeof(svdb_slot) ||
+		db->header->db_size > (uint64_t)st.st_size) {
+		printf("Rebuilding version index\n");
+		if (vdb_reset(db, VDB_INDEX_MIN_SLOTS) < 0) return -1;
+		return vdb_catch_up(db, 0);
+	}
+
+	// La base de datos crecio sin actualizar el indice: se indexan solo los registros nuevos
+	return vdb_catch_up(db, db->header->db_size);
+}
+
+static int vdb_reset(svdb *db, uint64_t capacity) {
+	vdb_unmap(db);
+	if (ftruncate(db->index_fd, 0) < 0 ||
+		ftruncate(db->index_fd, sizeof(svdb_header) + capacity * sizeof(svdb_slot)) < 0 ||
+		vdb_map(db) < 0 || !db->header) {
+		perror("Error creating version index");
+		return -1;
+	}
+
+	memcpy(db->header->magic, VDB_MAGIC, sizeof(VDB_MAGIC));
+	db->header->capacity = capacity;
+	db->header->used = 0;
+	db->header->db_size = 0;
+	db->header->dirty = 0;
+	return 0;
+}
+
+static int vdb_grow(svdb *db) {
+	uint64_t capacity = db->header->capacity * 2;
+	uint64_t used = db->header->used, n = 0;
+	svdb_slot *old = malloc(used * sizeof(svdb_slot));
+
+	if (!old) return -1;
+
+	for (uint64_t i = 0; i < db->header->capacity; i++)
+		if (db->slots[i].key) old[n++] = db->slots[i];
+
+	// El archivo conserva su inodo (y el candado), solo cambia de tamaño
+	vdb_unmap(db);
+	if (ftruncate(db->index_fd, sizeof(svdb_header) + capacity * sizeof(svdb_slot)) < 0 || vdb_map(db) < 0 || !db->header) {
+		perror("Error growing version index");
+		free(old);
+		return -1;
+	}
+
+	memset(db->slots, 0, capacity * sizeof(svdb_slot));
+	db->header->capacity = capacity;
+	db->header->used = 0;
+	for (uint64_t i = 0; i < n; i++)
+		vdb_put(db, old[i].key, old[i].offset, old[i].aux);
+
+	free(old);
+	return 0;
+}
+
+static int catch_up_record(const sadd *record, uint64_t offset, void *arg) {
+	return vdb_index_record(arg, record, offset);
+}
+
+static int vdb_catch_up(svdb *db, uint64_t from) {
+	uint64_t end;
+
+	db->header->dirty = 1;
+	if (from < VDB_DB_HEADER_SIZE) from = VDB_DB_HEADER_SIZE; // Los registros empiezan despues del encabezado
+	if (vdb_scan_from(db, from, catch_up_record, db, &end) < 0) {
+		perror("Error indexing version database");
+		return -1;
+	}
+
+	// Solo un registro incompleto al final (escritura interrumpida) se descarta
+	struct stat st;
+	if (fstat(db->db_fd, &st) < 0) return -1;
+	if ((uint64_t)st.st_size != end) {
+		if ((uint64_t)st.st_size - end >= VDB_RECORD_MAX) {
+			fprintf(stderr, "Version database has %llu unreadable bytes at offset %llu\n",
+				(unsigned long long)(st.st_size - end), (unsigned long long)end);
+			return -1;
+		}
+		if (ftruncate(db->db_fd, end) < 0) {
+			perror("Error truncating version database");
+			return -1;
+		}
+	}
+
+	db->header->db_size = end;
+	db->header->dirty = 0;
+	return 0;
+}
+
+static int vdb_index_record(svdb *db, const sadd *record, uint64_t offset) {
+	sadd scratch;
+
+	// Cada registro agrega hasta tres claves, se asegura el espacio antes de insertar
+	while ((db->header->used + 3) * 10 > db->header->capacity * 7)
+		if (vdb_grow(db) < 0) return -1;
+
+	svdb_slot *file = vdb_lookup(db, VDB_KIND_FILE, record->filename, NULL, 0, &scratch);
+	uint64_t version = file ? VDB_VALUE(file->aux) : 0;
+
+	vdb_put(db, vdb_key(VDB_KIND_NTH, record->filename, NULL, version), offset, VDB_AUX(VDB_KIND_NTH, version));
+	if (!vdb_lookup(db, VDB_KIND_VERSION, record->filename, record->hash, 0, &scratch))
+		vdb_put(db, vdb_key(VDB_KIND_VERSION, record->filename, record->hash, 0), offset, VDB_AUX(VDB_KIND_VERSION, 0));
+
+	if (file)
+		file->aux = VDB_AUX(VDB_KIND_FILE, version + 1);
+	else
+		vdb_put(db, vdb_key(VDB_KIND_FILE, record->filename, NULL, 0), offset, VDB_AUX(VDB_KIND_FILE, 1));
+
+	return 0;
+}
+
+static svdb_slot *vdb_lookup(svdb *db, uint64_t kind, const char *filename, const char *hash,
+	uint64_t version, sadd *record) {
+	if (!db->header) return NULL;
+
+	uint64_t key = vdb_key(kind, filename, hash, version);
+	uint64_t mask = db->header->capacity - 1;
+
+	// Sondeo lineal; el hash de 64 bits puede colisionar, por eso se compara el registro
+	for (uint64_t i = key & mask; db->slots[i].key; i = (i + 1) & mask) {
+		svdb_slot *slot = &db->slots[i];
+
+		if (slot->key != key || VDB_KIND(slot->aux) != kind) continue;
+		if (kind == VDB_KIND_NTH && VDB_VALUE(slot->aux) != version) continue;
+		if (vdb_read_record(db, slot->offset, record) < 0) continue;
+		if (!EQUALS(record->filename, filename)) continue;
+		if (kind == VDB_KIND_VERSION && !EQUALS(record->hash, hash)) continue;
+
+		return slot;
+	}
+
+	return NULL;
+}
+
+static void vdb_put(svdb *db, uint64_t key, uint64_t offset, uint64_t aux) {
+	uint64_t mask = db->header->capacity - 1;
+	uint64_t i = key & mask;
+
+	while (db->slots[i].key) i = (i + 1) & mask;
+
+	db->slots[i].key = key;
+	db->slots[i].offset = offset;
+	db->slots[i].aux = aux;
+	db->header->used++;
+}
+
+static uint64_t vdb_key(uint64_t kind, const char *filename, const char *hash, uint64_t version) {
+	uint64_t h = 0xcbf29ce484222325ULL ^ kind; // FNV-1a
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)filename; ; p++) {
+		h = (h ^ *p) * 0x100000001b3ULL;
+		if (!*p) break;
+	}
+
+	if (kind == VDB_KIND_VERSION)
+		for (p = (const unsigned char *)hash; *p; p++) h = (h ^ *p) * 0x100000001b3ULL;
+
+	if (kind == VDB_KIND_NTH)
+		for (int i = 0; i < 8; i++) h = (h ^ ((version >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+
+	// Mezcla final (splitmix64) para repartir mejor los bits bajos
+	h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h ? h : 1;
+}
+
+static int vdb_check_format(svdb *db, const char *db_path) {
+	char magic[VDB_DB_HEADER_SIZE];
+	ssize_t nread = pread(db->db_fd, magic, sizeof(magic), 0);
+
+	if (nread == 0) { // Base de datos nueva
+		if (pwrite(db->db_fd, VDB_DB_MAGIC, VDB_DB_HEADER_SIZE, 0) != VDB_DB_HEADER_SIZE) {
+			perror("Error writing version database header");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (nread != sizeof(magic) || memcmp(magic, VDB_DB_MAGIC, VDB_DB_HEADER_SIZE) != 0) {
+		fprintf(stderr, "%s is not in the current version database format, run ./migrate first\n", db_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+size_t vdb_encode(const sadd *record, uint8_t *out) {
+	size_t filename_len = strnlen(record->filename, PATH_MAX);
+	size_t comment_len = strnlen(record->comment, COMMENT_SIZE);
+
+	if (filename_len == 0 || filename_len >= PATH_MAX || comment_len >= COMMENT_SIZE) return 0;
+
+	// El hash se guarda en binario (32 bytes) en lugar de texto hexadecimal
+	for (int i = 0; i < VDB_HASH_BYTES; i++) {
+		unsigned int byte;
+		if (!isxdigit((unsigned char)record->hash[2 * i]) || !isxdigit((unsigned char)record->hash[2 * i + 1]) ||
+			sscanf(record->hash + 2 * i, "%2x", &byte) != 1) return 0;
+		out[i] = byte;
+	}
+	if (record->hash[2 * VDB_HASH_BYTES] != '\0') return 0;
+
+	out[VDB_HASH_BYTES] = filename_len & 0xff; // Longitudes en little-endian
+	out[VDB_HASH_BYTES + 1] = filename_len >> 8;
+	out[VDB_HASH_BYTES + 2] = comment_len;
+	memcpy(out + VDB_RECORD_HEADER, record->filename, filename_len);
+	memcpy(out + VDB_RECORD_HEADER + filename_len, record->comment, comment_len);
+	return VDB_RECORD_HEADER + filename_len + comment_len;
+}
+
+int vdb_decode(const uint8_t *data, size_t avail, sadd *record, size_t *size) {
+	static const char *hex = "0123456789abcdef";
+
+	if (avail < VDB_RECORD_HEADER) return 0;
+
+	size_t filename_len = data[VDB_HASH_BYTES] | (size_t)data[VDB_HASH_BYTES + 1] << 8;
+	size_t comment_len = data[VDB_HASH_BYTES + 2];
+
+	if (filename_len == 0 || filename_len >= PATH_MAX || comment_len >= COMMENT_SIZE) return -1;
+	if (avail < VDB_RECORD_HEADER + filename_len + comment_len) return 0;
+
+	// El nombre de usuario no se guarda: esta implicito en la ruta de la base de datos
+	record->username[0] = '\0';
+	for (int i = 0; i < VDB_HASH_BYTES; i++) {
+		record->hash[2 * i] = hex[data[i] >> 4];
+		record->hash[2 * i + 1] = hex[data[i] & 15];
+	}
+	record->hash[2 * VDB_HASH_BYTES] = '\0';
+	memcpy(record->filename, data + VDB_RECORD_HEADER, filename_len);
+	record->filename[filename_len] = '\0';
+	memcpy(record->comment, data + VDB_RECORD_HEADER + filename_len, comment_len);
+	record->comment[comment_len] = '\0';
+
+	*size = VDB_RECORD_HEADER + filename_len + comment_len;
+	return 1;
+}
+
+static int vdb_read_record(svdb *db, uint64_t offset, sadd *record) {
+	uint8_t data[VDB_RECORD_MAX];
+	size_t size;
+
+	// La mayoria de los registros caben en la primera lectura
+	ssize_t nread = pread(db->db_fd, data, VDB_RECORD_HEADER + 256, offset);
+	if (nread <= 0) return -1;
+
+	int r = vdb_decode(data, nread, record, &size);
+	if (r == 0) {
+		nread = pread(db->db_fd, data, sizeof(data), offset);
+		if (nread <= 0) return -1;
+		r = vdb_decode(data, nread, record, &size);
+	}
+
+	return r == 1 ? 0 : -1;
+}
+
+static int vdb_scan_from(svdb *db, uint64_t from,
+	int (*callback)(const sadd *record, uint64_t offset, void *arg), void *arg, uint64_t *end) {
+	uint8_t *buffer = malloc(VDB_SCAN_BUFFSIZE);
+	sadd *record = malloc(sizeof(sadd));
+	uint64_t offset = from; // Posicion del primer byte del buffer
+	size_t len = 0, pos = 0, size;
+	ssize_t nread = 0;
+	int r, status = 0;
+
+	if (!buffer || !record) {
+		free(buffer);
+		free(record);
+		return -1;
+	}
+
+	while (1) {
+		// Conserva el registro incompleto al inicio del buffer y lee mas datos
+		memmove(buffer, buffer + pos, len - pos);
+		offset += pos;
+		len -= pos;
+		pos = 0;
+
+		nread = pread(db->db_fd, buffer + len, VDB_SCAN_BUFFSIZE - len, offset + len);
+		if (nread <= 0) break;
+		len += nread;
+
+		while ((r = vdb_decode(buffer + pos, len - pos, record, &size)) == 1) {
+			if (callback(record, offset + pos, arg) != 0) {
+				status = -1;
+				goto done;
+			}
+			pos += size;
+		}
+
+		if (r < 0) { // Un registro invalido no es una escritura interrumpida: los siguientes no se descartan
+			fprintf(stderr, "Invalid version record at offset %llu\n", (unsigned long long)(offset + pos));
+			errno = EINVAL;
+			status = -1;
+			goto done;
+		}
+	}
+
+	if (nread < 0) status = -1;
+
+done:
+	*end = offset + pos;
+	free(record);
+	free(buffer);
+	return status;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file
+ * @brief Base de datos de versiones de un usuario con indice en disco
+ *
+ * Los registros de versiones se agregan al final de la base de datos del usuario
+ * (<usuario>.db). Cada registro ocupa solo lo necesario:
+ *  - hash SHA-256 en binario (32 bytes)
+ *  - longitud del nombre del archivo (2 bytes) y del comentario (1 byte)
+ *  - nombre del archivo y comentario, sin NULL
+ * El nombre de usuario no se guarda, ya esta en la ruta de la base de datos.
+ * Los registros del formato anterior (estructura sadd completa) se convierten con migrate.
+ *
+ * Junto a la base de datos se mantiene un indice (<usuario>.idx): una tabla hash
+ * de direccionamiento abierto, mapeada en memoria, con tres tipos de claves:
+ *  - (archivo, hash): posicion del registro, para detectar versiones repetidas.
+ *  - (archivo, n): posicion de la version n del archivo, para obtener una version.
+ *  - (archivo): cantidad de versiones del archivo.
+ * Asi las busquedas no dependen de la cantidad de versiones almacenadas.
+ *
+ * El indice se reconstruye a partir de la base de datos si no existe, si quedo
+ * a medio actualizar o si la base de datos cambio sin actualizarlo.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "protocol.h"
+
+#define VDB_INDEX_EXT ".idx" /**< Extension del indice */
+#define VDB_DB_MAGIC "RVDB0002" /**< Encabezado de la base de datos (8 bytes, sin NULL) */
+#define VDB_DB_HEADER_SIZE 8 /**< Tamaño del encabezado de la base de datos */
+#define VDB_HASH_BYTES 32 /**< Bytes del hash SHA-256 en binario */
+#define VDB_RECORD_HEADER (VDB_HASH_BYTES + 3) /**< Hash, longitud del nombre (2 bytes) y del comentario (1 byte) */
+#define VDB_RECORD_MAX (VDB_RECORD_HEADER + PATH_MAX + COMMENT_SIZE) /**< Tamaño maximo de un registro */
+#define VDB_INDEX_MIN_SLOTS 1024 /**< Capacidad inicial del indice */
+
+/**
+ * @brief Encabezado del archivo de indice
+ */
+typedef struct {
+	char magic[8]; /**< Identificador del formato */
+	uint64_t db_size; /**< Bytes de la base de datos cubiertos por el indice */
+	uint64_t capacity; /**< Cantidad de posiciones de la tabla (potencia de 2) */
+	uint64_t used; /**< Posiciones ocupadas */
+	uint64_t dirty; /**< Distinto de 0 mientras se modifica la tabla */
+} svdb_header;
+
+/**
+ * @brief Posicion de la tabla hash del indice
+ */
+typedef struct {
+	uint64_t key; /**< Hash de la clave, 0 si la posicion esta libre */
+	uint64_t offset; /**< Posicion del registro en la base de datos */
+	uint64_t aux; /**< Tipo de clave (8 bits altos) y numero de version o cantidad de versiones */
+} svdb_slot;
+
+/**
+ * @brief Base de datos de versiones abierta
+ */
+typedef struct {
+	int db_fd; /**< Descriptor de la base de datos */
+	int index_fd; /**< Descriptor del indice (tambien se usa como candado) */
+	int writable; /**< 1 si se abrio para agregar versiones */
+	svdb_header *header; /**< Indice mapeado en memoria */
+	svdb_slot *slots; /**< Tabla hash del indice */
+	size_t map_size; /**< Tamaño del mapeo */
+} svdb;
+
+/**
+ * @brief Abre la base de datos de un usuario y su indice
+ *
+ * Toma un candado compartido (lectura) o exclusivo (escritura) que se mantiene hasta vdb_close.
+ * Si el indice esta desactualizado se actualiza antes de retornar.
+ *
+ * @param db Base de datos
+ * @param db_path Ruta de la base de datos del usuario
+ * @param writable 1 para agregar versiones, 0 para solo leer
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int vdb_open(svdb *db, const char *db_path, int writable);
+
+/**
+ * @brief Libera el candado y cierra la base de datos
+ *
+ * @param db Base de datos
+ */
+void vdb_close(svdb *db);
+
+/**
+ * @brief Verifica si existe una version de un archivo con un hash
+ *
+ * @param db Base de datos
+ * @param filename Nombre del archivo
+ * @param hash Hash del contenido
+ *
+ * @return 1 si existe, 0 si no existe
+ */
+int vdb_find_version(svdb *db, const char *filename, const char *hash);
+
+/**
+ * @brief Cantidad de versiones de un archivo
+ *
+ * @param db Base de datos
+ * @param filename Nombre del archivo
+ *
+ * @return Cantidad de versiones
+ */
+uint64_t vdb_count(svdb *db, const char *filename);
+
+/**
+ * @brief Obtiene la version n (desde 0) de un archivo
+ *
+ * @param db Base de datos
+ * @param filename Nombre del archivo
+ * @param version Numero de version
+ * @param record Registro de la version
+ *
+ * @return 1 si la version existe, 0 si no existe
+ */
+int vdb_get(svdb *db, const char *filename, uint64_t version, sadd *record);
+
+/**
+ * @brief Agrega una version al final de la base de datos y la indexa
+ *
+ * @param db Base de datos abierta para escritura
+ * @param record Registro de la version
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int vdb_append(svdb *db, const sadd *record);
+
+/**
+ * @brief Recorre todas las versiones en el orden en que fueron agregadas
+ *
+ * @param db Base de datos
+ * @param callback Funcion llamada por cada registro, si retorna distinto de 0 se detiene el recorrido
+ * @param arg Argumento de la funcion
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error de lectura o el recorrido se detuvo
+ */
+int vdb_scan(svdb *db, int (*callback)(const sadd *record, void *arg), void *arg);
+
+/**
+ * @brief Codifica un registro en el formato de la base de datos
+ *
+ * @param record Registro
+ * @param out Buffer de al menos VDB_RECORD_MAX bytes
+ * @return Tamaño del registro codificado, 0 si el registro no es valido
+ */
+size_t vdb_encode(const sadd *record, uint8_t *out);
+
+/**
+ * @brief Decodifica un registro del formato de la base de datos
+ *
+ * @param data Datos leidos
+ * @param avail Bytes disponibles en data
+ * @param record Registro decodificado
+ * @param size Tamaño del registro codificado
+ * @return 1 si se decodifico, 0 si faltan datos, -1 si el registro no es valido
+ */
+int vdb_decode(const uint8_t *data, size_t avail, sadd *record, size_t *size);
@@ -6,275 +6,411 @@
  * @copyright MIT Liscense
  */
 
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
 #include "versions.h"
+#include "vcache.h"
+#include "wal.h"
+#include "objects.h"
 
+svcache cache; // Tablas de versiones de los usuarios usados recientemente
+swal wal; // Registro de escritura anticipada de las adiciones
+unsigned int keyframe_interval; // Cada cuantas versiones de un archivo se guarda una completa
+int compression; // 1 si los contenidos nuevos se guardan comprimidos cuando vale la pena
 
 /**
- * @brief Escribe en el socket el resultado de la peticion add
- * 
- * @param socket   Socket de comunicacion
- * @param result  Resultado de la operacion que se escribira en la primera linea del socket 
- * @return return_code  Resultado de la operacion (result), si ocurre un error al escribir retorna ERROR
+ * @brief Empaquetado periodico de los contenidos pequeños
  */
-return_code add_result(int socket, return_code result);
+static struct {
+	pthread_t thread; /**< Hilo que empaqueta */
+	pthread_mutex_t lock; /**< Candado de stop */
+	pthread_cond_t wake; /**< Se señala para terminar antes de la siguiente pasada */
+	unsigned int interval; /**< Segundos entre pasadas, 0 si no hay hilo */
+	int stop; /**< 1 si el hilo debe terminar */
+} repacker = { .lock = PTHREAD_MUTEX_INITIALIZER };
 
 /**
- * @brief Escribe en el socket el resultado de la peticion get
- * 
- * @param socket   Socket de comunicacion
- * @param result  Resultado de la operacion que se escribira en la primera linea del socket 
- * @param hash Hash del archivo a devolver, si la operacion es exitosa
- * @return return_code  Resultado de la operacion (result), si ocurre un error al escribir retorna ERROR
+ * @brief Estado del listado de versiones
  */
-return_code get_result(int socket, return_code result, char * hash);
+typedef struct {
+	char ** response; /**< Buffer de la respuesta */
+	size_t * len; /**< Bytes usados */
+	size_t cap; /**< Capacidad del buffer */
+	int count; /**< Versiones listadas */
+} slist_state;
 
 /**
- * @brief Verifica si existe una version para un archivo
- *
- * @param filename Nombre del archivo
- * @param hash Hash del contenido
+ * @brief Agrega una linea de listado a la respuesta
  *
- * @return 1 si la version existe, 0 en caso contrario.
+ * @param record Registro de la version
+ * @param arg Estado del listado
+ * @return 0 en caso de exito, -1 si no hay memoria
  */
-int version_exists(const char *db_path, char * filename, char * hash);
-
+static int list_line(const sadd * record, void * arg);
 
 /**
-* @brief Almacena un archivo en el repositorio
-*
-* @param socket Socket de comunicacion
-* @param filename Nombre del archivo
-* @param hash Hash del archivo: nombre del archivo en el repositorio
-*
-* @return Resultado de la operacion
-*/
-return_code store_file(int socket, const char *db_path, const char *filename, const char *hash);
+ * @brief Adiciona datos al final de una respuesta, creciendo el buffer si es necesario
+ *
+ * @param response Buffer de la respuesta
+ * @param len Bytes usados
+ * @param cap Capacidad del buffer
+ * @param data Datos a copiar
+ * @param size Tamaño de los datos
+ *
+ * @return 0 en caso de exito, -1 si no hay memoria
+ */
+static int append_response(char ** response, size_t * len, size_t * cap, const void * data, size_t size);
 
 /**
- * @brief Adiciona una nueva version de un archivo.
+ * @brief Mueve los contenidos pequeños a los paquetes cada repacker.interval segundos hasta que se detiene
  *
- * @param filename Nombre del archivo.
- * @param comment Comentario de la version.
- * @param hash Hash del contenido.
- *
- * @return 1 en caso de exito, 0 en caso de error.
+ * @param arg No se usa
+ * @return NULL
  */
-return_code add_new_version(const char *db_path, sadd * req);
+static void * repack_loop(void * arg);
 
 
-/**
-* @brief Recupera un archivo del repositorio
-*
-* @param socket Socket de comunicacion
-* @param hash Hash del archivo: nombre del archivo en el repositorio
-*
-* @return Resultado de la operacion
-*/
-return_code retrieve_file(int socket, char * hash);
-
-
-return_code add(int socket, sadd * request) {
-	char db_path[PATH_MAX];
-    get_user_db_path(request->username, db_path, sizeof(db_path)); // Ruta específica del usuario
-
-    // Verifica si ya existe una version con el mismo hash
-	// Retorna VERSION_ALREADY_EXISTS si ya existe
-	//version_exists(filename, v.hash)
-
-	if(version_exists(db_path, request->filename, request->hash)  == VERSION_ALREADY_EXISTS)
-		return add_result(socket, VERSION_ALREADY_EXISTS);
-
-	// Almacena el archivo en el repositorio.
-	// El nombre del archivo dentro del repositorio es su hash (sin extension)
-	// Retorna VERSION_ERROR si la operacion falla
-	if(store_file(socket, db_path, request->filename, request->hash) == VERSION_ERROR)
-		return add_result(socket, VERSION_ERROR);
-
-	// Agrega un nuevo registro al archivo versions.db
-	// Si no puede adicionar el registro, se debe borrar el archivo almacenado en el paso anterior
-	// Si la operacion falla, retorna VERSION_ERROR
-	if(add_new_version(db_path, request) == VERSION_ERROR) {
-		//char file_path[PATH_MAX];
-		//snprintf(file_path, PATH_MAX, "%s/%s", VERSIONS_DIR, request->hash);
-		//if (remove(request->filename) != 0) {
-		//	perror("Remove failed");
-		//}
-		//else {
-		//	printf("File %s deleted successfully", request->filename);
-		//}
-
-		//remove(file_path);
-		//remove(db_path);
-		return add_result(socket, VERSION_ERROR);
+
+int versions_init(size_t cache_budget, wal_mode durability, unsigned int latency_us, unsigned int keyframe, int compress,
+	unsigned int pack_interval) {
+	pthread_condattr_t attr;
+
+	// Se aplican las adiciones que quedaron en el registro antes de leer cualquier base de datos
+	if (objects_init(VERSIONS_DIR) < 0) {
+		perror("Error creating object store");
+		return -1;
+	}
+	if (wal_open(&wal, VERSIONS_DIR, durability, latency_us) < 0) return -1;
+	vcache_init(&cache, cache_budget);
+	keyframe_interval = keyframe < OBJECT_DELTA_CHAIN_LIMIT ? keyframe : OBJECT_DELTA_CHAIN_LIMIT;
+	compression = compress;
+
+	// Los contenidos pequeños se empaquetan en segundo plano: las adiciones no esperan al empaquetado
+	if (pack_interval > 0) {
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&repacker.wake, &attr);
+		pthread_condattr_destroy(&attr);
+		repacker.interval = pack_interval;
+		repacker.stop = 0;
+		if (pthread_create(&repacker.thread, NULL, repack_loop, NULL) != 0) {
+			fprintf(stderr, "Error starting object packer, small objects stay loose\n");
+			pthread_cond_destroy(&repacker.wake);
+			repacker.interval = 0;
+		}
 	}
-    
-	// Si la operacion es exitosa, retorna VERSION_ADDED
-	return add_result(socket, VERSION_ADDED);
+	return 0;
 }
 
+void versions_cleanup(void) {
+	if (repacker.interval > 0) {
+		pthread_mutex_lock(&repacker.lock);
+		repacker.stop = 1;
+		pthread_cond_signal(&repacker.wake);
+		pthread_mutex_unlock(&repacker.lock);
+		pthread_join(repacker.thread, NULL);
+		pthread_cond_destroy(&repacker.wake);
+		repacker.interval = 0;
+	}
+	wal_report(&wal);
+	wal_close(&wal);
+	vcache_destroy(&cache);
+}
+
+
 return_code add_new_version(const char *db_path, sadd * req) {
-	FILE * fp = fopen(db_path, "ab"); //Usa la ruta especifica
-	
-	if(!fp) return VERSION_ERROR;
-	// Adiciona un nuevo registro (estructura) al archivo versions.db
-	fwrite(req, sizeof *req, 1, fp);	
-	fclose(fp);
-	return VERSION_CREATED;
+	return_code result;
+
+	add_new_versions(db_path, req, 1, &result);
+	return result;
 }
 
+void add_new_versions(const char *db_path, sadd * reqs, size_t count, return_code * results) {
+	svcache_entry *entry; // Versiones del usuario
+	uint64_t start = wal_now();
+	int64_t lsn = 0; // Ultimo registro que se debe esperar
+	size_t created = 0;
+
+	if (!(entry = vcache_write(&cache, db_path))) {
+		for (size_t i = 0; i < count; i++) results[i] = VERSION_ERROR;
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		sadd *req = &reqs[i];
+		int64_t record;
+
+		// Otra conexion pudo adicionar la misma version mientras se recibia el archivo
+		if (vcache_find_version(entry, req->filename, req->hash))
+			results[i] = VERSION_ALREADY_EXISTS;
+		else if (vcache_append(&cache, entry, req) < 0 || // Adiciona el registro a la base de datos y luego a la cache
+			(record = wal_append(&wal, db_path, req)) < 0) // y despues al registro de escritura anticipada
+			results[i] = VERSION_ERROR;
+		else {
+			results[i] = VERSION_CREATED;
+			lsn = record;
+			created++;
+		}
+	}
+
+	vcache_release(&cache, entry);
 
-void list(int socket, slist * request) {
-	char db_path[PATH_MAX];
-	get_user_db_path(request->username, db_path, sizeof(db_path)); // Ruta específica del usuario
-	//FILE * fp; //Archivo de versiones
-	FILE *fp = fopen(db_path, "r"); //Archivo de versiones
+	// La espera del disco se hace sin el candado: otras adiciones del mismo usuario entran en el mismo lote
+	if (created) {
+		if (wal_sync(&wal, lsn) < 0) {
+			for (size_t i = 0; i < count; i++)
+				if (results[i] == VERSION_CREATED) results[i] = VERSION_ERROR;
+			return;
+		}
+		wal_observe(&wal, start);
+	}
+}
 
-	if (!fp) {
-        return_code result = VERSION_NOT_FOUND;
-        send(socket, &result, sizeof(result), 0);
-        return;
-    }
 
-    sadd sadd_buffer; //Estructura de versiones
-    char buffer[PATH_MAX]; //Buffer para enviar los datos al cliente
-	int version_count = 0; //Contador de versiones
-	//ssize_t read_count; //Cantidad de bytes leidos
-	//return_code result = VERSION_CREATED	; //Resultado de la operacion
+return_code list(const char *db_path, slist * request, char ** response, size_t * response_len) {
+	svcache_entry *entry; //Versiones del usuario
+	return_code result = VERSION_CREATED; //Resultado de la operacion
+	slist_state state = { response, response_len, 0, 0 }; //Estado del listado
+	sadd record; //Registro de una version
 	int msg_size; //Tamaño del mensaje
-	
-	//Abre el la base de datos de versiones (versions.db)
-	//if(!(fp = fopen(VERSIONS_DB_PATH, "r"))) return ;
-
-	//Muestra los registros cuyo nombre coincide con filename.
-	//Si filename es NULL, muestra todos los registros.
-    // while(read_count = fread(&sadd_buffer, sizeof(sadd), 1, fp), read_count > 0) {
-	// 	if(request->filename[0] == '\0') //Si filename es NULL, muestra todos los registros
-    //     {
-	// 		if(version_count == 0) send(socket, &result, sizeof(return_code), 0); //Envia VERSION_CREATED si se encuentra el archivo
-
-    //         snprintf(buffer,sizeof(buffer),"%s %.3s...%.3s %s\n", sadd_buffer.filename, sadd_buffer.hash, 
-    //         (sadd_buffer.hash + strlen(sadd_buffer.hash) - 3), sadd_buffer.comment); //Guarda el registro en el buffer
-	// 		msg_size = strlen(buffer);
-	// 		send (socket, &msg_size, sizeof(int), 0); //Envia el tamaño del mensaje
-    //         send(socket, buffer, msg_size, 0); //Envia el buffer al cliente
-	// 		version_count++;
-    //         continue;
-    //     }
-
-	// 	if(EQUALS(sadd_buffer.filename, request->filename)) //Si filename no es NULL, muestra los registros cuyo nombre coincide con filename
-	// 	{
-	// 		if(version_count == 0) send(socket, &result, sizeof(return_code), 0); //Envia VERSION_CREATED si se encuentra el archivo
-
-    //         snprintf(buffer,sizeof(buffer),"%s %.3s...%.3s %s (%d)\n", sadd_buffer.filename, sadd_buffer.hash,  
-    //         (sadd_buffer.hash + strlen(sadd_buffer.hash) - 3), sadd_buffer.comment, version_count++); //Guarda el registro en el buffer
-	// 		msg_size = strlen(buffer);
-	// 		send (socket, &msg_size, sizeof(int), 0); //Envia el tamaño del mensaje
-    //         send(socket, buffer, msg_size, 0); //Envia el buffer al cliente
-	// 	}
-	// }
-
-	while (fread(&sadd_buffer, sizeof(sadd), 1, fp) > 0) {
-        if (request->filename[0] == '\0' || EQUALS(sadd_buffer.filename, request->filename)) {
-            snprintf(buffer, sizeof(buffer), "%s %.3s...%.3s %s\n", 
-                     sadd_buffer.filename, sadd_buffer.hash, 
-                     sadd_buffer.hash + strlen(sadd_buffer.hash) - 3, 
-                     sadd_buffer.comment);
-            msg_size = strlen(buffer);
-            send(socket, &msg_size, sizeof(int), 0);
-            send(socket, buffer, msg_size, 0);
-            version_count++;
-        }
-    }
-
-	if(version_count == 0) 
+	int status = 0;
+
+	*response = NULL;
+	*response_len = 0;
+
+	if (append_response(response, response_len, &state.cap, &result, sizeof(result)) < 0) return VERSION_ERROR;
+
+	if ((entry = vcache_read(&cache, db_path)) != NULL) {
+		//Si filename es vacio, muestra todos los registros en el orden en que se adicionaron.
+		//Si no, recorre solo las versiones del archivo.
+		if (request->filename[0] == '\0')
+			status = vcache_scan(entry, list_line, &state);
+		else {
+			uint64_t count = vcache_count(entry, request->filename);
+			for (uint64_t i = 0; i < count && status == 0; i++)
+				if (vcache_get(entry, request->filename, i, &record))
+					status = list_line(&record, &state);
+		}
+		vcache_release(&cache, entry);
+	}
+
+	if (status < 0) goto error;
+
+	if(state.count == 0) 
 	{
-		return_code result = VERSION_NOT_FOUND;
-		send(socket, &result, sizeof(result), 0); //Si no se encuentra el archivo, envia VERSION_NOT_FOUND
+		//Si no se encuentra el archivo, solo se envia VERSION_NOT_FOUND
+		result = VERSION_NOT_FOUND;
+		memcpy(*response, &result, sizeof(result));
+		*response_len = sizeof(result);
+		return result;
 	}
 
-	fclose(fp);
+	msg_size = 0; //Linea de tamaño 0: fin del listado
+	if (append_response(response, response_len, &state.cap, &msg_size, sizeof(int)) < 0) goto error;
+	return result;
+
+error:
+	free(*response);
+	*response = NULL;
+	*response_len = 0;
+	return VERSION_ERROR;
+}
+
+static int list_line(const sadd * record, void * arg) {
+	slist_state *state = arg;
+	char buffer[PATH_MAX + HASH_SIZE]; //Linea del listado
+	size_t hash_len = strlen(record->hash);
+	int msg_size = snprintf(buffer, sizeof(buffer), "%s %.3s...%.3s %s\n", 
+		record->filename, record->hash, 
+		record->hash + (hash_len > 3 ? hash_len - 3 : 0), 
+		record->comment);
+
+	if (msg_size >= (int)sizeof(buffer)) msg_size = sizeof(buffer) - 1;
+	if (append_response(state->response, state->len, &state->cap, &msg_size, sizeof(int)) < 0 ||
+		append_response(state->response, state->len, &state->cap, buffer, msg_size) < 0) return -1;
+
+	state->count++;
+	return 0;
 }
 
 int version_exists(const char *db_path, char * filename, char * hash) {
-	FILE *fp;
-	ssize_t read_count;
-	sadd sadd_buffer;
+	svcache_entry *entry;
+	int found;
 	
-	if(!(fp = fopen(db_path, "r"))) return -1; // db_path en lugar de VERSIONS_DB_PATH
+	if (!(entry = vcache_read(&cache, db_path))) return -1;
 
-	while(read_count = fread(&sadd_buffer, sizeof sadd_buffer, 1, fp), read_count > 0) {	
-		if (EQUALS(filename, sadd_buffer.filename) && EQUALS(hash, sadd_buffer.hash)) {
-			fclose(fp);
-			return VERSION_ALREADY_EXISTS;
-		}
+	found = vcache_find_version(entry, filename, hash);
+	vcache_release(&cache, entry);
+	return found ? VERSION_ALREADY_EXISTS : 1;
+}
+
+return_code get(const char *db_path, sget * request, char * hash) {
+	svcache_entry *entry; //Versiones del usuario
+	sadd record; //Registro de la version solicitada
+	int found;
+
+	if (!(entry = vcache_read(&cache, db_path))) return VERSION_NOT_FOUND; //Si no se puede abrir el archivo de versiones, retorna VERSION_NOT_FOUND
+
+	found = vcache_get(entry, request->filename, request->version, &record);
+	vcache_release(&cache, entry);
+
+	if (!found) return VERSION_NOT_FOUND; //Si no se encuentra la version solicitada retorna VERSION_NOT_FOUND
+
+	strcpy(hash, record.hash);
+	return VERSION_CREATED; //Si se encuentra la version solicitada, retorna VERSION_CREATED
+}
+
+int file_stored(const char *hash) {
+	return object_exists(VERSIONS_DIR, hash);
+}
+
+int store_file(sobject_writer *writer, const char *hash) {
+	return object_create(VERSIONS_DIR, writer, hash);
+}
+
+int resume_file(sobject_writer *writer, const char *hash, const char *key, off_t *size) {
+	return object_resume(VERSIONS_DIR, writer, hash, key, size);
+}
+
+int publish_file(sobject_writer *writer, int fd) {
+	// El contenido debe estar en disco antes de confirmar la version que lo referencia
+	int status = wal_sync_file(&wal, fd);
+
+	if (status < 0) {
+		perror("Error syncing version file");
+		object_abort(writer);
 	}
+	else // Se cierra despues: una recepcion que se puede continuar sigue bloqueada hasta dejar objects/partial
+		status = object_publish(VERSIONS_DIR, writer, wal.mode != WAL_NONE);
 
-	fclose(fp);
-    return 1;  
+	close(fd);
+	return status;
 }
 
-return_code get(int socket, sget * request) {
-	char db_path[PATH_MAX];
-    get_user_db_path(request->username, db_path, sizeof(db_path)); // Ruta específica del usuario
+int store_delta(const char *db_path, const char *filename, const char *hash) {
+	svcache_entry *entry; // Versiones del usuario
+	sobject_writer writer;
+	sadd previous; // Ultima version del archivo
+	uint64_t count;
+	int found = 0, fd;
 
-	sadd sadd_buffer; //Estructura de versiones que guardara temporalmente los registros leidos
-	int count =0; //Contador de versiones
-	//ssize_t nread; //Cantidad de bytes leidos
+	if (keyframe_interval < 2) return 0;
 
-	FILE * fp = fopen(VERSIONS_DB_PATH, "r"); //Abre el archivo de versiones
-	if(!fp) return get_result(socket, VERSION_NOT_FOUND, NULL); //Si no se puede abrir el archivo de versiones, retorna VERSION_NOT_FOUND
+	if (!(entry = vcache_read(&cache, db_path))) return -1;
+	if ((count = vcache_count(entry, filename)) > 0)
+		found = vcache_get(entry, filename, count - 1, &previous);
+	vcache_release(&cache, entry);
 
-	//while (nread = fread(&sadd_buffer, sizeof sadd_buffer, 1, fp), nread > 0) //Lee el archivo de versiones
-	while (fread(&sadd_buffer, sizeof(sadd), 1, fp) > 0)
-	{
-		printf("Filename: %s %s\n",request->filename, sadd_buffer.filename);
-		if(EQUALS(request->filename, sadd_buffer.filename) && count++ == request->version)
-        {
-			fclose(fp);
-			return get_result(socket, VERSION_CREATED, sadd_buffer.hash); //Si se encuentra la version solicitada, retorna VERSION_CREATED
-        }
+	if (!found || (fd = object_create_delta(VERSIONS_DIR, &writer, hash, previous.hash, keyframe_interval)) < 0) return 0;
+
+	// La diferencia se publica (y llega a disco) antes de eliminar el contenido completo
+	if (publish_file(&writer, fd) < 0) return -1;
+	if (object_unlink(VERSIONS_DIR, hash) < 0) {
+		perror("Error removing full version file");
+		return -1;
 	}
+	return 1;
+}
+
+int store_compressed(const char *hash) {
+	sobject_writer writer;
+	int fd;
+
+	if (!compression || (fd = object_create_compressed(VERSIONS_DIR, &writer, hash)) < 0) return 0;
 
-	fclose(fp);
-    return get_result(socket, VERSION_NOT_FOUND, NULL); //Si no se encuentra la version solicitada retorna VERSION_NOT_FOUND
+	// El contenido comprimido se publica (y llega a disco) antes de eliminar el completo
+	if (publish_file(&writer, fd) < 0) return -1;
+	if (object_unlink(VERSIONS_DIR, hash) < 0) {
+		perror("Error removing full version file");
+		return -1;
+	}
+	return 1;
 }
 
-return_code store_file(int socket, const char *db_path, const char *filename, const char *hash){
-	// Guardaren .db en lugar no crear un archivo nuevo
-	FILE *db_file = fopen(db_path, "ab");
-    if (!db_file) return VERSION_ERROR;
+int store_recipe(const char *hash, const sobject_chunk *chunks, uint32_t count) {
+	char computed[OBJECT_HASH_LEN + 1];
+	struct sha256_buff digest;
+	sobject_reader reader;
+	sobject_writer writer;
+	ssize_t nread;
+	char *buffer;
+	int fd;
+
+	if (!(buffer = malloc(TRANSFER_BUFFSIZE)) || object_reader_chunks(VERSIONS_DIR, &reader, chunks, count) < 0) {
+		free(buffer);
+		return -1;
+	}
 
-	fwrite(hash, sizeof(char), strlen(hash), db_file);
-    fwrite(filename, sizeof(char), strlen(filename), db_file);
+	// Los fragmentos se verificaron al recibirlos, pero su union debe tener el hash de la version
+	sha256_init(&digest);
+	while ((nread = object_reader_read(&reader, buffer, TRANSFER_BUFFSIZE)) > 0)
+		sha256_update(&digest, buffer, nread);
+	object_reader_close(&reader);
+	free(buffer);
+
+	sha256_finalize(&digest);
+	sha256_read_hex(&digest, computed);
+	computed[OBJECT_HASH_LEN] = '\0';
+	if (nread < 0 || strcmp(computed, hash) != 0) return -1;
+
+	if ((fd = object_create_recipe(VERSIONS_DIR, &writer, hash, chunks, count)) < 0) {
+		perror("Error creating version file");
+		return -1;
+	}
+	return publish_file(&writer, fd);
+}
 
-	fclose(db_file);
-    return VERSION_CREATED;
+void discard_file(sobject_writer *writer) {
+	object_abort(writer);
 }
 
-return_code add_result(int socket, return_code result) {
-    int bytes_sent = send(socket, &result, sizeof(return_code), 0);
-    if (bytes_sent < 0) {
-        perror("Error sending result");
-        return ERROR;
-    }
+void suspend_file(sobject_writer *writer) {
+	object_suspend(writer);
+}
 
-    return result;
+int retrieve_file(const char *hash, sobject_reader *reader, off_t *size) {
+	return object_reader_open(VERSIONS_DIR, hash, reader, size);
 }
 
-return_code get_result(int socket, return_code result, char * hash) {
-    int bytes_sent = send(socket, &result, sizeof(return_code), 0);
-    if (bytes_sent < 0) {
-        perror("Error sending result");
-        return ERROR;
-    }
+static int append_response(char ** response, size_t * len, size_t * cap, const void * data, size_t size) {
+	if (*len + size > *cap) {
+		size_t new_cap = *cap ? *cap : BUFFSIZE;
+		while (new_cap < *len + size) new_cap *= 2;
 
-    if (result != VERSION_CREATED) return result;
+		char *tmp = realloc(*response, new_cap);
+		if (!tmp) return -1;
+		*response = tmp;
+		*cap = new_cap;
+	}
 
-    return retrieve_file(socket, hash);
+	memcpy(*response + *len, data, size);
+	*len += size;
+	return 0;
 }
 
-return_code retrieve_file(int socket, char * hash) {
-	char src_filename[PATH_MAX]; 
-	snprintf(src_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
-	return remote_copy(src_filename, socket); //Copia el archivo del repositorio al socket
+static void * repack_loop(void * arg) {
+	struct timespec deadline;
+	int packed;
+
+	(void)arg;
+	pthread_mutex_lock(&repacker.lock);
+	while (!repacker.stop) {
+		pthread_mutex_unlock(&repacker.lock);
+
+		// Otro proceso (migrate) puede estar empaquetando: se intenta en la siguiente pasada
+		if ((packed = objects_repack(VERSIONS_DIR, OBJECT_PACK_MIN_AGE)) > 0)
+			printf("Packed %d small objects\n", packed);
+		else if (packed < 0 && errno != EWOULDBLOCK)
+			perror("Error packing small objects");
+
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += repacker.interval;
+		pthread_mutex_lock(&repacker.lock);
+		while (!repacker.stop && pthread_cond_timedwait(&repacker.wake, &repacker.lock, &deadline) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&repacker.lock);
+	return NULL;
 }
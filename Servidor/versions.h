@@ -24,39 +24,215 @@
 
 
 #include "protocol.h"
+#include "wal.h"
+#include "objects.h"
 
 #define VERSIONS_DB "versions.db" /**< Nombre de la base de datos de versiones. */
 #define VERSIONS_DIR ".versions" /**< Directorio del repositorio. */
 #define VERSIONS_DB_PATH VERSIONS_DIR "/" VERSIONS_DB /**< Ruta completa de la base de datos.*/
 
 #define EQUALS(s1, s2) (strcmp(s1, s2) == 0) /**< Verdadero si dos cadenas son iguales.*/
+#define VERSIONS_DEFAULT_KEYFRAME 16 /**< Cada cuantas versiones de un archivo se guarda una completa, por defecto */
+#define VERSIONS_DEFAULT_PACK_INTERVAL 60 /**< Segundos entre pasadas del empaquetado de contenidos pequeños, por defecto */
 
 /**
- * @brief Adiciona un archivo al repositorio.
+ * @brief Aplica el registro de escritura anticipada e inicializa la cache de versiones
  *
- * @param filename Nombre del archivo a adicionar
- * @param comment Comentario de la version actual
+ * @param cache_budget Memoria maxima de la cache en bytes, 0 para usar el valor por defecto
+ * @param durability Modo de durabilidad de las adiciones
+ * @param latency_us Latencia maxima del modo WAL_BATCHED
+ * @param keyframe Cada cuantas versiones de un archivo se guarda una completa (ver store_delta), 0 o 1 para guardarlas todas completas
+ * @param compress 1 para guardar comprimidos los contenidos nuevos (ver store_compressed), 0 para guardarlos tal cual
+ * @param pack_interval Segundos entre pasadas de un hilo que mueve los contenidos pequeños a los paquetes
+ *                      (ver objects_repack), 0 para no empaquetarlos
  *
- * @return Codigo de la operacion
+ * @return 0 en caso de exito, -1 si ocurre un error
  */
-return_code add(int socket, sadd * request);
+int versions_init(size_t cache_budget, wal_mode durability, unsigned int latency_us, unsigned int keyframe, int compress,
+	unsigned int pack_interval);
+
+/**
+ * @brief Detiene el empaquetado, muestra las estadisticas de las adiciones, cierra el registro y libera la cache
+ */
+void versions_cleanup(void);
+
+/**
+ * @brief Verifica si existe una version para un archivo
+ *
+ * @param db_path Ruta de la base de datos del usuario
+ * @param filename Nombre del archivo
+ * @param hash Hash del contenido
+ *
+ * @return VERSION_ALREADY_EXISTS si la version existe, 1 en caso contrario, -1 si no se puede abrir la base de datos.
+ */
+int version_exists(const char *db_path, char * filename, char * hash);
+
+/**
+ * @brief Adiciona una nueva version de un archivo.
+ *
+ * @param db_path Ruta de la base de datos del usuario
+ * @param req Solicitud de adicion con el nombre, hash y comentario de la version.
+ *
+ * @return VERSION_CREATED en caso de exito, VERSION_ALREADY_EXISTS si la version ya estaba registrada,
+ *         VERSION_ERROR en caso de error.
+ */
+return_code add_new_version(const char *db_path, sadd * req);
+
+/**
+ * @brief Adiciona varias versiones con una sola espera del disco.
+ *
+ * Los registros se agregan al registro de escritura anticipada uno tras otro y
+ * se espera una vez a que el ultimo este en disco.
+ *
+ * @param db_path Ruta de la base de datos del usuario
+ * @param reqs Solicitudes de adicion
+ * @param count Cantidad de solicitudes
+ * @param results Resultado de cada solicitud, como en add_new_version
+ */
+void add_new_versions(const char *db_path, sadd * reqs, size_t count, return_code * results);
 
 /**
  * @brief Lista las versiones de un archivo.
  *
- * @param filename Nombre del archivo, NULL para listar todo el repositorio.
+ * Construye la respuesta completa de la operacion, tal como se envia por el socket
+ * (codigo de retorno, lineas del listado y linea de tamaño 0 al final).
+ *
+ * @param db_path Ruta de la base de datos del usuario
+ * @param request Solicitud de listado, filename vacio para listar todo el repositorio.
+ * @param response Buffer reservado con malloc con la respuesta, lo libera quien llama
+ * @param response_len Tamaño de la respuesta
+ *
+ * @return VERSION_CREATED si hay versiones, VERSION_NOT_FOUND si no hay, VERSION_ERROR si no hay memoria.
  */
-void list(int socket, slist * request);
+return_code list(const char *db_path, slist * request, char ** response, size_t * response_len);
 
 /**
- * @brief Obtiene una version del un archivo.
- * Sobreescribe la version existente.
+ * @brief Obtiene el hash de una version del un archivo.
  *
- * @param filename Nombre de archivo.
- * @param version Numero secuencial de la version.
+ * @param db_path Ruta de la base de datos del usuario
+ * @param request Solicitud con el nombre de archivo y el numero secuencial de la version.
+ * @param hash Buffer de HASH_SIZE bytes donde se copia el hash de la version.
  *
- * @return 1 en caso de exito, 0 si ocurre un error.
+ * @return VERSION_CREATED si la version existe, VERSION_NOT_FOUND en caso contrario.
  */
-return_code get(int socket, sget * request);
+return_code get(const char *db_path, sget * request, char * hash);
+
+/**
+* @brief Verifica si un contenido ya esta en el repositorio
+*
+* @param hash Hash del contenido
+*
+* @return 1 si existe, 0 en caso contrario
+*/
+int file_stored(const char *hash);
+
+/**
+* @brief Crea el archivo temporal donde se recibe un contenido
+*
+* El contenido no es visible para las obtenciones hasta que se publica con publish_file.
+*
+* @param writer Contenido pendiente
+* @param hash Hash del contenido, NULL si se conoce al terminar de recibirlo
+*
+* @return Descriptor abierto para escritura, -1 si ocurre un error
+*/
+int store_file(sobject_writer *writer, const char *hash);
+
+/**
+* @brief Abre el archivo donde se recibe un contenido que se puede continuar si la recepcion se interrumpe
+*
+* Igual que store_file, pero si una recepcion anterior con la misma clave se interrumpio
+* el archivo conserva lo que ya se recibio.
+*
+* @param writer Contenido pendiente
+* @param hash Hash del contenido, NULL si se conoce al terminar de recibirlo
+* @param key Clave de la recepcion (64 caracteres hexadecimales)
+* @param size Bytes que ya se recibieron
+*
+* @return Descriptor abierto para lectura y escritura, -1 si ocurre un error
+*/
+int resume_file(sobject_writer *writer, const char *hash, const char *key, off_t *size);
+
+/**
+* @brief Cierra y publica un contenido recibido
+*
+* Si el modo de durabilidad lo requiere, el contenido se sincroniza antes de publicarlo.
+*
+* @param writer Contenido pendiente
+* @param fd Descriptor retornado por store_file o resume_file (se cierra)
+*
+* @return 0 en caso de exito, -1 si ocurre un error (el contenido se descarta)
+*/
+int publish_file(sobject_writer *writer, int fd);
+
+/**
+* @brief Guarda un contenido recien publicado como diferencia contra la ultima version del archivo
+*
+* Se llama antes de registrar la version. Las diferencias forman cadenas: cada
+* keyframe versiones (versions_init) el contenido se deja completo, asi una obtencion
+* reconstruye a lo sumo keyframe - 1 diferencias. El contenido queda completo si
+* es grande o si la diferencia no ahorra al menos la mitad.
+*
+* @param db_path Ruta de la base de datos del usuario
+* @param filename Nombre del archivo
+* @param hash Hash del contenido publicado
+*
+* @return 1 si se guardo como diferencia, 0 si queda completo, -1 si ocurre un error (el contenido sigue completo)
+*/
+int store_delta(const char *db_path, const char *filename, const char *hash);
+
+/**
+* @brief Guarda comprimido un contenido recien publicado que no se guardo como diferencia
+*
+* El contenido queda completo si es pequeño, si la compresion esta desactivada
+* (versions_init) o si no ahorra lo suficiente: los datos que no se comprimen
+* (imagenes, archivos ya comprimidos) se siguen enviando con sendfile.
+*
+* @param hash Hash del contenido publicado
+*
+* @return 1 si se guardo comprimido, 0 si queda completo, -1 si ocurre un error (el contenido sigue completo)
+*/
+int store_compressed(const char *hash);
+
+/**
+* @brief Guarda un contenido por fragmentos que ya estan en el repositorio
+*
+* Lee los fragmentos en orden y verifica que formen un contenido con el hash indicado
+* antes de publicar su lista; asi un hash nunca nombra un contenido distinto.
+*
+* @param hash Hash de todo el contenido
+* @param chunks Fragmentos en orden
+* @param count Cantidad de fragmentos
+*
+* @return 0 en caso de exito, -1 si falta un fragmento, el hash no coincide u ocurre un error
+*/
+int store_recipe(const char *hash, const sobject_chunk *chunks, uint32_t count);
+
+/**
+* @brief Descarta un contenido pendiente
+*
+* @param writer Contenido pendiente
+*/
+void discard_file(sobject_writer *writer);
+
+/**
+* @brief Deja un contenido pendiente de una recepcion interrumpida para continuarla despues
+*
+* Si se creo con store_file se descarta. Se llama antes de cerrar su descriptor.
+*
+* @param writer Contenido pendiente
+*/
+void suspend_file(sobject_writer *writer);
+
+/**
+* @brief Abre un contenido del repositorio para enviarlo, guardado en un archivo o por fragmentos
+*
+* @param hash Hash del contenido
+* @param reader Lector del contenido (se cierra con object_reader_close)
+* @param size Tamaño del contenido
+*
+* @return 0 en caso de exito, -1 si el contenido no existe
+*/
+int retrieve_file(const char *hash, sobject_reader *reader, off_t *size);
 
 #endif
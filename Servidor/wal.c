@@ -0,0 +1,333 @@
+/**
+ * @file
+ * @brief Implementacion del registro de escritura anticipada
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+#include "versiondb.h"
+#include "versions.h"
+
+#define WAL_RECORD_HEADER 8 /**< Longitud (4 bytes) y suma de verificacion (4 bytes) de cada registro */
+
+/**
+ * @brief Aplica las operaciones que quedaron en el registro
+ *
+ * @param wal Registro
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int wal_replay(swal *wal);
+
+/**
+ * @brief Aplica una operacion del registro a la base de datos de su usuario
+ *
+ * @param data Operacion: longitud de la ruta (2 bytes), ruta y registro codificado
+ * @param len Tamaño de la operacion
+ * @return 1 si se agrego la version, 0 si ya existia, -1 si ocurre un error
+ */
+static int wal_apply(const uint8_t *data, size_t len);
+
+/**
+ * @brief Sincroniza las bases de datos y vacia el registro
+ *
+ * @param wal Registro con su candado tomado
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+static int wal_checkpoint(swal *wal);
+
+/**
+ * @brief Suma de verificacion FNV-1a de 32 bits
+ *
+ * @param data Datos
+ * @param len Tamaño de los datos
+ * @return Suma de verificacion
+ */
+static uint32_t wal_checksum(const uint8_t *data, size_t len);
+
+int wal_parse_mode(const char *text, wal_mode *mode, unsigned int *latency_us) {
+	*latency_us = WAL_DEFAULT_LATENCY_US;
+
+	if (EQUALS(text, "none")) *mode = WAL_NONE;
+	else if (EQUALS(text, "strict")) *mode = WAL_STRICT;
+	else if (strncmp(text, "batched", 7) == 0 && (text[7] == '\0' || text[7] == ':')) {
+		*mode = WAL_BATCHED;
+		if (text[7] == ':') *latency_us = strtoul(text + 8, NULL, 10);
+	} else return -1;
+
+	return 0;
+}
+
+int wal_open(swal *wal, const char *dir, wal_mode mode, unsigned int latency_us) {
+	char path[PATH_MAX];
+	pthread_condattr_t attr;
+
+	memset(wal, 0, sizeof *wal);
+	wal->mode = mode;
+	wal->latency_us = latency_us;
+	wal->fd = -1;
+
+	pthread_mutex_init(&wal->lock, NULL);
+	pthread_cond_init(&wal->synced, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wal->batch_full, &attr);
+	pthread_condattr_destroy(&attr);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, WAL_FILE);
+
+	// Aun sin registro, se aplican las operaciones que dejo una ejecucion anterior
+	if ((wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+		perror("Error opening write-ahead log");
+		return -1;
+	}
+
+	if (wal_replay(wal) < 0) return -1;
+
+	if (mode == WAL_NONE) {
+		close(wal->fd);
+		unlink(path);
+		wal->fd = -1;
+	}
+
+	return 0;
+}
+
+void wal_close(swal *wal) {
+	if (wal->fd >= 0) {
+		pthread_mutex_lock(&wal->lock);
+		wal_checkpoint(wal);
+		pthread_mutex_unlock(&wal->lock);
+		close(wal->fd);
+		wal->fd = -1;
+	}
+
+	pthread_cond_destroy(&wal->batch_full);
+	pthread_cond_destroy(&wal->synced);
+	pthread_mutex_destroy(&wal->lock);
+}
+
+int64_t wal_append(swal *wal, const char *db_path, const sadd *record) {
+	uint8_t data[WAL_RECORD_HEADER + 2 + PATH_MAX + VDB_RECORD_MAX];
+	size_t path_len = strlen(db_path), record_len, len;
+	uint32_t header[2];
+	int64_t lsn;
+
+	if (wal->mode == WAL_NONE) return 0;
+	if (path_len >= PATH_MAX) return -1;
+
+	// Operacion: longitud de la ruta, ruta de la base de datos y registro en el formato de la base de datos
+	data[WAL_RECORD_HEADER] = path_len & 0xff;
+	data[WAL_RECORD_HEADER + 1] = path_len >> 8;
+	memcpy(data + WAL_RECORD_HEADER + 2, db_path, path_len);
+	if (!(record_len = vdb_encode(record, data + WAL_RECORD_HEADER + 2 + path_len))) return -1;
+
+	len = 2 + path_len + record_len;
+	header[0] = len;
+	header[1] = wal_checksum(data + WAL_RECORD_HEADER, len);
+	memcpy(data, header, sizeof(header));
+	len += WAL_RECORD_HEADER;
+
+	pthread_mutex_lock(&wal->lock);
+
+	if (write(wal->fd, data, len) != (ssize_t)len) {
+		perror("Error writing write-ahead log");
+		if (ftruncate(wal->fd, wal->size) < 0) wal->failed = 1; // No se puede descartar la escritura parcial
+		pthread_mutex_unlock(&wal->lock);
+		return -1;
+	}
+
+	wal->size += len;
+	wal->lsn += len;
+	lsn = wal->lsn;
+
+	if (wal->size >= WAL_CHECKPOINT_SIZE && wal_checkpoint(wal) < 0) lsn = -1;
+
+	pthread_mutex_unlock(&wal->lock);
+	return lsn;
+}
+
+int wal_sync(swal *wal, int64_t lsn) {
+	int status;
+
+	if (wal->mode == WAL_NONE) return 0;
+
+	if (wal->mode == WAL_STRICT) {
+		status = fdatasync(wal->fd);
+		pthread_mutex_lock(&wal->lock);
+		wal->syncs++;
+		pthread_mutex_unlock(&wal->lock);
+		return status;
+	}
+
+	pthread_mutex_lock(&wal->lock);
+
+	if (++wal->waiting >= WAL_BATCH_MAX) pthread_cond_signal(&wal->batch_full);
+
+	while (!wal->failed && wal->durable_lsn < (uint64_t)lsn) {
+		// Otro hilo ya esta sincronizando: al terminar se vuelve a verificar
+		if (wal->flushing) {
+			pthread_cond_wait(&wal->synced, &wal->lock);
+			continue;
+		}
+
+		// Este hilo lidera el lote: espera a que lleguen mas operaciones o se cumpla la latencia maxima
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += (long)(wal->latency_us % 1000000) * 1000;
+		deadline.tv_sec += wal->latency_us / 1000000 + deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+
+		wal->flushing = 1;
+		while (wal->waiting < WAL_BATCH_MAX &&
+			pthread_cond_timedwait(&wal->batch_full, &wal->lock, &deadline) != ETIMEDOUT);
+
+		uint64_t target = wal->lsn; // Todo lo escrito hasta ahora queda incluido en el lote
+		pthread_mutex_unlock(&wal->lock);
+		status = fdatasync(wal->fd);
+		pthread_mutex_lock(&wal->lock);
+
+		wal->syncs++;
+		if (status < 0) {
+			perror("Error syncing write-ahead log");
+			wal->failed = 1; // No se sabe que parte llego al disco
+		} else if (target > wal->durable_lsn) wal->durable_lsn = target;
+
+		wal->flushing = 0;
+		pthread_cond_broadcast(&wal->synced);
+	}
+
+	wal->waiting--;
+	status = wal->failed ? -1 : 0;
+	pthread_mutex_unlock(&wal->lock);
+	return status;
+}
+
+int wal_sync_file(swal *wal, int fd) {
+	if (wal->mode == WAL_NONE) return 0;
+	return fdatasync(fd);
+}
+
+void wal_observe(swal *wal, uint64_t start_us) {
+	uint64_t now = wal_now();
+	uint64_t bucket = (now - start_us) / WAL_LATENCY_STEP_US;
+
+	pthread_mutex_lock(&wal->lock);
+	if (wal->commits++ == 0) wal->first_us = start_us;
+	wal->last_us = now;
+	wal->latency[bucket < WAL_LATENCY_BUCKETS ? bucket : WAL_LATENCY_BUCKETS]++;
+	pthread_mutex_unlock(&wal->lock);
+}
+
+void wal_report(swal *wal) {
+	static const char *names[] = { "none", "batched", "strict" };
+	uint64_t target = (wal->commits * 99 + 99) / 100, seen = 0, bucket = 0;
+	double seconds = (wal->last_us - wal->first_us) / 1e6;
+
+	if (wal->commits == 0) return;
+
+	for (bucket = 0; bucket < WAL_LATENCY_BUCKETS; bucket++)
+		if ((seen += wal->latency[bucket]) >= target) break;
+
+	printf("Durability %s: %lu ADD operations, %lu syncs, %.1f ADD/s, p99 latency %s%.2f ms\n",
+		names[wal->mode], (unsigned long)wal->commits, (unsigned long)wal->syncs,
+		seconds > 0 ? wal->commits / seconds : 0.0,
+		bucket == WAL_LATENCY_BUCKETS ? ">" : "", (bucket + 1) * WAL_LATENCY_STEP_US / 1000.0);
+}
+
+uint64_t wal_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int wal_replay(swal *wal) {
+	struct stat st;
+	uint8_t *data;
+	size_t pos = 0;
+	int applied = 0;
+
+	if (fstat(wal->fd, &st) < 0) return -1;
+	if (st.st_size == 0) return 0;
+
+	if (!(data = malloc(st.st_size)) || pread(wal->fd, data, st.st_size, 0) != st.st_size) {
+		perror("Error reading write-ahead log");
+		free(data);
+		return -1;
+	}
+
+	// Un registro incompleto o con suma de verificacion invalida es una escritura interrumpida: fin del registro
+	while (pos + WAL_RECORD_HEADER <= (size_t)st.st_size) {
+		uint32_t header[2];
+		memcpy(header, data + pos, sizeof(header));
+		if (header[0] > (size_t)st.st_size - pos - WAL_RECORD_HEADER ||
+			wal_checksum(data + pos + WAL_RECORD_HEADER, header[0]) != header[1]) break;
+
+		int r = wal_apply(data + pos + WAL_RECORD_HEADER, header[0]);
+		if (r < 0) {
+			free(data);
+			return -1;
+		}
+		applied += r;
+		pos += WAL_RECORD_HEADER + header[0];
+	}
+
+	free(data);
+	if (applied) printf("Recovered %d versions from the write-ahead log\n", applied);
+
+	return wal_checkpoint(wal);
+}
+
+static int wal_apply(const uint8_t *data, size_t len) {
+	char db_path[PATH_MAX];
+	sadd record;
+	size_t path_len, size;
+	svdb db;
+	int status = 0;
+
+	if (len < 2) return 0;
+	path_len = data[0] | (size_t)data[1] << 8;
+	if (path_len >= PATH_MAX || 2 + path_len > len ||
+		vdb_decode(data + 2 + path_len, len - 2 - path_len, &record, &size) != 1) return 0;
+
+	memcpy(db_path, data + 2, path_len);
+	db_path[path_len] = '\0';
+
+	if (vdb_open(&db, db_path, 1) < 0) return -1;
+	if (!vdb_find_version(&db, record.filename, record.hash))
+		status = vdb_append(&db, &record) < 0 ? -1 : 1;
+	vdb_close(&db);
+	return status;
+}
+
+static int wal_checkpoint(swal *wal) {
+	// Las bases de datos se escriben antes que el registro: al sincronizarlas ya no se necesita
+	if (syncfs(wal->fd) < 0 || ftruncate(wal->fd, 0) < 0 || fsync(wal->fd) < 0) {
+		perror("Error checkpointing write-ahead log");
+		return -1;
+	}
+
+	wal->size = 0;
+	wal->durable_lsn = wal->lsn;
+	pthread_cond_broadcast(&wal->synced);
+	return 0;
+}
+
+static uint32_t wal_checksum(const uint8_t *data, size_t len) {
+	uint32_t h = 0x811c9dc5; // FNV-1a
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ data[i]) * 0x01000193;
+
+	return h;
+}
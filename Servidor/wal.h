@@ -0,0 +1,149 @@
+/**
+ * @file
+ * @brief Registro de escritura anticipada (WAL) de las versiones agregadas
+ *
+ * Cada ADD se escribe en la base de datos del usuario y luego se agrega
+ * al registro (.versions/wal.log). Para confirmar las operaciones basta con
+ * sincronizar un solo archivo, sin importar cuantos usuarios las hicieron:
+ *  - WAL_NONE: no se usa el registro ni se sincroniza nada.
+ *  - WAL_BATCHED: las operaciones concurrentes esperan hasta una latencia
+ *    maxima y se confirman con un solo fdatasync (group commit).
+ *  - WAL_STRICT: cada operacion hace su propio fdatasync.
+ *
+ * Cuando el registro crece se sincroniza el sistema de archivos del
+ * repositorio (syncfs, que incluye las bases de datos) y se vacia
+ * (checkpoint). Al iniciar, los registros que quedaron en el archivo
+ * se vuelven a aplicar; las versiones repetidas se ignoran.
+ *
+ * @author Julian David Meneses <juliandavidm@unicauca.edu.co>
+ * @author Andrea Carolina Realpe Munoz <andrearealpe@unicauca.edu.co>
+ * @copyright MIT License
+ */
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define WAL_FILE "wal.log" /**< Nombre del registro dentro del repositorio */
+#define WAL_DEFAULT_LATENCY_US 2000 /**< Latencia maxima por defecto del modo batched */
+#define WAL_BATCH_MAX 64 /**< Operaciones que completan un lote antes de la latencia maxima */
+#define WAL_CHECKPOINT_SIZE (8 * 1024 * 1024) /**< Tamaño del registro que dispara un checkpoint */
+#define WAL_LATENCY_BUCKETS 4096 /**< Posiciones del histograma de latencias */
+#define WAL_LATENCY_STEP_US 50 /**< Ancho de cada posicion del histograma */
+
+/**
+ * @brief Modos de durabilidad
+ */
+typedef enum {
+	WAL_NONE, /**< Sin registro ni sincronizacion */
+	WAL_BATCHED, /**< Sincronizacion agrupada con latencia maxima */
+	WAL_STRICT /**< Sincronizacion de cada operacion */
+} wal_mode;
+
+/**
+ * @brief Registro de escritura anticipada
+ */
+typedef struct {
+	wal_mode mode; /**< Modo de durabilidad */
+	unsigned int latency_us; /**< Latencia maxima del modo batched */
+	int fd; /**< Descriptor del registro, -1 en modo WAL_NONE */
+	pthread_mutex_t lock; /**< Protege el registro y los contadores */
+	pthread_cond_t synced; /**< Se señala al terminar cada sincronizacion */
+	pthread_cond_t batch_full; /**< Se señala cuando el lote en espera esta completo */
+	uint64_t lsn; /**< Bytes agregados desde que se abrio el registro */
+	uint64_t durable_lsn; /**< Bytes que ya estan en disco */
+	uint64_t size; /**< Tamaño actual del archivo */
+	int flushing; /**< 1 si un hilo lidera la sincronizacion del lote actual */
+	int waiting; /**< Operaciones esperando la sincronizacion */
+	int failed; /**< 1 si una sincronizacion fallo */
+	uint64_t commits; /**< Operaciones confirmadas */
+	uint64_t syncs; /**< Llamadas a fdatasync */
+	uint64_t first_us; /**< Inicio de la primera operacion */
+	uint64_t last_us; /**< Fin de la ultima operacion */
+	uint64_t latency[WAL_LATENCY_BUCKETS + 1]; /**< Histograma de latencias (la ultima posicion acumula el resto) */
+} swal;
+
+/**
+ * @brief Interpreta el modo de durabilidad de la linea de comandos
+ *
+ * @param text none, strict o batched[:microsegundos]
+ * @param mode Modo
+ * @param latency_us Latencia maxima del modo batched
+ *
+ * @return 0 en caso de exito, -1 si el texto no es valido
+ */
+int wal_parse_mode(const char *text, wal_mode *mode, unsigned int *latency_us);
+
+/**
+ * @brief Abre el registro, aplica las operaciones que contenga y lo vacia
+ *
+ * @param wal Registro
+ * @param dir Directorio del repositorio
+ * @param mode Modo de durabilidad
+ * @param latency_us Latencia maxima del modo batched
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int wal_open(swal *wal, const char *dir, wal_mode mode, unsigned int latency_us);
+
+/**
+ * @brief Hace un checkpoint y cierra el registro
+ *
+ * @param wal Registro
+ */
+void wal_close(swal *wal);
+
+/**
+ * @brief Agrega al registro una version que ya se escribio en la base de datos del usuario
+ *
+ * @param wal Registro
+ * @param db_path Ruta de la base de datos del usuario
+ * @param record Registro de la version
+ *
+ * @return Posicion que se debe pasar a wal_sync, -1 si ocurre un error
+ */
+int64_t wal_append(swal *wal, const char *db_path, const sadd *record);
+
+/**
+ * @brief Espera hasta que el registro este en disco hasta una posicion
+ *
+ * @param wal Registro
+ * @param lsn Posicion retornada por wal_append
+ *
+ * @return 0 en caso de exito, -1 si la sincronizacion fallo
+ */
+int wal_sync(swal *wal, int64_t lsn);
+
+/**
+ * @brief Sincroniza un archivo de contenido si el modo lo requiere
+ *
+ * @param wal Registro
+ * @param fd Descriptor del archivo
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error
+ */
+int wal_sync_file(swal *wal, int fd);
+
+/**
+ * @brief Registra la duracion de una operacion confirmada
+ *
+ * @param wal Registro
+ * @param start_us Inicio de la operacion (wal_now)
+ */
+void wal_observe(swal *wal, uint64_t start_us);
+
+/**
+ * @brief Muestra el modo, las operaciones por segundo y la latencia p99
+ *
+ * @param wal Registro
+ */
+void wal_report(swal *wal);
+
+/**
+ * @brief Tiempo monotono en microsegundos
+ *
+ * @return Microsegundos
+ */
+uint64_t wal_now(void);